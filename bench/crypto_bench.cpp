@@ -0,0 +1,429 @@
+// Cost of every CryptoProvider operation on this machine: the ones that
+// take a payload at sizes from 64 B to 16 MB, the rest once each. Prints
+// JSON to stdout, with the CPU features libsodium found and the
+// implementations it picks from them, and a table to stderr.
+//
+// Usage: linknet_crypto_bench [milliseconds_per_measurement] [max_bytes]
+
+#include "linknet/crypto.h"
+#include "linknet/logger.h"
+#include <sodium.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace linknet {
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t MIN_BYTES = 64;
+constexpr size_t MAX_BYTES = 16 * 1024 * 1024;
+
+// Messages in a SignBatch() or VerifyBatch() call, at most
+constexpr size_t MAX_BATCH = 256;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+const char* SuiteName(crypto::CipherSuite suite) {
+  switch (suite) {
+    case crypto::CipherSuite::XCHACHA20_POLY1305:
+      return "xchacha20-poly1305";
+    case crypto::CipherSuite::AES256_GCM:
+      return "aes-256-gcm";
+    default:
+      return "none";
+  }
+}
+
+void Check(bool ok, const std::string& operation) {
+  if (!ok) {
+    throw std::runtime_error(operation + " failed");
+  }
+}
+
+struct Result {
+  std::string operation;
+  size_t bytes;  // Payload per call, 0 for operations without one
+  size_t items;  // Messages per call, for the batch operations
+  uint64_t iterations;
+  double seconds;
+};
+
+class CryptoBench {
+ public:
+  CryptoBench(double budget_seconds, size_t max_bytes)
+      : _crypto(crypto::CryptoFactory::Create()),
+        _budget(budget_seconds),
+        _max_bytes(max_bytes) {}
+  
+  void Run() {
+    RunFixed();
+    for (size_t bytes = MIN_BYTES; bytes <= _max_bytes; bytes *= 4) {
+      RunSized(bytes);
+    }
+  }
+  
+  void PrintJson(double budget_ms) const;
+ 
+ private:
+  // Time operation over about the budget: one call to warm up and size
+  // the run, then as many as fit
+  template <typename Operation>
+  void Measure(const std::string& name, size_t bytes, size_t items, Operation&& operation) {
+    auto start = Clock::now();
+    Check(operation(), name);
+    double once = std::max(SecondsSince(start), 1e-9);
+    auto iterations = static_cast<uint64_t>(
+        std::clamp(_budget / once, 1.0, 10000000.0));
+    
+    start = Clock::now();
+    for (uint64_t i = 0; i < iterations; ++i) {
+      Check(operation(), name);
+    }
+    Result result{name, bytes, items, iterations, SecondsSince(start)};
+    _results.push_back(result);
+    
+    double ns = result.seconds * 1e9 / iterations;
+    if (bytes > 0) {
+      std::fprintf(stderr, "%-40s %10zu B %14.1f ns/op %9.3f GB/s\n", name.c_str(), bytes, ns,
+                   bytes / ns);
+    } else {
+      std::fprintf(stderr, "%-40s %12s %14.1f ns/op\n", name.c_str(), "", ns);
+    }
+  }
+  
+  std::vector<crypto::CipherSuite> Suites() const {
+    std::vector<crypto::CipherSuite> suites;
+    for (crypto::CipherSuite suite :
+         {crypto::CipherSuite::XCHACHA20_POLY1305, crypto::CipherSuite::AES256_GCM}) {
+      if (_crypto->GetCipherSuites() & crypto::CipherSuiteBit(suite)) {
+        suites.push_back(suite);
+      }
+    }
+    return suites;
+  }
+  
+  // Operations without a payload
+  void RunFixed() {
+    const crypto::CryptoProvider& crypto = *_crypto;
+    crypto::KeyPair local_keys = crypto.GenerateKeyPair();
+    crypto::KeyPair remote_keys = crypto.GenerateKeyPair();
+    
+    Measure("generate_key", 0, 1, [&] { return crypto.GenerateKey().size() == crypto::KEY_SIZE; });
+    Measure("generate_key_pair", 0, 1, [&] {
+      return crypto.GenerateKeyPair().public_key.size() == crypto::KEY_SIZE;
+    });
+    Measure("generate_signature_key_pair", 0, 1, [&] {
+      return crypto.GenerateSignatureKeyPair().public_key.size() == crypto::SIGN_PUBLICKEY_SIZE;
+    });
+    Measure("generate_nonce", 0, 1, [&] {
+      return crypto.GenerateNonce().size() == crypto::NONCE_SIZE;
+    });
+    Measure("compute_shared_key", 0, 1, [&] {
+      return crypto.ComputeSharedKey(remote_keys.public_key, local_keys.private_key).size() ==
+             crypto::KEY_SIZE;
+    });
+    Measure("get_cipher_suites", 0, 1, [&] { return crypto.GetCipherSuites() != 0; });
+    Measure("choose_cipher_suite", 0, 1, [&] {
+      return crypto.ChooseCipherSuite(crypto.GetCipherSuites()) != crypto::CipherSuite::NONE;
+    });
+    
+    crypto::Key secret = crypto.GenerateKey();
+    ByteBuffer salt(64, 1);
+    for (crypto::CipherSuite suite : Suites()) {
+      std::string suffix = std::string("/") + SuiteName(suite);
+      Measure("create_session_cipher" + suffix, 0, 1, [&] {
+        return crypto.CreateSessionCipher(suite, local_keys, remote_keys.public_key, true) !=
+               nullptr;
+      });
+      Measure("resume_session_cipher" + suffix, 0, 1, [&] {
+        return crypto.ResumeSessionCipher(suite, secret, salt, true) != nullptr;
+      });
+      auto cipher = crypto.ResumeSessionCipher(suite, secret, salt, true);
+      Measure("session_derive" + suffix, 0, 1, [&] {
+        return cipher->Derive(salt) != nullptr;
+      });
+      Measure("session_resumption_secret" + suffix, 0, 1, [&] {
+        return cipher->GetResumptionSecret().size() == crypto::KEY_SIZE;
+      });
+    }
+    
+    auto sealer = crypto.CreateStreamSealer(local_keys, remote_keys.public_key);
+    Check(sealer != nullptr, "create_stream_sealer");
+    Measure("create_stream_sealer", 0, 1, [&] {
+      return crypto.CreateStreamSealer(local_keys, remote_keys.public_key) != nullptr;
+    });
+    Measure("create_stream_opener", 0, 1, [&] {
+      return crypto.CreateStreamOpener(remote_keys, local_keys.public_key,
+                                       sealer->GetHeader().data()) != nullptr;
+    });
+    Measure("create_hasher/sha256", 0, 1, [&] {
+      return crypto.CreateHasher(crypto::HashAlgorithm::SHA256) != nullptr;
+    });
+  }
+  
+  // Operations on a payload of bytes bytes
+  void RunSized(size_t bytes) {
+    const crypto::CryptoProvider& crypto = *_crypto;
+    crypto::Key key = crypto.GenerateKey();
+    crypto::Nonce nonce = crypto.GenerateNonce();
+    crypto::KeyPair local_keys = crypto.GenerateKeyPair();
+    crypto::KeyPair remote_keys = crypto.GenerateKeyPair();
+    crypto::Key shared_key = crypto.ComputeSharedKey(remote_keys.public_key,
+                                                     local_keys.private_key);
+    crypto::SignatureKeyPair sign_keys = crypto.GenerateSignatureKeyPair();
+    
+    ByteBuffer plaintext(bytes, 0x5a);
+    ByteBuffer output(crypto::AsymmetricEncryptedSize(bytes));
+    ByteBuffer opened(bytes);
+    uint8_t mac[crypto::MAC_SIZE];
+    
+    // Symmetric
+    ByteBuffer ciphertext = crypto.Encrypt(plaintext, key, nonce);
+    Measure("encrypt/buffer", bytes, 1, [&] {
+      return crypto.Encrypt(plaintext, key, nonce).size() == ciphertext.size();
+    });
+    Measure("decrypt/buffer", bytes, 1, [&] {
+      return crypto.Decrypt(ciphertext, key, nonce).size() == bytes;
+    });
+    Measure("encrypt/pointer", bytes, 1, [&] {
+      return crypto.Encrypt(plaintext.data(), bytes, output.data(), key, nonce);
+    });
+    Measure("decrypt/pointer", bytes, 1, [&] {
+      return crypto.Decrypt(ciphertext.data(), ciphertext.size(), opened.data(), key, nonce);
+    });
+    Check(crypto.EncryptDetached(plaintext.data(), bytes, output.data(), mac, key, nonce),
+          "encrypt_detached");
+    ByteBuffer detached(output.begin(), output.begin() + bytes);
+    Measure("encrypt_detached", bytes, 1, [&] {
+      return crypto.EncryptDetached(plaintext.data(), bytes, output.data(), mac, key, nonce);
+    });
+    Measure("decrypt_detached", bytes, 1, [&] {
+      return crypto.DecryptDetached(detached.data(), bytes, mac, opened.data(), key, nonce);
+    });
+    
+    // Asymmetric, with and without a precomputed shared key
+    ByteBuffer sealed = crypto.AsymmetricEncrypt(plaintext, remote_keys.public_key,
+                                                 local_keys.private_key);
+    Measure("asymmetric_encrypt/buffer", bytes, 1, [&] {
+      return !crypto.AsymmetricEncrypt(plaintext, remote_keys.public_key,
+                                       local_keys.private_key).empty();
+    });
+    Measure("asymmetric_decrypt/buffer", bytes, 1, [&] {
+      return crypto.AsymmetricDecrypt(sealed, local_keys.public_key,
+                                      remote_keys.private_key).size() == bytes;
+    });
+    Measure("asymmetric_encrypt/pointer", bytes, 1, [&] {
+      return crypto.AsymmetricEncrypt(plaintext.data(), bytes, output.data(),
+                                      remote_keys.public_key, local_keys.private_key);
+    });
+    Measure("asymmetric_decrypt/pointer", bytes, 1, [&] {
+      return crypto.AsymmetricDecrypt(sealed.data(), sealed.size(), opened.data(),
+                                      local_keys.public_key, remote_keys.private_key);
+    });
+    Measure("asymmetric_encrypt_precomputed/buffer", bytes, 1, [&] {
+      return !crypto.AsymmetricEncryptPrecomputed(plaintext, shared_key).empty();
+    });
+    Measure("asymmetric_decrypt_precomputed/buffer", bytes, 1, [&] {
+      return crypto.AsymmetricDecryptPrecomputed(sealed, shared_key).size() == bytes;
+    });
+    Measure("asymmetric_encrypt_precomputed/pointer", bytes, 1, [&] {
+      return crypto.AsymmetricEncryptPrecomputed(plaintext.data(), bytes, output.data(),
+                                                 shared_key);
+    });
+    Measure("asymmetric_decrypt_precomputed/pointer", bytes, 1, [&] {
+      return crypto.AsymmetricDecryptPrecomputed(sealed.data(), sealed.size(), opened.data(),
+                                                 shared_key);
+    });
+    
+    // Signatures
+    ByteBuffer signature = crypto.Sign(plaintext, sign_keys.private_key);
+    uint8_t signature_out[crypto::SIGNATURE_SIZE];
+    Measure("sign/buffer", bytes, 1, [&] {
+      return crypto.Sign(plaintext, sign_keys.private_key).size() == crypto::SIGNATURE_SIZE;
+    });
+    Measure("verify/buffer", bytes, 1, [&] {
+      return crypto.Verify(plaintext, signature, sign_keys.public_key);
+    });
+    Measure("sign/pointer", bytes, 1, [&] {
+      return crypto.Sign(plaintext.data(), bytes, signature_out, sign_keys.private_key);
+    });
+    Measure("verify/pointer", bytes, 1, [&] {
+      return crypto.Verify(plaintext.data(), bytes, signature.data(), sign_keys.public_key);
+    });
+    
+    // Batches of up to MAX_BATCH messages, no more than MAX_BYTES in all
+    size_t count = std::clamp<size_t>(MAX_BYTES / bytes, 1, MAX_BATCH);
+    std::vector<ByteBuffer> messages(count, plaintext);
+    std::vector<ByteBuffer> signatures = crypto.SignBatch(messages, sign_keys.private_key);
+    std::vector<crypto::SignedData> items;
+    for (size_t i = 0; i < count; ++i) {
+      items.push_back({messages[i].data(), bytes, signatures[i].data(), &sign_keys.public_key});
+    }
+    Measure("sign_batch", bytes * count, count, [&] {
+      return crypto.SignBatch(messages, sign_keys.private_key).size() == count;
+    });
+    Measure("verify_batch", bytes * count, count, [&] {
+      return crypto.VerifyBatch(items).empty();
+    });
+    
+    // Hashing
+    std::string text(plaintext.begin(), plaintext.end());
+    Measure("hash", bytes, 1, [&] { return !crypto.Hash(text).empty(); });
+    for (auto [algorithm, name] : {std::make_pair(crypto::HashAlgorithm::SHA256, "sha256"),
+                                   std::make_pair(crypto::HashAlgorithm::BLAKE2B, "blake2b")}) {
+      Measure(std::string("hasher/") + name, bytes, 1, [&, algorithm = algorithm] {
+        auto hasher = crypto.CreateHasher(algorithm);
+        hasher->Update(plaintext.data(), bytes);
+        return hasher->Final().size() == crypto::DIGEST_SIZE;
+      });
+    }
+    
+    std::filesystem::path path = std::filesystem::temp_directory_path() /
+                                  ("linknet_crypto_bench_" + std::to_string(bytes));
+    {
+      std::ofstream file(path, std::ios::binary);
+      file.write(reinterpret_cast<const char*>(plaintext.data()), bytes);
+    }
+    crypto::Digest digest;
+    Measure("hash_file/blake2b", bytes, 1, [&] {
+      return crypto.HashFile(path.string(), crypto::HashAlgorithm::BLAKE2B, digest);
+    });
+    std::filesystem::remove(path);
+    
+    // Session ciphers seal in place; opening needs the frame sealed next,
+    // so it is timed along with sealing
+    uint8_t ad[4] = {0, 0, 0, 0};
+    for (crypto::CipherSuite suite : Suites()) {
+      std::string suffix = std::string("/") + SuiteName(suite);
+      auto sender = crypto.CreateSessionCipher(suite, local_keys, remote_keys.public_key, true);
+      auto receiver = crypto.CreateSessionCipher(suite, remote_keys, local_keys.public_key,
+                                                 false);
+      auto seal_only = crypto.CreateSessionCipher(suite, local_keys, remote_keys.public_key,
+                                                  true);
+      ByteBuffer frame = plaintext;
+      Measure("session_seal" + suffix, bytes, 1, [&] {
+        return seal_only->Seal(frame.data(), bytes, ad, sizeof(ad), mac);
+      });
+      Measure("session_seal_open" + suffix, bytes, 1, [&] {
+        return sender->Seal(frame.data(), bytes, ad, sizeof(ad), mac) &&
+               receiver->Open(frame.data(), bytes, ad, sizeof(ad), mac);
+      });
+    }
+    
+    // Streams, likewise
+    auto push_only = crypto.CreateStreamSealer(local_keys, remote_keys.public_key);
+    auto sealer = crypto.CreateStreamSealer(local_keys, remote_keys.public_key);
+    auto opener = crypto.CreateStreamOpener(remote_keys, local_keys.public_key,
+                                            sealer->GetHeader().data());
+    ByteBuffer pushed(bytes + crypto::StreamSealer::OVERHEAD);
+    Measure("stream_push", bytes, 1, [&] {
+      return push_only->Push(plaintext.data(), bytes, false, pushed.data());
+    });
+    Measure("stream_push_pull", bytes, 1, [&] {
+      return sealer->Push(plaintext.data(), bytes, false, pushed.data()) &&
+             opener->Pull(pushed.data(), pushed.size(), opened.data());
+    });
+  }
+  
+  std::unique_ptr<crypto::CryptoProvider> _crypto;
+  double _budget;
+  size_t _max_bytes;
+  std::vector<Result> _results;
+};
+
+const char* Bool(int value) {
+  return value ? "true" : "false";
+}
+
+// libsodium has no call to name the implementations it picked; these
+// follow the checks it makes at sodium_init() on x86-64
+void PrintLibsodium() {
+  bool aes256gcm = crypto_aead_aes256gcm_is_available();
+  const char* chacha20 = sodium_runtime_has_avx2() ? "dolbeau-avx2"
+                         : sodium_runtime_has_ssse3() ? "dolbeau-ssse3" : "ref";
+  const char* poly1305 = sodium_runtime_has_sse2() ? "sse2" : "donna";
+  const char* salsa20 = sodium_runtime_has_avx2() ? "xmm6int-avx2"
+                        : sodium_runtime_has_sse2() ? "xmm6int-sse2" : "ref";
+  const char* blake2b = sodium_runtime_has_avx2() ? "avx2"
+                        : sodium_runtime_has_sse41() ? "sse41"
+                        : sodium_runtime_has_ssse3() ? "ssse3" : "ref";
+  const char* x25519 = sodium_runtime_has_avx() ? "sandy2x" : "ref10";
+  
+  std::printf("  \"libsodium\": {\n");
+  std::printf("    \"version\": \"%s\",\n", sodium_version_string());
+  std::printf("    \"cpu\": {\"sse2\": %s, \"sse3\": %s, \"ssse3\": %s, \"sse41\": %s, "
+              "\"avx\": %s, \"avx2\": %s, \"avx512f\": %s, \"pclmul\": %s, "
+              "\"aesni\": %s, \"rdrand\": %s, \"neon\": %s},\n",
+              Bool(sodium_runtime_has_sse2()), Bool(sodium_runtime_has_sse3()),
+              Bool(sodium_runtime_has_ssse3()), Bool(sodium_runtime_has_sse41()),
+              Bool(sodium_runtime_has_avx()), Bool(sodium_runtime_has_avx2()),
+              Bool(sodium_runtime_has_avx512f()), Bool(sodium_runtime_has_pclmul()),
+              Bool(sodium_runtime_has_aesni()), Bool(sodium_runtime_has_rdrand()),
+              Bool(sodium_runtime_has_neon()));
+  std::printf("    \"implementations\": {\"aes256gcm\": \"%s\", \"chacha20\": \"%s\", "
+              "\"poly1305\": \"%s\", \"salsa20\": \"%s\", \"blake2b\": \"%s\", "
+              "\"x25519\": \"%s\"}\n",
+              aes256gcm ? "aesni-pclmul" : "unavailable", chacha20, poly1305, salsa20,
+              blake2b, x25519);
+  std::printf("  },\n");
+}
+
+void CryptoBench::PrintJson(double budget_ms) const {
+  std::printf("{\n");
+  PrintLibsodium();
+  std::printf("  \"threads\": %u,\n", std::max(1u, std::thread::hardware_concurrency()));
+  std::printf("  \"budget_ms\": %.0f,\n", budget_ms);
+  std::printf("  \"results\": [\n");
+  for (size_t i = 0; i < _results.size(); ++i) {
+    const Result& result = _results[i];
+    double ns = result.seconds * 1e9 / result.iterations;
+    std::printf("    {\"operation\": \"%s\", \"bytes\": %zu, \"items\": %zu, "
+                "\"iterations\": %llu, \"ns_per_op\": %.1f, ",
+                result.operation.c_str(), result.bytes, result.items,
+                static_cast<unsigned long long>(result.iterations), ns);
+    if (result.bytes > 0) {
+      std::printf("\"gb_per_s\": %.4f}", result.bytes / ns);
+    } else {
+      std::printf("\"gb_per_s\": null}");
+    }
+    std::printf("%s\n", i + 1 < _results.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+}
+
+}  // namespace
+
+int Run(int argc, char** argv) {
+  Logger::GetInstance().SetLogLevel(LogLevel::WARNING);
+  double budget_ms = argc > 1 ? std::stod(argv[1]) : 100;
+  size_t max_bytes = std::min<size_t>(argc > 2 ? std::stoul(argv[2]) : MAX_BYTES, MAX_BYTES);
+  
+  CryptoBench bench(budget_ms / 1000, max_bytes);
+  bench.Run();
+  bench.PrintJson(budget_ms);
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace linknet
+
+int main(int argc, char** argv) {
+  try {
+    return linknet::bench::Run(argc, argv);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
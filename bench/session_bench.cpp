@@ -0,0 +1,180 @@
+// Throughput of session encryption: each cipher suite sealing and opening
+// chunk-sized frames in memory, then file chunks sent between two network
+// managers over loopback, in the clear and encrypted.
+//
+// Usage: linknet_session_bench [megabytes_per_run]
+
+#include "linknet/crypto.h"
+#include "linknet/logger.h"
+#include "linknet/message.h"
+#include "linknet/network.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace linknet {
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The file transfer chunk size
+constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double GigabytesPerSecond(uint64_t bytes, double seconds) {
+  return bytes / seconds / 1e9;
+}
+
+const char* SuiteName(crypto::CipherSuite suite) {
+  switch (suite) {
+    case crypto::CipherSuite::XCHACHA20_POLY1305:
+      return "xchacha20-poly1305";
+    case crypto::CipherSuite::AES256_GCM:
+      return "aes-256-gcm";
+    default:
+      return "none";
+  }
+}
+
+// Seal frames alone, then seal and open each in turn
+void BenchCipher(const crypto::CryptoProvider& crypto, crypto::CipherSuite suite,
+                 size_t frame_size, uint64_t total_bytes) {
+  crypto::KeyPair local_keys = crypto.GenerateKeyPair();
+  crypto::KeyPair remote_keys = crypto.GenerateKeyPair();
+  auto sender = crypto.CreateSessionCipher(suite, local_keys, remote_keys.public_key, true);
+  auto receiver = crypto.CreateSessionCipher(suite, remote_keys, local_keys.public_key, false);
+  auto seal_only = crypto.CreateSessionCipher(suite, local_keys, remote_keys.public_key, true);
+  
+  ByteBuffer frame(frame_size, 0x5a);
+  uint8_t ad[4] = {0, 0, 0, 0};
+  uint8_t mac[crypto::SessionCipher::MAC_SIZE];
+  uint64_t frames = std::max<uint64_t>(1, total_bytes / frame_size);
+  
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < frames; ++i) {
+    seal_only->Seal(frame.data(), frame.size(), ad, sizeof(ad), mac);
+  }
+  double seal_seconds = SecondsSince(start);
+  
+  start = Clock::now();
+  for (uint64_t i = 0; i < frames; ++i) {
+    sender->Seal(frame.data(), frame.size(), ad, sizeof(ad), mac);
+    if (!receiver->Open(frame.data(), frame.size(), ad, sizeof(ad), mac)) {
+      std::fprintf(stderr, "%s: frame failed to open\n", SuiteName(suite));
+      return;
+    }
+  }
+  double round_trip_seconds = SecondsSince(start);
+  
+  std::printf("%-20s %8zu B frames  seal %6.2f GB/s  seal+open %6.2f GB/s\n", SuiteName(suite),
+              frame_size, GigabytesPerSecond(frames * frame_size, seal_seconds),
+              GigabytesPerSecond(frames * frame_size, round_trip_seconds));
+}
+
+PeerId WaitForPeer(const NetworkManager& network) {
+  for (int i = 0; i < 500; ++i) {
+    auto peers = network.GetConnectedPeers();
+    if (!peers.empty()) {
+      return peers[0].id;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  throw std::runtime_error("Peer did not connect");
+}
+
+// Send total_bytes of file chunks from a dialing network manager to an
+// accepting one and time their arrival
+void BenchLoopback(const std::shared_ptr<crypto::CryptoProvider>& crypto,
+                   size_t data_connections, uint64_t total_bytes) {
+  auto receiver = NetworkFactory::Create();
+  auto sender = NetworkFactory::Create();
+  receiver->SetCryptoProvider(crypto);
+  sender->SetCryptoProvider(crypto);
+  sender->SetDataConnections(data_connections);
+  
+  uint64_t chunks = std::max<uint64_t>(1, total_bytes / CHUNK_SIZE);
+  std::atomic<uint64_t> received{0};
+  std::promise<void> done;
+  receiver->SetMessageCallback([&](std::unique_ptr<Message> message) {
+    if (message->GetType() == MessageType::FILE_CHUNK && ++received == chunks) {
+      done.set_value();
+    }
+  });
+  
+  if (!receiver->Start(0) || !sender->Start(0) ||
+      !sender->ConnectToPeer("127.0.0.1", receiver->GetLocalPort())) {
+    throw std::runtime_error("Failed to set up loopback connection");
+  }
+  PeerId peer_id = WaitForPeer(*sender);
+  WaitForPeer(*receiver);
+  
+  // Let the data connections open
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  
+  ByteBuffer data(CHUNK_SIZE, 0x5a);
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < chunks; ++i) {
+    FileChunkMessage chunk(peer_id, 1, static_cast<uint32_t>(i), data);
+    if (!sender->SendMessage(peer_id, chunk)) {
+      throw std::runtime_error("Send failed");
+    }
+  }
+  done.get_future().wait();
+  double seconds = SecondsSince(start);
+  
+  std::printf("loopback %-10s %2zu data connections  %6.2f GB/s\n",
+              crypto ? "encrypted" : "plaintext", data_connections,
+              GigabytesPerSecond(chunks * CHUNK_SIZE, seconds));
+  
+  sender->Stop();
+  receiver->Stop();
+}
+
+}  // namespace
+
+int Run(int argc, char** argv) {
+  Logger::GetInstance().SetLogLevel(LogLevel::WARNING);
+  uint64_t total_bytes = (argc > 1 ? std::stoull(argv[1]) : 512) * 1024 * 1024;
+  
+  std::shared_ptr<crypto::CryptoProvider> crypto = crypto::CryptoFactory::Create();
+  for (crypto::CipherSuite suite :
+       {crypto::CipherSuite::XCHACHA20_POLY1305, crypto::CipherSuite::AES256_GCM}) {
+    if (!(crypto->GetCipherSuites() & crypto::CipherSuiteBit(suite))) {
+      std::printf("%-20s not available on this CPU\n", SuiteName(suite));
+      continue;
+    }
+    for (size_t frame_size : {size_t{1024}, CHUNK_SIZE, size_t{1024 * 1024}}) {
+      BenchCipher(*crypto, suite, frame_size, total_bytes);
+    }
+  }
+  std::printf("sessions use %s\n",
+              SuiteName(crypto->ChooseCipherSuite(crypto->GetCipherSuites())));
+  
+  for (size_t data_connections : {size_t{0}, size_t{4}}) {
+    BenchLoopback(nullptr, data_connections, total_bytes);
+    BenchLoopback(crypto, data_connections, total_bytes);
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace linknet
+
+int main(int argc, char** argv) {
+  try {
+    return linknet::bench::Run(argc, argv);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,103 @@
+// Ed25519 signatures and verifications per second, one at a time and in
+// batches spread over 1, 2, 4, ... worker threads up to the core count.
+//
+// Usage: linknet_sign_bench [messages] [message_bytes]
+
+#include "linknet/crypto.h"
+#include "linknet/logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace linknet {
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void Report(const char* label, unsigned int threads, size_t count, double sign_seconds,
+            double verify_seconds) {
+  std::printf("%-10s %3u threads  sign %10.0f/s  verify %10.0f/s\n", label, threads,
+              count / sign_seconds, count / verify_seconds);
+}
+
+}  // namespace
+
+int Run(int argc, char** argv) {
+  Logger::GetInstance().SetLogLevel(LogLevel::WARNING);
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 20000;
+  size_t message_bytes = argc > 2 ? std::stoul(argv[2]) : 256;
+  
+  auto single = crypto::CryptoFactory::Create(1);
+  crypto::SignatureKeyPair keys = single->GenerateSignatureKeyPair();
+  std::vector<ByteBuffer> messages(count, ByteBuffer(message_bytes));
+  for (size_t i = 0; i < count; ++i) {
+    messages[i][0] = static_cast<uint8_t>(i);
+  }
+  
+  // One at a time
+  std::vector<ByteBuffer> signatures(count);
+  auto start = Clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    signatures[i] = single->Sign(messages[i], keys.private_key);
+  }
+  double sign_seconds = SecondsSince(start);
+  
+  start = Clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    if (!single->Verify(messages[i], signatures[i], keys.public_key)) {
+      throw std::runtime_error("Signature failed to verify");
+    }
+  }
+  Report("single", 1, count, sign_seconds, SecondsSince(start));
+  
+  std::vector<crypto::SignedData> items;
+  for (size_t i = 0; i < count; ++i) {
+    items.push_back({messages[i].data(), messages[i].size(), signatures[i].data(),
+                     &keys.public_key});
+  }
+  
+  unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int threads = 1; ; threads = std::min(threads * 2, cores)) {
+    auto batch = crypto::CryptoFactory::Create(threads);
+    
+    // Start the worker threads outside the timing
+    batch->VerifyBatch(items);
+    
+    start = Clock::now();
+    batch->SignBatch(messages, keys.private_key);
+    sign_seconds = SecondsSince(start);
+    
+    start = Clock::now();
+    if (!batch->VerifyBatch(items).empty()) {
+      throw std::runtime_error("Batch failed to verify");
+    }
+    Report("batch", threads, count, sign_seconds, SecondsSince(start));
+    
+    if (threads == cores) {
+      break;
+    }
+  }
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace linknet
+
+int main(int argc, char** argv) {
+  try {
+    return linknet::bench::Run(argc, argv);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
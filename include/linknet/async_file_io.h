@@ -0,0 +1,49 @@
+#ifndef LINKNET_ASYNC_FILE_IO_H_
+#define LINKNET_ASYNC_FILE_IO_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+
+namespace linknet {
+
+// Positioned reads and writes that run in the background, so disk latency
+// overlaps with network latency. Requests are queued and handed to the
+// backend in batches by Submit. Each completes with the number of bytes
+// moved, which may be short, or -errno.
+//
+// Thread-safe. Destroying it waits for every request in flight.
+class AsyncFileIo {
+ public:
+  virtual ~AsyncFileIo() = default;
+  
+  // Queue a read of size bytes at offset into data, or a write from it.
+  // owner is held until the request completes, so it should own data; the
+  // file descriptor must stay open until then. Blocks while queue depth
+  // requests are in flight.
+  virtual std::future<int64_t> Read(int fd, uint64_t offset, uint8_t* data, size_t size,
+                                    std::shared_ptr<void> owner) = 0;
+  virtual std::future<int64_t> Write(int fd, uint64_t offset, const uint8_t* data, size_t size,
+                                     std::shared_ptr<void> owner) = 0;
+  
+  // Start every queued request
+  virtual void Submit() = 0;
+  
+  // "io_uring" or "threads"
+  virtual const char* GetName() const = 0;
+};
+
+class AsyncFileIoFactory {
+ public:
+  static constexpr unsigned DEFAULT_QUEUE_DEPTH = 128;
+  
+  // io_uring where the kernel has it, otherwise a pool of threads doing
+  // blocking I/O, which is also used if allow_io_uring is unset
+  static std::unique_ptr<AsyncFileIo> Create(unsigned queue_depth = DEFAULT_QUEUE_DEPTH,
+                                             bool allow_io_uring = true);
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_ASYNC_FILE_IO_H_
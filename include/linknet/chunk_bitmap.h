@@ -0,0 +1,54 @@
+#ifndef LINKNET_CHUNK_BITMAP_H_
+#define LINKNET_CHUNK_BITMAP_H_
+
+#include "linknet/types.h"
+#include <string>
+#include <vector>
+
+namespace linknet {
+
+// Compact record of which chunks of a file have been received (one bit per
+// chunk). Can be persisted next to a partial download so that an interrupted
+// transfer resumes from where it stopped.
+class ChunkBitmap {
+ public:
+  ChunkBitmap() = default;
+  explicit ChunkBitmap(uint32_t chunk_count);
+  
+  // Number of chunks tracked
+  uint32_t Size() const { return _chunk_count; }
+  
+  // Number of chunks marked as received
+  uint32_t Count() const { return _set_count; }
+  
+  bool IsComplete() const { return _set_count == _chunk_count; }
+  
+  bool Test(uint32_t index) const;
+  
+  // Mark a chunk as received. Returns false if it was already marked.
+  bool Set(uint32_t index);
+  
+  // Mark a chunk as missing again
+  void Clear(uint32_t index);
+  
+  // Runs of chunks not yet received, in ascending order
+  std::vector<ChunkRange> MissingRanges() const;
+  
+  // Persist the bitmap together with the transfer geometry it describes.
+  // The file is replaced atomically so a crash never leaves a torn bitmap.
+  bool Save(const std::string& path, uint64_t file_size, uint32_t chunk_size) const;
+  
+  // Load a bitmap saved by Save(). Fails if the file is missing, corrupt or
+  // was written for a different file size or chunk size.
+  static bool Load(const std::string& path, uint64_t file_size, uint32_t chunk_size,
+                   ChunkBitmap& bitmap);
+ 
+ private:
+  uint32_t _chunk_count = 0;
+  uint32_t _set_count = 0;
+  std::vector<uint64_t> _words;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_CHUNK_BITMAP_H_
@@ -0,0 +1,50 @@
+#ifndef LINKNET_COMPRESSION_H_
+#define LINKNET_COMPRESSION_H_
+
+#include "linknet/types.h"
+#include <memory>
+
+namespace linknet {
+
+// Interface for a chunk compression codec. Implementations keep no state
+// between calls, so one instance can be shared by several threads.
+class Compressor {
+ public:
+  virtual ~Compressor() = default;
+  
+  virtual CompressionType GetType() const = 0;
+  
+  // Compress size bytes of data into output. Returns false on failure.
+  virtual bool Compress(const uint8_t* data, size_t size, ByteBuffer& output) const = 0;
+  
+  // Decompress into output, which must come out exactly original_size bytes
+  // long. Returns false for corrupt input or a size mismatch.
+  virtual bool Decompress(const uint8_t* data, size_t size, size_t original_size,
+                          ByteBuffer& output) const = 0;
+};
+
+class CompressorFactory {
+ public:
+  // Returns nullptr for a codec that isn't built in
+  static std::unique_ptr<Compressor> Create(CompressionType type);
+  
+  // Bitmask of the built-in codecs
+  static uint8_t SupportedTypes();
+  
+  // Pick the preferred built-in codec among those offered, NONE if there is
+  // none in common
+  static CompressionType Negotiate(uint8_t offered_types);
+};
+
+// Shannon entropy of data in bits per byte, estimated from a few evenly
+// spaced samples so that it costs a small fraction of compressing
+double SampleEntropy(const uint8_t* data, size_t size);
+
+// Compress a chunk in place when it is worth it. Data that already looks
+// random, or that doesn't shrink by at least 1/16, is left as is. Returns
+// the codec used, NONE if the chunk was left alone.
+CompressionType CompressChunk(const Compressor& compressor, ByteBuffer& chunk);
+
+}  // namespace linknet
+
+#endif  // LINKNET_COMPRESSION_H_
@@ -0,0 +1,37 @@
+#ifndef LINKNET_CONTENT_CHUNKER_H_
+#define LINKNET_CONTENT_CHUNKER_H_
+
+#include "linknet/crypto.h"
+#include <string>
+#include <vector>
+
+namespace linknet {
+
+// A content-defined chunk of a file and the hash of its contents
+struct ContentChunk {
+  uint64_t offset;
+  uint32_t length;
+  crypto::Digest hash;
+};
+
+// Splits data at content-defined boundaries (FastCDC with a Gear rolling
+// hash and normalized chunking). Boundaries depend only on nearby bytes, so
+// an insertion or deletion only changes the chunks around it and the rest of
+// a modified file still matches the chunks of the previous version.
+class ContentChunker {
+ public:
+  static constexpr uint32_t MIN_CHUNK_SIZE = 2 * 1024;
+  static constexpr uint32_t AVG_CHUNK_SIZE = 8 * 1024;
+  static constexpr uint32_t MAX_CHUNK_SIZE = 64 * 1024;
+  
+  // Length of the first chunk in data. Unless data holds at least
+  // MAX_CHUNK_SIZE bytes, it is assumed to end at the end of the input.
+  static size_t FindBoundary(const uint8_t* data, size_t size);
+  
+  // Chunk and hash a whole file. Returns false if the file can't be read.
+  static bool ChunkFile(const std::string& path, std::vector<ContentChunk>& chunks);
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_CONTENT_CHUNKER_H_
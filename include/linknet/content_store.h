@@ -0,0 +1,77 @@
+#ifndef LINKNET_CONTENT_STORE_H_
+#define LINKNET_CONTENT_STORE_H_
+
+#include "linknet/crypto.h"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace linknet {
+
+// Copies of received files, one per content hash, so a file that arrives
+// again can be put in place without downloading it. Entries are read-only.
+// Files are taken in and put back as reflinks where the file system has
+// them, otherwise as copies, so changes to a file put back never reach the
+// entry. Once the entries exceed the size cap, the least recently used go
+// first.
+//
+// Thread-safe.
+class ContentStore {
+ public:
+  // Entries live in directory, one file per hash
+  ContentStore(std::string directory, uint64_t max_bytes);
+  
+  ContentStore(const ContentStore&) = delete;
+  ContentStore& operator=(const ContentStore&) = delete;
+  
+  // Create the directory, or pick up the entries already in it, oldest
+  // first, and drop leftovers of interrupted additions
+  bool Open();
+  
+  // Whether there is an entry for hash of the given size
+  bool Contains(const crypto::Digest& hash, uint64_t size) const;
+  
+  // Put the entry for hash at destination, replacing whatever is there. An
+  // entry of another size is dropped. Returns false if there is no entry.
+  bool Fetch(const crypto::Digest& hash, uint64_t size, const std::string& destination);
+  
+  // Store source, whose content hashes to hash. Files larger than the cap
+  // aren't stored. With a chunk_size, the copy is hashed as a Merkle tree
+  // of chunks that size and refused unless its root is hash, so a source
+  // changed after it was checked never becomes an entry.
+  bool Add(const crypto::Digest& hash, const std::string& source, size_t chunk_size = 0);
+  
+  void SetMaxBytes(uint64_t max_bytes);
+  
+  const std::string& GetDirectory() const { return _directory; }
+  uint64_t GetSize() const;
+  size_t GetCount() const;
+ 
+ private:
+  struct Entry {
+    std::string name;
+    uint64_t size;
+  };
+  
+  std::string EntryPath(const std::string& name) const;
+  
+  // Drop least recently used entries until the total fits. Caller must
+  // hold the lock.
+  void EvictLocked();
+  
+  std::string _directory;
+  uint64_t _max_bytes;
+  
+  // Entries most recently used first
+  mutable std::mutex _mutex;
+  std::list<Entry> _entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+  uint64_t _size = 0;
+  uint64_t _next_temp = 0;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_CONTENT_STORE_H_
@@ -5,6 +5,7 @@
 #include <string>
 #include <array>
 #include <memory>
+#include <vector>
 
 namespace linknet {
 namespace crypto {
@@ -15,12 +16,25 @@ constexpr size_t NONCE_SIZE = 24;
 constexpr size_t MAC_SIZE = 16;
 constexpr size_t SIGN_PUBLICKEY_SIZE = 32;
 constexpr size_t SIGN_SECRETKEY_SIZE = 64;  // Ed25519 secret key is 64 bytes in libsodium
+constexpr size_t DIGEST_SIZE = 32;  // BLAKE2b-256
+constexpr size_t SIGNATURE_SIZE = 64;
 
 // Key types
 using Key = std::array<uint8_t, KEY_SIZE>;
 using Nonce = std::array<uint8_t, NONCE_SIZE>;
 using SignPublicKey = std::array<uint8_t, SIGN_PUBLICKEY_SIZE>;
 using SignPrivateKey = std::array<uint8_t, SIGN_SECRETKEY_SIZE>;
+using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+// Output sizes of Encrypt() and AsymmetricEncrypt() for a plaintext of
+// plaintext_size bytes; decrypting gives back plaintext_size bytes
+constexpr size_t EncryptedSize(size_t plaintext_size) {
+  return plaintext_size + MAC_SIZE;
+}
+
+constexpr size_t AsymmetricEncryptedSize(size_t plaintext_size) {
+  return NONCE_SIZE + plaintext_size + MAC_SIZE;
+}
 
 // Key pair for asymmetric encryption
 struct KeyPair {
@@ -34,6 +48,114 @@ struct SignatureKeyPair {
   SignPrivateKey private_key;
 };
 
+// One message and its signature for CryptoProvider::VerifyBatch(). The
+// data pointed to must outlive the call.
+struct SignedData {
+  const uint8_t* message;
+  size_t size;
+  const uint8_t* signature;  // SIGNATURE_SIZE bytes
+  const SignPublicKey* public_key;
+};
+
+// AEADs that can encrypt a session
+enum class CipherSuite : uint8_t {
+  NONE = 0,
+  XCHACHA20_POLY1305 = 1,
+  AES256_GCM = 2,
+};
+
+// The flag for a suite in a set of suites
+constexpr uint8_t CipherSuiteBit(CipherSuite suite) {
+  return static_cast<uint8_t>(1u << static_cast<uint8_t>(suite));
+}
+
+// Seals and opens the frames of one connection, with a key for each
+// direction. Nonces count the frames sealed with a key, so frames must be
+// opened in the order they were sealed.
+//
+// Not thread-safe.
+class SessionCipher {
+ public:
+  static constexpr size_t MAC_SIZE = 16;
+  
+  virtual ~SessionCipher() = default;
+  
+  virtual CipherSuite GetSuite() const = 0;
+  
+  // Encrypt size bytes at data in place, authenticating ad along with them,
+  // and write the MAC_SIZE-byte tag to mac
+  virtual bool Seal(uint8_t* data, size_t size, const uint8_t* ad, size_t ad_size,
+                    uint8_t* mac) = 0;
+  
+  // Decrypt in place. Fails for a frame that was forged, altered, or is out
+  // of order.
+  virtual bool Open(uint8_t* data, size_t size, const uint8_t* ad, size_t ad_size,
+                    const uint8_t* mac) = 0;
+  
+  // A cipher for another connection of the same session, with fresh keys
+  // and nonces. Both ends derive matching ciphers from the same salt.
+  virtual std::unique_ptr<SessionCipher> Derive(const ByteBuffer& salt) const = 0;
+  
+  // The secret a later connection can resume this session from, without a
+  // key exchange. Both ends compute the same one.
+  virtual Key GetResumptionSecret() const = 0;
+};
+
+// Seals a stream of messages under one key: each message is bound to the
+// ones before it, so they must be opened in order and none can be dropped,
+// repeated or reordered unnoticed
+//
+// Not thread-safe.
+class StreamSealer {
+ public:
+  static constexpr size_t HEADER_SIZE = 24;
+  static constexpr size_t OVERHEAD = 17;
+  
+  virtual ~StreamSealer() = default;
+  
+  // The header the opener must start from
+  virtual const std::array<uint8_t, HEADER_SIZE>& GetHeader() const = 0;
+  
+  // Encrypt size bytes at data to size + OVERHEAD bytes at output. After a
+  // message pushed with rekey, both ends move on to a new key.
+  virtual bool Push(const uint8_t* data, size_t size, bool rekey, uint8_t* output) = 0;
+};
+
+// Opens the messages of a StreamSealer
+//
+// Not thread-safe.
+class StreamOpener {
+ public:
+  virtual ~StreamOpener() = default;
+  
+  // Decrypt size bytes at data to size - OVERHEAD bytes at output. Fails
+  // for a message that was forged, altered, or is out of order.
+  virtual bool Pull(const uint8_t* data, size_t size, uint8_t* output) = 0;
+};
+
+// Hash functions with DIGEST_SIZE-byte output
+enum class HashAlgorithm : uint8_t {
+  SHA256 = 0,
+  BLAKE2B = 1,  // BLAKE2b-256
+};
+
+// Hashes data fed to it piece by piece, so inputs of any size can be hashed
+// without holding them in memory
+//
+// Not thread-safe.
+class Hasher {
+ public:
+  virtual ~Hasher() = default;
+  
+  virtual HashAlgorithm GetAlgorithm() const = 0;
+  
+  virtual void Update(const uint8_t* data, size_t size) = 0;
+  
+  // The hash of everything given to Update() since the hasher was created
+  // or last finished, after which it starts over
+  virtual Digest Final() = 0;
+};
+
 // Interface for cryptographic operations
 class CryptoProvider {
  public:
@@ -48,12 +170,24 @@ class CryptoProvider {
   // Generate a keypair specifically for digital signatures
   virtual SignatureKeyPair GenerateSignatureKeyPair() const = 0;
   
-  // Generate a random nonce
+  // Generate a random nonce. For a run of messages under one key,
+  // NonceSequence is cheaper.
   virtual Nonce GenerateNonce() const = 0;
   
   // Hash a string using a cryptographically secure hash function (SHA-256)
   virtual ByteBuffer Hash(const std::string& data) const = 0;
   
+  // A hasher for input too large to pass at once
+  virtual std::unique_ptr<Hasher> CreateHasher(HashAlgorithm algorithm) const = 0;
+  
+  // Tree hash of a file: segments of TREE_SEGMENT_SIZE bytes are hashed on
+  // the worker threads, and their hashes in order hashed into the result.
+  // Not the same as hashing the file as a whole. Returns false if the file
+  // can't be read.
+  static constexpr uint64_t TREE_SEGMENT_SIZE = 4 * 1024 * 1024;
+  virtual bool HashFile(const std::string& path, HashAlgorithm algorithm,
+                        Digest& digest) const = 0;
+  
   // Symmetric encryption/decryption
   virtual ByteBuffer Encrypt(const ByteBuffer& plaintext, 
                            const Key& key, 
@@ -79,12 +213,121 @@ class CryptoProvider {
   virtual bool Verify(const ByteBuffer& message, 
                      const ByteBuffer& signature,
                      const SignPublicKey& public_key) const = 0;
+  
+  // The same operations on caller-supplied buffers, for hot paths that
+  // can't afford an allocation per call. Outputs are sized with
+  // EncryptedSize() and AsymmetricEncryptedSize() and may overlap the
+  // input, so data can be encrypted and decrypted in place. These return
+  // false instead of throwing or logging.
+  virtual bool Encrypt(const uint8_t* plaintext, size_t size, uint8_t* ciphertext,
+                       const Key& key, const Nonce& nonce) const = 0;
+  
+  // size is the ciphertext's, MAC included
+  virtual bool Decrypt(const uint8_t* ciphertext, size_t size, uint8_t* plaintext,
+                       const Key& key, const Nonce& nonce) const = 0;
+  
+  // Encrypt with the MAC_SIZE-byte MAC written apart from the size bytes
+  // of ciphertext, which can then stay where the plaintext was
+  virtual bool EncryptDetached(const uint8_t* plaintext, size_t size, uint8_t* ciphertext,
+                               uint8_t* mac, const Key& key, const Nonce& nonce) const = 0;
+  
+  virtual bool DecryptDetached(const uint8_t* ciphertext, size_t size, const uint8_t* mac,
+                               uint8_t* plaintext, const Key& key,
+                               const Nonce& nonce) const = 0;
+  
+  virtual bool AsymmetricEncrypt(const uint8_t* plaintext, size_t size, uint8_t* output,
+                                 const Key& receiver_public_key,
+                                 const Key& sender_private_key) const = 0;
+  
+  // size is the whole output of AsymmetricEncrypt(), nonce included
+  virtual bool AsymmetricDecrypt(const uint8_t* data, size_t size, uint8_t* plaintext,
+                                 const Key& sender_public_key,
+                                 const Key& receiver_private_key) const = 0;
+  
+  // Write the SIGNATURE_SIZE-byte signature of message to signature
+  virtual bool Sign(const uint8_t* message, size_t size, uint8_t* signature,
+                    const SignPrivateKey& private_key) const = 0;
+  
+  virtual bool Verify(const uint8_t* message, size_t size, const uint8_t* signature,
+                      const SignPublicKey& public_key) const = 0;
+  
+  // Sign every message in messages, spread across the worker threads.
+  // Throws as Sign() does.
+  virtual std::vector<ByteBuffer> SignBatch(const std::vector<ByteBuffer>& messages,
+                                            const SignPrivateKey& private_key) const = 0;
+  
+  // Check every item's signature, spread across the worker threads, and
+  // return the indices of those that fail, in order. With
+  // stop_at_first_failure, checking stops as soon as any fails, so only
+  // the failures found by then are listed.
+  virtual std::vector<size_t> VerifyBatch(const std::vector<SignedData>& items,
+                                          bool stop_at_first_failure = false) const = 0;
+  
+  // The key shared with the holder of remote_public_key, for the
+  // precomputed operations below. Computing it costs the X25519
+  // multiplication that AsymmetricEncrypt() and AsymmetricDecrypt() do on
+  // every call; SharedKeyCache keeps them per peer.
+  virtual Key ComputeSharedKey(const Key& remote_public_key,
+                               const Key& local_private_key) const = 0;
+  
+  // AsymmetricEncrypt() and AsymmetricDecrypt() with a key from
+  // ComputeSharedKey(). Both ends compute the same key, and what either
+  // form encrypts, either form decrypts.
+  virtual ByteBuffer AsymmetricEncryptPrecomputed(const ByteBuffer& plaintext,
+                                                  const Key& shared_key) const = 0;
+  
+  virtual ByteBuffer AsymmetricDecryptPrecomputed(const ByteBuffer& data,
+                                                  const Key& shared_key) const = 0;
+  
+  virtual bool AsymmetricEncryptPrecomputed(const uint8_t* plaintext, size_t size,
+                                            uint8_t* output,
+                                            const Key& shared_key) const = 0;
+  
+  virtual bool AsymmetricDecryptPrecomputed(const uint8_t* data, size_t size,
+                                            uint8_t* plaintext,
+                                            const Key& shared_key) const = 0;
+  
+  // Session cipher suites this host runs, as CipherSuiteBit flags
+  virtual uint8_t GetCipherSuites() const = 0;
+  
+  // The suite to use with a peer running remote_suites: AES-256-GCM where
+  // both have AES instructions, otherwise XChaCha20-Poly1305. NONE if
+  // there is nothing in common.
+  virtual CipherSuite ChooseCipherSuite(uint8_t remote_suites) const = 0;
+  
+  // A session cipher keyed from an X25519 exchange of key pairs from
+  // GenerateKeyPair(). The side that opened the connection is the
+  // initiator. Returns null if the exchange fails.
+  virtual std::unique_ptr<SessionCipher> CreateSessionCipher(CipherSuite suite,
+                                                             const KeyPair& local_keys,
+                                                             const Key& remote_public_key,
+                                                             bool initiator) const = 0;
+  
+  // A session cipher for a connection resuming a session from its
+  // resumption secret. Both ends pass the same salt, fresh for each
+  // connection, so no keys or nonces are reused. Returns null for a suite
+  // this host doesn't run.
+  virtual std::unique_ptr<SessionCipher> ResumeSessionCipher(CipherSuite suite,
+                                                             const Key& secret,
+                                                             const ByteBuffer& salt,
+                                                             bool initiator) const = 0;
+  
+  // The two ends of a stream keyed from an X25519 exchange of key pairs
+  // from GenerateKeyPair(); the opener starts from the sealer's header.
+  // Return null if the exchange fails.
+  virtual std::unique_ptr<StreamSealer> CreateStreamSealer(
+      const KeyPair& local_keys, const Key& remote_public_key) const = 0;
+  virtual std::unique_ptr<StreamOpener> CreateStreamOpener(
+      const KeyPair& local_keys, const Key& remote_public_key,
+      const uint8_t* header) const = 0;
 };
 
 // Factory to create a concrete implementation
 class CryptoFactory {
  public:
-  static std::unique_ptr<CryptoProvider> Create();
+  // batch_threads run SignBatch(), VerifyBatch() and HashFile() (0 = one
+  // per core); they start on first use
+  static std::unique_ptr<CryptoProvider> Create(unsigned int batch_threads = 0);
 };
 
 }  // namespace crypto
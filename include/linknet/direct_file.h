@@ -0,0 +1,167 @@
+#ifndef LINKNET_DIRECT_FILE_H_
+#define LINKNET_DIRECT_FILE_H_
+
+#include "linknet/async_file_io.h"
+#include "linknet/types.h"
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace linknet {
+
+// Fixed-size buffers aligned for direct I/O, reused across reads and writes.
+// Thread-safe. Buffers must be returned before the pool is destroyed.
+class AlignedBufferPool {
+ public:
+  // Alignment of buffers, and of file offsets and lengths for direct I/O
+  static constexpr size_t ALIGNMENT = 4096;
+  
+  struct Releaser {
+    AlignedBufferPool* pool;
+    void operator()(uint8_t* data) const { pool->Release(data); }
+  };
+  using Buffer = std::unique_ptr<uint8_t[], Releaser>;
+  
+  // buffer_size is rounded up to ALIGNMENT. Up to max_idle returned buffers
+  // are kept for reuse.
+  explicit AlignedBufferPool(size_t buffer_size, size_t max_idle = 16);
+  ~AlignedBufferPool();
+  
+  AlignedBufferPool(const AlignedBufferPool&) = delete;
+  AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+  
+  // Null if out of memory
+  Buffer Acquire();
+  
+  size_t BufferSize() const { return _buffer_size; }
+ 
+ private:
+  void Release(uint8_t* data);
+  
+  size_t _buffer_size;
+  size_t _max_idle;
+  std::mutex _mutex;
+  std::vector<uint8_t*> _idle;
+};
+
+// A read or write started through DirectFile, with the buffers the I/O goes
+// through, which stay alive until it completes
+struct AsyncFileRequest {
+  struct Buffers {
+    ByteBuffer data;
+    AlignedBufferPool::Buffer aligned{nullptr, AlignedBufferPool::Releaser{nullptr}};
+  };
+  
+  uint64_t offset = 0;
+  size_t size = 0;
+  bool write = false;
+  std::shared_ptr<Buffers> buffers;
+  std::shared_future<int64_t> result;
+};
+
+// Positioned reads and writes on a file, blocking or through an AsyncFileIo.
+// Opened direct, it keeps file data out of the page cache, so moving a huge
+// file doesn't evict everything else on the host: aligned I/O goes through
+// O_DIRECT via the pool's buffers, while unaligned I/O, and all I/O where
+// the file system refuses O_DIRECT, goes through the cache, which is written
+// back and dropped with posix_fadvise(POSIX_FADV_DONTNEED) every few
+// megabytes.
+//
+// Not thread-safe; callers lock around it.
+class DirectFile {
+ public:
+  enum class Mode {
+    READ,
+    READ_WRITE,  // The file must exist
+    CREATE,      // Created, or truncated if it exists
+  };
+  
+  // Cached data is written back and dropped after this many bytes went
+  // through the cache
+  static constexpr uint64_t DROP_BATCH = 8 * 1024 * 1024;
+  
+  explicit DirectFile(std::shared_ptr<AlignedBufferPool> buffers);
+  ~DirectFile();
+  
+  DirectFile(const DirectFile&) = delete;
+  DirectFile& operator=(const DirectFile&) = delete;
+  
+  // Without direct, the file is used through the page cache like any other
+  bool Open(const std::string& path, Mode mode, bool direct = true);
+  
+  // Wait for requests in flight, write back and drop whatever is still
+  // cached, then close
+  void Close();
+  
+  bool IsOpen() const { return _fd >= 0; }
+  
+  // Whether O_DIRECT is in use, as opposed to the cache-dropping fallback
+  bool IsDirect() const { return _direct; }
+  
+  // Read exactly size bytes at offset. Fails at the end of the file.
+  bool ReadAt(uint64_t offset, uint8_t* data, size_t size);
+  
+  bool WriteAt(uint64_t offset, const uint8_t* data, size_t size);
+ 
+  // The extent of data at or after offset, as [begin, end), from
+  // SEEK_DATA and SEEK_HOLE. Both are the file size if only a hole follows.
+  // Where the file system doesn't report holes, everything is data.
+  void FindData(uint64_t offset, uint64_t& begin, uint64_t& end);
+  
+  // Make size bytes at offset read as zeros, growing the file if it ends
+  // before them. They become a hole where the file system can punch one,
+  // and are written out otherwise.
+  bool Zero(uint64_t offset, uint64_t size);
+  
+  // Queue a read of size bytes at offset, or a write of data there, on io;
+  // io.Submit starts them. A write that can't go through O_DIRECT on a
+  // direct file is done before WriteAsync returns.
+  AsyncFileRequest ReadAsync(AsyncFileIo& io, uint64_t offset, size_t size);
+  AsyncFileRequest WriteAsync(AsyncFileIo& io, uint64_t offset, ByteBuffer data);
+  
+  // Wait for a request queued on this file, completing a short transfer
+  // with blocking I/O. Afterwards a read's data is in buffers->data.
+  bool Finish(AsyncFileRequest& request);
+ 
+ private:
+  bool BufferedReadAt(uint64_t offset, uint8_t* data, size_t size);
+  bool BufferedWriteAt(uint64_t offset, const uint8_t* data, size_t size);
+  
+  // Turn O_DIRECT on or off for the next I/O. The thread pool backend
+  // issues queued requests later, so those must have finished first.
+  bool SetDirect(bool direct);
+  
+  // Remember a queued request, forgetting those that completed
+  void Track(const std::shared_future<int64_t>& result);
+  void WaitInFlight();
+  
+  // Remember a range that went through the cache, dropping the cached
+  // ranges every DROP_BATCH bytes
+  void AddCached(uint64_t offset, uint64_t length, bool written);
+  void DropCached();
+  
+  std::shared_ptr<AlignedBufferPool> _buffers;
+  int _fd = -1;
+  bool _direct = false;
+  bool _direct_on = false;
+  bool _drop_cache = false;
+  
+  // Requests queued on _io that may not have completed
+  AsyncFileIo* _io = nullptr;
+  std::vector<std::shared_future<int64_t>> _in_flight;
+  
+  // Span of the data in the cache, how much went through it, and whether
+  // any of it is dirty
+  uint64_t _cached_begin = 0;
+  uint64_t _cached_end = 0;
+  uint64_t _cached_bytes = 0;
+  bool _cached_dirty = false;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_DIRECT_FILE_H_
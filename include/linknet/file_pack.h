@@ -0,0 +1,49 @@
+#ifndef LINKNET_FILE_PACK_H_
+#define LINKNET_FILE_PACK_H_
+
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace linknet {
+
+// A file at a fixed offset inside a pack
+struct PackEntry {
+  std::string path;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Small files laid out back to back as one byte stream, so that a directory
+// of many small files moves as a single chunked transfer instead of one
+// request and confirmation per file. A chunk may span several files.
+class FilePack {
+ public:
+  // Append a file of the given size to the end of the pack
+  void Add(const std::string& path, uint64_t size);
+  
+  const std::vector<PackEntry>& GetEntries() const { return _entries; }
+  uint64_t Size() const { return _size; }
+  
+  // Read length bytes of the pack starting at offset from the files it is
+  // made of. Returns false if a file is missing or shorter than recorded.
+  bool Read(uint64_t offset, uint8_t* data, size_t length);
+  
+  // Split a pack stored at pack_path into its files, creating or replacing
+  // each one. Returns false if the pack is short or a file can't be written.
+  bool Unpack(const std::string& pack_path) const;
+ 
+ private:
+  std::vector<PackEntry> _entries;
+  uint64_t _size = 0;
+  
+  // The file read last, kept open since reads are mostly sequential
+  size_t _open_index = std::numeric_limits<size_t>::max();
+  std::ifstream _open_file;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_FILE_PACK_H_
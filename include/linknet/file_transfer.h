@@ -2,6 +2,7 @@
 #define LINKNET_FILE_TRANSFER_H_
 
 #include "linknet/types.h"
+#include <chrono>
 #include <string>
 #include <functional>
 #include <memory>
@@ -9,11 +10,44 @@
 
 namespace linknet {
 
-// Forward declaration
+// Forward declarations
 class NetworkManager;
+class Message;
+
+namespace crypto {
+class CryptoProvider;
+}  // namespace crypto
+
+// Progress of a transfer as reported to the progress callback
+struct TransferProgress {
+  double fraction = 0;             // Share of the file done, 0 to 1
+  uint64_t bytes_transferred = 0;
+  uint64_t total_bytes = 0;
+  double bytes_per_second = 0;     // Recent throughput
+  double eta_seconds = -1;         // Estimated time left, negative if unknown
+};
+
+// Snapshot of an ongoing transfer's progress and health
+struct TransferStats {
+  PeerId peer_id;
+  std::string file_path;
+  FileTransferStatus status = FileTransferStatus::PENDING;
+  bool outgoing = false;
+  uint64_t bytes_transferred = 0;
+  uint64_t total_bytes = 0;
+  double bytes_per_second = 0;          // Over the last half second
+  double average_bytes_per_second = 0;  // Exponentially weighted average
+  double eta_seconds = -1;              // Negative if unknown
+  uint32_t chunks_in_flight = 0;        // Requested or read ahead, not yet delivered
+  uint32_t retransmits = 0;             // Chunks sent or requested again
+  std::chrono::steady_clock::duration elapsed{};
+  std::chrono::steady_clock::duration since_progress{};
+  bool stalled = false;                 // No progress within the stall timeout
+};
 
 // Callbacks for file transfer events
-using FileTransferProgressCallback = std::function<void(const PeerId&, const std::string&, double)>;
+using FileTransferProgressCallback =
+    std::function<void(const PeerId&, const std::string&, const TransferProgress&)>;
 using FileTransferCompletedCallback = std::function<void(const PeerId&, const std::string&, bool, const std::string&)>;
 using FileTransferRequestCallback = std::function<bool(const PeerId&, const std::string&, uint64_t)>;
 
@@ -24,15 +58,80 @@ class FileTransferManager {
   // Send a file to a peer
   virtual bool SendFile(const PeerId& peer_id, const std::string& file_path) = 0;
   
+  // Send a directory and everything under it to a peer, preserving file
+  // modes and modification times. Small files are packed into shared chunks
+  // and larger ones are sent side by side.
+  virtual bool SendDirectory(const PeerId& peer_id, const std::string& directory_path) = 0;
+  
+  // Offer a file to swarm downloads. Peers ask for it by the content hash
+  // returned in content_hash.
+  virtual bool ShareFile(const std::string& file_path, ByteBuffer& content_hash) = 0;
+  
+  // Download a file by content hash, pulling disjoint parts of it from every
+  // connected peer that shares it. The file is saved under filename in
+  // downloads/. Swarm downloads are reported with an all-zero peer ID.
+  virtual bool DownloadFile(const ByteBuffer& content_hash, const std::string& filename) = 0;
+  
   // Cancel an ongoing file transfer
   virtual void CancelTransfer(const PeerId& peer_id, const std::string& file_path) = 0;
   
+  // Change the priority of an outgoing transfer, named by local path or
+  // file ID. A peer's share of the upload is split among its transfers in
+  // proportion to their priority.
+  virtual bool SetTransferPriority(const PeerId& peer_id, const std::string& file_path,
+                                   TransferPriority priority) = 0;
+  
+  // Upload scheduling. Peers get equal shares of the upload. At most
+  // max_transfers outgoing transfers send at a time and the rest queue, and
+  // the total upload rate is capped at bytes_per_second. 0 lifts a limit.
+  virtual void SetMaxConcurrentTransfers(size_t max_transfers) = 0;
+  virtual void SetUploadLimit(uint64_t bytes_per_second) = 0;
+  
+  // Offer to compress the chunks of new outgoing transfers. Each chunk is
+  // compressed only if it looks compressible and actually shrinks.
+  virtual void SetCompressionEnabled(bool enabled) = 0;
+  
+  // Offer to seal the chunks of new transfers as one authenticated stream,
+  // keyed by an exchange through provider, and accept such offers. The
+  // stream moves to a new key every rekey_interval chunks (0 never). Null
+  // turns sealing off.
+  virtual void SetEncryption(std::shared_ptr<crypto::CryptoProvider> provider,
+                             uint32_t rekey_interval = 4096) = 0;
+  
+  // Read and write files of at least min_file_size bytes without going
+  // through the page cache, so huge transfers don't evict everything else.
+  // Where direct I/O is unsupported the cached data is dropped behind them
+  // instead. 0 (the default) turns this off.
+  virtual void SetDirectIoThreshold(uint64_t min_file_size) = 0;
+  
+  // Keep verified downloads in a content-addressed cache in directory, of
+  // at most max_bytes, and answer later requests for the same content from
+  // it instead of receiving the file again. 0 turns the cache off. Returns
+  // false if the directory can't be used.
+  virtual bool SetContentCache(const std::string& directory, uint64_t max_bytes) = 0;
+  
   // Get the status of ongoing transfers
   virtual std::vector<std::tuple<PeerId, std::string, FileTransferStatus, double>> 
       GetOngoingTransfers() const = 0;
   
+  // Throughput, ETA and health of ongoing transfers
+  virtual std::vector<TransferStats> GetTransferStats() const = 0;
+  
+  // Flag transfers that make no progress for timeout, or fail them if
+  // fail_stalled is set. Queued and finished transfers never stall; a swarm
+  // download no peer answers does. A zero timeout turns detection off.
+  virtual void SetStallTimeout(std::chrono::milliseconds timeout, bool fail_stalled) = 0;
+  
+  // Handle an incoming file transfer message. Only needed when the
+  // application routes network messages through its own handler chain.
+  virtual void HandleMessage(std::unique_ptr<Message> message) = 0;
+  
   // Set callbacks
   virtual void SetProgressCallback(FileTransferProgressCallback callback) = 0;
+  
+  // Limit progress reports to updates_per_second per transfer; the report
+  // of a finished file always goes out. 0 reports every chunk.
+  virtual void SetProgressRate(uint32_t updates_per_second) = 0;
   virtual void SetCompletedCallback(FileTransferCompletedCallback callback) = 0;
   virtual void SetRequestCallback(FileTransferRequestCallback callback) = 0;
 };
@@ -0,0 +1,73 @@
+#ifndef LINKNET_KEY_ARENA_H_
+#define LINKNET_KEY_ARENA_H_
+
+#include "linknet/crypto.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace linknet {
+namespace crypto {
+
+// A fixed number of key slots in one block from sodium_malloc(): locked
+// into memory so keys are never swapped out, between guard pages so an
+// overrun faults, with a canary checked when it is freed. Keys held here
+// stay in one place instead of being copied around the heap. Allocate()
+// and Free() take constant time, and a freed slot is wiped.
+//
+// Not thread-safe.
+class KeyArena {
+ public:
+  // Throws std::runtime_error if the memory can't be allocated
+  explicit KeyArena(size_t capacity);
+  ~KeyArena();
+  
+  KeyArena(const KeyArena&) = delete;
+  KeyArena& operator=(const KeyArena&) = delete;
+  
+  // A zeroed slot, or null if every slot is taken
+  Key* Allocate();
+  
+  // Wipe and return a slot from Allocate(). Null is ignored.
+  void Free(Key* key);
+  
+  // Whether key is one of this arena's slots
+  bool Contains(const Key* key) const { return key >= _slots && key < _slots + _capacity; }
+  
+  size_t GetCapacity() const { return _capacity; }
+  size_t GetUsed() const { return _capacity - _free.size(); }
+ 
+ private:
+  size_t _capacity;
+  Key* _slots;
+  
+  // Indices of the free slots, the next one to hand out last
+  std::vector<uint32_t> _free;
+};
+
+// Keys in key arenas added as more keys are held at once than the ones
+// there have room for. Shared by the objects holding its keys, which may
+// outlive whoever made it.
+//
+// Thread-safe.
+class KeyStore {
+ public:
+  // A zeroed slot. Throws std::runtime_error if no memory can be had.
+  Key* Allocate();
+  
+  // Wipe and return a slot from Allocate(). Null is ignored.
+  void Free(Key* key);
+ 
+ private:
+  static constexpr size_t ARENA_CAPACITY = 64;
+  
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<KeyArena>> _arenas;
+};
+
+}  // namespace crypto
+}  // namespace linknet
+
+#endif  // LINKNET_KEY_ARENA_H_
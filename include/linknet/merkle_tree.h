@@ -0,0 +1,42 @@
+#ifndef LINKNET_MERKLE_TREE_H_
+#define LINKNET_MERKLE_TREE_H_
+
+#include "linknet/crypto.h"
+#include <string>
+#include <vector>
+
+namespace linknet {
+namespace crypto {
+
+// Binary hash tree over the chunks of a file. Leaves are BLAKE2b-256 hashes
+// of individual chunks, so any chunk can be checked on its own once the leaf
+// list has been checked against the root.
+class MerkleTree {
+ public:
+  MerkleTree() = default;
+  explicit MerkleTree(std::vector<Digest> leaves);
+  
+  // Hash one chunk as a leaf
+  static Digest HashLeaf(const uint8_t* data, size_t size);
+  
+  // Root over a list of leaves
+  static Digest ComputeRoot(const std::vector<Digest>& leaves);
+  
+  // Hash every chunk of a file, splitting the file across worker threads
+  // (0 = one per hardware thread). Returns false if the file can't be read.
+  static bool BuildFromFile(const std::string& path, size_t chunk_size,
+                            MerkleTree& tree, unsigned int threads = 0);
+  
+  const std::vector<Digest>& GetLeaves() const { return _leaves; }
+  size_t LeafCount() const { return _leaves.size(); }
+  const Digest& GetRoot() const { return _root; }
+ 
+ private:
+  std::vector<Digest> _leaves;
+  Digest _root{};
+};
+
+}  // namespace crypto
+}  // namespace linknet
+
+#endif  // LINKNET_MERKLE_TREE_H_
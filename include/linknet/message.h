@@ -5,6 +5,7 @@
 #include <ctime>
 #include <string>
 #include <memory>
+#include <vector>
 
 namespace linknet {
 
@@ -18,6 +19,9 @@ class Message {
   const MessageId& GetId() const { return _id; }
   std::time_t GetTimestamp() const { return _timestamp; }
   
+  // Attribute the message to the local session it arrived on
+  void SetSender(const PeerId& sender) { _sender = sender; }
+  
   // Serialize the message to a byte buffer
   virtual ByteBuffer Serialize() const = 0;
   
@@ -50,39 +54,394 @@ class ChatMessage : public Message {
   std::string _content;
 };
 
-// File transfer request message
+// File transfer request message. The sender picks the transfer ID, and
+// every later message of the transfer carries it in place of the file name.
 class FileTransferRequestMessage : public Message {
  public:
   FileTransferRequestMessage(const PeerId& sender, 
+                            TransferId transfer_id,
                             const std::string& filename, 
-                            uint64_t file_size);
+                            uint64_t file_size,
+                            const ByteBuffer& content_hash = {},
+                            uint8_t compression_types = 0,
+                            const ByteBuffer& stream_key = {});
   FileTransferRequestMessage(const PeerId& sender);  // For deserialization
   
+  TransferId GetTransferId() const { return _transfer_id; }
   const std::string& GetFilename() const { return _filename; }
   uint64_t GetFileSize() const { return _file_size; }
   
+  // Merkle root over the file's chunk hashes (empty if not provided)
+  const ByteBuffer& GetContentHash() const { return _content_hash; }
+  
+  // Chunk compression codecs the sender can use, one bit per CompressionType
+  uint8_t GetCompressionTypes() const { return _compression_types; }
+  
+  // The sender's public key for a sealed stream of chunks (empty if the
+  // sender doesn't offer one)
+  const ByteBuffer& GetStreamKey() const { return _stream_key; }
+  
   ByteBuffer Serialize() const override;
   bool Deserialize(const ByteBuffer& data) override;
   
  private:
+  TransferId _transfer_id;
   std::string _filename;
   uint64_t _file_size;
+  ByteBuffer _content_hash;
+  uint8_t _compression_types;
+  ByteBuffer _stream_key;
+};
+
+// Receiver's answer to a file transfer request. When accepted, carries the
+// chunk ranges the receiver still needs (everything for a fresh download,
+// only the gaps when resuming a partial one). A receiver holding an older
+// version of the file may instead ask for the delta manifest first and send
+// a second response once it knows which chunks it can reuse. An accepted
+// response also names the codec, picked from those the sender offered, that
+// the sender may compress chunks with, and whether runs of zero chunks may
+// come as FILE_HOLES. A receiver that already had the content flags it as
+// cached and needs nothing at all. If the sender offered a sealed stream and
+// the receiver takes it, the response carries the receiver's public key.
+class FileTransferResponseMessage : public Message {
+ public:
+  FileTransferResponseMessage(const PeerId& sender,
+                             TransferId transfer_id,
+                             bool accepted,
+                             const std::vector<ChunkRange>& missing_ranges = {},
+                             bool manifest_requested = false,
+                             CompressionType compression = CompressionType::NONE,
+                             bool cached = false,
+                             bool sparse = false,
+                             const ByteBuffer& stream_key = {});
+  FileTransferResponseMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  bool IsAccepted() const { return _accepted; }
+  const std::vector<ChunkRange>& GetMissingRanges() const { return _missing_ranges; }
+  bool IsManifestRequested() const { return _manifest_requested; }
+  CompressionType GetCompression() const { return _compression; }
+  bool IsCached() const { return _cached; }
+  bool IsSparse() const { return _sparse; }
+  const ByteBuffer& GetStreamKey() const { return _stream_key; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  bool _accepted;
+  std::vector<ChunkRange> _missing_ranges;
+  bool _manifest_requested;
+  CompressionType _compression;
+  bool _cached;
+  bool _sparse;
+  ByteBuffer _stream_key;
+};
+
+// A single chunk of file data, compressed with the given codec or raw.
+// Each chunk is flagged on its own, so a chunk that doesn't compress well
+// can be sent raw in the middle of a compressed transfer. The chunks of a
+// sealed transfer are the messages of one stream, numbered in the order
+// they were sealed; the first also carries the stream header in front.
+class FileChunkMessage : public Message {
+ public:
+  FileChunkMessage(const PeerId& sender, 
+                  TransferId transfer_id,
+                  uint32_t chunk_index,
+                  const ByteBuffer& data,
+                  CompressionType compression = CompressionType::NONE,
+                  bool sealed = false,
+                  uint32_t stream_index = 0);
+  FileChunkMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  uint32_t GetChunkIndex() const { return _chunk_index; }
+  const ByteBuffer& GetData() const { return _data; }
+  CompressionType GetCompression() const { return _compression; }
+  bool IsSealed() const { return _sealed; }
+  uint32_t GetStreamIndex() const { return _stream_index; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  uint32_t _chunk_index;
+  ByteBuffer _data;
+  CompressionType _compression;
+  bool _sealed;
+  uint32_t _stream_index;
+};
+
+// Chunk ranges of a transfer that hold nothing but zeros, sent in place of
+// their data. The receiver leaves holes in the file for them.
+class FileHolesMessage : public Message {
+ public:
+  FileHolesMessage(const PeerId& sender,
+                  TransferId transfer_id,
+                  const std::vector<ChunkRange>& ranges);
+  FileHolesMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  const std::vector<ChunkRange>& GetRanges() const { return _ranges; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  std::vector<ChunkRange> _ranges;
+};
+
+// A batch of per-chunk hashes (Merkle leaves) for a transfer, starting at
+// the given chunk index. Hashes are concatenated 32-byte digests.
+class FileChunkHashesMessage : public Message {
+ public:
+  FileChunkHashesMessage(const PeerId& sender,
+                        TransferId transfer_id,
+                        uint32_t first_index,
+                        const ByteBuffer& hashes);
+  FileChunkHashesMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  uint32_t GetFirstIndex() const { return _first_index; }
+  const ByteBuffer& GetHashes() const { return _hashes; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  uint32_t _first_index;
+  ByteBuffer _hashes;
+};
+
+// Receiver asks the sender to (re)send specific chunk ranges
+class FileChunkRequestMessage : public Message {
+ public:
+  FileChunkRequestMessage(const PeerId& sender,
+                         TransferId transfer_id,
+                         const std::vector<ChunkRange>& ranges);
+  FileChunkRequestMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  const std::vector<ChunkRange>& GetRanges() const { return _ranges; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  std::vector<ChunkRange> _ranges;
+};
+
+// A batch of the sender's content-defined chunk list for a delta transfer,
+// starting at the given entry. Chunks are contiguous, so offsets follow from
+// the lengths. Hashes are concatenated 32-byte digests, one per length.
+class FileDeltaManifestMessage : public Message {
+ public:
+  FileDeltaManifestMessage(const PeerId& sender,
+                          TransferId transfer_id,
+                          uint32_t first_index,
+                          const std::vector<uint32_t>& chunk_lengths,
+                          const ByteBuffer& chunk_hashes);
+  FileDeltaManifestMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  uint32_t GetFirstIndex() const { return _first_index; }
+  const std::vector<uint32_t>& GetChunkLengths() const { return _chunk_lengths; }
+  const ByteBuffer& GetChunkHashes() const { return _chunk_hashes; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  uint32_t _first_index;
+  std::vector<uint32_t> _chunk_lengths;
+  ByteBuffer _chunk_hashes;
+};
+
+// Asks peers whether they share the file with the given content hash. With
+// send_hashes set, the peer also sends the file's chunk hashes. The transfer
+// ID is picked by the downloader and used by every source it pulls from.
+class FileSwarmQueryMessage : public Message {
+ public:
+  FileSwarmQueryMessage(const PeerId& sender,
+                       TransferId transfer_id,
+                       const ByteBuffer& content_hash,
+                       bool send_hashes = false,
+                       uint32_t first_hash = 0);
+  FileSwarmQueryMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  const ByteBuffer& GetContentHash() const { return _content_hash; }
+  bool IsSendHashes() const { return _send_hashes; }
+  // Index of the first chunk hash to send, when sending hashes
+  uint32_t GetFirstHash() const { return _first_hash; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  ByteBuffer _content_hash;
+  bool _send_hashes;
+  uint32_t _first_hash;
+};
+
+// A peer's answer to a swarm query: it can serve the file
+class FileSwarmHaveMessage : public Message {
+ public:
+  FileSwarmHaveMessage(const PeerId& sender,
+                      TransferId transfer_id,
+                      const ByteBuffer& content_hash,
+                      uint64_t file_size);
+  FileSwarmHaveMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  const ByteBuffer& GetContentHash() const { return _content_hash; }
+  uint64_t GetFileSize() const { return _file_size; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  ByteBuffer _content_hash;
+  uint64_t _file_size;
 };
 
-// Connection notification message
+// A batch of the entries of a directory being sent. The receiver creates
+// the directory once the last batch has arrived; its files follow as
+// transfers named "<directory>/<path>", with every packed file in one
+// transfer named "<directory>/".
+class FileDirectoryManifestMessage : public Message {
+ public:
+  FileDirectoryManifestMessage(const PeerId& sender,
+                               const std::string& directory_name,
+                               uint32_t first_index,
+                               const std::vector<DirectoryEntry>& entries,
+                               bool last);
+  FileDirectoryManifestMessage(const PeerId& sender);  // For deserialization
+  
+  const std::string& GetDirectoryName() const { return _directory_name; }
+  uint32_t GetFirstIndex() const { return _first_index; }
+  const std::vector<DirectoryEntry>& GetEntries() const { return _entries; }
+  bool IsLast() const { return _last; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  std::string _directory_name;
+  uint32_t _first_index;
+  std::vector<DirectoryEntry> _entries;
+  bool _last;
+};
+
+// Final status of a file transfer, sent by either side
+class FileTransferCompleteMessage : public Message {
+ public:
+  FileTransferCompleteMessage(const PeerId& sender, 
+                             TransferId transfer_id,
+                             bool success,
+                             const std::string& error_message = "");
+  FileTransferCompleteMessage(const PeerId& sender);  // For deserialization
+  
+  TransferId GetTransferId() const { return _transfer_id; }
+  bool IsSuccess() const { return _success; }
+  const std::string& GetErrorMessage() const { return _error_message; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  TransferId _transfer_id;
+  bool _success;
+  std::string _error_message;
+};
+
+// Connection notification message. The first one each way on a connection
+// may carry an X25519 public key and the session cipher suites the sender
+// runs (the one it chose, in an answer), to encrypt the connection. To
+// resume a session instead, the dialer adds a salt and its session ticket,
+// and a peer that redeems the ticket answers with a salt of its own and no
+// public key.
 class ConnectionMessage : public Message {
  public:
+  static constexpr size_t PUBLIC_KEY_SIZE = 32;
+  static constexpr size_t RESUMPTION_SALT_SIZE = 32;
+  
   ConnectionMessage(const PeerId& sender, ConnectionStatus status);
   ConnectionMessage(const PeerId& sender);  // For deserialization
   
   ConnectionStatus GetStatus() const { return _status; }
   void SetStatus(ConnectionStatus status) { _status = status; }
   
+  void SetKeyExchange(const ByteBuffer& public_key, uint8_t cipher_suites);
+  bool HasKeyExchange() const { return _public_key.size() == PUBLIC_KEY_SIZE; }
+  const ByteBuffer& GetPublicKey() const { return _public_key; }
+  uint8_t GetCipherSuites() const { return _cipher_suites; }
+  
+  // ticket is empty in an answer
+  void SetResumption(const ByteBuffer& salt, const ByteBuffer& ticket = {});
+  bool HasResumption() const { return _resumption_salt.size() == RESUMPTION_SALT_SIZE; }
+  const ByteBuffer& GetResumptionSalt() const { return _resumption_salt; }
+  const ByteBuffer& GetTicket() const { return _ticket; }
+  
   ByteBuffer Serialize() const override;
   bool Deserialize(const ByteBuffer& data) override;
   
  private:
   ConnectionStatus _status;
+  ByteBuffer _public_key;
+  uint8_t _cipher_suites = 0;
+  ByteBuffer _resumption_salt;
+  ByteBuffer _ticket;
+};
+
+// A session ticket, sent by the accepting side over an encrypted session
+// once it is up, for the dialer to resume the session with on its next
+// connection
+class SessionTicketMessage : public Message {
+ public:
+  SessionTicketMessage(const PeerId& sender, const ByteBuffer& ticket);
+  SessionTicketMessage(const PeerId& sender);  // For deserialization
+  
+  const ByteBuffer& GetTicket() const { return _ticket; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  ByteBuffer _ticket;
+};
+
+// Opens or joins an extra data connection of a session. The accepting side
+// offers a token on the primary connection; the dialing side sends it back
+// as the first message of each data connection it opens. If the session is
+// encrypted, the join carries the dialer's salt, and the acceptor answers
+// with the token and its own salt; the connection's keys are derived from
+// both.
+class DataConnectionMessage : public Message {
+ public:
+  static constexpr size_t TOKEN_SIZE = 32;
+  
+  DataConnectionMessage(const PeerId& sender, const ByteBuffer& token,
+                        const ByteBuffer& salt = {});
+  DataConnectionMessage(const PeerId& sender);  // For deserialization
+  
+  const ByteBuffer& GetToken() const { return _token; }
+  const ByteBuffer& GetSalt() const { return _salt; }
+  
+  ByteBuffer Serialize() const override;
+  bool Deserialize(const ByteBuffer& data) override;
+ 
+ private:
+  ByteBuffer _token;
+  ByteBuffer _salt;
 };
 
 // Message factory to create messages from raw data
@@ -13,6 +13,10 @@ namespace linknet {
 // Forward declarations
 class Message;
 
+namespace crypto {
+class CryptoProvider;
+}  // namespace crypto
+
 // Callback types
 using MessageCallback = std::function<void(std::unique_ptr<Message>)>;
 using ConnectionCallback = std::function<void(const PeerId&, ConnectionStatus)>;
@@ -47,6 +51,15 @@ class NetworkManager {
   // Get local listening port
   virtual uint16_t GetLocalPort() const = 0;
   
+  // Open this many extra data connections to each peer connected to from
+  // here on, and stripe file chunks across them; 0 sends everything over
+  // the one connection
+  virtual void SetDataConnections(size_t count) = 0;
+  
+  // Encrypt connections made from here on with keys exchanged through
+  // provider, refusing peers that offer no key; null leaves them unencrypted
+  virtual void SetCryptoProvider(std::shared_ptr<crypto::CryptoProvider> provider) = 0;
+  
   // Set callbacks
   virtual void SetMessageCallback(MessageCallback callback) = 0;
   virtual void SetConnectionCallback(ConnectionCallback callback) = 0;
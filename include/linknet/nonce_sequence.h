@@ -0,0 +1,72 @@
+#ifndef LINKNET_NONCE_SEQUENCE_H_
+#define LINKNET_NONCE_SEQUENCE_H_
+
+#include "linknet/crypto.h"
+#include <bitset>
+#include <cstdint>
+
+namespace linknet {
+namespace crypto {
+
+// Nonces for the messages sent under one key: a random prefix chosen once,
+// then a 64-bit counter, so no random bytes are drawn per message and no
+// nonce repeats until the counter runs out.
+//
+// Not thread-safe.
+class NonceSequence {
+ public:
+  static constexpr size_t PREFIX_SIZE = NONCE_SIZE - sizeof(uint64_t);
+  
+  // Count from start, which is 0 for a new key
+  explicit NonceSequence(uint64_t start = 0);
+  
+  // Write the next nonce. Returns false once every counter value has been
+  // used; the key must then be replaced, and Reset() called.
+  bool Next(Nonce& nonce);
+  
+  // Start again from 0 with a new prefix, for a new key
+  void Reset();
+  
+  // Nonces handed out since the last reset
+  uint64_t GetCount() const { return _count; }
+ 
+ private:
+  std::array<uint8_t, PREFIX_SIZE> _prefix;
+  uint64_t _next;
+  uint64_t _count = 0;
+  bool _exhausted = false;
+};
+
+// The receiving end of one NonceSequence: accepts each nonce at most once.
+// Messages may arrive out of order, up to WINDOW_SIZE behind the newest one
+// seen; anything older, or with another sequence's prefix, is refused.
+//
+// Not thread-safe.
+class ReplayWindow {
+ public:
+  static constexpr uint64_t WINDOW_SIZE = 1024;
+  
+  // Whether nonce would be accepted. Check before decrypting and Accept()
+  // once the message has authenticated, so forgeries can't move the window.
+  bool Check(const Nonce& nonce) const;
+  
+  // Record nonce as seen. Returns false, recording nothing, if Check()
+  // would fail.
+  bool Accept(const Nonce& nonce);
+  
+  // Forget the sequence, for a new key
+  void Reset();
+ 
+ private:
+  bool _started = false;
+  std::array<uint8_t, NonceSequence::PREFIX_SIZE> _prefix{};
+  uint64_t _newest = 0;
+  
+  // Bit i is set if the nonce counting _newest - i has been seen
+  std::bitset<WINDOW_SIZE> _seen;
+};
+
+}  // namespace crypto
+}  // namespace linknet
+
+#endif  // LINKNET_NONCE_SEQUENCE_H_
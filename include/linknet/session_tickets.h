@@ -0,0 +1,92 @@
+#ifndef LINKNET_SESSION_TICKETS_H_
+#define LINKNET_SESSION_TICKETS_H_
+
+#include "linknet/crypto.h"
+#include "linknet/key_arena.h"
+#include "linknet/nonce_sequence.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace linknet {
+namespace crypto {
+
+// What a peer needs to resume a session: the ID it was known by, and the
+// suite and resumption secret of the session
+struct SessionTicket {
+  PeerId peer_id;
+  CipherSuite suite;
+  Key secret;
+};
+
+// Issues and redeems session tickets: a SessionTicket sealed under a local
+// ticket key, handed to the peer to present on its next connection. Only
+// this host can open its tickets, so it keeps no state per ticket.
+//
+// The ticket key is replaced every rotation period, and the one before it
+// kept for tickets issued just before the change. A ticket is good for one
+// rotation period, and redeems once: it is refused once a ticket 1024 or
+// more issues newer under the same key has been redeemed, so a peer that
+// keeps one too long falls back to a full handshake. Keys are held in a
+// key arena and wiped when they are dropped.
+//
+// Thread-safe.
+class SessionTicketKeys {
+ public:
+  static constexpr std::chrono::seconds DEFAULT_ROTATION{3600};
+  
+  // Size of an issued ticket
+  static constexpr size_t TICKET_SIZE =
+      4 + NONCE_SIZE + EncryptedSize(8 + sizeof(PeerId) + 1 + KEY_SIZE);
+  
+  // Throws std::runtime_error if the key memory can't be allocated
+  explicit SessionTicketKeys(const CryptoProvider& crypto,
+                             std::chrono::seconds rotation = DEFAULT_ROTATION);
+  ~SessionTicketKeys();
+  
+  SessionTicketKeys(const SessionTicketKeys&) = delete;
+  SessionTicketKeys& operator=(const SessionTicketKeys&) = delete;
+  
+  ByteBuffer Issue(const SessionTicket& ticket);
+  
+  // Open a ticket issued here into ticket. Returns false for a ticket that
+  // was forged, has expired or was already redeemed.
+  bool Redeem(const ByteBuffer& data, SessionTicket& ticket);
+  
+  // Replace the ticket key now
+  void Rotate();
+ 
+ private:
+  using Clock = std::chrono::steady_clock;
+  
+  struct TicketKey {
+    uint32_t generation;
+    Key* key;
+    Clock::time_point created;
+    NonceSequence nonces;
+    ReplayWindow redeemed;
+  };
+  
+  // Rotate if the current key is older than the rotation period
+  void RotateIfDueLocked(Clock::time_point now);
+  void RotateLocked(Clock::time_point now);
+  
+  void Wipe(std::unique_ptr<TicketKey>& key);
+  
+  const CryptoProvider& _crypto;
+  const Clock::duration _rotation;
+  
+  mutable std::mutex _mutex;
+  
+  // Room for the current and the previous key
+  KeyArena _keys{2};
+  std::unique_ptr<TicketKey> _current;
+  std::unique_ptr<TicketKey> _previous;
+  uint32_t _next_generation = 0;
+};
+
+}  // namespace crypto
+}  // namespace linknet
+
+#endif  // LINKNET_SESSION_TICKETS_H_
@@ -0,0 +1,77 @@
+#ifndef LINKNET_SHARDED_TABLE_H_
+#define LINKNET_SHARDED_TABLE_H_
+
+#include "linknet/types.h"
+#include <array>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace linknet {
+
+// Hash table of shared values keyed by transfer ID, split into shards that
+// are locked independently. A shard is locked only while a pointer is looked
+// up, added or removed; values carry their own locks for everything else,
+// so lookups for different transfers rarely contend. A value stays alive
+// while anyone still holds its pointer, even after it has been erased.
+template <typename Value>
+class ShardedTable {
+ public:
+  using Pointer = std::shared_ptr<Value>;
+  
+  static constexpr size_t SHARD_COUNT = 16;
+  
+  Pointer Find(TransferId id) const {
+    const Shard& shard = ShardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.values.find(id);
+    return it != shard.values.end() ? it->second : nullptr;
+  }
+  
+  // Returns false if the ID is already taken
+  bool Insert(TransferId id, Pointer value) {
+    Shard& shard = ShardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.values.emplace(id, std::move(value)).second;
+  }
+  
+  // Remove id, but only while it still maps to value
+  void Erase(TransferId id, const Value* value) {
+    Shard& shard = ShardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.values.find(id);
+    if (it != shard.values.end() && it->second.get() == value) {
+      shard.values.erase(it);
+    }
+  }
+  
+  // Every value at the time of the call, one shard at a time
+  std::vector<Pointer> Snapshot() const {
+    std::vector<Pointer> values;
+    for (const Shard& shard : _shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      for (const auto& [id, value] : shard.values) {
+        values.push_back(value);
+      }
+    }
+    return values;
+  }
+ 
+ private:
+  // Padded to a cache line so neighbouring shard locks don't false-share
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<TransferId, Pointer> values;
+  };
+  
+  // Transfer IDs are random, so the low bits spread evenly
+  Shard& ShardFor(TransferId id) { return _shards[id % SHARD_COUNT]; }
+  const Shard& ShardFor(TransferId id) const { return _shards[id % SHARD_COUNT]; }
+  
+  std::array<Shard, SHARD_COUNT> _shards;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_SHARDED_TABLE_H_
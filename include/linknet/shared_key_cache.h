@@ -0,0 +1,85 @@
+#ifndef LINKNET_SHARED_KEY_CACHE_H_
+#define LINKNET_SHARED_KEY_CACHE_H_
+
+#include "linknet/crypto.h"
+#include "linknet/key_arena.h"
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace linknet {
+namespace crypto {
+
+// Keys shared with peers for the precomputed asymmetric operations, one per
+// peer public key, so only the first message to or from a peer pays for the
+// X25519 multiplication. Once the cache is full, the least recently used
+// key goes first. The private key and the shared keys are held in a
+// KeyArena, and wiped from memory when they are dropped.
+//
+// Thread-safe.
+class SharedKeyCache {
+ public:
+  static constexpr size_t DEFAULT_CAPACITY = 256;
+  
+  SharedKeyCache(const CryptoProvider& crypto, const Key& private_key,
+                 size_t capacity = DEFAULT_CAPACITY);
+  ~SharedKeyCache();
+  
+  SharedKeyCache(const SharedKeyCache&) = delete;
+  SharedKeyCache& operator=(const SharedKeyCache&) = delete;
+  
+  // AsymmetricEncrypt() to, and AsymmetricDecrypt() from, the holder of
+  // peer_public_key with the local private key. Throw as those do.
+  ByteBuffer Encrypt(const ByteBuffer& plaintext, const Key& peer_public_key);
+  ByteBuffer Decrypt(const ByteBuffer& data, const Key& peer_public_key);
+  
+  // Drop the key for a peer whose key pair changed
+  void Forget(const Key& peer_public_key);
+  
+  // Switch to a new local private key, dropping every key made with the
+  // old one
+  void SetPrivateKey(const Key& private_key);
+  
+  size_t GetSize() const;
+ 
+ private:
+  struct Entry {
+    Key public_key;
+    Key* shared_key;  // In _arena
+  };
+  
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      size_t value;
+      std::memcpy(&value, key.data(), sizeof(value));
+      return value;
+    }
+  };
+  
+  // Copy the key shared with peer_public_key into shared_key, computing it
+  // if it isn't cached
+  void Lookup(const Key& peer_public_key, Key& shared_key);
+  
+  // Wipe and remove every entry. Caller must hold the lock.
+  void ClearLocked();
+  
+  // Wipe and remove the least recently used entry. Caller must hold the
+  // lock.
+  void EvictLocked();
+  
+  const CryptoProvider& _crypto;
+  size_t _capacity;
+  
+  // Entries most recently used first
+  mutable std::mutex _mutex;
+  KeyArena _arena;  // A slot per entry, and one for the private key
+  Key* _private_key;
+  std::list<Entry> _entries;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> _index;
+};
+
+}  // namespace crypto
+}  // namespace linknet
+
+#endif  // LINKNET_SHARED_KEY_CACHE_H_
@@ -0,0 +1,63 @@
+#ifndef LINKNET_THROUGHPUT_METER_H_
+#define LINKNET_THROUGHPUT_METER_H_
+
+#include <chrono>
+#include <cstdint>
+
+namespace linknet {
+
+// Measures the rate of a byte stream. Bytes are counted into fixed windows;
+// the current rate is that of the last complete window, and the average is
+// an exponentially weighted moving average over windows, so it follows
+// changes within a few windows while smoothing out bursts. Windows without
+// traffic count as zero.
+//
+// Not thread-safe; callers lock around it.
+class ThroughputMeter {
+ public:
+  using Clock = std::chrono::steady_clock;
+  
+  static constexpr Clock::duration DEFAULT_WINDOW = std::chrono::milliseconds(500);
+  static constexpr double DEFAULT_SMOOTHING = 0.3;
+  
+  // smoothing is the weight of the latest window in the average
+  explicit ThroughputMeter(Clock::duration window = DEFAULT_WINDOW,
+                           double smoothing = DEFAULT_SMOOTHING);
+  
+  // Start measuring at now. Without it, measuring starts at the first Add.
+  void Start(Clock::time_point now);
+  
+  void Add(uint64_t bytes, Clock::time_point now);
+  
+  // Bytes per second over the last complete window
+  double CurrentRate(Clock::time_point now) const;
+  
+  // Smoothed bytes per second
+  double AverageRate(Clock::time_point now) const;
+  
+  // When bytes were last added, or Start was called
+  Clock::time_point LastActivity() const { return _last_activity; }
+  
+  uint64_t TotalBytes() const { return _total_bytes; }
+ 
+ private:
+  // Close every window that ended by now
+  void Roll(Clock::time_point now);
+  
+  Clock::duration _window;
+  double _smoothing;
+  bool _started = false;
+  
+  Clock::time_point _window_start;
+  uint64_t _window_bytes = 0;
+  double _current_rate = 0;
+  double _average_rate = 0;
+  bool _have_average = false;
+  
+  Clock::time_point _last_activity;
+  uint64_t _total_bytes = 0;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_THROUGHPUT_METER_H_
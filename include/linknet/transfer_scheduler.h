@@ -0,0 +1,101 @@
+#ifndef LINKNET_TRANSFER_SCHEDULER_H_
+#define LINKNET_TRANSFER_SCHEDULER_H_
+
+#include "linknet/types.h"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace linknet {
+
+// Decides which outgoing transfer sends next. Scheduling is deficit round
+// robin on two levels: peers take turns with equal byte quanta, and within a
+// peer its transfers take turns with quanta weighted by priority. Credit is
+// spent after the fact, so a transfer may overdraw by one message and pays
+// it back on its next turn.
+//
+// At most a fixed number of transfers are admitted at a time; the rest wait,
+// highest priority first and then in the order they were added. An optional
+// token bucket caps the total upload rate.
+//
+// Not thread-safe; meant to be driven by a single send thread.
+class TransferScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+  
+  struct Transfer {
+    TransferId transfer_id;
+    PeerId peer_id;
+    TransferPriority priority;
+  };
+  
+  // quantum is the credit, in bytes, a peer or a normal priority transfer
+  // gets per turn. It should be at least the size of one message.
+  explicit TransferScheduler(uint64_t quantum);
+  
+  // Maximum number of admitted transfers, 0 for no limit
+  void SetMaxActive(size_t max_active);
+  
+  // Total upload rate cap in bytes per second, 0 for no limit
+  void SetUploadLimit(uint64_t bytes_per_second);
+  
+  // Bring the scheduled set in line with transfers: new transfers are added
+  // in the order given, missing ones are dropped and priorities updated
+  void Update(const std::vector<Transfer>& transfers);
+  
+  // Pick the transfer that sends next among those is_ready accepts. Returns
+  // false if no admitted transfer is ready.
+  bool Next(const std::function<bool(TransferId)>& is_ready, TransferId& transfer_id);
+  
+  // Account for bytes sent by a transfer
+  void Charge(TransferId transfer_id, uint64_t bytes, Clock::time_point now = Clock::now());
+  
+  // How long to wait before sending more under the upload cap
+  Clock::duration UploadDelay(Clock::time_point now = Clock::now());
+  
+  bool IsAdmitted(TransferId transfer_id) const;
+  
+  // Relative share of a peer's quanta for each priority
+  static uint32_t Weight(TransferPriority priority);
+ 
+ private:
+  struct Flow {
+    PeerId peer_id;
+    TransferPriority priority = TransferPriority::NORMAL;
+    uint64_t sequence = 0;
+    bool admitted = false;
+    int64_t credit = 0;
+  };
+  
+  struct PeerQueue {
+    std::deque<TransferId> flows;
+    int64_t credit = 0;
+  };
+  
+  void Remove(TransferId transfer_id);
+  void Admit();
+  bool PickFlow(PeerQueue& peer, const std::function<bool(TransferId)>& is_ready,
+                TransferId& transfer_id);
+  void RefillTokens(Clock::time_point now);
+  
+  uint64_t _quantum;
+  size_t _max_active = 0;
+  size_t _active = 0;
+  uint64_t _next_sequence = 0;
+  
+  std::unordered_map<TransferId, Flow> _flows;
+  std::map<PeerId, PeerQueue> _peers;
+  std::deque<PeerId> _peer_order;
+  
+  // Upload cap: tokens are bytes, and may go negative after a send
+  uint64_t _rate = 0;
+  double _tokens = 0;
+  Clock::time_point _last_refill;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_TRANSFER_SCHEDULER_H_
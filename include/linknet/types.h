@@ -12,6 +12,10 @@ namespace linknet {
 using PeerId = std::array<uint8_t, 32>;
 using MessageId = std::array<uint8_t, 16>;
 
+// Identifies a file transfer in every message about it. Picked at random by
+// the side that starts the transfer.
+using TransferId = uint64_t;
+
 // Buffer type for binary data
 using ByteBuffer = std::vector<uint8_t>;
 
@@ -26,6 +30,15 @@ enum class MessageType : uint8_t {
   PING = 6,
   PONG = 7,
   CONNECTION_NOTIFICATION = 8,
+  FILE_CHUNK_HASHES = 9,
+  FILE_CHUNK_REQUEST = 10,
+  FILE_DELTA_MANIFEST = 11,
+  FILE_SWARM_QUERY = 12,
+  FILE_SWARM_HAVE = 13,
+  FILE_DIRECTORY_MANIFEST = 14,
+  FILE_HOLES = 15,
+  DATA_CONNECTION = 16,
+  SESSION_TICKET = 17,
 };
 
 // Connection status
@@ -45,6 +58,41 @@ enum class FileTransferStatus : uint8_t {
   REJECTED = 4,
 };
 
+// Share of the upload an outgoing transfer gets relative to the other
+// transfers to the same peer
+enum class TransferPriority : uint8_t {
+  LOW = 0,
+  NORMAL = 1,
+  HIGH = 2,
+};
+
+// Codec a file chunk is compressed with. Offered sets of codecs are bitmasks
+// with bit n standing for codec n.
+enum class CompressionType : uint8_t {
+  NONE = 0,
+  ZLIB = 1,
+  LZ4 = 2,   // Reserved
+  ZSTD = 3,  // Reserved
+};
+
+// Contiguous run of file chunks [first, first + count)
+struct ChunkRange {
+  uint32_t first;
+  uint32_t count;
+};
+
+// A file or subdirectory in a directory transfer. The path is relative to
+// the transferred directory and '/'-separated. Packed files travel back to
+// back in a stream shared with the directory's other small files.
+struct DirectoryEntry {
+  std::string path;
+  uint64_t size = 0;
+  uint32_t mode = 0;
+  int64_t mtime_ns = 0;
+  bool is_directory = false;
+  bool packed = false;
+};
+
 // Peer information
 struct PeerInfo {
   PeerId id;
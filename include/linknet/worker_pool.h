@@ -0,0 +1,55 @@
+#ifndef LINKNET_WORKER_POOL_H_
+#define LINKNET_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace linknet {
+
+// Fixed set of threads running submitted jobs in the order they arrive.
+// Jobs still queued when the pool is destroyed are dropped; their futures
+// report a broken promise.
+class WorkerPool {
+ public:
+  // 0 threads means one per core
+  explicit WorkerPool(unsigned int threads = 0);
+  ~WorkerPool();
+  
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  
+  template <typename Function>
+  auto Submit(Function function) -> std::future<decltype(function())> {
+    using Result = decltype(function());
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+    std::future<Result> result = task->get_future();
+    
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.emplace_back([task] { (*task)(); });
+    }
+    _cv.notify_one();
+    return result;
+  }
+  
+  size_t Size() const { return _threads.size(); }
+ 
+ private:
+  void ThreadFunc();
+  
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::function<void()>> _jobs;
+  bool _stopping = false;
+};
+
+}  // namespace linknet
+
+#endif  // LINKNET_WORKER_POOL_H_
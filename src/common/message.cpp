@@ -6,6 +6,58 @@
 
 namespace linknet {
 
+namespace {
+
+// Chunk ranges are encoded as a 4-byte count followed by
+// (4 bytes first chunk, 4 bytes chunk count) pairs, all in network byte order
+size_t RangesSize(const std::vector<ChunkRange>& ranges) {
+  return 4 + ranges.size() * 8;
+}
+
+void WriteRanges(const std::vector<ChunkRange>& ranges, uint8_t* out) {
+  uint32_t range_count_network = htobe32(static_cast<uint32_t>(ranges.size()));
+  std::memcpy(out, &range_count_network, 4);
+  out += 4;
+  
+  for (const auto& range : ranges) {
+    uint32_t first_network = htobe32(range.first);
+    uint32_t count_network = htobe32(range.count);
+    std::memcpy(out, &first_network, 4);
+    std::memcpy(out + 4, &count_network, 4);
+    out += 8;
+  }
+}
+
+bool ReadRanges(const ByteBuffer& data, size_t offset, std::vector<ChunkRange>& ranges) {
+  if (data.size() < offset + 4) {
+    return false;
+  }
+  
+  uint32_t range_count_network;
+  std::memcpy(&range_count_network, data.data() + offset, 4);
+  uint32_t range_count = be32toh(range_count_network);
+  offset += 4;
+  
+  if ((data.size() - offset) / 8 < range_count) {
+    return false;
+  }
+  
+  ranges.resize(range_count);
+  for (auto& range : ranges) {
+    uint32_t first_network;
+    uint32_t count_network;
+    std::memcpy(&first_network, data.data() + offset, 4);
+    std::memcpy(&count_network, data.data() + offset + 4, 4);
+    range.first = be32toh(first_network);
+    range.count = be32toh(count_network);
+    offset += 8;
+  }
+  
+  return true;
+}
+
+}  // namespace
+
 Message::Message(MessageType type, const PeerId& sender)
     : _type(type), _sender(sender), _id(GenerateMessageId()), _timestamp(std::time(nullptr)) {}
 
@@ -109,13 +161,22 @@ bool ChatMessage::Deserialize(const ByteBuffer& data) {
 
 // FileTransferRequestMessage implementation
 FileTransferRequestMessage::FileTransferRequestMessage(
-    const PeerId& sender, const std::string& filename, uint64_t file_size)
+    const PeerId& sender, TransferId transfer_id, const std::string& filename,
+    uint64_t file_size, const ByteBuffer& content_hash, uint8_t compression_types,
+    const ByteBuffer& stream_key)
     : Message(MessageType::FILE_TRANSFER_REQUEST, sender),
+      _transfer_id(transfer_id),
       _filename(filename),
-      _file_size(file_size) {}
+      _file_size(file_size),
+      _content_hash(content_hash),
+      _compression_types(compression_types),
+      _stream_key(stream_key) {}
 
 FileTransferRequestMessage::FileTransferRequestMessage(const PeerId& sender)
-    : Message(MessageType::FILE_TRANSFER_REQUEST, sender), _file_size(0) {}
+    : Message(MessageType::FILE_TRANSFER_REQUEST, sender),
+      _transfer_id(0),
+      _file_size(0),
+      _compression_types(0) {}
 
 ByteBuffer FileTransferRequestMessage::Serialize() const {
   // Header format:
@@ -123,13 +184,20 @@ ByteBuffer FileTransferRequestMessage::Serialize() const {
   // - 32 bytes: PeerId
   // - 16 bytes: MessageId
   // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
   // - 8 bytes: File size
   // - 4 bytes: Filename length
   // - N bytes: Filename
-  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4;
+  // - 4 bytes: Content hash length
+  // - H bytes: Content hash
+  // - 1 byte: Compression codecs offered (bitmask)
+  // - K bytes: Stream public key, if offered
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 8 + 4;
   
-  // Allocate buffer with room for header and filename
-  ByteBuffer buffer(HEADER_SIZE + _filename.size());
+  // Allocate buffer with room for header, filename, content hash, codecs
+  // and stream key
+  size_t codecs_offset = HEADER_SIZE + _filename.size() + 4 + _content_hash.size();
+  ByteBuffer buffer(codecs_offset + 1 + _stream_key.size());
   
   // Fill the header
   buffer[0] = static_cast<uint8_t>(_type);
@@ -144,22 +212,40 @@ ByteBuffer FileTransferRequestMessage::Serialize() const {
   uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
   std::memcpy(buffer.data() + 49, &timestamp_network, 8);
   
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
   // Copy File size (network byte order)
   uint64_t file_size_network = htobe64(_file_size);
-  std::memcpy(buffer.data() + 57, &file_size_network, 8);
+  std::memcpy(buffer.data() + 65, &file_size_network, 8);
   
   // Copy Filename length (network byte order)
   uint32_t filename_len_network = htobe32(static_cast<uint32_t>(_filename.size()));
-  std::memcpy(buffer.data() + 65, &filename_len_network, 4);
+  std::memcpy(buffer.data() + 73, &filename_len_network, 4);
   
   // Copy Filename
   std::copy(_filename.begin(), _filename.end(), buffer.begin() + HEADER_SIZE);
   
+  // Copy Content hash length (network byte order)
+  size_t hash_offset = HEADER_SIZE + _filename.size();
+  uint32_t hash_len_network = htobe32(static_cast<uint32_t>(_content_hash.size()));
+  std::memcpy(buffer.data() + hash_offset, &hash_len_network, 4);
+  
+  // Copy Content hash
+  std::copy(_content_hash.begin(), _content_hash.end(), buffer.begin() + hash_offset + 4);
+  
+  // Copy Compression codecs
+  buffer[codecs_offset] = _compression_types;
+  
+  // Copy Stream key
+  std::copy(_stream_key.begin(), _stream_key.end(), buffer.begin() + codecs_offset + 1);
+  
   return buffer;
 }
 
 bool FileTransferRequestMessage::Deserialize(const ByteBuffer& data) {
-  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4;
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 8 + 4;
   
   if (data.size() < HEADER_SIZE) {
     LOG_ERROR("FileTransferRequestMessage: Buffer too small to deserialize");
@@ -184,14 +270,19 @@ bool FileTransferRequestMessage::Deserialize(const ByteBuffer& data) {
   std::memcpy(&timestamp_network, data.data() + 49, 8);
   _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
   
+  // Get Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
   // Get File size
   uint64_t file_size_network;
-  std::memcpy(&file_size_network, data.data() + 57, 8);
+  std::memcpy(&file_size_network, data.data() + 65, 8);
   _file_size = be64toh(file_size_network);
   
   // Get Filename length
   uint32_t filename_len_network;
-  std::memcpy(&filename_len_network, data.data() + 65, 4);
+  std::memcpy(&filename_len_network, data.data() + 73, 4);
   uint32_t filename_len = be32toh(filename_len_network);
   
   // Verify buffer is large enough
@@ -203,80 +294,224 @@ bool FileTransferRequestMessage::Deserialize(const ByteBuffer& data) {
   // Copy Filename
   _filename.assign(data.begin() + HEADER_SIZE, data.begin() + HEADER_SIZE + filename_len);
   
+  // Content hash, compression codecs and stream key are optional; older
+  // peers don't send them
+  size_t hash_offset = HEADER_SIZE + filename_len;
+  _content_hash.clear();
+  _compression_types = 0;
+  _stream_key.clear();
+  if (data.size() >= hash_offset + 4) {
+    uint32_t hash_len_network;
+    std::memcpy(&hash_len_network, data.data() + hash_offset, 4);
+    uint32_t hash_len = be32toh(hash_len_network);
+    
+    if (data.size() - hash_offset - 4 < hash_len) {
+      LOG_ERROR("FileTransferRequestMessage: Buffer too small for content hash");
+      return false;
+    }
+    
+    _content_hash.assign(data.begin() + hash_offset + 4,
+                         data.begin() + hash_offset + 4 + hash_len);
+    
+    size_t codecs_offset = hash_offset + 4 + hash_len;
+    if (data.size() > codecs_offset) {
+      _compression_types = data[codecs_offset];
+      _stream_key.assign(data.begin() + codecs_offset + 1, data.end());
+    }
+  }
+  
   return true;
 }
 
-// MessageFactory implementation
-std::unique_ptr<Message> MessageFactory::CreateFromBuffer(const ByteBuffer& data) {
-  if (data.empty()) {
-    LOG_ERROR("MessageFactory: Empty buffer");
-    return nullptr;
+// FileTransferResponseMessage implementation
+FileTransferResponseMessage::FileTransferResponseMessage(
+    const PeerId& sender, TransferId transfer_id, bool accepted,
+    const std::vector<ChunkRange>& missing_ranges, bool manifest_requested,
+    CompressionType compression, bool cached, bool sparse, const ByteBuffer& stream_key)
+    : Message(MessageType::FILE_TRANSFER_RESPONSE, sender),
+      _transfer_id(transfer_id),
+      _accepted(accepted),
+      _missing_ranges(missing_ranges),
+      _manifest_requested(manifest_requested),
+      _compression(compression),
+      _cached(cached),
+      _sparse(sparse),
+      _stream_key(stream_key) {}
+
+FileTransferResponseMessage::FileTransferResponseMessage(const PeerId& sender)
+    : Message(MessageType::FILE_TRANSFER_RESPONSE, sender),
+      _transfer_id(0),
+      _accepted(false),
+      _manifest_requested(false),
+      _compression(CompressionType::NONE),
+      _cached(false),
+      _sparse(false) {}
+
+ByteBuffer FileTransferResponseMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 1 byte: Accepted flag
+  // - 4 bytes: Missing range count
+  // - R * 8 bytes: Missing ranges (4 bytes first chunk, 4 bytes chunk count)
+  // - 1 byte: Manifest requested flag
+  // - 1 byte: Compression codec chosen
+  // - 1 byte: Content cached flag
+  // - 1 byte: Sparse flag
+  // - K bytes: Stream public key, if a sealed stream was taken
+  constexpr size_t HEADER_SIZE_WITHOUT_RANGES = 1 + 32 + 16 + 8 + 8 + 1 + 1 + 1 + 1 + 1;
+  
+  ByteBuffer buffer(HEADER_SIZE_WITHOUT_RANGES + RangesSize(_missing_ranges) +
+                    _stream_key.size());
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy Accepted flag
+  buffer[65] = _accepted ? 1 : 0;
+  
+  // Copy Missing ranges
+  WriteRanges(_missing_ranges, buffer.data() + 66);
+  
+  // Copy Manifest requested flag
+  size_t flag_offset = 66 + RangesSize(_missing_ranges);
+  buffer[flag_offset] = _manifest_requested ? 1 : 0;
+  
+  // Copy Compression codec
+  buffer[flag_offset + 1] = static_cast<uint8_t>(_compression);
+  
+  // Copy Content cached flag
+  buffer[flag_offset + 2] = _cached ? 1 : 0;
+  
+  // Copy Sparse flag
+  buffer[flag_offset + 3] = _sparse ? 1 : 0;
+  
+  // Copy Stream key
+  std::copy(_stream_key.begin(), _stream_key.end(), buffer.begin() + flag_offset + 4);
+  
+  return buffer;
+}
+
+bool FileTransferResponseMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 1;  // Without ranges
+  
+  if (data.size() < MIN_HEADER_SIZE) {
+    LOG_ERROR("FileTransferResponseMessage: Buffer too small to deserialize");
+    return false;
   }
   
-  // Extract the message type from the first byte
+  // Verify message type
   MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_TRANSFER_RESPONSE) {
+    LOG_ERROR("FileTransferResponseMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
   
-  // We need at least the PeerId (32 bytes) plus the type byte
-  if (data.size() < 33) {
-    LOG_ERROR("MessageFactory: Buffer too small for PeerId");
-    return nullptr;
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Copy Accepted flag
+  _accepted = data[65] != 0;
+  
+  // Copy Missing ranges
+  if (!ReadRanges(data, 66, _missing_ranges)) {
+    LOG_ERROR("FileTransferResponseMessage: Buffer too small for missing ranges");
+    return false;
   }
   
-  // Extract the sender PeerId
-  PeerId sender;
-  std::copy(data.begin() + 1, data.begin() + 33, sender.begin());
+  // Copy Manifest requested flag
+  size_t flag_offset = 66 + RangesSize(_missing_ranges);
+  _manifest_requested = data.size() > flag_offset && data[flag_offset] != 0;
   
-  std::unique_ptr<Message> message;
+  // Copy Compression codec; older peers don't send it
+  _compression = data.size() > flag_offset + 1 ? static_cast<CompressionType>(data[flag_offset + 1])
+                                               : CompressionType::NONE;
   
-  switch (type) {
-    case MessageType::CHAT_MESSAGE: {
-      auto chat_msg = std::make_unique<ChatMessage>(sender);
-      if (chat_msg->Deserialize(data)) {
-        message = std::move(chat_msg);
-      }
-      break;
-    }
-    
-    case MessageType::FILE_TRANSFER_REQUEST: {
-      auto file_req_msg = std::make_unique<FileTransferRequestMessage>(sender);
-      if (file_req_msg->Deserialize(data)) {
-        message = std::move(file_req_msg);
-      }
-      break;
-    }
-    
-    case MessageType::CONNECTION_NOTIFICATION: {
-      auto conn_msg = std::make_unique<ConnectionMessage>(sender);
-      if (conn_msg->Deserialize(data)) {
-        message = std::move(conn_msg);
-      }
-      break;
-    }
-    
-    default:
-      LOG_ERROR("MessageFactory: Unsupported message type: ", static_cast<int>(type));
-      break;
+  // Copy Content cached flag; older peers don't send it
+  _cached = data.size() > flag_offset + 2 && data[flag_offset + 2] != 0;
+  
+  // Copy Sparse flag; older peers don't send it and take no holes
+  _sparse = data.size() > flag_offset + 3 && data[flag_offset + 3] != 0;
+  
+  // Copy Stream key; older peers don't send it
+  _stream_key.clear();
+  if (data.size() > flag_offset + 4) {
+    _stream_key.assign(data.begin() + flag_offset + 4, data.end());
   }
   
-  return message;
+  return true;
 }
 
-ConnectionMessage::ConnectionMessage(const PeerId& sender, ConnectionStatus status)
-    : Message(MessageType::CONNECTION_NOTIFICATION, sender), _status(status) {}
+// FileChunkMessage implementation
+FileChunkMessage::FileChunkMessage(const PeerId& sender, 
+                                   TransferId transfer_id,
+                                   uint32_t chunk_index,
+                                   const ByteBuffer& data,
+                                   CompressionType compression,
+                                   bool sealed,
+                                   uint32_t stream_index)
+    : Message(MessageType::FILE_CHUNK, sender),
+      _transfer_id(transfer_id),
+      _chunk_index(chunk_index),
+      _data(data),
+      _compression(compression),
+      _sealed(sealed),
+      _stream_index(stream_index) {}
 
-ConnectionMessage::ConnectionMessage(const PeerId& sender)
-    : Message(MessageType::CONNECTION_NOTIFICATION, sender), _status(ConnectionStatus::DISCONNECTED) {}
+FileChunkMessage::FileChunkMessage(const PeerId& sender)
+    : Message(MessageType::FILE_CHUNK, sender),
+      _transfer_id(0),
+      _chunk_index(0),
+      _compression(CompressionType::NONE),
+      _sealed(false),
+      _stream_index(0) {}
 
-ByteBuffer ConnectionMessage::Serialize() const {
+ByteBuffer FileChunkMessage::Serialize() const {
   // Header format:
   // - 1 byte: MessageType
   // - 32 bytes: PeerId
   // - 16 bytes: MessageId
   // - 8 bytes: Timestamp
-  // - 1 byte: Connection status
-  constexpr size_t BUFFER_SIZE = 1 + 32 + 16 + 8 + 1;
+  // - 8 bytes: Transfer ID
+  // - 4 bytes: Chunk index
+  // - 4 bytes: Data length
+  // - M bytes: Data
+  // - 1 byte: Compression codec of the data
+  // - 4 bytes: Stream index, only if the data is sealed
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4 + 4;
   
-  ByteBuffer buffer(BUFFER_SIZE);
+  // Allocate buffer with room for header, data, codec and stream index
+  ByteBuffer buffer(HEADER_SIZE + _data.size() + 1 + (_sealed ? 4 : 0));
   
   // Fill the header
   buffer[0] = static_cast<uint8_t>(_type);
@@ -287,34 +522,1442 @@ ByteBuffer ConnectionMessage::Serialize() const {
   // Copy MessageId
   std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
   
-  // Copy timestamp
+  // Copy Timestamp (network byte order)
   uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
   std::memcpy(buffer.data() + 49, &timestamp_network, 8);
   
-  // Copy connection status
-  buffer[57] = static_cast<uint8_t>(_status);
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy Chunk index (network byte order)
+  uint32_t chunk_index_network = htobe32(_chunk_index);
+  std::memcpy(buffer.data() + 65, &chunk_index_network, 4);
+  
+  // Copy Data length (network byte order)
+  uint32_t data_len_network = htobe32(static_cast<uint32_t>(_data.size()));
+  std::memcpy(buffer.data() + 69, &data_len_network, 4);
+  
+  // Copy Data
+  std::copy(_data.begin(), _data.end(), buffer.begin() + HEADER_SIZE);
+  
+  // Copy Compression codec
+  size_t codec_offset = HEADER_SIZE + _data.size();
+  buffer[codec_offset] = static_cast<uint8_t>(_compression);
+  
+  // Copy Stream index (network byte order)
+  if (_sealed) {
+    uint32_t stream_index_network = htobe32(_stream_index);
+    std::memcpy(buffer.data() + codec_offset + 1, &stream_index_network, 4);
+  }
   
   return buffer;
 }
 
-bool ConnectionMessage::Deserialize(const ByteBuffer& data) {
-  // Validate data size
-  constexpr size_t MIN_SIZE = 1 + 32 + 16 + 8 + 1;
-  if (data.size() < MIN_SIZE) {
-    LOG_ERROR("ConnectionMessage::Deserialize: Buffer too small");
+bool FileChunkMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4 + 4;
+  
+  if (data.size() < HEADER_SIZE) {
+    LOG_ERROR("FileChunkMessage: Buffer too small to deserialize");
     return false;
   }
   
-  // Extract timestamp
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_CHUNK) {
+    LOG_ERROR("FileChunkMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
   uint64_t timestamp_network;
   std::memcpy(&timestamp_network, data.data() + 49, 8);
   _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
   
-  // Extract message ID
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Copy Chunk index
+  uint32_t chunk_index_network;
+  std::memcpy(&chunk_index_network, data.data() + 65, 4);
+  _chunk_index = be32toh(chunk_index_network);
+  
+  // Get Data length
+  uint32_t data_len_network;
+  std::memcpy(&data_len_network, data.data() + 69, 4);
+  uint32_t data_len = be32toh(data_len_network);
+  
+  if (data.size() - HEADER_SIZE < data_len) {
+    LOG_ERROR("FileChunkMessage: Buffer too small for data");
+    return false;
+  }
+  
+  // Copy Data
+  _data.assign(data.begin() + HEADER_SIZE, data.begin() + HEADER_SIZE + data_len);
+  
+  // Copy Compression codec; older peers only send raw data
+  size_t codec_offset = HEADER_SIZE + data_len;
+  _compression = data.size() > codec_offset ? static_cast<CompressionType>(data[codec_offset])
+                                            : CompressionType::NONE;
+  
+  // Copy Stream index; only sealed chunks have one
+  _sealed = data.size() >= codec_offset + 1 + 4;
+  _stream_index = 0;
+  if (_sealed) {
+    uint32_t stream_index_network;
+    std::memcpy(&stream_index_network, data.data() + codec_offset + 1, 4);
+    _stream_index = be32toh(stream_index_network);
+  }
+  
+  return true;
+}
+
+// FileHolesMessage implementation
+FileHolesMessage::FileHolesMessage(const PeerId& sender,
+                                   TransferId transfer_id,
+                                   const std::vector<ChunkRange>& ranges)
+    : Message(MessageType::FILE_HOLES, sender),
+      _transfer_id(transfer_id),
+      _ranges(ranges) {}
+
+FileHolesMessage::FileHolesMessage(const PeerId& sender)
+    : Message(MessageType::FILE_HOLES, sender), _transfer_id(0) {}
+
+ByteBuffer FileHolesMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 4 bytes: Range count
+  // - R * 8 bytes: Ranges (4 bytes first chunk, 4 bytes chunk count)
+  constexpr size_t HEADER_SIZE_WITHOUT_RANGES = 1 + 32 + 16 + 8 + 8;
+  
+  ByteBuffer buffer(HEADER_SIZE_WITHOUT_RANGES + RangesSize(_ranges));
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy Ranges
+  WriteRanges(_ranges, buffer.data() + 65);
+  
+  return buffer;
+}
+
+bool FileHolesMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 8;  // Without ranges
+  
+  if (data.size() < MIN_HEADER_SIZE) {
+    LOG_ERROR("FileHolesMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_HOLES) {
+    LOG_ERROR("FileHolesMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
   std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
   
-  // Extract connection status
-  _status = static_cast<ConnectionStatus>(data[57]);
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Copy Ranges
+  if (!ReadRanges(data, 65, _ranges)) {
+    LOG_ERROR("FileHolesMessage: Buffer too small for ranges");
+    return false;
+  }
+  
+  return true;
+}
+
+// FileChunkHashesMessage implementation
+FileChunkHashesMessage::FileChunkHashesMessage(const PeerId& sender,
+                                               TransferId transfer_id,
+                                               uint32_t first_index,
+                                               const ByteBuffer& hashes)
+    : Message(MessageType::FILE_CHUNK_HASHES, sender),
+      _transfer_id(transfer_id),
+      _first_index(first_index),
+      _hashes(hashes) {}
+
+FileChunkHashesMessage::FileChunkHashesMessage(const PeerId& sender)
+    : Message(MessageType::FILE_CHUNK_HASHES, sender), _transfer_id(0), _first_index(0) {}
+
+ByteBuffer FileChunkHashesMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 4 bytes: First chunk index
+  // - 4 bytes: Hashes length
+  // - M bytes: Hashes
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4 + 4;
+  
+  ByteBuffer buffer(HEADER_SIZE + _hashes.size());
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy First chunk index (network byte order)
+  uint32_t first_index_network = htobe32(_first_index);
+  std::memcpy(buffer.data() + 65, &first_index_network, 4);
+  
+  // Copy Hashes length (network byte order)
+  uint32_t hashes_len_network = htobe32(static_cast<uint32_t>(_hashes.size()));
+  std::memcpy(buffer.data() + 69, &hashes_len_network, 4);
+  
+  // Copy Hashes
+  std::copy(_hashes.begin(), _hashes.end(), buffer.begin() + HEADER_SIZE);
+  
+  return buffer;
+}
+
+bool FileChunkHashesMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4 + 4;
+  
+  if (data.size() < HEADER_SIZE) {
+    LOG_ERROR("FileChunkHashesMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_CHUNK_HASHES) {
+    LOG_ERROR("FileChunkHashesMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Copy First chunk index
+  uint32_t first_index_network;
+  std::memcpy(&first_index_network, data.data() + 65, 4);
+  _first_index = be32toh(first_index_network);
+  
+  // Get Hashes length
+  uint32_t hashes_len_network;
+  std::memcpy(&hashes_len_network, data.data() + 69, 4);
+  uint32_t hashes_len = be32toh(hashes_len_network);
+  
+  if (data.size() - HEADER_SIZE < hashes_len) {
+    LOG_ERROR("FileChunkHashesMessage: Buffer too small for hashes");
+    return false;
+  }
+  
+  // Copy Hashes
+  _hashes.assign(data.begin() + HEADER_SIZE, data.begin() + HEADER_SIZE + hashes_len);
+  
+  return true;
+}
+
+// FileChunkRequestMessage implementation
+FileChunkRequestMessage::FileChunkRequestMessage(const PeerId& sender,
+                                                 TransferId transfer_id,
+                                                 const std::vector<ChunkRange>& ranges)
+    : Message(MessageType::FILE_CHUNK_REQUEST, sender),
+      _transfer_id(transfer_id),
+      _ranges(ranges) {}
+
+FileChunkRequestMessage::FileChunkRequestMessage(const PeerId& sender)
+    : Message(MessageType::FILE_CHUNK_REQUEST, sender), _transfer_id(0) {}
+
+ByteBuffer FileChunkRequestMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 4 bytes: Range count
+  // - R * 8 bytes: Ranges (4 bytes first chunk, 4 bytes chunk count)
+  constexpr size_t HEADER_SIZE_WITHOUT_RANGES = 1 + 32 + 16 + 8 + 8;
+  
+  ByteBuffer buffer(HEADER_SIZE_WITHOUT_RANGES + RangesSize(_ranges));
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy Ranges
+  WriteRanges(_ranges, buffer.data() + 65);
+  
+  return buffer;
+}
+
+bool FileChunkRequestMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 8;  // Without ranges
+  
+  if (data.size() < MIN_HEADER_SIZE) {
+    LOG_ERROR("FileChunkRequestMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_CHUNK_REQUEST) {
+    LOG_ERROR("FileChunkRequestMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Copy Ranges
+  if (!ReadRanges(data, 65, _ranges)) {
+    LOG_ERROR("FileChunkRequestMessage: Buffer too small for ranges");
+    return false;
+  }
+  
+  return true;
+}
+
+// FileDeltaManifestMessage implementation
+FileDeltaManifestMessage::FileDeltaManifestMessage(const PeerId& sender,
+                                                   TransferId transfer_id,
+                                                   uint32_t first_index,
+                                                   const std::vector<uint32_t>& chunk_lengths,
+                                                   const ByteBuffer& chunk_hashes)
+    : Message(MessageType::FILE_DELTA_MANIFEST, sender),
+      _transfer_id(transfer_id),
+      _first_index(first_index),
+      _chunk_lengths(chunk_lengths),
+      _chunk_hashes(chunk_hashes) {}
+
+FileDeltaManifestMessage::FileDeltaManifestMessage(const PeerId& sender)
+    : Message(MessageType::FILE_DELTA_MANIFEST, sender), _transfer_id(0), _first_index(0) {}
+
+ByteBuffer FileDeltaManifestMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 4 bytes: First entry index
+  // - 4 bytes: Entry count
+  // - E * 4 bytes: Chunk lengths
+  // - E * 32 bytes: Chunk hashes
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4 + 4;
+  constexpr size_t HASH_SIZE = 32;
+  
+  size_t entry_count = _chunk_lengths.size();
+  ByteBuffer buffer(HEADER_SIZE + entry_count * (4 + HASH_SIZE));
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy First entry index (network byte order)
+  uint32_t first_index_network = htobe32(_first_index);
+  std::memcpy(buffer.data() + 65, &first_index_network, 4);
+  
+  // Copy Entry count (network byte order)
+  uint32_t entry_count_network = htobe32(static_cast<uint32_t>(entry_count));
+  std::memcpy(buffer.data() + 69, &entry_count_network, 4);
+  size_t offset = HEADER_SIZE;
+  
+  // Copy Chunk lengths (network byte order)
+  for (uint32_t length : _chunk_lengths) {
+    uint32_t length_network = htobe32(length);
+    std::memcpy(buffer.data() + offset, &length_network, 4);
+    offset += 4;
+  }
+  
+  // Copy Chunk hashes, padding or truncating to one per length
+  size_t hashes_size = std::min(_chunk_hashes.size(), entry_count * HASH_SIZE);
+  std::copy(_chunk_hashes.begin(), _chunk_hashes.begin() + hashes_size, buffer.begin() + offset);
+  
+  return buffer;
+}
+
+bool FileDeltaManifestMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4 + 4;
+  constexpr size_t HASH_SIZE = 32;
+  
+  if (data.size() < HEADER_SIZE) {
+    LOG_ERROR("FileDeltaManifestMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_DELTA_MANIFEST) {
+    LOG_ERROR("FileDeltaManifestMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Copy First entry index
+  uint32_t first_index_network;
+  std::memcpy(&first_index_network, data.data() + 65, 4);
+  _first_index = be32toh(first_index_network);
+  
+  // Get Entry count
+  uint32_t entry_count_network;
+  std::memcpy(&entry_count_network, data.data() + 69, 4);
+  uint32_t entry_count = be32toh(entry_count_network);
+  size_t offset = HEADER_SIZE;
+  
+  if ((data.size() - offset) / (4 + HASH_SIZE) < entry_count) {
+    LOG_ERROR("FileDeltaManifestMessage: Buffer too small for entries");
+    return false;
+  }
+  
+  // Copy Chunk lengths
+  _chunk_lengths.resize(entry_count);
+  for (auto& length : _chunk_lengths) {
+    uint32_t length_network;
+    std::memcpy(&length_network, data.data() + offset, 4);
+    length = be32toh(length_network);
+    offset += 4;
+  }
+  
+  // Copy Chunk hashes
+  _chunk_hashes.assign(data.begin() + offset, data.begin() + offset + entry_count * HASH_SIZE);
+  
+  return true;
+}
+
+// FileSwarmQueryMessage implementation
+FileSwarmQueryMessage::FileSwarmQueryMessage(const PeerId& sender,
+                                             TransferId transfer_id,
+                                             const ByteBuffer& content_hash,
+                                             bool send_hashes,
+                                             uint32_t first_hash)
+    : Message(MessageType::FILE_SWARM_QUERY, sender),
+      _transfer_id(transfer_id),
+      _content_hash(content_hash),
+      _send_hashes(send_hashes),
+      _first_hash(first_hash) {}
+
+FileSwarmQueryMessage::FileSwarmQueryMessage(const PeerId& sender)
+    : Message(MessageType::FILE_SWARM_QUERY, sender),
+      _transfer_id(0),
+      _send_hashes(false),
+      _first_hash(0) {}
+
+ByteBuffer FileSwarmQueryMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 4 bytes: Content hash length
+  // - H bytes: Content hash
+  // - 1 byte: Send hashes flag
+  // - 4 bytes: Index of the first chunk hash to send
+  constexpr size_t HEADER_SIZE_WITHOUT_HASH = 1 + 32 + 16 + 8 + 8 + 4 + 1 + 4;
+  
+  ByteBuffer buffer(HEADER_SIZE_WITHOUT_HASH + _content_hash.size());
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy Content hash length (network byte order)
+  uint32_t hash_len_network = htobe32(static_cast<uint32_t>(_content_hash.size()));
+  std::memcpy(buffer.data() + 65, &hash_len_network, 4);
+  
+  // Copy Content hash
+  std::copy(_content_hash.begin(), _content_hash.end(), buffer.begin() + 69);
+  
+  // Copy Send hashes flag
+  buffer[69 + _content_hash.size()] = _send_hashes ? 1 : 0;
+  
+  // Copy First hash index (network byte order)
+  uint32_t first_hash_network = htobe32(_first_hash);
+  std::memcpy(buffer.data() + 70 + _content_hash.size(), &first_hash_network, 4);
+  
+  return buffer;
+}
+
+bool FileSwarmQueryMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4;  // Without content hash
+  
+  if (data.size() < MIN_HEADER_SIZE) {
+    LOG_ERROR("FileSwarmQueryMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_SWARM_QUERY) {
+    LOG_ERROR("FileSwarmQueryMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Get Content hash length
+  uint32_t hash_len_network;
+  std::memcpy(&hash_len_network, data.data() + 65, 4);
+  uint32_t hash_len = be32toh(hash_len_network);
+  
+  // + 1 for the send hashes flag, + 4 for the first hash index
+  if (data.size() - MIN_HEADER_SIZE < static_cast<size_t>(hash_len) + 1 + 4) {
+    LOG_ERROR("FileSwarmQueryMessage: Buffer too small for content hash");
+    return false;
+  }
+  
+  // Copy Content hash
+  _content_hash.assign(data.begin() + 69, data.begin() + 69 + hash_len);
+  
+  // Copy Send hashes flag
+  _send_hashes = data[69 + hash_len] != 0;
+  
+  // Copy First hash index
+  uint32_t first_hash_network;
+  std::memcpy(&first_hash_network, data.data() + 70 + hash_len, 4);
+  _first_hash = be32toh(first_hash_network);
+  
+  return true;
+}
+
+// FileSwarmHaveMessage implementation
+FileSwarmHaveMessage::FileSwarmHaveMessage(const PeerId& sender,
+                                           TransferId transfer_id,
+                                           const ByteBuffer& content_hash,
+                                           uint64_t file_size)
+    : Message(MessageType::FILE_SWARM_HAVE, sender),
+      _transfer_id(transfer_id),
+      _content_hash(content_hash),
+      _file_size(file_size) {}
+
+FileSwarmHaveMessage::FileSwarmHaveMessage(const PeerId& sender)
+    : Message(MessageType::FILE_SWARM_HAVE, sender), _transfer_id(0), _file_size(0) {}
+
+ByteBuffer FileSwarmHaveMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 4 bytes: Content hash length
+  // - H bytes: Content hash
+  // - 8 bytes: File size
+  constexpr size_t HEADER_SIZE_WITHOUT_HASH = 1 + 32 + 16 + 8 + 8 + 4 + 8;
+  
+  ByteBuffer buffer(HEADER_SIZE_WITHOUT_HASH + _content_hash.size());
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy Content hash length (network byte order)
+  uint32_t hash_len_network = htobe32(static_cast<uint32_t>(_content_hash.size()));
+  std::memcpy(buffer.data() + 65, &hash_len_network, 4);
+  
+  // Copy Content hash
+  std::copy(_content_hash.begin(), _content_hash.end(), buffer.begin() + 69);
+  
+  // Copy File size (network byte order)
+  uint64_t file_size_network = htobe64(_file_size);
+  std::memcpy(buffer.data() + 69 + _content_hash.size(), &file_size_network, 8);
+  
+  return buffer;
+}
+
+bool FileSwarmHaveMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 4;  // Without content hash
+  
+  if (data.size() < MIN_HEADER_SIZE) {
+    LOG_ERROR("FileSwarmHaveMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_SWARM_HAVE) {
+    LOG_ERROR("FileSwarmHaveMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Get Content hash length
+  uint32_t hash_len_network;
+  std::memcpy(&hash_len_network, data.data() + 65, 4);
+  uint32_t hash_len = be32toh(hash_len_network);
+  
+  if (data.size() - MIN_HEADER_SIZE < static_cast<size_t>(hash_len) + 8) {  // + 8 for file size
+    LOG_ERROR("FileSwarmHaveMessage: Buffer too small for content hash and size");
+    return false;
+  }
+  
+  // Copy Content hash
+  _content_hash.assign(data.begin() + 69, data.begin() + 69 + hash_len);
+  
+  // Copy File size
+  uint64_t file_size_network;
+  std::memcpy(&file_size_network, data.data() + 69 + hash_len, 8);
+  _file_size = be64toh(file_size_network);
+  
+  return true;
+}
+
+// FileDirectoryManifestMessage implementation
+FileDirectoryManifestMessage::FileDirectoryManifestMessage(const PeerId& sender,
+                                                           const std::string& directory_name,
+                                                           uint32_t first_index,
+                                                           const std::vector<DirectoryEntry>& entries,
+                                                           bool last)
+    : Message(MessageType::FILE_DIRECTORY_MANIFEST, sender),
+      _directory_name(directory_name),
+      _first_index(first_index),
+      _entries(entries),
+      _last(last) {}
+
+FileDirectoryManifestMessage::FileDirectoryManifestMessage(const PeerId& sender)
+    : Message(MessageType::FILE_DIRECTORY_MANIFEST, sender), _first_index(0), _last(false) {}
+
+ByteBuffer FileDirectoryManifestMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 4 bytes: Directory name length
+  // - N bytes: Directory name
+  // - 4 bytes: First entry index
+  // - 1 byte: Last batch flag
+  // - 4 bytes: Entry count
+  // - Per entry:
+  //   - 4 bytes: Path length
+  //   - P bytes: Path
+  //   - 8 bytes: Size
+  //   - 4 bytes: Mode
+  //   - 8 bytes: Modification time (nanoseconds since the epoch)
+  //   - 1 byte: Flags (bit 0: directory, bit 1: packed)
+  constexpr size_t HEADER_SIZE_WITHOUT_NAME = 1 + 32 + 16 + 8 + 4 + 4 + 1 + 4;
+  constexpr size_t ENTRY_SIZE_WITHOUT_PATH = 4 + 8 + 4 + 8 + 1;
+  
+  size_t entries_size = 0;
+  for (const auto& entry : _entries) {
+    entries_size += ENTRY_SIZE_WITHOUT_PATH + entry.path.size();
+  }
+  
+  ByteBuffer buffer(HEADER_SIZE_WITHOUT_NAME + _directory_name.size() + entries_size);
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Directory name length (network byte order)
+  uint32_t name_len_network = htobe32(static_cast<uint32_t>(_directory_name.size()));
+  std::memcpy(buffer.data() + 57, &name_len_network, 4);
+  
+  // Copy Directory name
+  std::copy(_directory_name.begin(), _directory_name.end(), buffer.begin() + 61);
+  
+  // Copy First entry index (network byte order)
+  size_t offset = 61 + _directory_name.size();
+  uint32_t first_index_network = htobe32(_first_index);
+  std::memcpy(buffer.data() + offset, &first_index_network, 4);
+  
+  // Copy Last batch flag
+  buffer[offset + 4] = _last ? 1 : 0;
+  
+  // Copy Entry count (network byte order)
+  uint32_t entry_count_network = htobe32(static_cast<uint32_t>(_entries.size()));
+  std::memcpy(buffer.data() + offset + 5, &entry_count_network, 4);
+  offset += 9;
+  
+  // Copy Entries (network byte order)
+  for (const auto& entry : _entries) {
+    uint32_t path_len_network = htobe32(static_cast<uint32_t>(entry.path.size()));
+    std::memcpy(buffer.data() + offset, &path_len_network, 4);
+    std::copy(entry.path.begin(), entry.path.end(), buffer.begin() + offset + 4);
+    offset += 4 + entry.path.size();
+    
+    uint64_t size_network = htobe64(entry.size);
+    uint32_t mode_network = htobe32(entry.mode);
+    uint64_t mtime_network = htobe64(static_cast<uint64_t>(entry.mtime_ns));
+    std::memcpy(buffer.data() + offset, &size_network, 8);
+    std::memcpy(buffer.data() + offset + 8, &mode_network, 4);
+    std::memcpy(buffer.data() + offset + 12, &mtime_network, 8);
+    buffer[offset + 20] = (entry.is_directory ? 1 : 0) | (entry.packed ? 2 : 0);
+    offset += 21;
+  }
+  
+  return buffer;
+}
+
+bool FileDirectoryManifestMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 4;  // Without directory name
+  constexpr size_t ENTRY_SIZE_WITHOUT_PATH = 4 + 8 + 4 + 8 + 1;
+  
+  if (data.size() < MIN_HEADER_SIZE) {
+    LOG_ERROR("FileDirectoryManifestMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_DIRECTORY_MANIFEST) {
+    LOG_ERROR("FileDirectoryManifestMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Get Directory name length
+  uint32_t name_len_network;
+  std::memcpy(&name_len_network, data.data() + 57, 4);
+  uint32_t name_len = be32toh(name_len_network);
+  
+  if (data.size() < MIN_HEADER_SIZE + name_len + 9) {  // + 9 for index, flag and entry count
+    LOG_ERROR("FileDirectoryManifestMessage: Buffer too small for directory name and index");
+    return false;
+  }
+  
+  // Copy Directory name
+  _directory_name.assign(data.begin() + 61, data.begin() + 61 + name_len);
+  
+  // Copy First entry index
+  size_t offset = 61 + name_len;
+  uint32_t first_index_network;
+  std::memcpy(&first_index_network, data.data() + offset, 4);
+  _first_index = be32toh(first_index_network);
+  
+  // Copy Last batch flag
+  _last = data[offset + 4] != 0;
+  
+  // Get Entry count
+  uint32_t entry_count_network;
+  std::memcpy(&entry_count_network, data.data() + offset + 5, 4);
+  uint32_t entry_count = be32toh(entry_count_network);
+  offset += 9;
+  
+  if ((data.size() - offset) / ENTRY_SIZE_WITHOUT_PATH < entry_count) {
+    LOG_ERROR("FileDirectoryManifestMessage: Buffer too small for entries");
+    return false;
+  }
+  
+  // Copy Entries
+  _entries.resize(entry_count);
+  for (auto& entry : _entries) {
+    if (data.size() - offset < ENTRY_SIZE_WITHOUT_PATH) {
+      LOG_ERROR("FileDirectoryManifestMessage: Buffer too small for entry");
+      return false;
+    }
+    
+    uint32_t path_len_network;
+    std::memcpy(&path_len_network, data.data() + offset, 4);
+    uint32_t path_len = be32toh(path_len_network);
+    offset += 4;
+    
+    if (data.size() - offset < path_len + ENTRY_SIZE_WITHOUT_PATH - 4) {
+      LOG_ERROR("FileDirectoryManifestMessage: Buffer too small for entry path");
+      return false;
+    }
+    
+    entry.path.assign(data.begin() + offset, data.begin() + offset + path_len);
+    offset += path_len;
+    
+    uint64_t size_network;
+    uint32_t mode_network;
+    uint64_t mtime_network;
+    std::memcpy(&size_network, data.data() + offset, 8);
+    std::memcpy(&mode_network, data.data() + offset + 8, 4);
+    std::memcpy(&mtime_network, data.data() + offset + 12, 8);
+    entry.size = be64toh(size_network);
+    entry.mode = be32toh(mode_network);
+    entry.mtime_ns = static_cast<int64_t>(be64toh(mtime_network));
+    entry.is_directory = (data[offset + 20] & 1) != 0;
+    entry.packed = (data[offset + 20] & 2) != 0;
+    offset += 21;
+  }
+  
+  return true;
+}
+
+// FileTransferCompleteMessage implementation
+FileTransferCompleteMessage::FileTransferCompleteMessage(const PeerId& sender, 
+                                                         TransferId transfer_id,
+                                                         bool success,
+                                                         const std::string& error_message)
+    : Message(MessageType::FILE_TRANSFER_COMPLETE, sender),
+      _transfer_id(transfer_id),
+      _success(success),
+      _error_message(error_message) {}
+
+FileTransferCompleteMessage::FileTransferCompleteMessage(const PeerId& sender)
+    : Message(MessageType::FILE_TRANSFER_COMPLETE, sender), _transfer_id(0), _success(false) {}
+
+ByteBuffer FileTransferCompleteMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 8 bytes: Transfer ID
+  // - 1 byte: Success flag
+  // - 4 bytes: Error message length
+  // - M bytes: Error message
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 1 + 4;
+  
+  // Allocate buffer with room for header and error message
+  ByteBuffer buffer(HEADER_SIZE + _error_message.size());
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy Timestamp (network byte order)
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy Transfer ID (network byte order)
+  uint64_t transfer_id_network = htobe64(_transfer_id);
+  std::memcpy(buffer.data() + 57, &transfer_id_network, 8);
+  
+  // Copy Success flag
+  buffer[65] = _success ? 1 : 0;
+  
+  // Copy Error message length (network byte order)
+  uint32_t error_len_network = htobe32(static_cast<uint32_t>(_error_message.size()));
+  std::memcpy(buffer.data() + 66, &error_len_network, 4);
+  
+  // Copy Error message
+  std::copy(_error_message.begin(), _error_message.end(), buffer.begin() + HEADER_SIZE);
+  
+  return buffer;
+}
+
+bool FileTransferCompleteMessage::Deserialize(const ByteBuffer& data) {
+  constexpr size_t HEADER_SIZE = 1 + 32 + 16 + 8 + 8 + 1 + 4;
+  
+  if (data.size() < HEADER_SIZE) {
+    LOG_ERROR("FileTransferCompleteMessage: Buffer too small to deserialize");
+    return false;
+  }
+  
+  // Verify message type
+  MessageType type = static_cast<MessageType>(data[0]);
+  if (type != MessageType::FILE_TRANSFER_COMPLETE) {
+    LOG_ERROR("FileTransferCompleteMessage: Incorrect message type: ", static_cast<int>(type));
+    return false;
+  }
+  
+  // Copy PeerId
+  std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
+  
+  // Copy MessageId
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Copy Timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Copy Transfer ID
+  uint64_t transfer_id_network;
+  std::memcpy(&transfer_id_network, data.data() + 57, 8);
+  _transfer_id = be64toh(transfer_id_network);
+  
+  // Copy Success flag
+  _success = data[65] != 0;
+  
+  // Get Error message length
+  uint32_t error_len_network;
+  std::memcpy(&error_len_network, data.data() + 66, 4);
+  uint32_t error_len = be32toh(error_len_network);
+  
+  if (data.size() - HEADER_SIZE < error_len) {
+    LOG_ERROR("FileTransferCompleteMessage: Buffer too small for error message");
+    return false;
+  }
+  
+  // Copy Error message
+  _error_message.assign(data.begin() + HEADER_SIZE, data.begin() + HEADER_SIZE + error_len);
+  
+  return true;
+}
+
+// MessageFactory implementation
+std::unique_ptr<Message> MessageFactory::CreateFromBuffer(const ByteBuffer& data) {
+  if (data.empty()) {
+    LOG_ERROR("MessageFactory: Empty buffer");
+    return nullptr;
+  }
+  
+  // Extract the message type from the first byte
+  MessageType type = static_cast<MessageType>(data[0]);
+  
+  // We need at least the PeerId (32 bytes) plus the type byte
+  if (data.size() < 33) {
+    LOG_ERROR("MessageFactory: Buffer too small for PeerId");
+    return nullptr;
+  }
+  
+  // Extract the sender PeerId
+  PeerId sender;
+  std::copy(data.begin() + 1, data.begin() + 33, sender.begin());
+  
+  std::unique_ptr<Message> message;
+  
+  switch (type) {
+    case MessageType::CHAT_MESSAGE: {
+      auto chat_msg = std::make_unique<ChatMessage>(sender);
+      if (chat_msg->Deserialize(data)) {
+        message = std::move(chat_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_TRANSFER_REQUEST: {
+      auto file_req_msg = std::make_unique<FileTransferRequestMessage>(sender);
+      if (file_req_msg->Deserialize(data)) {
+        message = std::move(file_req_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_TRANSFER_RESPONSE: {
+      auto file_resp_msg = std::make_unique<FileTransferResponseMessage>(sender);
+      if (file_resp_msg->Deserialize(data)) {
+        message = std::move(file_resp_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_CHUNK: {
+      auto chunk_msg = std::make_unique<FileChunkMessage>(sender);
+      if (chunk_msg->Deserialize(data)) {
+        message = std::move(chunk_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_HOLES: {
+      auto holes_msg = std::make_unique<FileHolesMessage>(sender);
+      if (holes_msg->Deserialize(data)) {
+        message = std::move(holes_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_CHUNK_HASHES: {
+      auto hashes_msg = std::make_unique<FileChunkHashesMessage>(sender);
+      if (hashes_msg->Deserialize(data)) {
+        message = std::move(hashes_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_CHUNK_REQUEST: {
+      auto chunk_req_msg = std::make_unique<FileChunkRequestMessage>(sender);
+      if (chunk_req_msg->Deserialize(data)) {
+        message = std::move(chunk_req_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_DELTA_MANIFEST: {
+      auto manifest_msg = std::make_unique<FileDeltaManifestMessage>(sender);
+      if (manifest_msg->Deserialize(data)) {
+        message = std::move(manifest_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_SWARM_QUERY: {
+      auto query_msg = std::make_unique<FileSwarmQueryMessage>(sender);
+      if (query_msg->Deserialize(data)) {
+        message = std::move(query_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_SWARM_HAVE: {
+      auto have_msg = std::make_unique<FileSwarmHaveMessage>(sender);
+      if (have_msg->Deserialize(data)) {
+        message = std::move(have_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_DIRECTORY_MANIFEST: {
+      auto directory_msg = std::make_unique<FileDirectoryManifestMessage>(sender);
+      if (directory_msg->Deserialize(data)) {
+        message = std::move(directory_msg);
+      }
+      break;
+    }
+    
+    case MessageType::FILE_TRANSFER_COMPLETE: {
+      auto complete_msg = std::make_unique<FileTransferCompleteMessage>(sender);
+      if (complete_msg->Deserialize(data)) {
+        message = std::move(complete_msg);
+      }
+      break;
+    }
+    
+    case MessageType::DATA_CONNECTION: {
+      auto data_conn_msg = std::make_unique<DataConnectionMessage>(sender);
+      if (data_conn_msg->Deserialize(data)) {
+        message = std::move(data_conn_msg);
+      }
+      break;
+    }
+    
+    case MessageType::SESSION_TICKET: {
+      auto ticket_msg = std::make_unique<SessionTicketMessage>(sender);
+      if (ticket_msg->Deserialize(data)) {
+        message = std::move(ticket_msg);
+      }
+      break;
+    }
+    
+    case MessageType::CONNECTION_NOTIFICATION: {
+      auto conn_msg = std::make_unique<ConnectionMessage>(sender);
+      if (conn_msg->Deserialize(data)) {
+        message = std::move(conn_msg);
+      }
+      break;
+    }
+    
+    default:
+      LOG_ERROR("MessageFactory: Unsupported message type: ", static_cast<int>(type));
+      break;
+  }
+  
+  return message;
+}
+
+ConnectionMessage::ConnectionMessage(const PeerId& sender, ConnectionStatus status)
+    : Message(MessageType::CONNECTION_NOTIFICATION, sender), _status(status) {}
+
+ConnectionMessage::ConnectionMessage(const PeerId& sender)
+    : Message(MessageType::CONNECTION_NOTIFICATION, sender), _status(ConnectionStatus::DISCONNECTED) {}
+
+void ConnectionMessage::SetKeyExchange(const ByteBuffer& public_key, uint8_t cipher_suites) {
+  _public_key = public_key;
+  _cipher_suites = cipher_suites;
+}
+
+void ConnectionMessage::SetResumption(const ByteBuffer& salt, const ByteBuffer& ticket) {
+  _resumption_salt = salt;
+  _ticket = ticket;
+}
+
+ByteBuffer ConnectionMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 1 byte: Connection status
+  // - 1 byte: Cipher suites (optional)
+  // - 32 bytes: X25519 public key, zero if there is none (optional)
+  // - 32 bytes: Resumption salt (optional)
+  // - T bytes: Session ticket (optional)
+  constexpr size_t BUFFER_SIZE = 1 + 32 + 16 + 8 + 1;
+  constexpr size_t KEY_EXCHANGE_SIZE = 1 + PUBLIC_KEY_SIZE;
+  
+  size_t size = BUFFER_SIZE;
+  if (HasResumption()) {
+    size += KEY_EXCHANGE_SIZE + RESUMPTION_SALT_SIZE + _ticket.size();
+  } else if (HasKeyExchange()) {
+    size += KEY_EXCHANGE_SIZE;
+  }
+  ByteBuffer buffer(size);
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy timestamp
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy connection status
+  buffer[57] = static_cast<uint8_t>(_status);
+  
+  // Copy key exchange
+  if (HasKeyExchange() || HasResumption()) {
+    buffer[58] = _cipher_suites;
+    if (HasKeyExchange()) {
+      std::copy(_public_key.begin(), _public_key.end(), buffer.begin() + 59);
+    }
+  }
+  
+  // Copy resumption salt and ticket
+  if (HasResumption()) {
+    size_t offset = BUFFER_SIZE + KEY_EXCHANGE_SIZE;
+    std::copy(_resumption_salt.begin(), _resumption_salt.end(), buffer.begin() + offset);
+    std::copy(_ticket.begin(), _ticket.end(), buffer.begin() + offset + RESUMPTION_SALT_SIZE);
+  }
+  
+  return buffer;
+}
+
+bool ConnectionMessage::Deserialize(const ByteBuffer& data) {
+  // Validate data size
+  constexpr size_t MIN_SIZE = 1 + 32 + 16 + 8 + 1;
+  if (data.size() < MIN_SIZE) {
+    LOG_ERROR("ConnectionMessage::Deserialize: Buffer too small");
+    return false;
+  }
+  
+  // Extract timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Extract message ID
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Extract connection status
+  _status = static_cast<ConnectionStatus>(data[57]);
+  
+  // Extract key exchange; older peers don't send one, and a resuming
+  // answer leaves the public key zero
+  constexpr size_t KEY_EXCHANGE_SIZE = 1 + PUBLIC_KEY_SIZE;
+  if (data.size() >= MIN_SIZE + KEY_EXCHANGE_SIZE) {
+    _cipher_suites = data[58];
+    auto key_begin = data.begin() + 59;
+    auto key_end = key_begin + PUBLIC_KEY_SIZE;
+    if (std::any_of(key_begin, key_end, [](uint8_t byte) { return byte != 0; })) {
+      _public_key.assign(key_begin, key_end);
+    }
+  }
+  
+  // Extract resumption salt and ticket
+  size_t offset = MIN_SIZE + KEY_EXCHANGE_SIZE;
+  if (data.size() >= offset + RESUMPTION_SALT_SIZE) {
+    _resumption_salt.assign(data.begin() + offset, data.begin() + offset + RESUMPTION_SALT_SIZE);
+    _ticket.assign(data.begin() + offset + RESUMPTION_SALT_SIZE, data.end());
+  }
+  
+  return true;
+}
+
+SessionTicketMessage::SessionTicketMessage(const PeerId& sender, const ByteBuffer& ticket)
+    : Message(MessageType::SESSION_TICKET, sender), _ticket(ticket) {}
+
+SessionTicketMessage::SessionTicketMessage(const PeerId& sender)
+    : Message(MessageType::SESSION_TICKET, sender) {}
+
+ByteBuffer SessionTicketMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - T bytes: Session ticket
+  constexpr size_t BUFFER_SIZE = 1 + 32 + 16 + 8;
+  
+  ByteBuffer buffer(BUFFER_SIZE + _ticket.size());
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy timestamp
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy ticket
+  std::copy(_ticket.begin(), _ticket.end(), buffer.begin() + BUFFER_SIZE);
+  
+  return buffer;
+}
+
+bool SessionTicketMessage::Deserialize(const ByteBuffer& data) {
+  // Validate data size
+  constexpr size_t MIN_SIZE = 1 + 32 + 16 + 8;
+  if (data.size() < MIN_SIZE) {
+    LOG_ERROR("SessionTicketMessage::Deserialize: Buffer too small");
+    return false;
+  }
+  
+  // Extract timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Extract message ID
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Extract ticket
+  _ticket.assign(data.begin() + MIN_SIZE, data.end());
+  
+  return true;
+}
+
+DataConnectionMessage::DataConnectionMessage(const PeerId& sender, const ByteBuffer& token,
+                                             const ByteBuffer& salt)
+    : Message(MessageType::DATA_CONNECTION, sender), _token(token), _salt(salt) {}
+
+DataConnectionMessage::DataConnectionMessage(const PeerId& sender)
+    : Message(MessageType::DATA_CONNECTION, sender) {}
+
+ByteBuffer DataConnectionMessage::Serialize() const {
+  // Header format:
+  // - 1 byte: MessageType
+  // - 32 bytes: PeerId
+  // - 16 bytes: MessageId
+  // - 8 bytes: Timestamp
+  // - 32 bytes: Token
+  // - S bytes: Key derivation salt (optional)
+  constexpr size_t BUFFER_SIZE = 1 + 32 + 16 + 8 + TOKEN_SIZE;
+  
+  ByteBuffer buffer(BUFFER_SIZE + _salt.size());
+  
+  // Fill the header
+  buffer[0] = static_cast<uint8_t>(_type);
+  
+  // Copy PeerId
+  std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+  
+  // Copy MessageId
+  std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+  
+  // Copy timestamp
+  uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
+  std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+  
+  // Copy token, zero-padded to its fixed size
+  std::copy_n(_token.begin(), std::min(_token.size(), TOKEN_SIZE), buffer.begin() + 57);
+  
+  // Copy salt
+  std::copy(_salt.begin(), _salt.end(), buffer.begin() + BUFFER_SIZE);
+  
+  return buffer;
+}
+
+bool DataConnectionMessage::Deserialize(const ByteBuffer& data) {
+  // Validate data size
+  constexpr size_t MIN_SIZE = 1 + 32 + 16 + 8 + TOKEN_SIZE;
+  if (data.size() < MIN_SIZE) {
+    LOG_ERROR("DataConnectionMessage::Deserialize: Buffer too small");
+    return false;
+  }
+  
+  // Extract timestamp
+  uint64_t timestamp_network;
+  std::memcpy(&timestamp_network, data.data() + 49, 8);
+  _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
+  
+  // Extract message ID
+  std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
+  
+  // Extract token
+  _token.assign(data.begin() + 57, data.begin() + 57 + TOKEN_SIZE);
+  
+  // Extract salt
+  _salt.assign(data.begin() + MIN_SIZE, data.end());
   
   return true;
 }
@@ -0,0 +1,47 @@
+#include "linknet/worker_pool.h"
+#include <algorithm>
+
+namespace linknet {
+
+WorkerPool::WorkerPool(unsigned int threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  
+  for (unsigned int i = 0; i < threads; ++i) {
+    _threads.emplace_back(&WorkerPool::ThreadFunc, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+    _jobs.clear();
+  }
+  _cv.notify_all();
+  
+  for (auto& thread : _threads) {
+    thread.join();
+  }
+}
+
+void WorkerPool::ThreadFunc() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+      if (_stopping) {
+        return;
+      }
+      
+      job = std::move(_jobs.front());
+      _jobs.pop_front();
+    }
+    
+    job();
+  }
+}
+
+}  // namespace linknet
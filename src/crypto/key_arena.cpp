@@ -0,0 +1,77 @@
+#include "linknet/key_arena.h"
+#include "linknet/logger.h"
+#include <sodium.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace linknet {
+namespace crypto {
+
+KeyArena::KeyArena(size_t capacity)
+    : _capacity(std::max<size_t>(1, capacity)), _slots(nullptr) {
+  // sodium_malloc() needs the page size sodium_init() finds
+  if (sodium_init() < 0) {
+    LOG_FATAL("Failed to initialize sodium library");
+    throw std::runtime_error("Failed to initialize sodium library");
+  }
+  
+  // sodium_malloc() also locks the pages
+  _slots = static_cast<Key*>(sodium_allocarray(_capacity, sizeof(Key)));
+  if (!_slots) {
+    throw std::runtime_error("Failed to allocate key arena");
+  }
+  sodium_memzero(_slots, _capacity * sizeof(Key));
+  
+  // Hand out the lowest slots first
+  _free.resize(_capacity);
+  for (size_t i = 0; i < _capacity; ++i) {
+    _free[i] = static_cast<uint32_t>(_capacity - 1 - i);
+  }
+}
+
+KeyArena::~KeyArena() {
+  // sodium_free() wipes the whole block
+  sodium_free(_slots);
+}
+
+Key* KeyArena::Allocate() {
+  if (_free.empty()) {
+    return nullptr;
+  }
+  Key* key = _slots + _free.back();
+  _free.pop_back();
+  return key;
+}
+
+void KeyArena::Free(Key* key) {
+  if (!key) {
+    return;
+  }
+  sodium_memzero(key->data(), key->size());
+  _free.push_back(static_cast<uint32_t>(key - _slots));
+}
+
+Key* KeyStore::Allocate() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto& arena : _arenas) {
+    Key* key = arena->Allocate();
+    if (key) {
+      return key;
+    }
+  }
+  _arenas.push_back(std::make_unique<KeyArena>(ARENA_CAPACITY));
+  return _arenas.back()->Allocate();
+}
+
+void KeyStore::Free(Key* key) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto& arena : _arenas) {
+    if (arena->Contains(key)) {
+      arena->Free(key);
+      return;
+    }
+  }
+}
+
+}  // namespace crypto
+}  // namespace linknet
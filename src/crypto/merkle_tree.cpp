@@ -0,0 +1,152 @@
+#include "linknet/merkle_tree.h"
+#include "linknet/logger.h"
+#include <sodium.h>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+
+namespace linknet {
+namespace crypto {
+
+namespace {
+
+// Domain separation so a leaf can never be passed off as an inner node
+constexpr uint8_t LEAF_PREFIX = 0x00;
+constexpr uint8_t NODE_PREFIX = 0x01;
+
+// Chunks read per I/O call while hashing a file
+constexpr size_t CHUNKS_PER_READ = 64;
+
+void EnsureSodiumInitialized() {
+  static const bool initialized = sodium_init() >= 0;
+  if (!initialized) {
+    LOG_FATAL("Failed to initialize sodium library");
+    throw std::runtime_error("Failed to initialize sodium library");
+  }
+}
+
+Digest HashNode(const Digest& left, const Digest& right) {
+  Digest digest;
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, nullptr, 0, digest.size());
+  crypto_generichash_update(&state, &NODE_PREFIX, 1);
+  crypto_generichash_update(&state, left.data(), left.size());
+  crypto_generichash_update(&state, right.data(), right.size());
+  crypto_generichash_final(&state, digest.data(), digest.size());
+  return digest;
+}
+
+}  // namespace
+
+MerkleTree::MerkleTree(std::vector<Digest> leaves)
+    : _leaves(std::move(leaves)), _root(ComputeRoot(_leaves)) {}
+
+Digest MerkleTree::HashLeaf(const uint8_t* data, size_t size) {
+  EnsureSodiumInitialized();
+  
+  Digest digest;
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, nullptr, 0, digest.size());
+  crypto_generichash_update(&state, &LEAF_PREFIX, 1);
+  crypto_generichash_update(&state, data, size);
+  crypto_generichash_final(&state, digest.data(), digest.size());
+  return digest;
+}
+
+Digest MerkleTree::ComputeRoot(const std::vector<Digest>& leaves) {
+  if (leaves.empty()) {
+    return HashLeaf(nullptr, 0);
+  }
+  
+  // Combine pairwise level by level; an odd node is promoted unchanged
+  std::vector<Digest> level = leaves;
+  while (level.size() > 1) {
+    size_t parents = (level.size() + 1) / 2;
+    for (size_t i = 0; i < parents; ++i) {
+      if (2 * i + 1 < level.size()) {
+        level[i] = HashNode(level[2 * i], level[2 * i + 1]);
+      } else {
+        level[i] = level[2 * i];
+      }
+    }
+    level.resize(parents);
+  }
+  
+  return level.front();
+}
+
+bool MerkleTree::BuildFromFile(const std::string& path, size_t chunk_size,
+                               MerkleTree& tree, unsigned int threads) {
+  EnsureSodiumInitialized();
+  
+  std::ifstream probe(path, std::ios::binary | std::ios::ate);
+  if (!probe || chunk_size == 0) {
+    LOG_ERROR("Failed to open file for hashing: ", path);
+    return false;
+  }
+  uint64_t file_size = static_cast<uint64_t>(probe.tellg());
+  probe.close();
+  
+  uint64_t chunk_count = (file_size + chunk_size - 1) / chunk_size;
+  std::vector<Digest> leaves(chunk_count);
+  
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = static_cast<unsigned int>(
+      std::max<uint64_t>(1, std::min<uint64_t>(threads, chunk_count / CHUNKS_PER_READ)));
+  
+  // Each worker hashes a contiguous run of chunks through its own stream
+  std::atomic<bool> failed(false);
+  auto worker = [&](uint64_t first_chunk, uint64_t last_chunk) {
+    std::ifstream in(path, std::ios::binary);
+    ByteBuffer buffer(chunk_size * CHUNKS_PER_READ);
+    in.seekg(static_cast<std::streamoff>(first_chunk * chunk_size));
+    
+    for (uint64_t chunk = first_chunk; chunk < last_chunk && !failed;) {
+      uint64_t batch = std::min<uint64_t>(CHUNKS_PER_READ, last_chunk - chunk);
+      uint64_t offset = chunk * chunk_size;
+      uint64_t want = std::min<uint64_t>(batch * chunk_size, file_size - offset);
+      
+      in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(want));
+      if (!in || static_cast<uint64_t>(in.gcount()) != want) {
+        failed = true;
+        break;
+      }
+      
+      for (uint64_t i = 0; i < batch; ++i) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(chunk_size, want - i * chunk_size));
+        leaves[chunk + i] = HashLeaf(buffer.data() + i * chunk_size, length);
+      }
+      chunk += batch;
+    }
+  };
+  
+  std::vector<std::thread> workers;
+  uint64_t per_thread = (chunk_count + threads - 1) / threads;
+  for (unsigned int t = 1; t < threads; ++t) {
+    uint64_t first = t * per_thread;
+    if (first >= chunk_count) {
+      break;
+    }
+    workers.emplace_back(worker, first, std::min(chunk_count, first + per_thread));
+  }
+  worker(0, std::min(chunk_count, per_thread));
+  
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  
+  if (failed) {
+    LOG_ERROR("Failed to read file for hashing: ", path);
+    return false;
+  }
+  
+  tree = MerkleTree(std::move(leaves));
+  return true;
+}
+
+}  // namespace crypto
+}  // namespace linknet
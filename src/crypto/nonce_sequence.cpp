@@ -0,0 +1,102 @@
+#include "linknet/nonce_sequence.h"
+#include <sodium.h>
+#include <algorithm>
+#include <limits>
+
+namespace linknet {
+namespace crypto {
+
+namespace {
+
+// The counter follows the prefix, little-endian
+void WriteCounter(uint64_t counter, uint8_t* out) {
+  for (size_t i = 0; i < sizeof(counter); ++i) {
+    out[i] = static_cast<uint8_t>(counter >> (8 * i));
+  }
+}
+
+uint64_t ReadCounter(const uint8_t* in) {
+  uint64_t counter = 0;
+  for (size_t i = 0; i < sizeof(counter); ++i) {
+    counter |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return counter;
+}
+
+}  // namespace
+
+NonceSequence::NonceSequence(uint64_t start) : _next(start) {
+  randombytes_buf(_prefix.data(), _prefix.size());
+}
+
+bool NonceSequence::Next(Nonce& nonce) {
+  if (_exhausted) {
+    return false;
+  }
+  
+  std::copy(_prefix.begin(), _prefix.end(), nonce.begin());
+  WriteCounter(_next, nonce.data() + PREFIX_SIZE);
+  ++_count;
+  if (_next == std::numeric_limits<uint64_t>::max()) {
+    _exhausted = true;
+  } else {
+    ++_next;
+  }
+  return true;
+}
+
+void NonceSequence::Reset() {
+  randombytes_buf(_prefix.data(), _prefix.size());
+  _next = 0;
+  _count = 0;
+  _exhausted = false;
+}
+
+bool ReplayWindow::Check(const Nonce& nonce) const {
+  if (!_started) {
+    return true;
+  }
+  if (!std::equal(_prefix.begin(), _prefix.end(), nonce.begin())) {
+    return false;
+  }
+  
+  uint64_t counter = ReadCounter(nonce.data() + NonceSequence::PREFIX_SIZE);
+  if (counter > _newest) {
+    return true;
+  }
+  uint64_t behind = _newest - counter;
+  return behind < WINDOW_SIZE && !_seen[behind];
+}
+
+bool ReplayWindow::Accept(const Nonce& nonce) {
+  if (!Check(nonce)) {
+    return false;
+  }
+  
+  uint64_t counter = ReadCounter(nonce.data() + NonceSequence::PREFIX_SIZE);
+  if (!_started) {
+    std::copy(nonce.begin(), nonce.begin() + NonceSequence::PREFIX_SIZE, _prefix.begin());
+    _started = true;
+    _newest = counter;
+    _seen.reset();
+  } else if (counter > _newest) {
+    uint64_t ahead = counter - _newest;
+    if (ahead < WINDOW_SIZE) {
+      _seen <<= ahead;
+    } else {
+      _seen.reset();
+    }
+    _newest = counter;
+  }
+  _seen.set(_newest - counter);
+  return true;
+}
+
+void ReplayWindow::Reset() {
+  _started = false;
+  _newest = 0;
+  _seen.reset();
+}
+
+}  // namespace crypto
+}  // namespace linknet
@@ -0,0 +1,153 @@
+#include "linknet/session_tickets.h"
+#include <sodium.h>
+#include <algorithm>
+
+namespace linknet {
+namespace crypto {
+
+namespace {
+
+// Ticket layout: the generation of the key that sealed it, the nonce, then
+// the sealed issue time, peer ID, suite and secret
+constexpr size_t GENERATION_SIZE = 4;
+constexpr size_t NONCE_OFFSET = GENERATION_SIZE;
+constexpr size_t SEALED_OFFSET = NONCE_OFFSET + NONCE_SIZE;
+constexpr size_t PLAINTEXT_SIZE = 8 + sizeof(PeerId) + 1 + KEY_SIZE;
+
+void WriteInteger(uint64_t value, size_t size, uint8_t* out) {
+  for (size_t i = 0; i < size; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+uint64_t ReadInteger(const uint8_t* in, size_t size) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; ++i) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+}  // namespace
+
+SessionTicketKeys::SessionTicketKeys(const CryptoProvider& crypto, std::chrono::seconds rotation)
+    : _crypto(crypto), _rotation(std::max(rotation, std::chrono::seconds(1))) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  RotateLocked(Clock::now());
+}
+
+SessionTicketKeys::~SessionTicketKeys() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  Wipe(_current);
+  Wipe(_previous);
+}
+
+ByteBuffer SessionTicketKeys::Issue(const SessionTicket& ticket) {
+  std::array<uint8_t, PLAINTEXT_SIZE> plaintext;
+  ByteBuffer data(TICKET_SIZE);
+  
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto now = Clock::now();
+  RotateIfDueLocked(now);
+  
+  Nonce nonce;
+  if (!_current->nonces.Next(nonce)) {
+    RotateLocked(now);
+    _current->nonces.Next(nonce);
+  }
+  
+  uint64_t issued = std::chrono::duration_cast<std::chrono::milliseconds>(
+      now.time_since_epoch()).count();
+  WriteInteger(issued, 8, plaintext.data());
+  std::copy(ticket.peer_id.begin(), ticket.peer_id.end(), plaintext.begin() + 8);
+  plaintext[8 + sizeof(PeerId)] = static_cast<uint8_t>(ticket.suite);
+  std::copy(ticket.secret.begin(), ticket.secret.end(),
+            plaintext.begin() + 8 + sizeof(PeerId) + 1);
+  
+  WriteInteger(_current->generation, GENERATION_SIZE, data.data());
+  std::copy(nonce.begin(), nonce.end(), data.begin() + NONCE_OFFSET);
+  bool sealed = _crypto.Encrypt(plaintext.data(), plaintext.size(),
+                                data.data() + SEALED_OFFSET, *_current->key, nonce);
+  sodium_memzero(plaintext.data(), plaintext.size());
+  return sealed ? data : ByteBuffer();
+}
+
+bool SessionTicketKeys::Redeem(const ByteBuffer& data, SessionTicket& ticket) {
+  if (data.size() != TICKET_SIZE) {
+    return false;
+  }
+  
+  Nonce nonce;
+  std::copy(data.begin() + NONCE_OFFSET, data.begin() + SEALED_OFFSET, nonce.begin());
+  auto generation = static_cast<uint32_t>(ReadInteger(data.data(), GENERATION_SIZE));
+  std::array<uint8_t, PLAINTEXT_SIZE> plaintext;
+  
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto now = Clock::now();
+  RotateIfDueLocked(now);
+  
+  TicketKey* key = nullptr;
+  if (_current->generation == generation) {
+    key = _current.get();
+  } else if (_previous && _previous->generation == generation) {
+    key = _previous.get();
+  }
+  
+  // Check the nonce before opening, and record it only once the ticket
+  // has authenticated
+  if (!key || !key->redeemed.Check(nonce) ||
+      !_crypto.Decrypt(data.data() + SEALED_OFFSET, data.size() - SEALED_OFFSET,
+                       plaintext.data(), *key->key, nonce)) {
+    return false;
+  }
+  key->redeemed.Accept(nonce);
+  
+  uint64_t issued = ReadInteger(plaintext.data(), 8);
+  uint64_t age = std::chrono::duration_cast<std::chrono::milliseconds>(
+      now.time_since_epoch()).count() - issued;
+  bool fresh = age <= static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(_rotation).count());
+  if (fresh) {
+    std::copy(plaintext.begin() + 8, plaintext.begin() + 8 + sizeof(PeerId),
+              ticket.peer_id.begin());
+    ticket.suite = static_cast<CipherSuite>(plaintext[8 + sizeof(PeerId)]);
+    std::copy(plaintext.begin() + 8 + sizeof(PeerId) + 1, plaintext.end(),
+              ticket.secret.begin());
+  }
+  sodium_memzero(plaintext.data(), plaintext.size());
+  return fresh;
+}
+
+void SessionTicketKeys::Rotate() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  RotateLocked(Clock::now());
+}
+
+void SessionTicketKeys::RotateIfDueLocked(Clock::time_point now) {
+  if (now - _current->created >= _rotation) {
+    RotateLocked(now);
+  }
+}
+
+void SessionTicketKeys::RotateLocked(Clock::time_point now) {
+  Wipe(_previous);
+  _previous = std::move(_current);
+  
+  _current = std::make_unique<TicketKey>();
+  _current->generation = _next_generation++;
+  _current->key = _keys.Allocate();
+  Key key = _crypto.GenerateKey();
+  *_current->key = key;
+  sodium_memzero(key.data(), key.size());
+  _current->created = now;
+}
+
+void SessionTicketKeys::Wipe(std::unique_ptr<TicketKey>& key) {
+  if (key) {
+    _keys.Free(key->key);
+    key.reset();
+  }
+}
+
+}  // namespace crypto
+}  // namespace linknet
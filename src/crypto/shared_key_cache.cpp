@@ -0,0 +1,114 @@
+#include "linknet/shared_key_cache.h"
+#include <sodium.h>
+#include <algorithm>
+
+namespace linknet {
+namespace crypto {
+
+SharedKeyCache::SharedKeyCache(const CryptoProvider& crypto, const Key& private_key,
+                               size_t capacity)
+    : _crypto(crypto),
+      _capacity(std::max<size_t>(1, capacity)),
+      _arena(_capacity + 1),
+      _private_key(_arena.Allocate()) {
+  *_private_key = private_key;
+}
+
+SharedKeyCache::~SharedKeyCache() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  ClearLocked();
+  _arena.Free(_private_key);
+}
+
+ByteBuffer SharedKeyCache::Encrypt(const ByteBuffer& plaintext, const Key& peer_public_key) {
+  Key shared_key;
+  Lookup(peer_public_key, shared_key);
+  try {
+    ByteBuffer result = _crypto.AsymmetricEncryptPrecomputed(plaintext, shared_key);
+    sodium_memzero(shared_key.data(), shared_key.size());
+    return result;
+  } catch (...) {
+    sodium_memzero(shared_key.data(), shared_key.size());
+    throw;
+  }
+}
+
+ByteBuffer SharedKeyCache::Decrypt(const ByteBuffer& data, const Key& peer_public_key) {
+  Key shared_key;
+  Lookup(peer_public_key, shared_key);
+  try {
+    ByteBuffer result = _crypto.AsymmetricDecryptPrecomputed(data, shared_key);
+    sodium_memzero(shared_key.data(), shared_key.size());
+    return result;
+  } catch (...) {
+    sodium_memzero(shared_key.data(), shared_key.size());
+    throw;
+  }
+}
+
+void SharedKeyCache::Forget(const Key& peer_public_key) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto found = _index.find(peer_public_key);
+  if (found == _index.end()) {
+    return;
+  }
+  
+  _arena.Free(found->second->shared_key);
+  _entries.erase(found->second);
+  _index.erase(found);
+}
+
+void SharedKeyCache::SetPrivateKey(const Key& private_key) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  ClearLocked();
+  *_private_key = private_key;
+}
+
+size_t SharedKeyCache::GetSize() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _entries.size();
+}
+
+void SharedKeyCache::Lookup(const Key& peer_public_key, Key& shared_key) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto found = _index.find(peer_public_key);
+  if (found != _index.end()) {
+    _entries.splice(_entries.begin(), _entries, found->second);
+    shared_key = *found->second->shared_key;
+    return;
+  }
+  
+  // Make room first, so the arena always has a slot. Under the lock, so a
+  // key never outlives a change of private key.
+  if (_entries.size() >= _capacity) {
+    EvictLocked();
+  }
+  Key* slot = _arena.Allocate();
+  try {
+    *slot = _crypto.ComputeSharedKey(peer_public_key, *_private_key);
+  } catch (...) {
+    _arena.Free(slot);
+    throw;
+  }
+  shared_key = *slot;
+  _entries.push_front(Entry{peer_public_key, slot});
+  _index[peer_public_key] = _entries.begin();
+}
+
+void SharedKeyCache::ClearLocked() {
+  for (Entry& entry : _entries) {
+    _arena.Free(entry.shared_key);
+  }
+  _entries.clear();
+  _index.clear();
+}
+
+void SharedKeyCache::EvictLocked() {
+  Entry& oldest = _entries.back();
+  _arena.Free(oldest.shared_key);
+  _index.erase(oldest.public_key);
+  _entries.pop_back();
+}
+
+}  // namespace crypto
+}  // namespace linknet
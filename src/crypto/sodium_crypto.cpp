@@ -1,16 +1,308 @@
 #include "linknet/crypto.h"
+#include "linknet/key_arena.h"
 #include "linknet/logger.h"
+#include "linknet/nonce_sequence.h"
+#include "linknet/worker_pool.h"
 #include <sodium.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <random>
 #include <stdexcept>
 #include <cassert>
+#include <fstream>
 
 namespace linknet {
 namespace crypto {
 
+namespace {
+
+static_assert(MAC_SIZE == crypto_secretbox_MACBYTES && MAC_SIZE == crypto_box_MACBYTES,
+              "EncryptedSize() must match libsodium");
+static_assert(NONCE_SIZE == crypto_secretbox_NONCEBYTES && NONCE_SIZE == crypto_box_NONCEBYTES,
+              "AsymmetricEncryptedSize() must match libsodium");
+static_assert(SIGNATURE_SIZE == crypto_sign_BYTES, "Signature size must match libsodium");
+
+// Session ciphers on libsodium's AEADs. The nonce for a frame is the count
+// of frames sealed with its key before it, little-endian, padded with
+// zeros; each direction has its own key, so no nonce is ever used twice.
+// The keys are held in the provider's key store, and the expanded AES key
+// schedules in memory from sodium_malloc(), locked like the arenas.
+class SodiumSessionCipher : public SessionCipher {
+ public:
+  // Null if the key memory can't be allocated
+  static std::unique_ptr<SessionCipher> Create(std::shared_ptr<KeyStore> keys,
+                                               CipherSuite suite, const Key& receive_key,
+                                               const Key& send_key) {
+    try {
+      return std::unique_ptr<SessionCipher>(
+          new SodiumSessionCipher(std::move(keys), suite, receive_key, send_key));
+    } catch (const std::runtime_error& e) {
+      LOG_ERROR("Failed to allocate session keys: ", e.what());
+      return nullptr;
+    }
+  }
+  
+  ~SodiumSessionCipher() override {
+    // sodium_free() wipes the key schedules
+    sodium_free(_states);
+    _keys->Free(_receive_key);
+    _keys->Free(_send_key);
+  }
+  
+  CipherSuite GetSuite() const override {
+    return _suite;
+  }
+  
+  bool Seal(uint8_t* data, size_t size, const uint8_t* ad, size_t ad_size,
+            uint8_t* mac) override {
+    Nonce nonce;
+    if (!NextNonce(_send_counter, nonce)) {
+      LOG_ERROR("Session send key exhausted");
+      return false;
+    }
+    
+    if (_suite == CipherSuite::AES256_GCM) {
+      return crypto_aead_aes256gcm_encrypt_detached_afternm(
+                 data, mac, nullptr, data, size, ad, ad_size, nullptr, nonce.data(),
+                 &_states[SEND]) == 0;
+    }
+    return crypto_aead_xchacha20poly1305_ietf_encrypt_detached(
+               data, mac, nullptr, data, size, ad, ad_size, nullptr, nonce.data(),
+               _send_key->data()) == 0;
+  }
+  
+  bool Open(uint8_t* data, size_t size, const uint8_t* ad, size_t ad_size,
+            const uint8_t* mac) override {
+    Nonce nonce;
+    if (!NextNonce(_receive_counter, nonce)) {
+      LOG_ERROR("Session receive key exhausted");
+      return false;
+    }
+    
+    if (_suite == CipherSuite::AES256_GCM) {
+      return crypto_aead_aes256gcm_decrypt_detached_afternm(
+                 data, nullptr, data, size, mac, ad, ad_size, nonce.data(),
+                 &_states[RECEIVE]) == 0;
+    }
+    return crypto_aead_xchacha20poly1305_ietf_decrypt_detached(
+               data, nullptr, data, size, mac, ad, ad_size, nonce.data(),
+               _receive_key->data()) == 0;
+  }
+  
+  std::unique_ptr<SessionCipher> Derive(const ByteBuffer& salt) const override {
+    Key receive_key;
+    Key send_key;
+    crypto_generichash(receive_key.data(), receive_key.size(), salt.data(), salt.size(),
+                       _receive_key->data(), _receive_key->size());
+    crypto_generichash(send_key.data(), send_key.size(), salt.data(), salt.size(),
+                       _send_key->data(), _send_key->size());
+    
+    auto derived = Create(_keys, _suite, receive_key, send_key);
+    sodium_memzero(receive_key.data(), receive_key.size());
+    sodium_memzero(send_key.data(), send_key.size());
+    return derived;
+  }
+ 
+  // One end's send key is the other's receive key, so hashing the two in
+  // byte order gives both ends the same secret
+  Key GetResumptionSecret() const override {
+    const Key& low = std::min(*_receive_key, *_send_key);
+    const Key& high = std::max(*_receive_key, *_send_key);
+    std::array<uint8_t, 2 * KEY_SIZE> keys;
+    std::copy(low.begin(), low.end(), keys.begin());
+    std::copy(high.begin(), high.end(), keys.begin() + KEY_SIZE);
+    
+    Key secret;
+    crypto_generichash(secret.data(), secret.size(), keys.data(), keys.size(),
+                       reinterpret_cast<const uint8_t*>(RESUMPTION_CONTEXT),
+                       sizeof(RESUMPTION_CONTEXT) - 1);
+    sodium_memzero(keys.data(), keys.size());
+    return secret;
+  }
+ 
+ private:
+  static constexpr char RESUMPTION_CONTEXT[] = "linknet session resumption";
+  
+  // Indices of the key schedules in _states
+  static constexpr size_t RECEIVE = 0;
+  static constexpr size_t SEND = 1;
+  
+  SodiumSessionCipher(std::shared_ptr<KeyStore> keys, CipherSuite suite,
+                      const Key& receive_key, const Key& send_key)
+      : _keys(std::move(keys)), _suite(suite) {
+    _receive_key = _keys->Allocate();
+    try {
+      _send_key = _keys->Allocate();
+    } catch (...) {
+      _keys->Free(_receive_key);
+      throw;
+    }
+    *_receive_key = receive_key;
+    *_send_key = send_key;
+    
+    if (_suite == CipherSuite::AES256_GCM) {
+      // Expand the AES key schedules once rather than for every frame.
+      // Both together are a multiple of the alignment the state needs.
+      _states = static_cast<crypto_aead_aes256gcm_state*>(
+          sodium_allocarray(2, sizeof(crypto_aead_aes256gcm_state)));
+      if (!_states) {
+        _keys->Free(_receive_key);
+        _keys->Free(_send_key);
+        throw std::runtime_error("Failed to allocate AES key schedules");
+      }
+      crypto_aead_aes256gcm_beforenm(&_states[RECEIVE], _receive_key->data());
+      crypto_aead_aes256gcm_beforenm(&_states[SEND], _send_key->data());
+    }
+  }
+  
+  // The nonce for the next frame, or false once the counter has run out
+  static bool NextNonce(uint64_t& counter, Nonce& nonce) {
+    if (counter == UINT64_MAX) {
+      return false;
+    }
+    
+    nonce.fill(0);
+    uint64_t value = counter++;
+    for (size_t i = 0; i < 8; ++i) {
+      nonce[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+    return true;
+  }
+  
+  std::shared_ptr<KeyStore> _keys;
+  CipherSuite _suite;
+  Key* _receive_key = nullptr;
+  Key* _send_key = nullptr;
+  crypto_aead_aes256gcm_state* _states = nullptr;
+  uint64_t _receive_counter = 0;
+  uint64_t _send_counter = 0;
+};
+
+static_assert(StreamSealer::HEADER_SIZE == crypto_secretstream_xchacha20poly1305_HEADERBYTES &&
+              StreamSealer::OVERHEAD == crypto_secretstream_xchacha20poly1305_ABYTES,
+              "Stream framing must match libsodium");
+
+// Streams on libsodium's secretstream, which numbers the messages itself
+// and switches keys on a REKEY tag at both ends
+class SodiumStreamSealer : public StreamSealer {
+ public:
+  explicit SodiumStreamSealer(const Key& key) {
+    crypto_secretstream_xchacha20poly1305_init_push(&_state, _header.data(), key.data());
+  }
+  
+  ~SodiumStreamSealer() override {
+    sodium_memzero(&_state, sizeof(_state));
+  }
+  
+  const std::array<uint8_t, HEADER_SIZE>& GetHeader() const override {
+    return _header;
+  }
+  
+  bool Push(const uint8_t* data, size_t size, bool rekey, uint8_t* output) override {
+    unsigned char tag = rekey ? crypto_secretstream_xchacha20poly1305_TAG_REKEY
+                              : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE;
+    return crypto_secretstream_xchacha20poly1305_push(&_state, output, nullptr, data, size,
+                                                      nullptr, 0, tag) == 0;
+  }
+ 
+ private:
+  crypto_secretstream_xchacha20poly1305_state _state;
+  std::array<uint8_t, HEADER_SIZE> _header;
+};
+
+class SodiumStreamOpener : public StreamOpener {
+ public:
+  SodiumStreamOpener(const Key& key, const uint8_t* header) {
+    _valid = crypto_secretstream_xchacha20poly1305_init_pull(&_state, header, key.data()) == 0;
+  }
+  
+  ~SodiumStreamOpener() override {
+    sodium_memzero(&_state, sizeof(_state));
+  }
+  
+  bool Pull(const uint8_t* data, size_t size, uint8_t* output) override {
+    if (!_valid || size < StreamSealer::OVERHEAD) {
+      return false;
+    }
+    unsigned char tag;
+    if (crypto_secretstream_xchacha20poly1305_pull(&_state, output, nullptr, &tag, data, size,
+                                                   nullptr, 0) != 0) {
+      // The state can't be trusted after a failure
+      _valid = false;
+      return false;
+    }
+    return true;
+  }
+ 
+ private:
+  crypto_secretstream_xchacha20poly1305_state _state;
+  bool _valid;
+};
+
+class SodiumHasher : public Hasher {
+ public:
+  explicit SodiumHasher(HashAlgorithm algorithm) : _algorithm(algorithm) {
+    Start();
+  }
+  
+  HashAlgorithm GetAlgorithm() const override {
+    return _algorithm;
+  }
+  
+  void Update(const uint8_t* data, size_t size) override {
+    if (_algorithm == HashAlgorithm::SHA256) {
+      crypto_hash_sha256_update(&_sha256, data, size);
+    } else {
+      crypto_generichash_update(&_blake2b, data, size);
+    }
+  }
+  
+  Digest Final() override {
+    Digest digest;
+    if (_algorithm == HashAlgorithm::SHA256) {
+      crypto_hash_sha256_final(&_sha256, digest.data());
+    } else {
+      crypto_generichash_final(&_blake2b, digest.data(), digest.size());
+    }
+    Start();
+    return digest;
+  }
+ 
+ private:
+  void Start() {
+    if (_algorithm == HashAlgorithm::SHA256) {
+      crypto_hash_sha256_init(&_sha256);
+    } else {
+      crypto_generichash_init(&_blake2b, nullptr, 0, DIGEST_SIZE);
+    }
+  }
+  
+  HashAlgorithm _algorithm;
+  crypto_hash_sha256_state _sha256;
+  crypto_generichash_state _blake2b;
+};
+
+// The nonce for a message encrypted by the asymmetric operations. Each
+// thread counts from a random prefix of its own, so nonces stay unique
+// without drawing random bytes for every message.
+Nonce NextMessageNonce() {
+  thread_local NonceSequence sequence;
+  Nonce nonce;
+  if (!sequence.Next(nonce)) {
+    // A new prefix is as good as a new key for nonces drawn this way
+    sequence.Reset();
+    sequence.Next(nonce);
+  }
+  return nonce;
+}
+
+}  // namespace
+
 class SodiumCryptoProvider : public CryptoProvider {
  public:
-  SodiumCryptoProvider() {
+  explicit SodiumCryptoProvider(unsigned int batch_threads)
+      : _batch_threads(batch_threads) {
     if (sodium_init() < 0) {
       LOG_FATAL("Failed to initialize sodium library");
       throw std::runtime_error("Failed to initialize sodium library");
@@ -57,17 +349,75 @@ class SodiumCryptoProvider : public CryptoProvider {
     return hash;
   }
   
+  std::unique_ptr<Hasher> CreateHasher(HashAlgorithm algorithm) const override {
+    return std::make_unique<SodiumHasher>(algorithm);
+  }
+  
+  bool HashFile(const std::string& path, HashAlgorithm algorithm,
+                Digest& digest) const override {
+    std::ifstream probe(path, std::ios::binary | std::ios::ate);
+    if (!probe) {
+      LOG_ERROR("Failed to open file for hashing: ", path);
+      return false;
+    }
+    uint64_t file_size = static_cast<uint64_t>(probe.tellg());
+    probe.close();
+    
+    // An empty file is one empty segment
+    uint64_t segment_count = std::max<uint64_t>(
+        1, (file_size + TREE_SEGMENT_SIZE - 1) / TREE_SEGMENT_SIZE);
+    std::vector<Digest> segments(segment_count);
+    std::atomic<bool> failed{false};
+    
+    // Each share of segments is read through its own stream
+    RunBatch(segment_count, 2, [&](size_t begin, size_t end) {
+      std::ifstream in(path, std::ios::binary);
+      in.seekg(static_cast<std::streamoff>(begin * TREE_SEGMENT_SIZE));
+      ByteBuffer buffer(HASH_READ_SIZE);
+      SodiumHasher hasher(algorithm);
+      
+      for (size_t segment = begin; segment < end && !failed; ++segment) {
+        uint8_t prefix = TREE_LEAF_PREFIX;
+        hasher.Update(&prefix, 1);
+        
+        uint64_t offset = segment * TREE_SEGMENT_SIZE;
+        uint64_t remaining = std::min(TREE_SEGMENT_SIZE, file_size - offset);
+        while (remaining > 0) {
+          size_t want = static_cast<size_t>(std::min<uint64_t>(buffer.size(), remaining));
+          in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(want));
+          if (!in || static_cast<size_t>(in.gcount()) != want) {
+            failed = true;
+            return;
+          }
+          hasher.Update(buffer.data(), want);
+          remaining -= want;
+        }
+        segments[segment] = hasher.Final();
+      }
+    });
+    
+    if (failed) {
+      LOG_ERROR("Failed to read file for hashing: ", path);
+      return false;
+    }
+    
+    SodiumHasher root(algorithm);
+    uint8_t prefix = TREE_NODE_PREFIX;
+    root.Update(&prefix, 1);
+    for (const Digest& segment : segments) {
+      root.Update(segment.data(), segment.size());
+    }
+    digest = root.Final();
+    return true;
+  }
+  
   ByteBuffer Encrypt(const ByteBuffer& plaintext, 
                      const Key& key, 
                      const Nonce& nonce) const override {
     // Output will be ciphertext + MAC
-    ByteBuffer ciphertext(plaintext.size() + crypto_secretbox_MACBYTES);
+    ByteBuffer ciphertext(EncryptedSize(plaintext.size()));
     
-    if (crypto_secretbox_easy(ciphertext.data(), 
-                             plaintext.data(), 
-                             plaintext.size(), 
-                             nonce.data(), 
-                             key.data()) != 0) {
+    if (!Encrypt(plaintext.data(), plaintext.size(), ciphertext.data(), key, nonce)) {
       LOG_ERROR("Encryption failed");
       throw std::runtime_error("Encryption failed");
     }
@@ -87,11 +437,7 @@ class SodiumCryptoProvider : public CryptoProvider {
     // Output will be just the plaintext (without MAC)
     ByteBuffer plaintext(ciphertext.size() - crypto_secretbox_MACBYTES);
     
-    if (crypto_secretbox_open_easy(plaintext.data(), 
-                                  ciphertext.data(), 
-                                  ciphertext.size(), 
-                                  nonce.data(), 
-                                  key.data()) != 0) {
+    if (!Decrypt(ciphertext.data(), ciphertext.size(), plaintext.data(), key, nonce)) {
       LOG_ERROR("Decryption failed");
       throw std::runtime_error("Decryption failed");
     }
@@ -102,27 +448,15 @@ class SodiumCryptoProvider : public CryptoProvider {
   ByteBuffer AsymmetricEncrypt(const ByteBuffer& plaintext,
                               const Key& receiver_public_key,
                               const Key& sender_private_key) const override {
-    // Output will be ciphertext + MAC
-    ByteBuffer ciphertext(plaintext.size() + crypto_box_MACBYTES);
-    Nonce nonce = GenerateNonce();
-    
-    // We need to include the nonce with the ciphertext
-    ByteBuffer result(nonce.size() + ciphertext.size());
-    
-    if (crypto_box_easy(ciphertext.data(), 
-                       plaintext.data(), 
-                       plaintext.size(), 
-                       nonce.data(), 
-                       receiver_public_key.data(), 
-                       sender_private_key.data()) != 0) {
+    // The nonce goes ahead of the ciphertext and MAC
+    ByteBuffer result(AsymmetricEncryptedSize(plaintext.size()));
+    
+    if (!AsymmetricEncrypt(plaintext.data(), plaintext.size(), result.data(),
+                           receiver_public_key, sender_private_key)) {
       LOG_ERROR("Asymmetric encryption failed");
       throw std::runtime_error("Asymmetric encryption failed");
     }
     
-    // Copy the nonce and ciphertext to the result
-    std::copy(nonce.begin(), nonce.end(), result.begin());
-    std::copy(ciphertext.begin(), ciphertext.end(), result.begin() + nonce.size());
-    
     return result;
   }
   
@@ -135,22 +469,11 @@ class SodiumCryptoProvider : public CryptoProvider {
       throw std::invalid_argument("Encrypted data too short");
     }
     
-    // Extract the nonce
-    Nonce nonce;
-    std::copy(data.begin(), data.begin() + NONCE_SIZE, nonce.begin());
+    // Output will be just the plaintext (without nonce and MAC)
+    ByteBuffer plaintext(data.size() - NONCE_SIZE - crypto_box_MACBYTES);
     
-    // Extract the ciphertext
-    ByteBuffer ciphertext(data.begin() + NONCE_SIZE, data.end());
-    
-    // Output will be just the plaintext (without MAC)
-    ByteBuffer plaintext(ciphertext.size() - crypto_box_MACBYTES);
-    
-    if (crypto_box_open_easy(plaintext.data(), 
-                            ciphertext.data(), 
-                            ciphertext.size(), 
-                            nonce.data(), 
-                            sender_public_key.data(), 
-                            receiver_private_key.data()) != 0) {
+    if (!AsymmetricDecrypt(data.data(), data.size(), plaintext.data(),
+                           sender_public_key, receiver_private_key)) {
       LOG_ERROR("Asymmetric decryption failed");
       throw std::runtime_error("Asymmetric decryption failed");
     }
@@ -163,11 +486,7 @@ class SodiumCryptoProvider : public CryptoProvider {
     // This requires a signing private key from GenerateSignatureKeyPair()
     ByteBuffer signature(crypto_sign_BYTES);
     
-    if (crypto_sign_detached(signature.data(), 
-                            nullptr, 
-                            message.data(), 
-                            message.size(), 
-                            private_key.data()) != 0) {
+    if (!Sign(message.data(), message.size(), signature.data(), private_key)) {
       LOG_ERROR("Signature generation failed");
       throw std::runtime_error("Signature generation failed");
     }
@@ -184,15 +503,361 @@ class SodiumCryptoProvider : public CryptoProvider {
       return false;
     }
     
-    return crypto_sign_verify_detached(signature.data(), 
-                                      message.data(), 
-                                      message.size(), 
-                                      public_key.data()) == 0;
+    return Verify(message.data(), message.size(), signature.data(), public_key);
+  }
+  
+  // libsodium allows the output of each of these to overlap the input
+  bool Encrypt(const uint8_t* plaintext, size_t size, uint8_t* ciphertext,
+               const Key& key, const Nonce& nonce) const override {
+    return crypto_secretbox_easy(ciphertext, plaintext, size, nonce.data(), key.data()) == 0;
+  }
+  
+  bool Decrypt(const uint8_t* ciphertext, size_t size, uint8_t* plaintext,
+               const Key& key, const Nonce& nonce) const override {
+    return size >= crypto_secretbox_MACBYTES &&
+           crypto_secretbox_open_easy(plaintext, ciphertext, size, nonce.data(),
+                                      key.data()) == 0;
+  }
+  
+  bool EncryptDetached(const uint8_t* plaintext, size_t size, uint8_t* ciphertext,
+                       uint8_t* mac, const Key& key, const Nonce& nonce) const override {
+    return crypto_secretbox_detached(ciphertext, mac, plaintext, size, nonce.data(),
+                                     key.data()) == 0;
+  }
+  
+  bool DecryptDetached(const uint8_t* ciphertext, size_t size, const uint8_t* mac,
+                       uint8_t* plaintext, const Key& key,
+                       const Nonce& nonce) const override {
+    return crypto_secretbox_open_detached(plaintext, ciphertext, mac, size, nonce.data(),
+                                          key.data()) == 0;
+  }
+  
+  bool AsymmetricEncrypt(const uint8_t* plaintext, size_t size, uint8_t* output,
+                         const Key& receiver_public_key,
+                         const Key& sender_private_key) const override {
+    // Encrypt first, as the nonce may overwrite the start of the plaintext
+    Nonce nonce = NextMessageNonce();
+    if (crypto_box_easy(output + NONCE_SIZE, plaintext, size, nonce.data(),
+                        receiver_public_key.data(), sender_private_key.data()) != 0) {
+      return false;
+    }
+    std::copy(nonce.begin(), nonce.end(), output);
+    return true;
+  }
+  
+  bool AsymmetricDecrypt(const uint8_t* data, size_t size, uint8_t* plaintext,
+                         const Key& sender_public_key,
+                         const Key& receiver_private_key) const override {
+    if (size < NONCE_SIZE + crypto_box_MACBYTES) {
+      return false;
+    }
+    
+    // Copied out first, as the plaintext may overwrite it
+    Nonce nonce;
+    std::copy(data, data + NONCE_SIZE, nonce.begin());
+    return crypto_box_open_easy(plaintext, data + NONCE_SIZE, size - NONCE_SIZE,
+                                nonce.data(), sender_public_key.data(),
+                                receiver_private_key.data()) == 0;
   }
+  
+  std::vector<ByteBuffer> SignBatch(const std::vector<ByteBuffer>& messages,
+                                    const SignPrivateKey& private_key) const override {
+    std::vector<ByteBuffer> signatures(messages.size(), ByteBuffer(crypto_sign_BYTES));
+    RunBatch(messages.size(), MIN_BATCH_SHARE, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        if (!Sign(messages[i].data(), messages[i].size(), signatures[i].data(),
+                  private_key)) {
+          LOG_ERROR("Signature generation failed");
+          throw std::runtime_error("Signature generation failed");
+        }
+      }
+    });
+    return signatures;
+  }
+  
+  std::vector<size_t> VerifyBatch(const std::vector<SignedData>& items,
+                                  bool stop_at_first_failure) const override {
+    std::mutex failed_mutex;
+    std::vector<size_t> failed;
+    std::atomic<bool> stop{false};
+    RunBatch(items.size(), MIN_BATCH_SHARE, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end && !stop.load(std::memory_order_relaxed); ++i) {
+        const SignedData& item = items[i];
+        if (!Verify(item.message, item.size, item.signature, *item.public_key)) {
+          std::lock_guard<std::mutex> lock(failed_mutex);
+          failed.push_back(i);
+          if (stop_at_first_failure) {
+            stop = true;
+          }
+        }
+      }
+    });
+    std::sort(failed.begin(), failed.end());
+    return failed;
+  }
+  
+  Key ComputeSharedKey(const Key& remote_public_key,
+                       const Key& local_private_key) const override {
+    Key shared_key;
+    if (crypto_box_beforenm(shared_key.data(), remote_public_key.data(),
+                            local_private_key.data()) != 0) {
+      LOG_ERROR("Failed to compute shared key");
+      throw std::runtime_error("Failed to compute shared key");
+    }
+    return shared_key;
+  }
+  
+  ByteBuffer AsymmetricEncryptPrecomputed(const ByteBuffer& plaintext,
+                                          const Key& shared_key) const override {
+    ByteBuffer result(AsymmetricEncryptedSize(plaintext.size()));
+    
+    if (!AsymmetricEncryptPrecomputed(plaintext.data(), plaintext.size(), result.data(),
+                                      shared_key)) {
+      LOG_ERROR("Asymmetric encryption failed");
+      throw std::runtime_error("Asymmetric encryption failed");
+    }
+    
+    return result;
+  }
+  
+  ByteBuffer AsymmetricDecryptPrecomputed(const ByteBuffer& data,
+                                          const Key& shared_key) const override {
+    if (data.size() < NONCE_SIZE + crypto_box_MACBYTES) {
+      LOG_ERROR("Encrypted data too short");
+      throw std::invalid_argument("Encrypted data too short");
+    }
+    
+    ByteBuffer plaintext(data.size() - NONCE_SIZE - crypto_box_MACBYTES);
+    
+    if (!AsymmetricDecryptPrecomputed(data.data(), data.size(), plaintext.data(),
+                                      shared_key)) {
+      LOG_ERROR("Asymmetric decryption failed");
+      throw std::runtime_error("Asymmetric decryption failed");
+    }
+    
+    return plaintext;
+  }
+  
+  bool AsymmetricEncryptPrecomputed(const uint8_t* plaintext, size_t size, uint8_t* output,
+                                    const Key& shared_key) const override {
+    Nonce nonce = NextMessageNonce();
+    if (crypto_box_easy_afternm(output + NONCE_SIZE, plaintext, size, nonce.data(),
+                                shared_key.data()) != 0) {
+      return false;
+    }
+    std::copy(nonce.begin(), nonce.end(), output);
+    return true;
+  }
+  
+  bool AsymmetricDecryptPrecomputed(const uint8_t* data, size_t size, uint8_t* plaintext,
+                                    const Key& shared_key) const override {
+    if (size < NONCE_SIZE + crypto_box_MACBYTES) {
+      return false;
+    }
+    
+    Nonce nonce;
+    std::copy(data, data + NONCE_SIZE, nonce.begin());
+    return crypto_box_open_easy_afternm(plaintext, data + NONCE_SIZE, size - NONCE_SIZE,
+                                        nonce.data(), shared_key.data()) == 0;
+  }
+  
+  bool Sign(const uint8_t* message, size_t size, uint8_t* signature,
+            const SignPrivateKey& private_key) const override {
+    return crypto_sign_detached(signature, nullptr, message, size, private_key.data()) == 0;
+  }
+  
+  bool Verify(const uint8_t* message, size_t size, const uint8_t* signature,
+              const SignPublicKey& public_key) const override {
+    return crypto_sign_verify_detached(signature, message, size, public_key.data()) == 0;
+  }
+  
+  uint8_t GetCipherSuites() const override {
+    uint8_t suites = CipherSuiteBit(CipherSuite::XCHACHA20_POLY1305);
+    if (crypto_aead_aes256gcm_is_available()) {
+      suites |= CipherSuiteBit(CipherSuite::AES256_GCM);
+    }
+    return suites;
+  }
+  
+  CipherSuite ChooseCipherSuite(uint8_t remote_suites) const override {
+    uint8_t common = GetCipherSuites() & remote_suites;
+    if (common & CipherSuiteBit(CipherSuite::AES256_GCM)) {
+      return CipherSuite::AES256_GCM;
+    }
+    if (common & CipherSuiteBit(CipherSuite::XCHACHA20_POLY1305)) {
+      return CipherSuite::XCHACHA20_POLY1305;
+    }
+    return CipherSuite::NONE;
+  }
+  
+  std::unique_ptr<SessionCipher> CreateSessionCipher(CipherSuite suite,
+                                                     const KeyPair& local_keys,
+                                                     const Key& remote_public_key,
+                                                     bool initiator) const override {
+    if (suite == CipherSuite::NONE ||
+        !(GetCipherSuites() & CipherSuiteBit(suite))) {
+      LOG_ERROR("Unsupported cipher suite: ", static_cast<int>(suite));
+      return nullptr;
+    }
+    
+    // Both ends hash the shared secret with both public keys into one key
+    // for each direction
+    Key receive_key;
+    Key send_key;
+    int result = initiator
+        ? crypto_kx_client_session_keys(receive_key.data(), send_key.data(),
+                                        local_keys.public_key.data(),
+                                        local_keys.private_key.data(),
+                                        remote_public_key.data())
+        : crypto_kx_server_session_keys(receive_key.data(), send_key.data(),
+                                        local_keys.public_key.data(),
+                                        local_keys.private_key.data(),
+                                        remote_public_key.data());
+    if (result != 0) {
+      LOG_ERROR("Key exchange failed");
+      return nullptr;
+    }
+    
+    auto cipher = SodiumSessionCipher::Create(_session_keys, suite, receive_key, send_key);
+    sodium_memzero(receive_key.data(), receive_key.size());
+    sodium_memzero(send_key.data(), send_key.size());
+    return cipher;
+  }
+ 
+  std::unique_ptr<SessionCipher> ResumeSessionCipher(CipherSuite suite, const Key& secret,
+                                                     const ByteBuffer& salt,
+                                                     bool initiator) const override {
+    if (suite == CipherSuite::NONE ||
+        !(GetCipherSuites() & CipherSuiteBit(suite))) {
+      LOG_ERROR("Unsupported cipher suite: ", static_cast<int>(suite));
+      return nullptr;
+    }
+    
+    // A key for each direction, hashed from the secret with the salt and
+    // the direction
+    ByteBuffer input(1 + salt.size());
+    std::copy(salt.begin(), salt.end(), input.begin() + 1);
+    Key initiator_key;
+    Key responder_key;
+    input[0] = 'I';
+    crypto_generichash(initiator_key.data(), initiator_key.size(), input.data(), input.size(),
+                       secret.data(), secret.size());
+    input[0] = 'R';
+    crypto_generichash(responder_key.data(), responder_key.size(), input.data(),
+                       input.size(), secret.data(), secret.size());
+    
+    auto cipher = initiator
+        ? SodiumSessionCipher::Create(_session_keys, suite, responder_key, initiator_key)
+        : SodiumSessionCipher::Create(_session_keys, suite, initiator_key, responder_key);
+    sodium_memzero(initiator_key.data(), initiator_key.size());
+    sodium_memzero(responder_key.data(), responder_key.size());
+    return cipher;
+  }
+  
+  // The sealer takes the server side of the exchange and seals with its
+  // send key, which is the client's receive key
+  std::unique_ptr<StreamSealer> CreateStreamSealer(
+      const KeyPair& local_keys, const Key& remote_public_key) const override {
+    Key receive_key;
+    Key send_key;
+    if (crypto_kx_server_session_keys(receive_key.data(), send_key.data(),
+                                      local_keys.public_key.data(),
+                                      local_keys.private_key.data(),
+                                      remote_public_key.data()) != 0) {
+      LOG_ERROR("Key exchange failed");
+      return nullptr;
+    }
+    
+    auto sealer = std::make_unique<SodiumStreamSealer>(send_key);
+    sodium_memzero(receive_key.data(), receive_key.size());
+    sodium_memzero(send_key.data(), send_key.size());
+    return sealer;
+  }
+  
+  std::unique_ptr<StreamOpener> CreateStreamOpener(const KeyPair& local_keys,
+                                                   const Key& remote_public_key,
+                                                   const uint8_t* header) const override {
+    Key receive_key;
+    Key send_key;
+    if (crypto_kx_client_session_keys(receive_key.data(), send_key.data(),
+                                      local_keys.public_key.data(),
+                                      local_keys.private_key.data(),
+                                      remote_public_key.data()) != 0) {
+      LOG_ERROR("Key exchange failed");
+      return nullptr;
+    }
+    
+    auto opener = std::make_unique<SodiumStreamOpener>(receive_key, header);
+    sodium_memzero(receive_key.data(), receive_key.size());
+    sodium_memzero(send_key.data(), send_key.size());
+    return opener;
+  }
+ 
+ private:
+  // Fewer signatures than this to a thread cost more to hand over than to
+  // do
+  static constexpr size_t MIN_BATCH_SHARE = 32;
+  
+  // Tree hash segments are read in pieces of this size, and their hashes
+  // prefixed to tell leaves from the root
+  static constexpr size_t HASH_READ_SIZE = 1024 * 1024;
+  static constexpr uint8_t TREE_LEAF_PREFIX = 0x00;
+  static constexpr uint8_t TREE_NODE_PREFIX = 0x01;
+  
+  // Split count items into contiguous ranges of at least min_share, run
+  // work(begin, end) on each across the worker threads, and wait for them
+  // all. Small batches run on the calling thread. Rethrows the first
+  // exception from work.
+  template <typename Work>
+  void RunBatch(size_t count, size_t min_share, Work work) const {
+    size_t parts = 1;
+    if (count >= 2 * min_share && _batch_threads != 1) {
+      parts = std::min(GetWorkers().Size(), count / min_share);
+    }
+    if (parts <= 1) {
+      work(0, count);
+      return;
+    }
+    
+    std::vector<std::future<void>> done;
+    done.reserve(parts);
+    for (size_t part = 0; part < parts; ++part) {
+      size_t begin = count * part / parts;
+      size_t end = count * (part + 1) / parts;
+      done.push_back(GetWorkers().Submit([&work, begin, end] { work(begin, end); }));
+    }
+    
+    // Wait for every part before rethrowing, as they all use work
+    std::exception_ptr error;
+    for (auto& part : done) {
+      try {
+        part.get();
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  
+  WorkerPool& GetWorkers() const {
+    std::call_once(_workers_started, [this] {
+      _workers = std::make_unique<WorkerPool>(_batch_threads);
+    });
+    return *_workers;
+  }
+  
+  unsigned int _batch_threads;
+  std::shared_ptr<KeyStore> _session_keys = std::make_shared<KeyStore>();
+  mutable std::once_flag _workers_started;
+  mutable std::unique_ptr<WorkerPool> _workers;
 };
 
-std::unique_ptr<CryptoProvider> CryptoFactory::Create() {
-  return std::make_unique<SodiumCryptoProvider>();
+std::unique_ptr<CryptoProvider> CryptoFactory::Create(unsigned int batch_threads) {
+  return std::make_unique<SodiumCryptoProvider>(batch_threads);
 }
 
 }  // namespace crypto
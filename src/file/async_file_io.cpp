@@ -0,0 +1,475 @@
+#include "linknet/async_file_io.h"
+#include "linknet/worker_pool.h"
+#include "linknet/logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define LINKNET_HAVE_IO_URING 1
+#endif
+#endif
+
+namespace linknet {
+
+namespace {
+
+// Blocking I/O until size bytes moved, end of file or an error
+int64_t ReadFully(int fd, uint64_t offset, uint8_t* data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t result = ::pread(fd, data + done, size - done, static_cast<off_t>(offset + done));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0) {
+      return done > 0 ? static_cast<int64_t>(done) : -errno;
+    }
+    if (result == 0) {
+      break;
+    }
+    done += static_cast<size_t>(result);
+  }
+  return static_cast<int64_t>(done);
+}
+
+int64_t WriteFully(int fd, uint64_t offset, const uint8_t* data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t result = ::pwrite(fd, data + done, size - done, static_cast<off_t>(offset + done));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return done > 0 ? static_cast<int64_t>(done) : -errno;
+    }
+    done += static_cast<size_t>(result);
+  }
+  return static_cast<int64_t>(done);
+}
+
+// Requests run on a pool of threads, queue depth at a time
+class ThreadPoolFileIo : public AsyncFileIo {
+ public:
+  ThreadPoolFileIo(unsigned int threads, unsigned queue_depth)
+      : _queue_depth(queue_depth), _workers(threads) {
+  }
+  
+  ~ThreadPoolFileIo() override {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _in_flight == 0; });
+  }
+  
+  std::future<int64_t> Read(int fd, uint64_t offset, uint8_t* data, size_t size,
+                            std::shared_ptr<void> owner) override {
+    return Start([=, owner = std::move(owner)] { return ReadFully(fd, offset, data, size); });
+  }
+  
+  std::future<int64_t> Write(int fd, uint64_t offset, const uint8_t* data, size_t size,
+                             std::shared_ptr<void> owner) override {
+    return Start([=, owner = std::move(owner)] { return WriteFully(fd, offset, data, size); });
+  }
+  
+  void Submit() override {
+    // Requests start as soon as a thread is free
+  }
+  
+  const char* GetName() const override {
+    return "threads";
+  }
+ 
+ private:
+  template <typename Function>
+  std::future<int64_t> Start(Function function) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _idle.wait(lock, [this] { return _in_flight < _queue_depth; });
+      _in_flight++;
+    }
+    
+    return _workers.Submit([this, function = std::move(function)]() mutable {
+      int64_t result = function();
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _in_flight--;
+      }
+      _idle.notify_all();
+      return result;
+    });
+  }
+  
+  const size_t _queue_depth;
+  std::mutex _mutex;
+  std::condition_variable _idle;
+  size_t _in_flight = 0;
+  WorkerPool _workers;
+};
+
+#ifdef LINKNET_HAVE_IO_URING
+
+int IoUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int IoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                                    nullptr, 0));
+}
+
+// io_uring through the raw system calls. Callers fill submission queue
+// entries under a lock; one thread polls the ring, reaps completions and
+// fulfils the requests' promises. At most queue depth requests are in
+// flight, so the completion queue, twice as deep, never overflows. If the
+// ring stops working every outstanding request fails with its errno, as
+// does every later one.
+class IoUringFileIo : public AsyncFileIo {
+ public:
+  static std::unique_ptr<IoUringFileIo> Create(unsigned entries) {
+    std::unique_ptr<IoUringFileIo> io(new IoUringFileIo());
+    if (!io->Setup(entries)) {
+      return nullptr;
+    }
+    
+    io->_wake_fd = ::eventfd(0, EFD_CLOEXEC);
+    if (io->_wake_fd < 0) {
+      return nullptr;
+    }
+    
+    io->_reaper = std::thread(&IoUringFileIo::ReaperFunc, io.get());
+    return io;
+  }
+  
+  ~IoUringFileIo() override {
+    if (_reaper.joinable()) {
+      // Wait for outstanding requests, then tell the reaper to stop
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        SubmitLocked(lock);
+        _space.wait(lock, [this] { return _in_flight == 0; });
+      }
+      
+      uint64_t stop = 1;
+      while (::write(_wake_fd, &stop, sizeof(stop)) < 0 && errno == EINTR) {
+      }
+      _reaper.join();
+    }
+    
+    if (_sqes != MAP_FAILED) {
+      ::munmap(_sqes, _sqes_size);
+    }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+      ::munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sq_ring != MAP_FAILED) {
+      ::munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_ring_fd >= 0) {
+      ::close(_ring_fd);
+    }
+    if (_wake_fd >= 0) {
+      ::close(_wake_fd);
+    }
+    
+    // Requests failed with the ring, whose buffers the kernel may have
+    // touched until it was closed
+    for (Request* request : _outstanding) {
+      delete request;
+    }
+  }
+  
+  std::future<int64_t> Read(int fd, uint64_t offset, uint8_t* data, size_t size,
+                            std::shared_ptr<void> owner) override {
+    return Queue(IORING_OP_READ, fd, offset, data, size, std::move(owner));
+  }
+  
+  std::future<int64_t> Write(int fd, uint64_t offset, const uint8_t* data, size_t size,
+                             std::shared_ptr<void> owner) override {
+    return Queue(IORING_OP_WRITE, fd, offset, data, size, std::move(owner));
+  }
+  
+  void Submit() override {
+    std::unique_lock<std::mutex> lock(_mutex);
+    SubmitLocked(lock);
+  }
+  
+  const char* GetName() const override {
+    return "io_uring";
+  }
+ 
+ private:
+  struct Request {
+    std::promise<int64_t> promise;
+    std::shared_ptr<void> owner;
+  };
+  
+  IoUringFileIo() = default;
+  
+  bool Setup(unsigned entries) {
+    io_uring_params params{};
+    _ring_fd = IoUringSetup(entries, &params);
+    if (_ring_fd < 0) {
+      return false;
+    }
+    
+    // IORING_OP_READ and IORING_OP_WRITE came with this feature (5.6)
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+      return false;
+    }
+    _entries = params.sq_entries;
+    
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+    }
+    
+    _sq_ring = ::mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      _ring_fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+      return false;
+    }
+    
+    _cq_ring = single_mmap ? _sq_ring
+                           : ::mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+    if (_cq_ring == MAP_FAILED) {
+      return false;
+    }
+    
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = ::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   _ring_fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+      return false;
+    }
+    
+    auto* sq = static_cast<uint8_t*>(_sq_ring);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    
+    auto* cq = static_cast<uint8_t*>(_cq_ring);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+  
+  std::future<int64_t> Queue(uint8_t opcode, int fd, uint64_t offset, const uint8_t* data,
+                             size_t size, std::shared_ptr<void> owner) {
+    auto* request = new Request{std::promise<int64_t>(), std::move(owner)};
+    std::future<int64_t> result = request->promise.get_future();
+    
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_in_flight >= _entries) {
+      SubmitLocked(lock);
+      _space.wait(lock, [this] { return _in_flight < _entries || _error != 0; });
+    }
+    if (_error != 0) {
+      request->owner.reset();
+      request->promise.set_value(-_error);
+      delete request;
+      return result;
+    }
+    
+    io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(size);
+    sqe->user_data = reinterpret_cast<uint64_t>(request);
+    _outstanding.insert(request);
+    _queued++;
+    _in_flight++;
+    return result;
+  }
+  
+  // Claim and clear the next submission queue entry. Caller must hold the
+  // lock and have room for it.
+  io_uring_sqe* NextSqe() {
+    unsigned tail = *_sq_tail;
+    unsigned index = tail & _sq_mask;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(_sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+  }
+  
+  // Hand queued entries to the kernel. If it is short of resources, lock
+  // is released for a moment so completions can be reaped before retrying;
+  // on any other error the entries are taken back and their requests fail.
+  void SubmitLocked(std::unique_lock<std::mutex>& lock) {
+    while (_queued > 0) {
+      int result = IoUringEnter(_ring_fd, _queued, 0, 0);
+      if (result > 0) {
+        _queued -= std::min(_queued, static_cast<unsigned>(result));
+        continue;
+      }
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      if (result == 0 || errno == EAGAIN || errno == EBUSY) {
+        _space.wait_for(lock, std::chrono::milliseconds(1));
+        continue;
+      }
+      
+      int error = errno;
+      LOG_ERROR("io_uring submission failed: ", std::strerror(error));
+      UnqueueLocked(error);
+      return;
+    }
+  }
+  
+  // Withdraw the entries the kernel hasn't consumed, which are the last
+  // ones before the tail, and fail their requests
+  void UnqueueLocked(int error) {
+    unsigned tail = *_sq_tail;
+    for (unsigned i = 1; i <= _queued; ++i) {
+      const io_uring_sqe& sqe = static_cast<io_uring_sqe*>(_sqes)[(tail - i) & _sq_mask];
+      auto* request = reinterpret_cast<Request*>(sqe.user_data);
+      _outstanding.erase(request);
+      request->owner.reset();
+      request->promise.set_value(-error);
+      delete request;
+    }
+    
+    __atomic_store_n(_sq_tail, tail - _queued, __ATOMIC_RELEASE);
+    _in_flight -= _queued;
+    _queued = 0;
+    _space.notify_all();
+  }
+  
+  void ReaperFunc() {
+    pollfd fds[2] = {{_ring_fd, POLLIN, 0}, {_wake_fd, POLLIN, 0}};
+    std::vector<std::pair<Request*, int64_t>> completions;
+    
+    while (true) {
+      int ready = ::poll(fds, 2, -1);
+      if (ready < 0 && errno == EINTR) {
+        continue;
+      }
+      if (ready < 0 || (fds[0].revents & (POLLERR | POLLNVAL))) {
+        int error = ready < 0 ? errno : EIO;
+        LOG_ERROR("io_uring wait failed: ", std::strerror(error));
+        FailOutstanding(error);
+        return;
+      }
+      
+      unsigned head = *_cq_head;
+      unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head) {
+        const io_uring_cqe& cqe = _cqes[head & _cq_mask];
+        completions.emplace_back(reinterpret_cast<Request*>(cqe.user_data), cqe.res);
+      }
+      __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+      
+      if (!completions.empty()) {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          for (const auto& completion : completions) {
+            _outstanding.erase(completion.first);
+          }
+          _in_flight -= static_cast<unsigned>(completions.size());
+        }
+        _space.notify_all();
+        
+        for (const auto& completion : completions) {
+          std::unique_ptr<Request> request(completion.first);
+          request->owner.reset();
+          request->promise.set_value(completion.second);
+        }
+        completions.clear();
+      }
+      
+      if (fds[1].revents & POLLIN) {
+        return;
+      }
+    }
+  }
+  
+  // The ring is unusable: fail every request in it and every later one.
+  // The requests themselves live until the ring is closed.
+  void FailOutstanding(int error) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _error = error;
+      for (Request* request : _outstanding) {
+        request->promise.set_value(-error);
+      }
+      __atomic_store_n(_sq_tail, *_sq_tail - _queued, __ATOMIC_RELEASE);
+      _queued = 0;
+      _in_flight = 0;
+    }
+    _space.notify_all();
+  }
+  
+  int _ring_fd = -1;
+  int _wake_fd = -1;
+  unsigned _entries = 0;
+  
+  void* _sq_ring = MAP_FAILED;
+  size_t _sq_ring_size = 0;
+  unsigned* _sq_tail = nullptr;
+  unsigned _sq_mask = 0;
+  unsigned* _sq_array = nullptr;
+  void* _sqes = MAP_FAILED;
+  size_t _sqes_size = 0;
+  
+  void* _cq_ring = MAP_FAILED;
+  size_t _cq_ring_size = 0;
+  unsigned* _cq_head = nullptr;
+  unsigned* _cq_tail = nullptr;
+  unsigned _cq_mask = 0;
+  io_uring_cqe* _cqes = nullptr;
+  
+  // Entries filled but not yet submitted, requests not yet completed, and
+  // the errno that broke the ring
+  std::mutex _mutex;
+  std::condition_variable _space;
+  unsigned _queued = 0;
+  unsigned _in_flight = 0;
+  std::unordered_set<Request*> _outstanding;
+  int _error = 0;
+  
+  std::thread _reaper;
+};
+
+#endif  // LINKNET_HAVE_IO_URING
+
+}  // namespace
+
+std::unique_ptr<AsyncFileIo> AsyncFileIoFactory::Create(unsigned queue_depth,
+                                                        bool allow_io_uring) {
+  queue_depth = std::max(1u, queue_depth);
+
+#ifdef LINKNET_HAVE_IO_URING
+  if (allow_io_uring) {
+    auto io = IoUringFileIo::Create(queue_depth);
+    if (io) {
+      return io;
+    }
+    LOG_INFO("io_uring unavailable, using threads for file I/O");
+  }
+#endif
+
+  return std::make_unique<ThreadPoolFileIo>(std::min(queue_depth, 16u), queue_depth);
+}
+
+}  // namespace linknet
@@ -0,0 +1,194 @@
+#include "linknet/chunk_bitmap.h"
+#include "linknet/logger.h"
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+
+namespace linknet {
+
+namespace {
+
+constexpr char BITMAP_MAGIC[8] = {'L', 'N', 'K', 'B', 'M', 'P', '0', '1'};
+constexpr uint64_t ALL_ONES = ~uint64_t{0};
+
+}  // namespace
+
+ChunkBitmap::ChunkBitmap(uint32_t chunk_count)
+    : _chunk_count(chunk_count), _words((static_cast<size_t>(chunk_count) + 63) / 64, 0) {}
+
+bool ChunkBitmap::Test(uint32_t index) const {
+  if (index >= _chunk_count) {
+    return false;
+  }
+  return (_words[index / 64] >> (index % 64)) & 1;
+}
+
+bool ChunkBitmap::Set(uint32_t index) {
+  if (index >= _chunk_count) {
+    return false;
+  }
+  
+  uint64_t mask = uint64_t{1} << (index % 64);
+  uint64_t& word = _words[index / 64];
+  if (word & mask) {
+    return false;
+  }
+  
+  word |= mask;
+  _set_count++;
+  return true;
+}
+
+void ChunkBitmap::Clear(uint32_t index) {
+  if (index >= _chunk_count) {
+    return;
+  }
+  
+  uint64_t mask = uint64_t{1} << (index % 64);
+  uint64_t& word = _words[index / 64];
+  if (word & mask) {
+    word &= ~mask;
+    _set_count--;
+  }
+}
+
+std::vector<ChunkRange> ChunkBitmap::MissingRanges() const {
+  std::vector<ChunkRange> ranges;
+  
+  uint32_t index = 0;
+  while (index < _chunk_count) {
+    // Skip over fully received words without testing bit by bit
+    if (index % 64 == 0 && _words[index / 64] == ALL_ONES) {
+      index += 64;
+      continue;
+    }
+    
+    if (Test(index)) {
+      index++;
+      continue;
+    }
+    
+    uint32_t first = index;
+    while (index < _chunk_count && !Test(index)) {
+      if (index % 64 == 0 && _words[index / 64] == 0) {
+        index += 64;
+      } else {
+        index++;
+      }
+    }
+    if (index > _chunk_count) {
+      index = _chunk_count;
+    }
+    
+    ranges.push_back({first, index - first});
+  }
+  
+  return ranges;
+}
+
+bool ChunkBitmap::Save(const std::string& path, uint64_t file_size, uint32_t chunk_size) const {
+  // File format:
+  // - 8 bytes: Magic
+  // - 8 bytes: File size
+  // - 4 bytes: Chunk size
+  // - 4 bytes: Chunk count
+  // - W * 8 bytes: Bitmap words
+  std::string temp_path = path + ".tmp";
+  
+  {
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      LOG_ERROR("Failed to open chunk bitmap for writing: ", temp_path);
+      return false;
+    }
+    
+    uint64_t file_size_network = htobe64(file_size);
+    uint32_t chunk_size_network = htobe32(chunk_size);
+    uint32_t chunk_count_network = htobe32(_chunk_count);
+    
+    out.write(BITMAP_MAGIC, sizeof(BITMAP_MAGIC));
+    out.write(reinterpret_cast<const char*>(&file_size_network), 8);
+    out.write(reinterpret_cast<const char*>(&chunk_size_network), 4);
+    out.write(reinterpret_cast<const char*>(&chunk_count_network), 4);
+    
+    for (uint64_t word : _words) {
+      uint64_t word_network = htobe64(word);
+      out.write(reinterpret_cast<const char*>(&word_network), 8);
+    }
+    
+    if (!out) {
+      LOG_ERROR("Failed to write chunk bitmap: ", temp_path);
+      return false;
+    }
+  }
+  
+  std::error_code ec;
+  std::filesystem::rename(temp_path, path, ec);
+  if (ec) {
+    LOG_ERROR("Failed to replace chunk bitmap ", path, ": ", ec.message());
+    return false;
+  }
+  
+  return true;
+}
+
+bool ChunkBitmap::Load(const std::string& path, uint64_t file_size, uint32_t chunk_size,
+                       ChunkBitmap& bitmap) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  
+  char magic[sizeof(BITMAP_MAGIC)];
+  uint64_t file_size_network;
+  uint32_t chunk_size_network;
+  uint32_t chunk_count_network;
+  
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&file_size_network), 8);
+  in.read(reinterpret_cast<char*>(&chunk_size_network), 4);
+  in.read(reinterpret_cast<char*>(&chunk_count_network), 4);
+  
+  if (!in || std::memcmp(magic, BITMAP_MAGIC, sizeof(BITMAP_MAGIC)) != 0) {
+    LOG_WARNING("Ignoring malformed chunk bitmap: ", path);
+    return false;
+  }
+  
+  if (be64toh(file_size_network) != file_size || be32toh(chunk_size_network) != chunk_size) {
+    LOG_WARNING("Ignoring chunk bitmap for a different transfer: ", path);
+    return false;
+  }
+  
+  // The count is implied by the geometry; trusting it would let a corrupt
+  // file size the allocation below
+  uint32_t chunk_count = be32toh(chunk_count_network);
+  if (chunk_size == 0 || chunk_count != (file_size + chunk_size - 1) / chunk_size) {
+    LOG_WARNING("Ignoring corrupt chunk bitmap: ", path);
+    return false;
+  }
+  
+  ChunkBitmap loaded(chunk_count);
+  for (auto& word : loaded._words) {
+    uint64_t word_network;
+    in.read(reinterpret_cast<char*>(&word_network), 8);
+    word = be64toh(word_network);
+    loaded._set_count += static_cast<uint32_t>(__builtin_popcountll(word));
+  }
+  
+  if (!in) {
+    LOG_WARNING("Ignoring truncated chunk bitmap: ", path);
+    return false;
+  }
+  
+  // Bits past the last chunk must never be set
+  if (loaded._chunk_count % 64 != 0 && !loaded._words.empty() &&
+      (loaded._words.back() >> (loaded._chunk_count % 64)) != 0) {
+    LOG_WARNING("Ignoring corrupt chunk bitmap: ", path);
+    return false;
+  }
+  
+  bitmap = std::move(loaded);
+  return true;
+}
+
+}  // namespace linknet
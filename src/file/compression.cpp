@@ -0,0 +1,126 @@
+#include "linknet/compression.h"
+#include <zlib.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace linknet {
+
+namespace {
+
+// Compressed or encrypted data sits close to 8 bits per byte; text and most
+// tabular data well below 6
+constexpr double INCOMPRESSIBLE_ENTROPY = 7.5;
+
+constexpr size_t SAMPLE_COUNT = 8;
+constexpr size_t SAMPLE_SIZE = 256;
+
+class ZlibCompressor : public Compressor {
+ public:
+  CompressionType GetType() const override {
+    return CompressionType::ZLIB;
+  }
+  
+  bool Compress(const uint8_t* data, size_t size, ByteBuffer& output) const override {
+    uLongf output_size = compressBound(static_cast<uLong>(size));
+    output.resize(output_size);
+    
+    // Fastest level: chunks are compressed on the way to the network
+    int result = compress2(output.data(), &output_size, data, static_cast<uLong>(size),
+                           Z_BEST_SPEED);
+    if (result != Z_OK) {
+      return false;
+    }
+    
+    output.resize(output_size);
+    return true;
+  }
+  
+  bool Decompress(const uint8_t* data, size_t size, size_t original_size,
+                  ByteBuffer& output) const override {
+    output.resize(original_size);
+    
+    uLongf output_size = static_cast<uLongf>(original_size);
+    int result = uncompress(output.data(), &output_size, data, static_cast<uLong>(size));
+    return result == Z_OK && output_size == original_size;
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<Compressor> CompressorFactory::Create(CompressionType type) {
+  switch (type) {
+    case CompressionType::ZLIB:
+      return std::make_unique<ZlibCompressor>();
+    default:
+      return nullptr;
+  }
+}
+
+uint8_t CompressorFactory::SupportedTypes() {
+  return 1 << static_cast<int>(CompressionType::ZLIB);
+}
+
+CompressionType CompressorFactory::Negotiate(uint8_t offered_types) {
+  uint8_t common = offered_types & SupportedTypes();
+  
+  // Newer codecs are both faster and tighter than zlib
+  for (CompressionType type : {CompressionType::ZSTD, CompressionType::LZ4,
+                               CompressionType::ZLIB}) {
+    if (common & (1 << static_cast<int>(type))) {
+      return type;
+    }
+  }
+  return CompressionType::NONE;
+}
+
+double SampleEntropy(const uint8_t* data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  
+  std::array<uint32_t, 256> counts{};
+  size_t sampled = 0;
+  
+  if (size <= SAMPLE_COUNT * SAMPLE_SIZE) {
+    for (size_t i = 0; i < size; ++i) {
+      counts[data[i]]++;
+    }
+    sampled = size;
+  } else {
+    size_t stride = (size - SAMPLE_SIZE) / (SAMPLE_COUNT - 1);
+    for (size_t sample = 0; sample < SAMPLE_COUNT; ++sample) {
+      const uint8_t* begin = data + sample * stride;
+      for (size_t i = 0; i < SAMPLE_SIZE; ++i) {
+        counts[begin[i]]++;
+      }
+    }
+    sampled = SAMPLE_COUNT * SAMPLE_SIZE;
+  }
+  
+  double entropy = 0;
+  for (uint32_t count : counts) {
+    if (count > 0) {
+      double p = static_cast<double>(count) / sampled;
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy;
+}
+
+CompressionType CompressChunk(const Compressor& compressor, ByteBuffer& chunk) {
+  if (chunk.empty() || SampleEntropy(chunk.data(), chunk.size()) >= INCOMPRESSIBLE_ENTROPY) {
+    return CompressionType::NONE;
+  }
+  
+  ByteBuffer compressed;
+  if (!compressor.Compress(chunk.data(), chunk.size(), compressed) ||
+      compressed.size() > chunk.size() - chunk.size() / 16) {
+    return CompressionType::NONE;
+  }
+  
+  chunk = std::move(compressed);
+  return compressor.GetType();
+}
+
+}  // namespace linknet
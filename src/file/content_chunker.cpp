@@ -0,0 +1,118 @@
+#include "linknet/content_chunker.h"
+#include "linknet/merkle_tree.h"
+#include "linknet/logger.h"
+#include <array>
+#include <cstring>
+#include <fstream>
+
+namespace linknet {
+
+namespace {
+
+// Bytes read per I/O call while chunking a file
+constexpr size_t READ_SIZE = 1024 * 1024;
+
+// Normalized chunking: a stricter mask before the average size and a looser
+// one after it pull chunk sizes towards the average (15 and 11 bits around
+// the 13 of an 8 KB average). The bits are spread out so a boundary depends
+// on a window of recent bytes rather than only the last few.
+constexpr uint64_t MASK_SMALL = 0x0003590703530000ULL;
+constexpr uint64_t MASK_LARGE = 0x0000d90003530000ULL;
+
+// One random 64-bit value per byte value. Both peers must use the same
+// table, so it is generated from a fixed seed rather than at random.
+std::array<uint64_t, 256> MakeGearTable() {
+  std::array<uint64_t, 256> table{};
+  uint64_t state = 0x4c696e6b4e657431ULL;  // "LinkNet1"
+  for (auto& entry : table) {
+    // splitmix64
+    state += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    entry = z ^ (z >> 31);
+  }
+  return table;
+}
+
+const std::array<uint64_t, 256> GEAR = MakeGearTable();
+
+}  // namespace
+
+size_t ContentChunker::FindBoundary(const uint8_t* data, size_t size) {
+  if (size <= MIN_CHUNK_SIZE) {
+    return size;
+  }
+  
+  size_t limit = std::min<size_t>(size, MAX_CHUNK_SIZE);
+  size_t normal = std::min<size_t>(limit, AVG_CHUNK_SIZE);
+  uint64_t hash = 0;
+  size_t i = MIN_CHUNK_SIZE;
+  
+  for (; i < normal; ++i) {
+    hash = (hash << 1) + GEAR[data[i]];
+    if ((hash & MASK_SMALL) == 0) {
+      return i + 1;
+    }
+  }
+  
+  for (; i < limit; ++i) {
+    hash = (hash << 1) + GEAR[data[i]];
+    if ((hash & MASK_LARGE) == 0) {
+      return i + 1;
+    }
+  }
+  
+  return limit;
+}
+
+bool ContentChunker::ChunkFile(const std::string& path, std::vector<ContentChunk>& chunks) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    LOG_ERROR("Failed to open file for chunking: ", path);
+    return false;
+  }
+  
+  chunks.clear();
+  
+  // Keep at least MAX_CHUNK_SIZE bytes buffered until the end of the file
+  // so FindBoundary sees the same bytes however the file is read
+  std::vector<uint8_t> buffer(READ_SIZE + MAX_CHUNK_SIZE);
+  size_t begin = 0;
+  size_t end = 0;
+  uint64_t offset = 0;
+  bool eof = false;
+  
+  while (true) {
+    if (!eof && end - begin < MAX_CHUNK_SIZE) {
+      std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+      end -= begin;
+      begin = 0;
+      file.read(reinterpret_cast<char*>(buffer.data() + end), buffer.size() - end);
+      end += static_cast<size_t>(file.gcount());
+      if (file.bad()) {
+        LOG_ERROR("Failed to read file for chunking: ", path);
+        return false;
+      }
+      eof = file.eof();
+    }
+    
+    if (begin == end) {
+      break;
+    }
+    
+    size_t length = FindBoundary(buffer.data() + begin, end - begin);
+    ContentChunk chunk;
+    chunk.offset = offset;
+    chunk.length = static_cast<uint32_t>(length);
+    chunk.hash = crypto::MerkleTree::HashLeaf(buffer.data() + begin, length);
+    chunks.push_back(chunk);
+    
+    begin += length;
+    offset += length;
+  }
+  
+  return true;
+}
+
+}  // namespace linknet
@@ -0,0 +1,271 @@
+#include "linknet/content_store.h"
+#include "linknet/logger.h"
+#include "linknet/merkle_tree.h"
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/fs.h>)
+#include <linux/fs.h>
+#endif
+
+namespace linknet {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Additions and fetches are written under a temporary name, then renamed
+constexpr const char* TEMP_SUFFIX = ".tmp";
+
+std::string HashName(const crypto::Digest& hash) {
+  static const char* digits = "0123456789abcdef";
+  std::string name;
+  name.reserve(hash.size() * 2);
+  for (uint8_t byte : hash) {
+    name.push_back(digits[byte >> 4]);
+    name.push_back(digits[byte & 0x0f]);
+  }
+  return name;
+}
+
+// A new file at destination sharing source's data, on file systems with
+// copy-on-write extents (Btrfs, XFS)
+bool Reflink(const std::string& source, const std::string& destination) {
+#ifdef FICLONE
+  int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return false;
+  }
+  
+  int out = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool cloned = out >= 0 && ::ioctl(out, FICLONE, in) == 0;
+  ::close(in);
+  if (out >= 0) {
+    ::close(out);
+  }
+  
+  if (!cloned) {
+    std::error_code ec;
+    fs::remove(destination, ec);
+  }
+  return cloned;
+#else
+  (void)source;
+  (void)destination;
+  return false;
+#endif
+}
+
+// Give destination, which must not exist, the content of source: a reflink,
+// or else a copy. Never a hard link, which would let changes to one file
+// reach the other.
+bool Place(const std::string& source, const std::string& destination) {
+  if (Reflink(source, destination)) {
+    return true;
+  }
+  
+  std::error_code ec;
+  fs::copy_file(source, destination, ec);
+  if (ec) {
+    fs::remove(destination, ec);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+ContentStore::ContentStore(std::string directory, uint64_t max_bytes)
+    : _directory(std::move(directory)), _max_bytes(max_bytes) {
+}
+
+bool ContentStore::Open() {
+  std::error_code ec;
+  fs::create_directories(_directory, ec);
+  if (!fs::is_directory(_directory, ec)) {
+    LOG_ERROR("Cannot use content cache directory: ", _directory);
+    return false;
+  }
+  
+  std::vector<std::pair<fs::file_time_type, Entry>> found;
+  for (const auto& file : fs::directory_iterator(_directory, ec)) {
+    std::string name = file.path().filename().string();
+    if (file.path().extension() == TEMP_SUFFIX) {
+      fs::remove(file.path(), ec);
+      continue;
+    }
+    
+    if (name.size() != crypto::DIGEST_SIZE * 2 || !file.is_regular_file(ec)) {
+      continue;
+    }
+    
+    uint64_t size = file.file_size(ec);
+    fs::file_time_type added = file.last_write_time(ec);
+    if (!ec) {
+      found.push_back({added, Entry{name, size}});
+    }
+  }
+  
+  std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+    return a.first > b.first;
+  });
+  
+  std::lock_guard<std::mutex> lock(_mutex);
+  _entries.clear();
+  _index.clear();
+  _size = 0;
+  for (auto& [added, entry] : found) {
+    _size += entry.size;
+    _entries.push_back(std::move(entry));
+    _index[_entries.back().name] = std::prev(_entries.end());
+  }
+  EvictLocked();
+  
+  LOG_INFO("Content cache ", _directory, " holds ", _entries.size(), " files (", _size,
+           " bytes)");
+  return true;
+}
+
+bool ContentStore::Contains(const crypto::Digest& hash, uint64_t size) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto found = _index.find(HashName(hash));
+  return found != _index.end() && found->second->size == size;
+}
+
+bool ContentStore::Fetch(const crypto::Digest& hash, uint64_t size,
+                         const std::string& destination) {
+  std::string name = HashName(hash);
+  std::string path = EntryPath(name);
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _index.find(name);
+    if (found == _index.end()) {
+      return false;
+    }
+    
+    std::error_code ec;
+    if (found->second->size != size || fs::file_size(path, ec) != size || ec) {
+      LOG_WARNING("Dropping content cache entry of unexpected size: ", name);
+      fs::remove(path, ec);
+      _size -= found->second->size;
+      _entries.erase(found->second);
+      _index.erase(found);
+      return false;
+    }
+    _entries.splice(_entries.begin(), _entries, found->second);
+  }
+  
+  // An entry evicted from here on stays readable through the open file
+  std::string temp_path = destination + TEMP_SUFFIX;
+  std::error_code ec;
+  fs::remove(temp_path, ec);
+  
+  if (!Place(path, temp_path)) {
+    return false;
+  }
+  
+  // A copy gets the entry's read-only permissions
+  fs::permissions(temp_path, fs::perms::owner_write, fs::perm_options::add, ec);
+  
+  fs::rename(temp_path, destination, ec);
+  if (ec) {
+    fs::remove(temp_path, ec);
+    return false;
+  }
+  return true;
+}
+
+bool ContentStore::Add(const crypto::Digest& hash, const std::string& source,
+                       size_t chunk_size) {
+  std::error_code ec;
+  uint64_t size = fs::file_size(source, ec);
+  std::string name = HashName(hash);
+  std::string temp_path;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (ec || size > _max_bytes) {
+      return false;
+    }
+    
+    auto found = _index.find(name);
+    if (found != _index.end()) {
+      _entries.splice(_entries.begin(), _entries, found->second);
+      return true;
+    }
+    temp_path = EntryPath(name) + "." + std::to_string(_next_temp++) + TEMP_SUFFIX;
+  }
+  
+  if (!Place(source, temp_path)) {
+    LOG_WARNING("Failed to add ", source, " to the content cache");
+    return false;
+  }
+  
+  // The copy is checked rather than the source, which may change meanwhile
+  crypto::MerkleTree tree;
+  if (chunk_size != 0 && (fs::file_size(temp_path, ec) != size || ec ||
+                          !crypto::MerkleTree::BuildFromFile(temp_path, chunk_size, tree, 1) ||
+                          tree.GetRoot() != hash)) {
+    LOG_WARNING("Not caching ", source, ", its content no longer matches its hash");
+    fs::remove(temp_path, ec);
+    return false;
+  }
+  
+  fs::permissions(temp_path, fs::perms::owner_read | fs::perms::group_read |
+                      fs::perms::others_read, ec);
+  fs::rename(temp_path, EntryPath(name), ec);
+  if (ec) {
+    fs::remove(temp_path, ec);
+    return false;
+  }
+  
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto found = _index.find(name);
+  if (found != _index.end()) {
+    _entries.splice(_entries.begin(), _entries, found->second);
+    return true;
+  }
+  
+  _entries.push_front(Entry{name, size});
+  _index[name] = _entries.begin();
+  _size += size;
+  EvictLocked();
+  LOG_DEBUG("Added ", source, " to the content cache");
+  return true;
+}
+
+void ContentStore::SetMaxBytes(uint64_t max_bytes) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _max_bytes = max_bytes;
+  EvictLocked();
+}
+
+uint64_t ContentStore::GetSize() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _size;
+}
+
+size_t ContentStore::GetCount() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _entries.size();
+}
+
+std::string ContentStore::EntryPath(const std::string& name) const {
+  return (fs::path(_directory) / name).string();
+}
+
+void ContentStore::EvictLocked() {
+  while (_size > _max_bytes && !_entries.empty()) {
+    const Entry& oldest = _entries.back();
+    std::error_code ec;
+    fs::remove(EntryPath(oldest.name), ec);
+    _size -= oldest.size;
+    _index.erase(oldest.name);
+    _entries.pop_back();
+  }
+}
+
+}  // namespace linknet
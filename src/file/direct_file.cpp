@@ -0,0 +1,538 @@
+#include "linknet/direct_file.h"
+#include "linknet/logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace linknet {
+
+namespace {
+
+constexpr uint64_t ALIGNMENT_MASK = AlignedBufferPool::ALIGNMENT - 1;
+
+std::shared_future<int64_t> Completed(int64_t result) {
+  std::promise<int64_t> promise;
+  promise.set_value(result);
+  return promise.get_future().share();
+}
+
+}  // namespace
+
+AlignedBufferPool::AlignedBufferPool(size_t buffer_size, size_t max_idle)
+    : _buffer_size(std::max<size_t>(ALIGNMENT, (buffer_size + ALIGNMENT_MASK) & ~ALIGNMENT_MASK)),
+      _max_idle(max_idle) {
+}
+
+AlignedBufferPool::~AlignedBufferPool() {
+  for (uint8_t* data : _idle) {
+    std::free(data);
+  }
+}
+
+AlignedBufferPool::Buffer AlignedBufferPool::Acquire() {
+  uint8_t* data = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_idle.empty()) {
+      data = _idle.back();
+      _idle.pop_back();
+    }
+  }
+  
+  if (!data) {
+    data = static_cast<uint8_t*>(std::aligned_alloc(ALIGNMENT, _buffer_size));
+  }
+  return Buffer(data, Releaser{this});
+}
+
+void AlignedBufferPool::Release(uint8_t* data) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_idle.size() < _max_idle) {
+      _idle.push_back(data);
+      return;
+    }
+  }
+  std::free(data);
+}
+
+DirectFile::DirectFile(std::shared_ptr<AlignedBufferPool> buffers)
+    : _buffers(std::move(buffers)) {
+}
+
+DirectFile::~DirectFile() {
+  Close();
+}
+
+bool DirectFile::Open(const std::string& path, Mode mode, bool direct) {
+  Close();
+  
+  int flags = (mode == Mode::READ ? O_RDONLY : O_RDWR) | O_CLOEXEC;
+  if (mode == Mode::CREATE) {
+    flags |= O_CREAT | O_TRUNC;
+  }
+#ifdef O_DIRECT
+  if (direct) {
+    _fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+    _direct = _fd >= 0;
+  }
+#endif
+
+  // tmpfs and some network file systems refuse O_DIRECT
+  if (_fd < 0) {
+    _fd = ::open(path.c_str(), flags, 0644);
+  }
+  if (_fd < 0) {
+    return false;
+  }
+  _direct_on = _direct;
+  _drop_cache = direct;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (mode == Mode::READ) {
+    ::posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+
+  if (direct && !_direct) {
+    LOG_DEBUG("No direct I/O for ", path, ", dropping cached data instead");
+  }
+  return true;
+}
+
+void DirectFile::Close() {
+  if (_fd < 0) {
+    return;
+  }
+  
+  WaitInFlight();
+  DropCached();
+  ::close(_fd);
+  _fd = -1;
+  _direct = false;
+  _direct_on = false;
+  _drop_cache = false;
+  _io = nullptr;
+}
+
+bool DirectFile::ReadAt(uint64_t offset, uint8_t* data, size_t size) {
+  if (_fd < 0) {
+    return false;
+  }
+  
+  // Whole aligned blocks around the range; a short read ends at end of file
+  uint64_t begin = offset & ~ALIGNMENT_MASK;
+  uint64_t end = (offset + size + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+  if (!_direct || end - begin > _buffers->BufferSize()) {
+    return BufferedReadAt(offset, data, size);
+  }
+  
+  AlignedBufferPool::Buffer buffer = _buffers->Acquire();
+  if (!buffer || !SetDirect(true)) {
+    return BufferedReadAt(offset, data, size);
+  }
+  
+  uint64_t wanted = offset - begin + size;
+  uint64_t got = 0;
+  while (got < wanted && (got & ALIGNMENT_MASK) == 0) {
+    ssize_t result = ::pread(_fd, buffer.get() + got, end - begin - got,
+                             static_cast<off_t>(begin + got));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0 && errno == EINVAL) {
+      // The device wants a larger alignment
+      _direct = false;
+      return BufferedReadAt(offset, data, size);
+    }
+    if (result <= 0) {
+      break;
+    }
+    got += static_cast<uint64_t>(result);
+  }
+  
+  if (got < wanted) {
+    return false;
+  }
+  std::memcpy(data, buffer.get() + (offset - begin), size);
+  return true;
+}
+
+bool DirectFile::WriteAt(uint64_t offset, const uint8_t* data, size_t size) {
+  if (_fd < 0) {
+    return false;
+  }
+  
+  // The unaligned tail of a file can't be written directly
+  bool aligned = (offset & ALIGNMENT_MASK) == 0 && (size & ALIGNMENT_MASK) == 0;
+  if (!_direct || !aligned || size > _buffers->BufferSize()) {
+    return BufferedWriteAt(offset, data, size);
+  }
+  
+  AlignedBufferPool::Buffer buffer = _buffers->Acquire();
+  if (!buffer || !SetDirect(true)) {
+    return BufferedWriteAt(offset, data, size);
+  }
+  std::memcpy(buffer.get(), data, size);
+  
+  size_t written = 0;
+  while (written < size) {
+    ssize_t result = ::pwrite(_fd, buffer.get() + written, size - written,
+                              static_cast<off_t>(offset + written));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0 && errno == EINVAL && written == 0) {
+      _direct = false;
+      return BufferedWriteAt(offset, data, size);
+    }
+    if (result <= 0 || (static_cast<size_t>(result) & ALIGNMENT_MASK) != 0) {
+      return false;
+    }
+    written += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+void DirectFile::FindData(uint64_t offset, uint64_t& begin, uint64_t& end) {
+  struct stat info;
+  if (_fd < 0 || ::fstat(_fd, &info) != 0) {
+    begin = offset;
+    end = offset;
+    return;
+  }
+  
+  uint64_t file_size = static_cast<uint64_t>(info.st_size);
+  begin = std::min(offset, file_size);
+  end = file_size;
+  if (offset >= file_size) {
+    return;
+  }
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  off_t data = ::lseek(_fd, static_cast<off_t>(offset), SEEK_DATA);
+  if (data < 0) {
+    // ENXIO: nothing but a hole up to the end
+    if (errno == ENXIO) {
+      begin = file_size;
+    }
+    return;
+  }
+  
+  off_t hole = ::lseek(_fd, data, SEEK_HOLE);
+  begin = static_cast<uint64_t>(data);
+  end = hole < 0 ? file_size : static_cast<uint64_t>(hole);
+#endif
+}
+
+bool DirectFile::Zero(uint64_t offset, uint64_t size) {
+  struct stat info;
+  if (_fd < 0 || ::fstat(_fd, &info) != 0) {
+    return false;
+  }
+  
+  // Growing the file leaves a hole. A write in flight may grow it further,
+  // so wait for those before looking at the size again.
+  uint64_t end = offset + size;
+  uint64_t file_size = static_cast<uint64_t>(info.st_size);
+  if (end > file_size) {
+    WaitInFlight();
+    if (::fstat(_fd, &info) != 0) {
+      return false;
+    }
+    
+    file_size = static_cast<uint64_t>(info.st_size);
+    if (end > file_size && ::ftruncate(_fd, static_cast<off_t>(end)) != 0) {
+      return false;
+    }
+  }
+  
+  end = std::min(end, file_size);
+  if (offset >= end) {
+    return true;
+  }
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+  if (::fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset),
+                  static_cast<off_t>(end - offset)) == 0) {
+    return true;
+  }
+#endif
+
+  ByteBuffer zeros(std::min<uint64_t>(end - offset, _buffers->BufferSize()));
+  for (uint64_t at = offset; at < end; at += zeros.size()) {
+    if (!WriteAt(at, zeros.data(), std::min<uint64_t>(zeros.size(), end - at))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AsyncFileRequest DirectFile::ReadAsync(AsyncFileIo& io, uint64_t offset, size_t size) {
+  AsyncFileRequest request;
+  request.offset = offset;
+  request.size = size;
+  request.buffers = std::make_shared<AsyncFileRequest::Buffers>();
+  if (_fd < 0) {
+    request.result = Completed(-EBADF);
+    return request;
+  }
+  
+  // Whole aligned blocks around the range, as ReadAt does
+  uint64_t begin = offset & ~ALIGNMENT_MASK;
+  uint64_t end = (offset + size + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+  if (_direct && end - begin <= _buffers->BufferSize()) {
+    request.buffers->aligned = _buffers->Acquire();
+    if (request.buffers->aligned && SetDirect(true)) {
+      request.result = io.Read(_fd, begin, request.buffers->aligned.get(), end - begin,
+                               request.buffers).share();
+      _io = &io;
+      Track(request.result);
+      return request;
+    }
+    request.buffers->aligned.reset();
+  }
+  
+  request.buffers->data.resize(size);
+  if (_direct) {
+    // Reading through the cache means turning O_DIRECT off under requests
+    // in flight, so wait for them and read now
+    bool read = BufferedReadAt(offset, request.buffers->data.data(), size);
+    request.result = Completed(read ? static_cast<int64_t>(size) : -EIO);
+    return request;
+  }
+  
+  request.result = io.Read(_fd, offset, request.buffers->data.data(), size,
+                           request.buffers).share();
+  _io = &io;
+  Track(request.result);
+  return request;
+}
+
+AsyncFileRequest DirectFile::WriteAsync(AsyncFileIo& io, uint64_t offset, ByteBuffer data) {
+  AsyncFileRequest request;
+  request.offset = offset;
+  request.size = data.size();
+  request.write = true;
+  request.buffers = std::make_shared<AsyncFileRequest::Buffers>();
+  if (_fd < 0) {
+    request.result = Completed(-EBADF);
+    return request;
+  }
+  
+  bool aligned = (offset & ALIGNMENT_MASK) == 0 && (data.size() & ALIGNMENT_MASK) == 0;
+  if (_direct && aligned && data.size() <= _buffers->BufferSize()) {
+    request.buffers->aligned = _buffers->Acquire();
+    if (request.buffers->aligned && SetDirect(true)) {
+      std::memcpy(request.buffers->aligned.get(), data.data(), data.size());
+      request.result = io.Write(_fd, offset, request.buffers->aligned.get(), data.size(),
+                                request.buffers).share();
+      _io = &io;
+      Track(request.result);
+      return request;
+    }
+    request.buffers->aligned.reset();
+  }
+  
+  if (_direct) {
+    bool written = BufferedWriteAt(offset, data.data(), data.size());
+    request.result = Completed(written ? static_cast<int64_t>(data.size()) : -EIO);
+    return request;
+  }
+  
+  request.buffers->data = std::move(data);
+  request.result = io.Write(_fd, offset, request.buffers->data.data(), request.size,
+                            request.buffers).share();
+  _io = &io;
+  Track(request.result);
+  return request;
+}
+
+bool DirectFile::Finish(AsyncFileRequest& request) {
+  if (!request.buffers || !request.result.valid()) {
+    return false;
+  }
+  
+  if (_io && request.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    _io->Submit();
+  }
+  int64_t result = request.result.get();
+  AsyncFileRequest::Buffers& buffers = *request.buffers;
+  
+  if (buffers.aligned) {
+    uint64_t begin = request.offset & ~ALIGNMENT_MASK;
+    uint64_t wanted = request.write ? request.size : request.offset - begin + request.size;
+    bool done = result >= 0 && static_cast<uint64_t>(result) >= wanted;
+    
+    if (result == -EINVAL) {
+      // The device wants a larger alignment
+      _direct = false;
+    }
+    if (request.write) {
+      // Positioned writes can simply be repeated
+      return done || WriteAt(request.offset, buffers.aligned.get(), request.size);
+    }
+    
+    buffers.data.resize(request.size);
+    if (!done) {
+      // Short of the end of the file, or refused
+      return ReadAt(request.offset, buffers.data.data(), request.size);
+    }
+    std::memcpy(buffers.data.data(), buffers.aligned.get() + (request.offset - begin),
+                request.size);
+    buffers.aligned.reset();
+    return true;
+  }
+  
+  if (result < 0 || static_cast<size_t>(result) < request.size) {
+    if (request.write) {
+      return BufferedWriteAt(request.offset, buffers.data.data(), request.size);
+    }
+    return BufferedReadAt(request.offset, buffers.data.data(), request.size);
+  }
+  
+  AddCached(request.offset, request.size, request.write);
+  return true;
+}
+
+bool DirectFile::BufferedReadAt(uint64_t offset, uint8_t* data, size_t size) {
+  if (!SetDirect(false)) {
+    return false;
+  }
+  
+  size_t got = 0;
+  while (got < size) {
+    ssize_t result = ::pread(_fd, data + got, size - got, static_cast<off_t>(offset + got));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      break;
+    }
+    got += static_cast<size_t>(result);
+  }
+  
+  AddCached(offset, got, false);
+  return got == size;
+}
+
+bool DirectFile::BufferedWriteAt(uint64_t offset, const uint8_t* data, size_t size) {
+  if (!SetDirect(false)) {
+    return false;
+  }
+  
+  size_t written = 0;
+  while (written < size) {
+    ssize_t result = ::pwrite(_fd, data + written, size - written,
+                              static_cast<off_t>(offset + written));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return false;
+    }
+    written += static_cast<size_t>(result);
+  }
+  
+  AddCached(offset, size, true);
+  return true;
+}
+
+bool DirectFile::SetDirect(bool direct) {
+  if (direct == _direct_on) {
+    return true;
+  }
+  WaitInFlight();
+
+#ifdef O_DIRECT
+  int flags = ::fcntl(_fd, F_GETFL);
+  if (flags < 0 ||
+      ::fcntl(_fd, F_SETFL, direct ? flags | O_DIRECT : flags & ~O_DIRECT) != 0) {
+    return false;
+  }
+  _direct_on = direct;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void DirectFile::Track(const std::shared_future<int64_t>& result) {
+  _in_flight.erase(std::remove_if(_in_flight.begin(), _in_flight.end(),
+                                  [](const std::shared_future<int64_t>& request) {
+                                    return request.wait_for(std::chrono::seconds(0)) ==
+                                           std::future_status::ready;
+                                  }),
+                   _in_flight.end());
+  _in_flight.push_back(result);
+}
+
+void DirectFile::WaitInFlight() {
+  if (_in_flight.empty()) {
+    return;
+  }
+  
+  if (_io) {
+    _io->Submit();
+  }
+  for (const std::shared_future<int64_t>& request : _in_flight) {
+    request.wait();
+  }
+  _in_flight.clear();
+}
+
+void DirectFile::AddCached(uint64_t offset, uint64_t length, bool written) {
+  if (length == 0 || !_drop_cache) {
+    return;
+  }
+  
+  if (_cached_begin == _cached_end) {
+    _cached_begin = offset;
+    _cached_end = offset + length;
+  } else {
+    _cached_begin = std::min(_cached_begin, offset);
+    _cached_end = std::max(_cached_end, offset + length);
+  }
+  _cached_bytes += length;
+  _cached_dirty = _cached_dirty || written;
+  
+  if (_cached_bytes >= DROP_BATCH) {
+    DropCached();
+  }
+}
+
+void DirectFile::DropCached() {
+  if (_cached_begin == _cached_end) {
+    return;
+  }
+  
+  auto begin = static_cast<off_t>(_cached_begin);
+  auto length = static_cast<off_t>(_cached_end - _cached_begin);
+  
+  // Only clean pages can be dropped
+  if (_cached_dirty) {
+#ifdef SYNC_FILE_RANGE_WRITE
+    ::sync_file_range(_fd, begin, length,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                          SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    ::fdatasync(_fd);
+#endif
+  }
+
+#ifdef POSIX_FADV_DONTNEED
+  ::posix_fadvise(_fd, begin, length, POSIX_FADV_DONTNEED);
+#endif
+
+  _cached_begin = 0;
+  _cached_end = 0;
+  _cached_bytes = 0;
+  _cached_dirty = false;
+}
+
+}  // namespace linknet
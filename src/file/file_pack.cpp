@@ -0,0 +1,107 @@
+#include "linknet/file_pack.h"
+#include "linknet/logger.h"
+#include <algorithm>
+
+namespace linknet {
+
+namespace {
+
+constexpr size_t UNPACK_BUFFER_SIZE = 1024 * 1024;
+
+}  // namespace
+
+void FilePack::Add(const std::string& path, uint64_t size) {
+  _entries.push_back({path, _size, size});
+  _size += size;
+}
+
+bool FilePack::Read(uint64_t offset, uint8_t* data, size_t length) {
+  if (offset > _size || length > _size - offset) {
+    return false;
+  }
+  
+  // Last entry starting at or before offset. Empty files share their offset
+  // with the next file, which sorts after them.
+  auto it = std::upper_bound(_entries.begin(), _entries.end(), offset,
+                             [](uint64_t value, const PackEntry& entry) {
+                               return value < entry.offset;
+                             });
+  size_t index = static_cast<size_t>(it - _entries.begin()) - (it != _entries.begin() ? 1 : 0);
+  
+  while (length > 0) {
+    if (index >= _entries.size()) {
+      return false;
+    }
+    
+    const PackEntry& entry = _entries[index];
+    if (entry.size == 0 || offset >= entry.offset + entry.size) {
+      ++index;
+      continue;
+    }
+    
+    if (_open_index != index) {
+      _open_file.close();
+      _open_file.clear();
+      _open_file.open(entry.path, std::ios::binary);
+      _open_index = index;
+    }
+    
+    uint64_t within = offset - entry.offset;
+    size_t count = static_cast<size_t>(std::min<uint64_t>(length, entry.size - within));
+    _open_file.seekg(static_cast<std::streamoff>(within));
+    _open_file.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(count));
+    
+    if (!_open_file || static_cast<size_t>(_open_file.gcount()) != count) {
+      LOG_ERROR("Failed to read packed file: ", entry.path);
+      _open_index = std::numeric_limits<size_t>::max();
+      return false;
+    }
+    
+    data += count;
+    offset += count;
+    length -= count;
+    ++index;
+  }
+  
+  return true;
+}
+
+bool FilePack::Unpack(const std::string& pack_path) const {
+  std::ifstream pack(pack_path, std::ios::binary);
+  if (!pack) {
+    LOG_ERROR("Failed to open pack: ", pack_path);
+    return false;
+  }
+  
+  std::vector<char> buffer(UNPACK_BUFFER_SIZE);
+  
+  for (const auto& entry : _entries) {
+    std::ofstream output(entry.path, std::ios::binary | std::ios::trunc);
+    if (!output) {
+      LOG_ERROR("Failed to create file: ", entry.path);
+      return false;
+    }
+    
+    uint64_t remaining = entry.size;
+    while (remaining > 0) {
+      size_t count = static_cast<size_t>(std::min<uint64_t>(remaining, buffer.size()));
+      pack.read(buffer.data(), static_cast<std::streamsize>(count));
+      if (static_cast<size_t>(pack.gcount()) != count) {
+        LOG_ERROR("Pack ends before ", entry.path);
+        return false;
+      }
+      
+      output.write(buffer.data(), static_cast<std::streamsize>(count));
+      remaining -= count;
+    }
+    
+    if (!output) {
+      LOG_ERROR("Failed to write file: ", entry.path);
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+}  // namespace linknet
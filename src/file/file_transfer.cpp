@@ -1,379 +1,402 @@
 #include "linknet/file_transfer.h"
 #include "linknet/network.h"
 #include "linknet/message.h"
+#include "linknet/async_file_io.h"
+#include "linknet/chunk_bitmap.h"
+#include "linknet/compression.h"
+#include "linknet/content_chunker.h"
+#include "linknet/content_store.h"
+#include "linknet/crypto.h"
+#include "linknet/direct_file.h"
+#include "linknet/file_pack.h"
+#include "linknet/merkle_tree.h"
+#include "linknet/sharded_table.h"
+#include "linknet/throughput_meter.h"
+#include "linknet/transfer_scheduler.h"
+#include "linknet/worker_pool.h"
 #include "linknet/logger.h"
+#include <sodium.h>
+#include <atomic>
 #include <fstream>
 #include <mutex>
-#include <unordered_map>
+#include <condition_variable>
+#include <thread>
+#include <deque>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <filesystem>
 #include <algorithm>
 #include <chrono>
+#include <limits>
 #include <cstring>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 namespace linknet {
 
-// Message types for file transfer
-class FileChunkMessage : public Message {
+namespace {
+
+// Swarm downloads have no single sending peer. They are keyed and reported
+// with the all-zero peer ID.
+const PeerId SWARM_PEER_ID{};
+
+std::string ToHex(const ByteBuffer& bytes) {
+  std::stringstream ss;
+  for (uint8_t byte : bytes) {
+    ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
+  }
+  return ss.str();
+}
+
+bool IsAllZero(const ByteBuffer& data) {
+  return data.empty() ||
+         (data[0] == 0 && std::memcmp(data.data(), data.data() + 1, data.size() - 1) == 0);
+}
+
+// Random and nonzero; uniqueness is checked when the transfer is added to its
+// table
+TransferId NewTransferId() {
+  thread_local std::mt19937_64 generator(std::random_device{}());
+  TransferId transfer_id;
+  do {
+    transfer_id = generator();
+  } while (transfer_id == 0);
+  return transfer_id;
+}
+
+}  // namespace
+
+// Implementation of FileTransferManager
+class BasicFileTransferManager : public FileTransferManager {
  public:
-  FileChunkMessage(const PeerId& sender, 
-                  const std::string& file_id,
-                  uint32_t chunk_index,
-                  const ByteBuffer& data)
-      : Message(MessageType::FILE_CHUNK, sender),
-        _file_id(file_id),
-        _chunk_index(chunk_index),
-        _data(data) {}
+  static constexpr size_t DEFAULT_CHUNK_SIZE = 16 * 1024;  // 16 KB chunks
   
-  FileChunkMessage(const PeerId& sender)
-      : Message(MessageType::FILE_CHUNK, sender), _chunk_index(0) {}
+  // Receive progress is persisted after this many chunks or this much time,
+  // whichever comes first
+  static constexpr uint32_t CHECKPOINT_INTERVAL_CHUNKS = 256;
+  static constexpr std::chrono::seconds CHECKPOINT_INTERVAL{2};
   
-  const std::string& GetFileId() const { return _file_id; }
-  uint32_t GetChunkIndex() const { return _chunk_index; }
-  const ByteBuffer& GetData() const { return _data; }
+  // Suffix of the chunk bitmap stored next to a partial download
+  static constexpr const char* RESUME_SUFFIX = ".lnkpart";
   
-  ByteBuffer Serialize() const override {
-    // Header format:
-    // - 1 byte: MessageType
-    // - 32 bytes: PeerId
-    // - 16 bytes: MessageId
-    // - 8 bytes: Timestamp
-    // - 4 bytes: File ID length
-    // - N bytes: File ID
-    // - 4 bytes: Chunk index
-    // - 4 bytes: Data length
-    // - M bytes: Data
-    constexpr size_t HEADER_SIZE_WITHOUT_FILE_ID = 1 + 32 + 16 + 8 + 4 + 4 + 4;
-    
-    // Allocate buffer with room for header, file_id, and data
-    ByteBuffer buffer(HEADER_SIZE_WITHOUT_FILE_ID + _file_id.size() + _data.size());
-    
-    // Fill the header
-    buffer[0] = static_cast<uint8_t>(_type);
-    
-    // Copy PeerId
-    std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
-    
-    // Copy MessageId
-    std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
-    
-    // Copy Timestamp (network byte order)
-    uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
-    std::memcpy(buffer.data() + 49, &timestamp_network, 8);
-    
-    // Copy File ID length (network byte order)
-    uint32_t file_id_len_network = htobe32(static_cast<uint32_t>(_file_id.size()));
-    std::memcpy(buffer.data() + 57, &file_id_len_network, 4);
-    
-    // Copy File ID
-    std::copy(_file_id.begin(), _file_id.end(), buffer.begin() + 61);
-    
-    // Copy Chunk index (network byte order)
-    uint32_t chunk_index_network = htobe32(_chunk_index);
-    std::memcpy(buffer.data() + 61 + _file_id.size(), &chunk_index_network, 4);
-    
-    // Copy Data length (network byte order)
-    uint32_t data_len_network = htobe32(static_cast<uint32_t>(_data.size()));
-    std::memcpy(buffer.data() + 65 + _file_id.size(), &data_len_network, 4);
+  // Chunk hashes sent per FILE_CHUNK_HASHES message (128 KB of digests)
+  static constexpr uint32_t HASH_BATCH_SIZE = 4096;
+  
+  // Ranges of zero chunks sent per FILE_HOLES message
+  static constexpr uint32_t HOLE_BATCH_SIZE = 4096;
+  
+  // A chunk that fails verification this many times aborts the transfer
+  static constexpr uint32_t MAX_CHUNK_RETRIES = 3;
+  
+  // Files below this size are always sent in full
+  static constexpr uint64_t DELTA_MIN_FILE_SIZE = 256 * 1024;
+  
+  // Suffix of an earlier version set aside to seed a delta transfer
+  static constexpr const char* BASE_SUFFIX = ".lnkbase";
+  
+  // Delta manifest entries sent per FILE_DELTA_MANIFEST message
+  static constexpr uint32_t MANIFEST_BATCH_SIZE = 2048;
+  
+  // Swarm downloads hand out work in pieces of this many chunks (1 MB), and
+  // keep this many pieces requested from each source
+  static constexpr uint32_t SWARM_PIECE_CHUNKS = 64;
+  static constexpr size_t SWARM_PIECES_PER_SOURCE = 2;
+  
+  // Chunks of a finished swarm download arriving for this long afterwards
+  // are answers to endgame requests, not errors
+  static constexpr std::chrono::seconds FINISHED_SWARM_GRACE{30};
+  
+  // Files of a directory transfer below this size are packed into shared
+  // chunks; larger ones get a transfer of their own
+  static constexpr uint64_t DIRECTORY_PACK_THRESHOLD = 1024 * 1024;
+  
+  // Directory entries sent per FILE_DIRECTORY_MANIFEST message
+  static constexpr uint32_t DIRECTORY_BATCH_SIZE = 1024;
+  
+  // Suffix of the packed small files of a directory while they arrive
+  static constexpr const char* PACK_SUFFIX = ".lnkpack";
+  
+  // Chunks of a compressed or sealed transfer being encoded ahead of the
+  // one on the wire
+  static constexpr size_t COMPRESSION_AHEAD = 8;
+  
+  // Sealed chunks held back on the receiver until the ones before them in
+  // the stream arrive on another data connection
+  static constexpr size_t MAX_HELD_CHUNKS = 1024;
+  
+  // Progress reports per second per transfer, unless changed
+  static constexpr uint32_t DEFAULT_PROGRESS_RATE = 4;
+  
+  // Stall checks run at least this often while detection is on
+  static constexpr std::chrono::seconds MAX_STALL_CHECK_INTERVAL{1};
+  
+  // Chunk reads queued ahead of the wire per outgoing transfer, and chunk
+  // writes left in flight per incoming transfer
+  static constexpr size_t READ_AHEAD = 32;
+  static constexpr size_t WRITE_BEHIND = 32;
+  
+  explicit BasicFileTransferManager(std::shared_ptr<NetworkManager> network_manager)
+      : _network_manager(network_manager), _chunk_size(DEFAULT_CHUNK_SIZE),
+        _scheduler(DEFAULT_CHUNK_SIZE),
+        _io_buffers(std::make_shared<AlignedBufferPool>(DEFAULT_CHUNK_SIZE +
+                                                        AlignedBufferPool::ALIGNMENT)),
+        _file_io(AsyncFileIoFactory::Create()),
+        _running(true) {
+    
+    LOG_DEBUG("File I/O through ", _file_io->GetName());
+    
+    ByteBuffer zeros(_chunk_size);
+    _zero_chunk_hash = crypto::MerkleTree::HashLeaf(zeros.data(), zeros.size());
+    
+    for (CompressionType type : {CompressionType::ZLIB, CompressionType::LZ4,
+                                 CompressionType::ZSTD}) {
+      std::shared_ptr<const Compressor> compressor = CompressorFactory::Create(type);
+      if (compressor) {
+        _compressors.emplace(type, std::move(compressor));
+      }
+    }
     
-    // Copy Data
-    std::copy(_data.begin(), _data.end(), buffer.begin() + 69 + _file_id.size());
+    // Register for network messages
+    _network_manager->SetMessageCallback(
+        [this](std::unique_ptr<Message> message) {
+          HandleMessage(std::move(message));
+        });
     
-    return buffer;
+    _send_thread = std::thread(&BasicFileTransferManager::SendThreadFunc, this);
   }
-  
-  bool Deserialize(const ByteBuffer& data) override {
-    constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 4;  // Without file_id length
+
+  ~BasicFileTransferManager() override {
+    _running = false;
+    WakeSendThread();
     
-    if (data.size() < MIN_HEADER_SIZE) {
-      LOG_ERROR("FileChunkMessage: Buffer too small to deserialize");
-      return false;
+    if (_send_thread.joinable()) {
+      _send_thread.join();
     }
     
-    // Verify message type
-    MessageType type = static_cast<MessageType>(data[0]);
-    if (type != MessageType::FILE_CHUNK) {
-      LOG_ERROR("FileChunkMessage: Incorrect message type: ", static_cast<int>(type));
-      return false;
+    // Jobs still running on the workers answer nothing once stopped
+    {
+      std::unique_lock<std::mutex> lock(_send_mutex);
+      _send_cv.wait(lock, [this] { return _worker_jobs == 0; });
     }
     
-    // Copy PeerId
-    std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
-    
-    // Copy MessageId
-    std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
-    
-    // Copy Timestamp
-    uint64_t timestamp_network;
-    std::memcpy(&timestamp_network, data.data() + 49, 8);
-    _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
-    
-    // Get File ID length
-    uint32_t file_id_len_network;
-    std::memcpy(&file_id_len_network, data.data() + 57, 4);
-    uint32_t file_id_len = be32toh(file_id_len_network);
-    
-    if (data.size() < MIN_HEADER_SIZE + file_id_len + 8) {  // + 8 for chunk index and data length
-      LOG_ERROR("FileChunkMessage: Buffer too small for file_id and chunk info");
-      return false;
+    // Leave partial downloads resumable. Files are closed while the I/O
+    // backend their requests went to is still there.
+    for (const auto& transfer : _incoming_transfers.Snapshot()) {
+      std::lock_guard<std::mutex> lock(transfer->mutex);
+      Checkpoint(*transfer);
+      CloseFiles(*transfer);
+      RestoreDeltaBase(*transfer);
     }
-    
-    // Copy File ID
-    _file_id.assign(data.begin() + 61, data.begin() + 61 + file_id_len);
-    
-    // Copy Chunk index
-    uint32_t chunk_index_network;
-    std::memcpy(&chunk_index_network, data.data() + 61 + file_id_len, 4);
-    _chunk_index = be32toh(chunk_index_network);
-    
-    // Get Data length
-    uint32_t data_len_network;
-    std::memcpy(&data_len_network, data.data() + 65 + file_id_len, 4);
-    uint32_t data_len = be32toh(data_len_network);
-    
-    if (data.size() < MIN_HEADER_SIZE + file_id_len + 8 + data_len) {
-      LOG_ERROR("FileChunkMessage: Buffer too small for data");
-      return false;
+    for (const auto& transfer : _outgoing_transfers.Snapshot()) {
+      std::lock_guard<std::mutex> lock(transfer->mutex);
+      CloseFiles(*transfer);
     }
-    
-    // Copy Data
-    _data.assign(data.begin() + 69 + file_id_len, data.begin() + 69 + file_id_len + data_len);
-    
-    return true;
   }
-  
- private:
-  std::string _file_id;
-  uint32_t _chunk_index;
-  ByteBuffer _data;
-};
 
-class FileTransferCompleteMessage : public Message {
- public:
-  FileTransferCompleteMessage(const PeerId& sender, 
-                             const std::string& file_id,
-                             bool success,
-                             const std::string& error_message = "")
-      : Message(MessageType::FILE_TRANSFER_COMPLETE, sender),
-        _file_id(file_id),
-        _success(success),
-        _error_message(error_message) {}
-  
-  FileTransferCompleteMessage(const PeerId& sender)
-      : Message(MessageType::FILE_TRANSFER_COMPLETE, sender), _success(false) {}
-  
-  const std::string& GetFileId() const { return _file_id; }
-  bool IsSuccess() const { return _success; }
-  const std::string& GetErrorMessage() const { return _error_message; }
+  bool SendFile(const PeerId& peer_id, const std::string& file_path) override {
+    // Both sides identify the transfer by the name the receiver sees
+    std::string filename = std::filesystem::path(file_path).filename().string();
+    return SendFileAs(peer_id, file_path, filename);
+  }
   
-  ByteBuffer Serialize() const override {
-    // Header format:
-    // - 1 byte: MessageType
-    // - 32 bytes: PeerId
-    // - 16 bytes: MessageId
-    // - 8 bytes: Timestamp
-    // - 4 bytes: File ID length
-    // - N bytes: File ID
-    // - 1 byte: Success flag
-    // - 4 bytes: Error message length
-    // - M bytes: Error message
-    constexpr size_t HEADER_SIZE_WITHOUT_FILE_ID_ERROR = 1 + 32 + 16 + 8 + 4 + 1 + 4;
-    
-    // Allocate buffer with room for header, file_id, and error message
-    ByteBuffer buffer(HEADER_SIZE_WITHOUT_FILE_ID_ERROR + _file_id.size() + _error_message.size());
+  bool SendDirectory(const PeerId& peer_id, const std::string& directory_path) override {
+    namespace fs = std::filesystem;
     
-    // Fill the header
-    buffer[0] = static_cast<uint8_t>(_type);
-    
-    // Copy PeerId
-    std::copy(_sender.begin(), _sender.end(), buffer.begin() + 1);
+    std::error_code ec;
+    if (!fs::is_directory(directory_path, ec)) {
+      LOG_ERROR("Directory not found: ", directory_path);
+      return false;
+    }
     
-    // Copy MessageId
-    std::copy(_id.begin(), _id.end(), buffer.begin() + 33);
+    fs::path root = fs::absolute(directory_path, ec).lexically_normal();
+    if (!root.has_filename()) {
+      root = root.parent_path();
+    }
+    std::string directory_name = root.filename().string();
     
-    // Copy Timestamp (network byte order)
-    uint64_t timestamp_network = htobe64(static_cast<uint64_t>(_timestamp));
-    std::memcpy(buffer.data() + 49, &timestamp_network, 8);
+    std::vector<DirectoryEntry> entries;
+    if (!ListDirectory(root, entries)) {
+      LOG_ERROR("Failed to list directory: ", directory_path);
+      return false;
+    }
     
-    // Copy File ID length (network byte order)
-    uint32_t file_id_len_network = htobe32(static_cast<uint32_t>(_file_id.size()));
-    std::memcpy(buffer.data() + 57, &file_id_len_network, 4);
+    // Small files go back to back into one pack, in manifest order
+    FilePack pack;
+    std::vector<const DirectoryEntry*> large_files;
+    for (auto& entry : entries) {
+      if (entry.is_directory) {
+        continue;
+      }
+      if (entry.size < DIRECTORY_PACK_THRESHOLD) {
+        entry.packed = true;
+        pack.Add((root / entry.path).string(), entry.size);
+      } else {
+        large_files.push_back(&entry);
+      }
+    }
     
-    // Copy File ID
-    std::copy(_file_id.begin(), _file_id.end(), buffer.begin() + 61);
+    // The whole manifest goes out before any file so the receiver can create
+    // the tree in one pass
+    for (size_t first = 0; first == 0 || first < entries.size(); first += DIRECTORY_BATCH_SIZE) {
+      size_t count = std::min<size_t>(DIRECTORY_BATCH_SIZE, entries.size() - first);
+      std::vector<DirectoryEntry> batch(entries.begin() + first, entries.begin() + first + count);
+      bool last = first + count == entries.size();
+    
+      FileDirectoryManifestMessage manifest(peer_id, directory_name, static_cast<uint32_t>(first),
+                                            batch, last);
+      if (!_network_manager->SendMessage(peer_id, manifest)) {
+        LOG_ERROR("Failed to send directory manifest");
+        return false;
+      }
+      
+      if (last) {
+        break;
+      }
+    }
     
-    // Copy Success flag
-    buffer[61 + _file_id.size()] = _success ? 1 : 0;
+    LOG_INFO("Sending directory ", root.string(), ": ", entries.size(), " entries, ",
+             pack.GetEntries().size(), " packed files (", pack.Size(), " bytes), ",
+             large_files.size(), " large files");
     
-    // Copy Error message length (network byte order)
-    uint32_t error_len_network = htobe32(static_cast<uint32_t>(_error_message.size()));
-    std::memcpy(buffer.data() + 62 + _file_id.size(), &error_len_network, 4);
+    bool started = true;
+    if (!pack.GetEntries().empty()) {
+      started = SendPack(peer_id, root.string(), directory_name + "/", std::move(pack));
+    }
     
-    // Copy Error message
-    std::copy(_error_message.begin(), _error_message.end(), 
-             buffer.begin() + 66 + _file_id.size());
+    // Every large file is requested at once and streamed side by side
+    for (const auto* entry : large_files) {
+      started = SendFileAs(peer_id, (root / entry->path).string(),
+                           directory_name + "/" + entry->path) && started;
+    }
     
-    return buffer;
+    return started;
   }
   
-  bool Deserialize(const ByteBuffer& data) override {
-    constexpr size_t MIN_HEADER_SIZE = 1 + 32 + 16 + 8 + 4;  // Without file_id length
-    
-    if (data.size() < MIN_HEADER_SIZE) {
-      LOG_ERROR("FileTransferCompleteMessage: Buffer too small to deserialize");
-      return false;
-    }
-    
-    // Verify message type
-    MessageType type = static_cast<MessageType>(data[0]);
-    if (type != MessageType::FILE_TRANSFER_COMPLETE) {
-      LOG_ERROR("FileTransferCompleteMessage: Incorrect message type: ", static_cast<int>(type));
+  bool ShareFile(const std::string& file_path, ByteBuffer& content_hash) override {
+    if (!std::filesystem::is_regular_file(file_path)) {
+      LOG_ERROR("File not found: ", file_path);
       return false;
     }
     
-    // Copy PeerId
-    std::copy(data.begin() + 1, data.begin() + 33, _sender.begin());
-    
-    // Copy MessageId
-    std::copy(data.begin() + 33, data.begin() + 49, _id.begin());
-    
-    // Copy Timestamp
-    uint64_t timestamp_network;
-    std::memcpy(&timestamp_network, data.data() + 49, 8);
-    _timestamp = static_cast<std::time_t>(be64toh(timestamp_network));
-    
-    // Get File ID length
-    uint32_t file_id_len_network;
-    std::memcpy(&file_id_len_network, data.data() + 57, 4);
-    uint32_t file_id_len = be32toh(file_id_len_network);
-    
-    if (data.size() < MIN_HEADER_SIZE + file_id_len + 5) {  // + 5 for success flag and error length
-      LOG_ERROR("FileTransferCompleteMessage: Buffer too small for file_id and success info");
+    uint64_t file_size = std::filesystem::file_size(file_path);
+    if (ChunkCount(file_size) > std::numeric_limits<uint32_t>::max()) {
+      LOG_ERROR("File too large to share: ", file_path);
       return false;
     }
     
-    // Copy File ID
-    _file_id.assign(data.begin() + 61, data.begin() + 61 + file_id_len);
-    
-    // Copy Success flag
-    _success = data[61 + file_id_len] != 0;
-    
-    // Get Error message length
-    uint32_t error_len_network;
-    std::memcpy(&error_len_network, data.data() + 62 + file_id_len, 4);
-    uint32_t error_len = be32toh(error_len_network);
-    
-    if (data.size() < MIN_HEADER_SIZE + file_id_len + 5 + error_len) {
-      LOG_ERROR("FileTransferCompleteMessage: Buffer too small for error message");
+    SharedFile shared;
+    if (!crypto::MerkleTree::BuildFromFile(file_path, _chunk_size, shared.chunk_tree)) {
+      LOG_ERROR("Failed to hash file: ", file_path);
       return false;
     }
+    shared.file_path = file_path;
+    shared.file_size = file_size;
     
-    // Copy Error message
-    _error_message.assign(data.begin() + 66 + file_id_len, 
-                        data.begin() + 66 + file_id_len + error_len);
+    const crypto::Digest& root = shared.chunk_tree.GetRoot();
+    content_hash.assign(root.begin(), root.end());
+    std::string file_id = ToHex(content_hash);
     
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    _shared_files[file_id] = std::move(shared);
+    LOG_INFO("Sharing ", file_path, " as ", file_id);
     return true;
   }
   
- private:
-  std::string _file_id;
-  bool _success;
-  std::string _error_message;
-};
-
-// Implementation of FileTransferManager
-class BasicFileTransferManager : public FileTransferManager {
- public:
-  static constexpr size_t DEFAULT_CHUNK_SIZE = 16 * 1024;  // 16 KB chunks
-  
-  explicit BasicFileTransferManager(std::shared_ptr<NetworkManager> network_manager)
-      : _network_manager(network_manager), _chunk_size(DEFAULT_CHUNK_SIZE) {
-    
-    // Register for network messages
-    _network_manager->SetMessageCallback(
-        [this](std::unique_ptr<Message> message) {
-          HandleMessage(std::move(message));
-        });
-  }
-
-  ~BasicFileTransferManager() override = default;
-
-  bool SendFile(const PeerId& peer_id, const std::string& file_path) override {
-    // Check if file exists
-    if (!std::filesystem::exists(file_path)) {
-      LOG_ERROR("File not found: ", file_path);
+  bool DownloadFile(const ByteBuffer& content_hash, const std::string& filename) override {
+    if (content_hash.size() != crypto::DIGEST_SIZE) {
+      LOG_ERROR("Invalid content hash for swarm download");
       return false;
     }
     
-    // Get file size
-    uint64_t file_size = std::filesystem::file_size(file_path);
-    
-    // Generate a unique file ID (using the file path for simplicity)
-    std::string file_id = file_path;
-    std::string filename = std::filesystem::path(file_path).filename().string();
+    std::string safe_name = std::filesystem::path(filename).filename().string();
+    if (safe_name.empty() || safe_name != filename) {
+      LOG_ERROR("Invalid file name for swarm download: ", filename);
+      return false;
+    }
     
-    // Send file transfer request
-    FileTransferRequestMessage request(peer_id, filename, file_size);
-    bool sent = _network_manager->SendMessage(peer_id, request);
+    std::filesystem::path output_dir = std::filesystem::current_path() / "downloads";
+    std::filesystem::create_directories(output_dir);
+    std::string output_path = (output_dir / filename).string();
+    std::string file_id = ToHex(content_hash);
     
-    if (!sent) {
-      LOG_ERROR("Failed to send file transfer request");
-      return false;
+    for (const auto& other : _incoming_transfers.Snapshot()) {
+      if (other->swarm && other->file_id == file_id) {
+        LOG_ERROR("Already downloading ", file_id);
+        return false;
+      }
     }
     
-    // Store the transfer info
-    TransferInfo transfer_info;
-    transfer_info.file_path = file_path;
+    // Sized and opened once the first source answers
+    auto transfer = std::make_shared<TransferInfo>();
+    TransferInfo& transfer_info = *transfer;
+    transfer_info.file_path = output_path;
     transfer_info.file_id = file_id;
-    transfer_info.file_size = file_size;
-    transfer_info.peer_id = peer_id;
+    transfer_info.file_size = 0;
+    transfer_info.peer_id = SWARM_PEER_ID;
     transfer_info.status = FileTransferStatus::PENDING;
     transfer_info.bytes_transferred = 0;
     transfer_info.start_time = std::chrono::steady_clock::now();
+    transfer_info.resume_path = output_path + RESUME_SUFFIX;
+    transfer_info.last_checkpoint = transfer_info.start_time;
+    transfer_info.swarm = true;
+    transfer_info.verify_chunks = true;
+    std::copy(content_hash.begin(), content_hash.end(), transfer_info.expected_root.begin());
     
-    {
-      std::lock_guard<std::mutex> lock(_transfers_mutex);
-      _outgoing_transfers.emplace(std::make_pair(peer_id, file_id), std::move(transfer_info));
-    }
+    // Sources answer and serve under this ID
+    do {
+      transfer_info.transfer_id = NewTransferId();
+    } while (!_incoming_transfers.Insert(transfer_info.transfer_id, transfer));
     
-    LOG_INFO("File transfer request sent for ", filename);
+    FileSwarmQueryMessage query(SWARM_PEER_ID, transfer_info.transfer_id, content_hash);
+    _network_manager->BroadcastMessage(query);
+    
+    LOG_INFO("Looking for peers sharing ", file_id);
     return true;
   }
   
   void CancelTransfer(const PeerId& peer_id, const std::string& file_path) override {
-    std::string file_id = file_path;  // Same as in SendFile
-    
-    {
-      std::lock_guard<std::mutex> lock(_transfers_mutex);
-      
-      // Check outgoing transfers
-      auto out_it = _outgoing_transfers.find(std::make_pair(peer_id, file_id));
-      if (out_it != _outgoing_transfers.end()) {
-        out_it->second.status = FileTransferStatus::FAILED;
+    // Check outgoing transfers
+    auto outgoing = FindTransfer(_outgoing_transfers, peer_id, file_path);
+    if (outgoing) {
+      std::lock_guard<std::mutex> lock(outgoing->mutex);
+      if (IsActive(outgoing->status)) {
+        outgoing->status = FileTransferStatus::FAILED;
         
         // Notify the peer
-        FileTransferCompleteMessage complete(peer_id, file_id, false, "Transfer cancelled by sender");
+        FileTransferCompleteMessage complete(peer_id, outgoing->transfer_id, false,
+                                             "Transfer cancelled by sender");
         _network_manager->SendMessage(peer_id, complete);
         
-        _outgoing_transfers.erase(out_it);
+        EraseOutgoing(*outgoing);
         LOG_INFO("Outgoing file transfer cancelled: ", file_path);
         return;
       }
+    }
       
-      // Check incoming transfers
-      auto in_it = _incoming_transfers.find(std::make_pair(peer_id, file_id));
-      if (in_it != _incoming_transfers.end()) {
-        in_it->second.status = FileTransferStatus::FAILED;
+    // Check incoming transfers
+    auto incoming = FindTransfer(_incoming_transfers, peer_id, file_path);
+    if (incoming) {
+      std::lock_guard<std::mutex> lock(incoming->mutex);
+      if (IsActive(incoming->status)) {
+        incoming->status = FileTransferStatus::FAILED;
         
-        if (in_it->second.output_stream.is_open()) {
-          in_it->second.output_stream.close();
-        }
+        // Keep what was received so a later request can resume it
+        Checkpoint(*incoming);
+        CloseFiles(*incoming);
+        RestoreDeltaBase(*incoming);
         
-        // Notify the peer
-        FileTransferCompleteMessage complete(peer_id, file_id, false, "Transfer cancelled by receiver");
-        _network_manager->SendMessage(peer_id, complete);
+        // Notify the sending peers
+        NotifySenders(*incoming, false, "Transfer cancelled by receiver");
         
-        _incoming_transfers.erase(in_it);
+        if (IsDirectoryMember(incoming->file_id)) {
+          FailDirectoryMember(peer_id, incoming->file_id, "Transfer cancelled by receiver");
+        }
+        
+        _incoming_transfers.Erase(incoming->transfer_id, incoming.get());
         LOG_INFO("Incoming file transfer cancelled: ", file_path);
         return;
       }
@@ -382,43 +405,187 @@ class BasicFileTransferManager : public FileTransferManager {
     LOG_WARNING("No active transfer found for cancellation: ", file_path);
   }
   
-  std::vector<std::tuple<PeerId, std::string, FileTransferStatus, double>> 
+  bool SetTransferPriority(const PeerId& peer_id, const std::string& file_path,
+                           TransferPriority priority) override {
+    auto transfer = FindTransfer(_outgoing_transfers, peer_id, file_path);
+    if (!transfer) {
+      LOG_WARNING("No outgoing transfer found to prioritize: ", file_path);
+      return false;
+    }
+    
+    {
+      std::lock_guard<std::mutex> lock(transfer->mutex);
+      transfer->priority = priority;
+    }
+    WakeSendThread();
+    return true;
+  }
+  
+  void SetMaxConcurrentTransfers(size_t max_transfers) override {
+    _max_concurrent_transfers = max_transfers;
+    WakeSendThread();
+  }
+  
+  void SetUploadLimit(uint64_t bytes_per_second) override {
+    _upload_limit = bytes_per_second;
+    WakeSendThread();
+  }
+  
+  void SetCompressionEnabled(bool enabled) override {
+    _compression_enabled = enabled;
+  }
+  
+  void SetEncryption(std::shared_ptr<crypto::CryptoProvider> provider,
+                     uint32_t rekey_interval) override {
+    _rekey_interval = rekey_interval;
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    _stream_crypto = std::move(provider);
+  }
+  
+  void SetDirectIoThreshold(uint64_t min_file_size) override {
+    _direct_io_threshold = min_file_size;
+  }
+  
+  bool SetContentCache(const std::string& directory, uint64_t max_bytes) override {
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    if (max_bytes == 0) {
+      _content_store.reset();
+      return true;
+    }
+    
+    if (_content_store && _content_store->GetDirectory() == directory) {
+      _content_store->SetMaxBytes(max_bytes);
+      return true;
+    }
+    
+    auto store = std::make_shared<ContentStore>(directory, max_bytes);
+    if (!store->Open()) {
+      return false;
+    }
+    _content_store = std::move(store);
+    return true;
+  }
+  
+  std::vector<std::tuple<PeerId, std::string, FileTransferStatus, double>>
       GetOngoingTransfers() const override {
     std::vector<std::tuple<PeerId, std::string, FileTransferStatus, double>> result;
     
-    {
-      std::lock_guard<std::mutex> lock(_transfers_mutex);
-      
-      // Add outgoing transfers
-      for (const auto& [key, transfer] : _outgoing_transfers) {
+    // Add outgoing transfers, then incoming ones
+    for (const auto* table : {&_outgoing_transfers, &_incoming_transfers}) {
+      for (const auto& transfer : table->Snapshot()) {
+        std::lock_guard<std::mutex> lock(transfer->mutex);
         double progress = 0.0;
-        if (transfer.file_size > 0) {
-          progress = static_cast<double>(transfer.bytes_transferred) / transfer.file_size;
+        if (transfer->file_size > 0) {
+          progress = static_cast<double>(transfer->bytes_transferred) / transfer->file_size;
         }
         
-        result.emplace_back(transfer.peer_id, transfer.file_path, 
-                            transfer.status, progress);
+        result.emplace_back(transfer->peer_id, transfer->file_path,
+                            transfer->status, progress);
       }
-      
-      // Add incoming transfers
-      for (const auto& [key, transfer] : _incoming_transfers) {
-        double progress = 0.0;
-        if (transfer.file_size > 0) {
-          progress = static_cast<double>(transfer.bytes_transferred) / transfer.file_size;
-        }
+    }
+    
+    return result;
+  }
+  
+  std::vector<TransferStats> GetTransferStats() const override {
+    std::vector<TransferStats> result;
+    auto now = std::chrono::steady_clock::now();
+    
+    for (const auto* table : {&_outgoing_transfers, &_incoming_transfers}) {
+      for (const auto& transfer : table->Snapshot()) {
+        std::lock_guard<std::mutex> lock(transfer->mutex);
         
-        result.emplace_back(transfer.peer_id, transfer.file_path, 
-                            transfer.status, progress);
+        TransferStats stats;
+        stats.peer_id = transfer->peer_id;
+        stats.file_path = transfer->file_path;
+        stats.status = transfer->status;
+        stats.outgoing = table == &_outgoing_transfers;
+        stats.bytes_transferred = std::min(transfer->bytes_transferred, transfer->file_size);
+        stats.total_bytes = transfer->file_size;
+        stats.bytes_per_second = transfer->meter.CurrentRate(now);
+        stats.average_bytes_per_second = transfer->meter.AverageRate(now);
+        stats.eta_seconds = EstimateRemaining(*transfer, stats.average_bytes_per_second);
+        stats.chunks_in_flight = ChunksInFlight(*transfer);
+        stats.retransmits = transfer->retransmits;
+        stats.elapsed = now - transfer->start_time;
+        stats.since_progress = now - LastProgress(*transfer);
+        stats.stalled = transfer->stalled;
+        result.push_back(std::move(stats));
       }
     }
     
     return result;
   }
   
+  void SetStallTimeout(std::chrono::milliseconds timeout, bool fail_stalled) override {
+    {
+      std::lock_guard<std::mutex> lock(_send_mutex);
+      _stall_timeout = timeout;
+      _fail_stalled = fail_stalled;
+    }
+    WakeSendThread();
+  }
+  
+  void HandleMessage(std::unique_ptr<Message> message) override {
+    switch (message->GetType()) {
+      case MessageType::FILE_TRANSFER_REQUEST:
+        HandleFileTransferRequest(static_cast<FileTransferRequestMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_TRANSFER_RESPONSE:
+        HandleFileTransferResponse(static_cast<FileTransferResponseMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_CHUNK:
+        HandleFileChunk(static_cast<FileChunkMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_HOLES:
+        HandleFileHoles(static_cast<FileHolesMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_CHUNK_HASHES:
+        HandleFileChunkHashes(static_cast<FileChunkHashesMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_CHUNK_REQUEST:
+        HandleFileChunkRequest(static_cast<FileChunkRequestMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_DELTA_MANIFEST:
+        HandleFileDeltaManifest(static_cast<FileDeltaManifestMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_SWARM_QUERY:
+        HandleFileSwarmQuery(static_cast<FileSwarmQueryMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_SWARM_HAVE:
+        HandleFileSwarmHave(static_cast<FileSwarmHaveMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_DIRECTORY_MANIFEST:
+        HandleFileDirectoryManifest(static_cast<FileDirectoryManifestMessage&>(*message));
+        break;
+        
+      case MessageType::FILE_TRANSFER_COMPLETE:
+        HandleFileTransferComplete(static_cast<FileTransferCompleteMessage&>(*message));
+        break;
+        
+      default:
+        // Not a file transfer message
+        break;
+    }
+  }
+  
   void SetProgressCallback(FileTransferProgressCallback callback) override {
     _progress_callback = std::move(callback);
   }
   
+  void SetProgressRate(uint32_t updates_per_second) override {
+    _progress_rate = updates_per_second;
+  }
+  
   void SetCompletedCallback(FileTransferCompletedCallback callback) override {
     _completed_callback = std::move(callback);
   }
@@ -428,9 +595,49 @@ class BasicFileTransferManager : public FileTransferManager {
   }
 
  private:
-  mutable std::mutex _transfers_mutex;
-
+  // A chunk ready to go on the wire
+  struct EncodedChunk {
+    uint32_t chunk_index = 0;
+    CompressionType compression = CompressionType::NONE;
+    ByteBuffer data;
+    bool sealed = false;
+    uint32_t stream_index = 0;
+  };
+  
+  // The sealed stream of an outgoing transfer's chunks. Chunks are
+  // compressed on the workers side by side but sealed strictly in the order
+  // they were queued, each waiting for its turn; the pool runs jobs in
+  // submission order, so the chunk before is always already running.
+  struct ChunkStream {
+    ChunkStream(std::unique_ptr<crypto::StreamSealer> sealer, uint32_t rekey_interval)
+        : sealer(std::move(sealer)), rekey_interval(rekey_interval) {}
+    
+    std::mutex mutex;
+    std::condition_variable turn_cv;
+    std::unique_ptr<crypto::StreamSealer> sealer;
+    uint32_t rekey_interval;
+    uint32_t next_turn = 0;
+  };
+  
+  // A chunk being read ahead of the wire
+  struct ChunkRead {
+    uint32_t chunk_index = 0;
+    AsyncFileRequest request;
+  };
+  
+  // One side of a transfer. The ID, peer, path and file ID are fixed before
+  // the transfer is added to its table; everything else is guarded by mutex.
   struct TransferInfo {
+    ~TransferInfo() {
+      WipeStreamKey();
+    }
+    
+    void WipeStreamKey() {
+      sodium_memzero(stream_keys.private_key.data(), stream_keys.private_key.size());
+    }
+    
+    std::mutex mutex;
+    TransferId transfer_id = 0;
     std::string file_path;
     std::string file_id;
     uint64_t file_size;
@@ -438,353 +645,2921 @@ class BasicFileTransferManager : public FileTransferManager {
     FileTransferStatus status;
     uint64_t bytes_transferred;
     std::chrono::steady_clock::time_point start_time;
-    std::ifstream input_stream;
-    std::ofstream output_stream;
-    uint32_t next_chunk_index;
-    std::unordered_map<uint32_t, bool> received_chunks;
+    
+    // The file being sent or received. Files at or above the direct I/O
+    // threshold bypass the page cache.
+    std::unique_ptr<DirectFile> file;
+    
+    // Statistics: throughput, chunks sent or requested again, and when
+    // progress was last made and reported. A stalled transfer has made no
+    // progress within the stall timeout.
+    ThroughputMeter meter;
+    uint32_t retransmits = 0;
+    std::chrono::steady_clock::time_point last_progress;
+    std::chrono::steady_clock::time_point last_report;
+    bool stalled = false;
+    
+    // Sender side: chunk ranges the receiver still needs, sent front to back,
+    // and the chunk hashes that go out ahead of them. Chunks taken from
+    // pending_ranges are read from file in the background and sent from the
+    // front of reading.
+    std::deque<ChunkRange> pending_ranges;
+    std::deque<ChunkRead> reading;
+    crypto::MerkleTree chunk_tree;
+    uint32_t hashes_sent = 0;
+    
+    // Sender side: serving a swarm download, which pulls chunks on request
+    bool serving = false;
+    
+    // Sender side: sparse transfer, agreed with the receiver. Chunks that
+    // lie in a hole of the file or read as all zeros are collected in
+    // zero_ranges and go out as FILE_HOLES. The extent of data found last
+    // when looking from data_from is [data_begin, data_end).
+    bool sparse = false;
+    std::vector<ChunkRange> zero_ranges;
+    uint64_t data_from = 0;
+    uint64_t data_begin = 0;
+    uint64_t data_end = 0;
+    
+    // Sender side: share of the peer's upload relative to its other transfers
+    TransferPriority priority = TransferPriority::NORMAL;
+    
+    // Chunk compression codec agreed with the receiver. On the sender side,
+    // chunks taken from reading are compressed on the workers and sent from
+    // the front of compressing.
+    CompressionType compression = CompressionType::NONE;
+    uint8_t compression_offered = 0;
+    std::shared_ptr<const Compressor> compressor;
+    std::deque<std::future<EncodedChunk>> compressing;
+    
+    // Sealed stream of chunks, if the receiver took the one offered. The
+    // private key is wiped once the stream is keyed, and at the latest when
+    // the transfer goes away, however it ends. The sender numbers
+    // chunks as it queues them; the receiver holds back chunks that arrive
+    // ahead of next_stream_index and opens them in order.
+    std::shared_ptr<crypto::CryptoProvider> stream_crypto;
+    crypto::KeyPair stream_keys{};
+    crypto::Key stream_peer_key{};
+    bool sealed = false;
+    std::shared_ptr<ChunkStream> stream;
+    uint32_t stream_queued = 0;
+    std::unique_ptr<crypto::StreamOpener> opener;
+    uint32_t next_stream_index = 0;
+    std::map<uint32_t, EncodedChunk> held_chunks;
+    
+    // Sender side: content-defined chunk list, built and sent only when the
+    // receiver asks for a delta transfer
+    bool manifest_requested = false;
+    bool manifest_built = false;
+    std::vector<ContentChunk> manifest;
+    uint32_t manifest_sent = 0;
+    
+    // Sender side: the small files of a directory, read in place of file
+    std::unique_ptr<FilePack> pack;
+    
+    // Receiver side: chunks received and where that state is persisted.
+    // Chunks are marked when their write is queued; writes complete before
+    // the state is saved.
+    ChunkBitmap received_chunks;
+    std::deque<AsyncFileRequest> writing;
+    bool write_failed = false;
+    std::string resume_path;
+    uint32_t chunks_since_checkpoint = 0;
+    std::chrono::steady_clock::time_point last_checkpoint;
+    
+    // Receiver side: chunk verification. Chunks on disk before the hash list
+    // has been checked against the root are verified once it has.
+    bool verify_chunks = false;
+    crypto::Digest expected_root{};
+    std::vector<crypto::Digest> chunk_hashes;
+    uint32_t chunk_hashes_received = 0;
+    bool chunk_hashes_verified = false;
+    std::vector<uint32_t> unverified_chunks;
+    std::unordered_map<uint32_t, uint32_t> chunk_retries;
+    
+    // Receiver side: delta transfer. While base_path is set the sender's
+    // manifest is still arriving and no chunk data has been requested.
+    std::string base_path;
+    std::vector<uint32_t> manifest_lengths;
+    std::vector<crypto::Digest> manifest_hashes;
+    uint64_t manifest_bytes = 0;
+    
+    // Receiver side: swarm download. Pieces not yet handed to a source, the
+    // pieces each source is working on, and the source sending chunk hashes.
+    bool swarm = false;
+    std::deque<ChunkRange> unassigned_pieces;
+    std::map<PeerId, std::vector<ChunkRange>> swarm_sources;
+    PeerId hash_source{};
   };
   
-  void HandleMessage(std::unique_ptr<Message> message) {
-    switch (message->GetType()) {
-      case MessageType::FILE_TRANSFER_REQUEST:
-        HandleFileTransferRequest(static_cast<FileTransferRequestMessage&>(*message));
-        break;
-        
-      case MessageType::FILE_CHUNK:
-        HandleFileChunk(static_cast<FileChunkMessage&>(*message));
-        break;
+  // A file offered to swarm downloads, keyed by its content hash
+  struct SharedFile {
+    std::string file_path;
+    uint64_t file_size = 0;
+    crypto::MerkleTree chunk_tree;
+  };
+  
+  struct DigestHash {
+    size_t operator()(const crypto::Digest& digest) const {
+      size_t value;
+      std::memcpy(&value, digest.data(), sizeof(value));
+      return value;
+    }
+  };
+  
+  using TransferPtr = std::shared_ptr<TransferInfo>;
+  using TransferTable = ShardedTable<TransferInfo>;
+  
+  // A directory being received. Its files arrive as member transfers named
+  // "<directory>/<path>", and the packed small files as "<directory>/";
+  // members still to come are listed by path, with "" for the pack.
+  struct IncomingDirectory {
+    std::string root;
+    std::vector<DirectoryEntry> entries;
+    bool manifest_complete = false;
+    FilePack pack;
+    std::set<std::string> pending_members;
+  };
+  
+  using DirectoryMap = std::map<std::pair<PeerId, std::string>, IncomingDirectory>;
         
-      case MessageType::FILE_TRANSFER_COMPLETE:
-        HandleFileTransferComplete(static_cast<FileTransferCompleteMessage&>(*message));
-        break;
+  uint64_t ChunkCount(uint64_t file_size) const {
+    return (file_size + _chunk_size - 1) / _chunk_size;
+  }
         
-      default:
-        // Not a file transfer message
-        break;
+  uint64_t ChunkLength(uint64_t file_size, uint32_t chunk_index) const {
+    uint64_t offset = static_cast<uint64_t>(chunk_index) * _chunk_size;
+    return std::min<uint64_t>(_chunk_size, file_size - offset);
+  }
+        
+  // Bytes covered by a set of chunk ranges, accounting for a short last chunk
+  uint64_t RangeBytes(uint64_t file_size, const std::vector<ChunkRange>& ranges) const {
+    uint64_t bytes = 0;
+    for (const auto& range : ranges) {
+      uint64_t begin = static_cast<uint64_t>(range.first) * _chunk_size;
+      uint64_t end = std::min<uint64_t>(
+          (static_cast<uint64_t>(range.first) + range.count) * _chunk_size, file_size);
+      if (end > begin) {
+        bytes += end - begin;
+      }
+    }
+    return bytes;
+  }
+  
+  // Drop ranges, or the parts of them, that lie outside the file
+  std::vector<ChunkRange> ClampRanges(uint64_t file_size,
+                                      const std::vector<ChunkRange>& ranges) const {
+    uint32_t chunk_count = static_cast<uint32_t>(ChunkCount(file_size));
+    std::vector<ChunkRange> clamped;
+    for (const auto& range : ranges) {
+      if (range.first >= chunk_count || range.count == 0) {
+        continue;
+      }
+      clamped.push_back({range.first, std::min(range.count, chunk_count - range.first)});
+    }
+    return clamped;
+  }
+  
+  // Look a transfer up by the peer and either its local path or its file ID
+  static TransferPtr FindTransfer(const TransferTable& transfers, const PeerId& peer_id,
+                                  const std::string& path_or_id) {
+    for (const auto& transfer : transfers.Snapshot()) {
+      if (transfer->peer_id == peer_id &&
+          (transfer->file_id == path_or_id || transfer->file_path == path_or_id)) {
+        return transfer;
+      }
+    }
+    return nullptr;
+  }
+    
+  // Finished transfers are taken out of their table, but a handler may still
+  // hold a pointer to one
+  static bool IsActive(FileTransferStatus status) {
+    return status == FileTransferStatus::PENDING || status == FileTransferStatus::IN_PROGRESS;
+  }
+  
+  // Whether sender takes part in an incoming transfer. Swarm downloads
+  // accept messages from any of their sources.
+  static bool IsSender(const TransferInfo& transfer, const PeerId& sender) {
+    return transfer.swarm ? transfer.swarm_sources.count(sender) > 0 : transfer.peer_id == sender;
+  }
+  
+  std::shared_ptr<crypto::CryptoProvider> GetStreamCrypto() {
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    return _stream_crypto;
+  }
+  
+  // The public key this end of a transfer keys its chunk stream with, or
+  // nothing if the transfer isn't sealed
+  static ByteBuffer StreamKey(const TransferInfo& transfer) {
+    if (!transfer.stream_crypto) {
+      return {};
+    }
+    const crypto::Key& public_key = transfer.stream_keys.public_key;
+    return ByteBuffer(public_key.begin(), public_key.end());
+  }
+  
+  bool UseDirectIo(uint64_t file_size) const {
+    uint64_t threshold = _direct_io_threshold;
+    return threshold > 0 && file_size >= threshold;
+  }
+  
+  // Open a file being sent or received, bypassing the page cache if it is
+  // huge
+  std::unique_ptr<DirectFile> OpenFile(const std::string& path, DirectFile::Mode mode,
+                                       uint64_t file_size) {
+    auto file = std::make_unique<DirectFile>(_io_buffers);
+    if (!file->Open(path, mode, UseDirectIo(file_size))) {
+      return nullptr;
+    }
+    return file;
+  }
+  
+  std::shared_ptr<ContentStore> ContentCache() const {
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    return _content_store;
+  }
+  
+  // Whether the content cache has an entry for content_hash of file_size
+  bool HasCached(const ByteBuffer& content_hash, uint64_t file_size) {
+    std::shared_ptr<ContentStore> store = ContentCache();
+    if (!store || content_hash.size() != crypto::DIGEST_SIZE) {
+      return false;
+    }
+    
+    crypto::Digest hash;
+    std::copy(content_hash.begin(), content_hash.end(), hash.begin());
+    return store->Contains(hash, file_size);
+  }
+  
+  bool FetchCached(const ByteBuffer& content_hash, uint64_t file_size, const std::string& path) {
+    std::shared_ptr<ContentStore> store = ContentCache();
+    if (!store || content_hash.size() != crypto::DIGEST_SIZE) {
+      return false;
+    }
+    
+    crypto::Digest hash;
+    std::copy(content_hash.begin(), content_hash.end(), hash.begin());
+    return store->Fetch(hash, file_size, path);
+  }
+  
+  // Copying a file into the cache can take a while, so it happens on the
+  // workers. The file is no longer ours by then, so the copy is hashed again.
+  void AddToCache(const crypto::Digest& hash, const std::string& path) {
+    std::shared_ptr<ContentStore> store = ContentCache();
+    if (store) {
+      size_t chunk_size = _chunk_size;
+      _workers.Submit([store, hash, path, chunk_size] {
+        return store->Add(hash, path, chunk_size);
+      });
+    }
+  }
+  
+  bool OpenInput(TransferInfo& transfer) {
+    transfer.file = OpenFile(transfer.file_path, DirectFile::Mode::READ, transfer.file_size);
+    return transfer.file != nullptr;
+  }
+  
+  // Queue a write of a received chunk, finishing writes that completed and,
+  // past WRITE_BEHIND, the oldest one. Returns false once a write failed.
+  bool WriteChunk(TransferInfo& transfer, uint32_t chunk_index, ByteBuffer data) {
+    transfer.writing.push_back(transfer.file->WriteAsync(
+        *_file_io, static_cast<uint64_t>(chunk_index) * _chunk_size, std::move(data)));
+    _file_io->Submit();
+    
+    while (!transfer.writing.empty() &&
+           (transfer.writing.size() > WRITE_BEHIND ||
+            transfer.writing.front().result.wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready)) {
+      FinishWrite(transfer, transfer.writing.front());
+      transfer.writing.pop_front();
+    }
+    return !transfer.write_failed;
+  }
+  
+  // Wait for every chunk write in flight. Returns false once a write failed.
+  bool FlushWrites(TransferInfo& transfer) {
+    for (AsyncFileRequest& request : transfer.writing) {
+      FinishWrite(transfer, request);
+    }
+    transfer.writing.clear();
+    return !transfer.write_failed;
+  }
+  
+  // A chunk whose write failed is no longer received
+  void FinishWrite(TransferInfo& transfer, AsyncFileRequest& request) {
+    if (transfer.file->Finish(request)) {
+      return;
+    }
+    
+    uint32_t chunk_index = static_cast<uint32_t>(request.offset / _chunk_size);
+    if (chunk_index < transfer.received_chunks.Size() &&
+        transfer.received_chunks.Test(chunk_index)) {
+      transfer.received_chunks.Clear(chunk_index);
+      transfer.bytes_transferred -= std::min<uint64_t>(transfer.bytes_transferred, request.size);
+    }
+    transfer.write_failed = true;
+  }
+  
+  // Positioned access to the file being received
+  bool WriteOutput(TransferInfo& transfer, uint64_t offset, const uint8_t* data, size_t size) {
+    return FlushWrites(transfer) && transfer.file->WriteAt(offset, data, size);
+  }
+  
+  bool ReadOutput(TransferInfo& transfer, uint64_t offset, uint8_t* data, size_t size) {
+    return FlushWrites(transfer) && transfer.file->ReadAt(offset, data, size);
+  }
+  
+  // Requests in flight complete before the file closes. A stream key not
+  // used by now never will be.
+  static void CloseFiles(TransferInfo& transfer) {
+    transfer.reading.clear();
+    transfer.writing.clear();
+    transfer.file.reset();
+    transfer.WipeStreamKey();
+  }
+  
+  // Finish received data and persist the chunk bitmap. Writes complete
+  // first so the bitmap never claims chunks that are not yet in the file.
+  // Nothing is saved before a delta is applied; the earlier version is put
+  // back instead.
+  void Checkpoint(TransferInfo& transfer) {
+    if (!transfer.file || transfer.resume_path.empty() || !transfer.base_path.empty()) {
+      return;
+    }
+    
+    FlushWrites(transfer);
+    transfer.received_chunks.Save(transfer.resume_path, transfer.file_size,
+                                  static_cast<uint32_t>(_chunk_size));
+    transfer.chunks_since_checkpoint = 0;
+    transfer.last_checkpoint = std::chrono::steady_clock::now();
+  }
+  
+  // Reopen a partial download if its saved bitmap matches this file
+  bool OpenForResume(const std::string& output_path, uint64_t file_size,
+                     std::unique_ptr<DirectFile>& file, ChunkBitmap& received_chunks) {
+    if (!std::filesystem::exists(output_path) ||
+        !ChunkBitmap::Load(output_path + RESUME_SUFFIX, file_size,
+                           static_cast<uint32_t>(_chunk_size), received_chunks)) {
+      return false;
+    }
+    
+    file = OpenFile(output_path, DirectFile::Mode::READ_WRITE, file_size);
+    if (!file) {
+      LOG_WARNING("Cannot reopen partial download, starting over: ", output_path);
+      return false;
+    }
+    
+    return true;
+  }
+  
+  // Prepare chunk verification once the chunk count is known. Chunks kept
+  // from an earlier session are checked like new ones.
+  void StartVerification(TransferInfo& transfer) {
+    uint32_t chunk_count = transfer.received_chunks.Size();
+    transfer.chunk_hashes.resize(chunk_count);
+    transfer.chunk_hashes_verified = chunk_count == 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+      if (transfer.received_chunks.Test(i)) {
+        transfer.unverified_chunks.push_back(i);
+      }
+    }
+  }
+  
+  void MaybeCheckpoint(TransferInfo& transfer) {
+    if (transfer.chunks_since_checkpoint >= CHECKPOINT_INTERVAL_CHUNKS ||
+        std::chrono::steady_clock::now() - transfer.last_checkpoint >= CHECKPOINT_INTERVAL) {
+      Checkpoint(transfer);
     }
   }
   
   void HandleFileTransferRequest(const FileTransferRequestMessage& message) {
     const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
     const std::string& filename = message.GetFilename();
     uint64_t file_size = message.GetFileSize();
     
     LOG_INFO("Received file transfer request from peer: ", filename, " (", file_size, " bytes)");
     
+    // Never let the peer choose where the file lands. Members of a directory
+    // transfer go where its manifest put them.
+    std::filesystem::path output_dir = std::filesystem::current_path() / "downloads";
+    std::string output_path;
+    bool member = IsDirectoryMember(filename);
+    bool valid = ChunkCount(file_size) <= std::numeric_limits<uint32_t>::max() &&
+                 !_incoming_transfers.Find(transfer_id);
+    
+    if (member) {
+      valid = valid && ResolveDirectoryMember(sender, filename, output_path);
+    } else {
+      std::string safe_name = std::filesystem::path(filename).filename().string();
+      valid = valid && !safe_name.empty() && safe_name == filename;
+      output_path = (output_dir / filename).string();
+    }
+    
+    // A transfer into the same file from a dropped session of this peer, or
+    // of one no longer connected, is superseded by this one. One still
+    // running for another peer, or a swarm download, keeps the file.
+    std::vector<TransferPtr> stale;
+    if (valid) {
+      std::set<PeerId> connected;
+      for (const auto& peer : _network_manager->GetConnectedPeers()) {
+        connected.insert(peer.id);
+      }
+      
+      for (const auto& other : _incoming_transfers.Snapshot()) {
+        if (other->file_path != output_path) {
+          continue;
+        }
+        
+        std::lock_guard<std::mutex> other_lock(other->mutex);
+        if (!IsActive(other->status)) {
+          continue;
+        }
+        if (!other->swarm && (other->peer_id == sender || connected.count(other->peer_id) == 0)) {
+          stale.push_back(other);
+        } else {
+          LOG_WARNING("Another peer is already sending ", output_path);
+          valid = false;
+        }
+      }
+    }
+    
+    if (!valid) {
+      LOG_ERROR("Rejecting invalid file transfer request: ", filename);
+      FileTransferResponseMessage response(sender, transfer_id, false);
+      _network_manager->SendMessage(sender, response);
+      return;
+    }
+    
+    // Members were accepted along with their directory
     bool accept = true;
-    if (_request_callback) {
+    if (_request_callback && !member) {
       accept = _request_callback(sender, filename, file_size);
     }
     
     if (!accept) {
       LOG_INFO("File transfer request rejected by user");
-      FileTransferCompleteMessage response(sender, filename, false, "Transfer rejected by receiver");
+      FileTransferResponseMessage response(sender, transfer_id, false);
       _network_manager->SendMessage(sender, response);
       return;
     }
     
     // Create the output directory if it doesn't exist
-    std::filesystem::path output_dir = std::filesystem::current_path() / "downloads";
     std::filesystem::create_directories(output_dir);
     
-    // Prepare the output file
-    std::string output_path = (output_dir / filename).string();
-    std::ofstream output_stream(output_path, std::ios::binary | std::ios::trunc);
+    // Persist the progress of superseded transfers so it can be picked up
+    // when the request is answered
+    for (const auto& other : stale) {
+      std::lock_guard<std::mutex> other_lock(other->mutex);
+      if (IsActive(other->status)) {
+        LOG_INFO("Superseding stale incoming transfer: ", output_path);
+        other->status = FileTransferStatus::FAILED;
+        Checkpoint(*other);
+        CloseFiles(*other);
+        RestoreDeltaBase(*other);
+        _incoming_transfers.Erase(other->transfer_id, other.get());
+      }
+    }
+    
+    // Content received before is put in place from the cache, and nothing
+    // needs to be sent. Copying it can take a while, so it happens on the
+    // workers, which answer the request once it is done. A pack of small
+    // files is never cached.
+    bool packed = member && filename.back() == '/';
+    if (!packed && HasCached(message.GetContentHash(), file_size)) {
+      auto request = std::make_shared<FileTransferRequestMessage>(message);
+      {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        ++_worker_jobs;
+      }
+      _workers.Submit([this, request, output_path, packed] {
+        bool cached = FetchCached(request->GetContentHash(), request->GetFileSize(),
+                                  output_path);
+        if (_running) {
+          AcceptTransfer(*request, output_path, packed, cached);
+        }
+        
+        // The manager may be destroyed as soon as the lock is released
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        --_worker_jobs;
+        _send_cv.notify_all();
+      });
+      return;
+    }
+    
+    AcceptTransfer(message, output_path, packed, false);
+  }
+  
+  // Answer an accepted request for a file to be written at output_path,
+  // whose content was put in place from the cache if cached is set
+  void AcceptTransfer(const FileTransferRequestMessage& message, const std::string& output_path,
+                      bool packed, bool cached) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    const std::string& filename = message.GetFilename();
+    uint64_t file_size = message.GetFileSize();
+    const ByteBuffer& content_hash = message.GetContentHash();
+    std::string resume_path = output_path + RESUME_SUFFIX;
+    uint32_t chunk_count = static_cast<uint32_t>(ChunkCount(file_size));
+    
+    ChunkBitmap received_chunks;
+    std::unique_ptr<DirectFile> file;
+    bool resuming = !cached && OpenForResume(output_path, file_size, file, received_chunks);
+    
+    // Otherwise an earlier version of the file can seed a delta transfer.
+    // A pack of small files has no earlier version.
+    std::string base_path = output_path + BASE_SUFFIX;
+    bool delta = !cached && !resuming && !packed &&
+                 PrepareDeltaBase(output_path, base_path, file_size);
+    if (!delta) {
+      std::error_code ec;
+      std::filesystem::remove(base_path, ec);
+    }
+    
+    if (cached) {
+      received_chunks = ChunkBitmap(chunk_count);
+      for (uint32_t i = 0; i < chunk_count; ++i) {
+        received_chunks.Set(i);
+      }
+    } else if (!resuming) {
+      received_chunks = ChunkBitmap(chunk_count);
+      file = OpenFile(output_path, DirectFile::Mode::CREATE, file_size);
+    }
     
-    if (!output_stream) {
+    if (!cached && !file) {
+      if (delta) {
+        std::error_code ec;
+        std::filesystem::rename(base_path, output_path, ec);
+      }
       LOG_ERROR("Failed to create output file: ", output_path);
-      FileTransferCompleteMessage response(sender, filename, false, "Failed to create output file");
+      FileTransferCompleteMessage response(sender, transfer_id, false,
+                                           "Failed to create output file");
       _network_manager->SendMessage(sender, response);
       return;
     }
     
+    std::vector<ChunkRange> missing_ranges = received_chunks.MissingRanges();
+    
     // Store the transfer info
-    TransferInfo transfer_info;
+    auto transfer = std::make_shared<TransferInfo>();
+    TransferInfo& transfer_info = *transfer;
+    transfer_info.transfer_id = transfer_id;
     transfer_info.file_path = output_path;
-    transfer_info.file_id = filename;  // Using the filename as file_id for simplicity
+    transfer_info.file_id = filename;
     transfer_info.file_size = file_size;
     transfer_info.peer_id = sender;
     transfer_info.status = FileTransferStatus::IN_PROGRESS;
-    transfer_info.bytes_transferred = 0;
+    transfer_info.bytes_transferred = file_size - RangeBytes(file_size, missing_ranges);
     transfer_info.start_time = std::chrono::steady_clock::now();
-    transfer_info.output_stream = std::move(output_stream);
-    transfer_info.next_chunk_index = 0;
-    
-    {
-      std::lock_guard<std::mutex> lock(_transfers_mutex);
-      _incoming_transfers[std::make_pair(sender, filename)] = std::move(transfer_info);
+    transfer_info.file = std::move(file);
+    transfer_info.received_chunks = std::move(received_chunks);
+    transfer_info.resume_path = resume_path;
+    transfer_info.last_checkpoint = transfer_info.start_time;
+    
+    // Cached content was checked against the same hash when it was added
+    if (content_hash.size() == crypto::DIGEST_SIZE && !cached) {
+      transfer_info.verify_chunks = true;
+      std::copy(content_hash.begin(), content_hash.end(), transfer_info.expected_root.begin());
+      StartVerification(transfer_info);
+    } else if (!cached) {
+      LOG_WARNING("No content hash for ", filename, ", chunks will not be verified");
     }
     
-    LOG_INFO("File transfer accepted: ", output_path);
-  }
-  
-  void HandleFileChunk(const FileChunkMessage& message) {
-    const PeerId& sender = message.GetSender();
-    const std::string& file_id = message.GetFileId();
-    uint32_t chunk_index = message.GetChunkIndex();
-    const ByteBuffer& data = message.GetData();
-    
-    std::lock_guard<std::mutex> lock(_transfers_mutex);
-    auto it = _incoming_transfers.find(std::make_pair(sender, file_id));
-    
-    if (it == _incoming_transfers.end()) {
-      LOG_ERROR("Received chunk for unknown file transfer: ", file_id);
-      return;
+    if (delta) {
+      transfer_info.base_path = base_path;
     }
     
-    TransferInfo& transfer = it->second;
+    transfer_info.compression = CompressorFactory::Negotiate(message.GetCompressionTypes());
+    transfer_info.sparse = true;
+    
+    // A sealed stream is taken whenever encryption is on here too
+    const ByteBuffer& stream_key = message.GetStreamKey();
+    std::shared_ptr<crypto::CryptoProvider> stream_crypto = GetStreamCrypto();
+    if (stream_crypto && !cached && stream_key.size() == crypto::KEY_SIZE) {
+      transfer_info.stream_crypto = std::move(stream_crypto);
+      transfer_info.stream_keys = transfer_info.stream_crypto->GenerateKeyPair();
+      std::copy(stream_key.begin(), stream_key.end(), transfer_info.stream_peer_key.begin());
+      transfer_info.sealed = true;
+    }
     
-    // Skip if already received this chunk
-    if (transfer.received_chunks.find(chunk_index) != transfer.received_chunks.end()) {
-      LOG_WARNING("Received duplicate chunk: ", chunk_index);
+    // Nothing else can see the transfer until it is in the table
+    std::lock_guard<std::mutex> lock(transfer_info.mutex);
+    if (!_incoming_transfers.Insert(transfer_id, transfer)) {
+      LOG_ERROR("Rejecting file transfer request with a transfer ID in use: ", filename);
+      FileTransferResponseMessage response(sender, transfer_id, false);
+      _network_manager->SendMessage(sender, response);
       return;
     }
     
-    // Write the chunk to the file at the right position
-    transfer.output_stream.seekp(chunk_index * _chunk_size);
-    transfer.output_stream.write(reinterpret_cast<const char*>(data.data()), data.size());
-    
-    if (!transfer.output_stream) {
-      LOG_ERROR("Failed to write chunk to file: ", transfer.file_path);
-      FileTransferCompleteMessage response(sender, file_id, false, "Failed to write to output file");
+    if (delta) {
+      LOG_INFO("Found earlier version of ", filename, ", requesting delta manifest");
+      FileTransferResponseMessage response(sender, transfer_id, true, {}, true,
+                                           transfer_info.compression, false,
+                                           transfer_info.sparse, StreamKey(transfer_info));
       _network_manager->SendMessage(sender, response);
-      transfer.status = FileTransferStatus::FAILED;
-      transfer.output_stream.close();
-      _incoming_transfers.erase(it);
-      
-      if (_completed_callback) {
-        _completed_callback(sender, transfer.file_path, false, "Failed to write to output file");
-      }
-      
       return;
     }
     
-    // Mark this chunk as received
-    transfer.received_chunks[chunk_index] = true;
-    transfer.bytes_transferred += data.size();
-    
-    // Update progress
-    if (_progress_callback) {
-      double progress = static_cast<double>(transfer.bytes_transferred) / transfer.file_size;
-      _progress_callback(sender, transfer.file_path, progress);
+    if (cached) {
+      LOG_INFO("Already have ", filename, ", taken from the content cache: ", output_path);
+    } else if (resuming) {
+      LOG_INFO("Resuming file transfer: ", output_path, " (",
+               transfer_info.received_chunks.Count(), "/", chunk_count, " chunks present)");
+    } else {
+      LOG_INFO("File transfer accepted: ", output_path);
     }
     
-    // Check if transfer is complete
-    if (transfer.bytes_transferred >= transfer.file_size) {
-      LOG_INFO("File transfer complete: ", transfer.file_path);
-      transfer.status = FileTransferStatus::COMPLETED;
-      transfer.output_stream.close();
-      
-      FileTransferCompleteMessage response(sender, file_id, true);
-      _network_manager->SendMessage(sender, response);
-      
-      if (_completed_callback) {
-        _completed_callback(sender, transfer.file_path, true, "");
-      }
-      
-      _incoming_transfers.erase(it);
+    FileTransferResponseMessage response(sender, transfer_id, true, missing_ranges, false,
+                                         transfer_info.compression, cached, transfer_info.sparse,
+                                         StreamKey(transfer_info));
+    _network_manager->SendMessage(sender, response);
+    
+    // Nothing left to receive (empty file, or the previous session got
+    // every chunk but dropped before confirming)
+    if (IsFullyReceived(transfer_info)) {
+      CompleteIncoming(transfer_info);
     }
   }
   
-  void HandleFileTransferComplete(const FileTransferCompleteMessage& message) {
+  void HandleFileTransferResponse(const FileTransferResponseMessage& message) {
     const PeerId& sender = message.GetSender();
-    const std::string& file_id = message.GetFileId();
-    bool success = message.IsSuccess();
-    const std::string& error_message = message.GetErrorMessage();
+    TransferId transfer_id = message.GetTransferId();
     
-    std::lock_guard<std::mutex> lock(_transfers_mutex);
-    auto it = _outgoing_transfers.find(std::make_pair(sender, file_id));
-    
-    if (it == _outgoing_transfers.end()) {
-      LOG_ERROR("Received completion for unknown file transfer: ", file_id);
+    auto found = _outgoing_transfers.Find(transfer_id);
+    if (!found || found->peer_id != sender) {
+      LOG_ERROR("Received response for unknown file transfer: ", transfer_id);
       return;
     }
     
-    TransferInfo& transfer = it->second;
+    TransferInfo& transfer = *found;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
     
-    if (success) {
-      LOG_INFO("File transfer confirmed complete by receiver: ", transfer.file_path);
-      transfer.status = FileTransferStatus::COMPLETED;
-      
-      if (_completed_callback) {
-        _completed_callback(sender, transfer.file_path, true, "");
+    if (transfer.status != FileTransferStatus::PENDING) {
+      if (IsActive(transfer.status)) {
+        LOG_WARNING("Ignoring duplicate response for file transfer: ", transfer.file_id);
       }
-    } else {
-      LOG_ERROR("File transfer failed: ", transfer.file_path, ": ", error_message);
-      transfer.status = FileTransferStatus::FAILED;
+      return;
+    }
+    
+    if (!message.IsAccepted()) {
+      LOG_INFO("File transfer rejected by receiver: ", transfer.file_path);
+      transfer.status = FileTransferStatus::REJECTED;
       
       if (_completed_callback) {
-        _completed_callback(sender, transfer.file_path, false, error_message);
+        _completed_callback(sender, transfer.file_path, false, "Transfer rejected by receiver");
       }
+      
+      EraseOutgoing(transfer);
+      return;
     }
     
-    // Close any open streams
-    if (transfer.input_stream.is_open()) {
-      transfer.input_stream.close();
+    // The receiver answers again once it has matched the manifest against
+    // its earlier version
+    if (message.IsManifestRequested()) {
+      LOG_INFO("Receiver has an earlier version, sending delta manifest: ", transfer.file_path);
+      transfer.manifest_requested = true;
+      WakeSendThread();
+      return;
     }
     
-    _outgoing_transfers.erase(it);
-  }
-  
-  void StartSendingFile(const PeerId& peer_id, const std::string& file_id) {
-    std::lock_guard<std::mutex> lock(_transfers_mutex);
-    auto it = _outgoing_transfers.find(std::make_pair(peer_id, file_id));
+    // Nothing is sent for content the receiver already had; it confirms
+    // right away
+    if (message.IsCached()) {
+      LOG_INFO("Receiver already has ", transfer.file_path, " in its cache");
+      transfer.hashes_sent = static_cast<uint32_t>(transfer.chunk_tree.LeafCount());
+      transfer.bytes_transferred = transfer.file_size;
+      transfer.status = FileTransferStatus::IN_PROGRESS;
+      transfer.last_progress = std::chrono::steady_clock::now();
+      return;
+    }
     
-    if (it == _outgoing_transfers.end()) {
-      LOG_ERROR("Cannot start sending unknown file: ", file_id);
+    if (!transfer.pack && !OpenInput(transfer)) {
+      FailOutgoing(transfer, "Failed to open file for reading");
       return;
     }
     
-    TransferInfo& transfer = it->second;
+    std::vector<ChunkRange> missing_ranges = ClampRanges(transfer.file_size,
+                                                         message.GetMissingRanges());
     
-    if (!transfer.input_stream.is_open()) {
-      transfer.input_stream.open(transfer.file_path, std::ios::binary);
-      if (!transfer.input_stream) {
-        LOG_ERROR("Failed to open file for reading: ", transfer.file_path);
-        FileTransferCompleteMessage complete(peer_id, file_id, false, "Failed to open file for reading");
-        _network_manager->SendMessage(peer_id, complete);
-        transfer.status = FileTransferStatus::FAILED;
-        _outgoing_transfers.erase(it);
-        
-        if (_completed_callback) {
-          _completed_callback(peer_id, transfer.file_path, false, "Failed to open file for reading");
-        }
-        
+    transfer.pending_ranges.assign(missing_ranges.begin(), missing_ranges.end());
+    transfer.bytes_transferred = transfer.file_size - RangeBytes(transfer.file_size, missing_ranges);
+    transfer.sparse = message.IsSparse();
+    transfer.status = FileTransferStatus::IN_PROGRESS;
+    transfer.last_progress = std::chrono::steady_clock::now();
+    
+    // Only a codec that was offered can be agreed on
+    CompressionType compression = message.GetCompression();
+    auto compressor = _compressors.find(compression);
+    if (compressor != _compressors.end() &&
+        (transfer.compression_offered & (1 << static_cast<int>(compression)))) {
+      transfer.compression = compression;
+      transfer.compressor = compressor->second;
+    }
+    
+    // Chunks are sealed if the receiver took the stream offered
+    const ByteBuffer& stream_key = message.GetStreamKey();
+    if (transfer.stream_crypto && stream_key.size() == crypto::KEY_SIZE) {
+      crypto::Key peer_key;
+      std::copy(stream_key.begin(), stream_key.end(), peer_key.begin());
+      auto sealer = transfer.stream_crypto->CreateStreamSealer(transfer.stream_keys, peer_key);
+      transfer.WipeStreamKey();
+      if (!sealer) {
+        FailOutgoing(transfer, "Failed to key the chunk stream");
         return;
       }
+      transfer.stream = std::make_shared<ChunkStream>(std::move(sealer), _rekey_interval);
+    } else if (transfer.stream_crypto) {
+      LOG_WARNING("Receiver doesn't seal chunks, sending unsealed: ", transfer.file_path);
     }
     
-    transfer.status = FileTransferStatus::IN_PROGRESS;
-    transfer.next_chunk_index = 0;
+    if (transfer.bytes_transferred > 0) {
+      LOG_INFO("Receiver already has ", transfer.bytes_transferred, "/", transfer.file_size,
+               " bytes of ", transfer.file_path);
+    } else {
+      LOG_INFO("File transfer accepted by receiver: ", transfer.file_path);
+    }
     
-    // Start sending the file in chunks
-    SendNextChunk(peer_id, file_id);
+    WakeSendThread();
   }
   
-  void SendNextChunk(const PeerId& peer_id, const std::string& file_id) {
-    std::lock_guard<std::mutex> lock(_transfers_mutex);
-    auto it = _outgoing_transfers.find(std::make_pair(peer_id, file_id));
-    
-    if (it == _outgoing_transfers.end()) {
-      return;  // Transfer was cancelled
+  void HandleFileChunk(const FileChunkMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    
+    auto found = _incoming_transfers.Find(transfer_id);
+    if (!found) {
+      // Endgame requests can still be in flight when a swarm download ends
+      std::lock_guard<std::mutex> state_lock(_state_mutex);
+      PruneFinishedSwarms();
+      if (std::none_of(_finished_swarms.begin(), _finished_swarms.end(),
+                       [&](const auto& finished) { return finished.first == transfer_id; })) {
+        LOG_ERROR("Received chunk for unknown file transfer: ", transfer_id);
+      }
+      return;
     }
     
-    TransferInfo& transfer = it->second;
+    TransferInfo& transfer = *found;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
     
-    if (transfer.status != FileTransferStatus::IN_PROGRESS) {
-      return;  // Transfer is not in progress
+    if (!IsActive(transfer.status)) {
+      return;  // Finished while the chunk was in flight
     }
     
-    if (!transfer.input_stream.is_open()) {
-      LOG_ERROR("File stream not open for sending chunks");
+    if (!IsSender(transfer, sender)) {
+      LOG_ERROR("Received chunk for unknown file transfer: ", transfer_id);
       return;
     }
     
-    // Seek to the right position
-    uint64_t pos = transfer.next_chunk_index * _chunk_size;
-    transfer.input_stream.seekg(pos);
-    
-    if (!transfer.input_stream) {
-      LOG_ERROR("Failed to seek in file: ", transfer.file_path);
-      FileTransferCompleteMessage complete(peer_id, file_id, false, "Failed to read from file");
-      _network_manager->SendMessage(peer_id, complete);
-      transfer.status = FileTransferStatus::FAILED;
-      transfer.input_stream.close();
-      _outgoing_transfers.erase(it);
-      
-      if (_completed_callback) {
-        _completed_callback(peer_id, transfer.file_path, false, "Failed to read from file");
-      }
-      
+    if (message.IsSealed() != transfer.sealed) {
+      LOG_ERROR("Received ", message.IsSealed() ? "sealed" : "unsealed", " chunk ",
+                message.GetChunkIndex(), " for ", transfer.file_id);
       return;
     }
     
-    // Read a chunk
-    ByteBuffer chunk(_chunk_size);
-    transfer.input_stream.read(reinterpret_cast<char*>(chunk.data()), _chunk_size);
-    std::streamsize bytes_read = transfer.input_stream.gcount();
-    
-    if (bytes_read == 0) {
-      // End of file reached
-      if (transfer.bytes_transferred >= transfer.file_size) {
-        LOG_INFO("File sending complete: ", transfer.file_path);
-        transfer.status = FileTransferStatus::COMPLETED;
-        transfer.input_stream.close();
-        
-        if (_completed_callback) {
-          _completed_callback(peer_id, transfer.file_path, true, "");
-        }
-        
-        _outgoing_transfers.erase(it);
-      } else {
-        LOG_ERROR("Unexpected end of file: ", transfer.file_path);
-        FileTransferCompleteMessage complete(peer_id, file_id, false, "Unexpected end of file");
-        _network_manager->SendMessage(peer_id, complete);
-        transfer.status = FileTransferStatus::FAILED;
-        transfer.input_stream.close();
-        _outgoing_transfers.erase(it);
-        
-        if (_completed_callback) {
-          _completed_callback(peer_id, transfer.file_path, false, "Unexpected end of file");
-        }
-      }
-      
+    if (!transfer.sealed) {
+      ReceiveChunk(transfer, sender, message.GetChunkIndex(), message.GetCompression(),
+                   message.GetData());
       return;
     }
     
-    // Resize chunk to actual bytes read
-    chunk.resize(bytes_read);
-    
-    // Send the chunk
-    FileChunkMessage chunk_msg(peer_id, file_id, transfer.next_chunk_index, chunk);
-    bool sent = _network_manager->SendMessage(peer_id, chunk_msg);
-    
-    if (!sent) {
-      LOG_ERROR("Failed to send file chunk: ", transfer.file_path);
-      FileTransferCompleteMessage complete(peer_id, file_id, false, "Failed to send file chunk");
-      _network_manager->SendMessage(peer_id, complete);
-      transfer.status = FileTransferStatus::FAILED;
-      transfer.input_stream.close();
-      _outgoing_transfers.erase(it);
-      
-      if (_completed_callback) {
-        _completed_callback(peer_id, transfer.file_path, false, "Failed to send file chunk");
-      }
-      
+    uint32_t stream_index = message.GetStreamIndex();
+    if (stream_index < transfer.next_stream_index ||
+        transfer.held_chunks.count(stream_index) > 0) {
+      LOG_ERROR("Received sealed chunk ", stream_index, " of ", transfer.file_id, " twice");
       return;
     }
     
-    // Update progress
-    transfer.bytes_transferred += bytes_read;
-    transfer.next_chunk_index++;
-    
-    if (_progress_callback) {
-      double progress = static_cast<double>(transfer.bytes_transferred) / transfer.file_size;
-      _progress_callback(peer_id, transfer.file_path, progress);
+    if (transfer.held_chunks.size() >= MAX_HELD_CHUNKS) {
+      FailIncoming(transfer, "Sealed chunks arrived too far out of order");
+      return;
     }
     
-    // Check if we're done
-    if (transfer.bytes_transferred >= transfer.file_size) {
-      LOG_INFO("File sending complete: ", transfer.file_path);
-      transfer.status = FileTransferStatus::COMPLETED;
-      transfer.input_stream.close();
+    EncodedChunk& held = transfer.held_chunks[stream_index];
+    held.chunk_index = message.GetChunkIndex();
+    held.compression = message.GetCompression();
+    held.data = message.GetData();
+    
+    // Open every chunk that is now next in the stream
+    while (IsActive(transfer.status) && !transfer.held_chunks.empty() &&
+           transfer.held_chunks.begin()->first == transfer.next_stream_index) {
+      EncodedChunk chunk = std::move(transfer.held_chunks.begin()->second);
+      transfer.held_chunks.erase(transfer.held_chunks.begin());
+      transfer.next_stream_index++;
       
-      if (_completed_callback) {
-        _completed_callback(peer_id, transfer.file_path, true, "");
+      ByteBuffer opened;
+      if (!OpenChunk(transfer, chunk.data, opened)) {
+        FailIncoming(transfer, "File chunk failed to authenticate");
+        return;
       }
-      
-      _outgoing_transfers.erase(it);
-    } else {
-      // Send next chunk
-      SendNextChunk(peer_id, file_id);
+      ReceiveChunk(transfer, sender, chunk.chunk_index, chunk.compression, std::move(opened));
     }
   }
-  std::shared_ptr<NetworkManager> _network_manager;
-
-  std::map<std::pair<PeerId, std::string>, TransferInfo> _outgoing_transfers;
-  std::map<std::pair<PeerId, std::string>, TransferInfo> _incoming_transfers;
-
-  size_t _chunk_size;
+  
+  // Open the next sealed chunk of a transfer. The first chunk of the stream
+  // carries its header in front.
+  bool OpenChunk(TransferInfo& transfer, const ByteBuffer& sealed, ByteBuffer& opened) {
+    const uint8_t* data = sealed.data();
+    size_t size = sealed.size();
+    if (!transfer.opener) {
+      if (size < crypto::StreamSealer::HEADER_SIZE) {
+        return false;
+      }
+      transfer.opener = transfer.stream_crypto->CreateStreamOpener(
+          transfer.stream_keys, transfer.stream_peer_key, data);
+      transfer.WipeStreamKey();
+      if (!transfer.opener) {
+        return false;
+      }
+      data += crypto::StreamSealer::HEADER_SIZE;
+      size -= crypto::StreamSealer::HEADER_SIZE;
+    }
+    
+    if (size < crypto::StreamSealer::OVERHEAD) {
+      return false;
+    }
+    opened.resize(size - crypto::StreamSealer::OVERHEAD);
+    return transfer.opener->Pull(data, size, opened.data());
+  }
+  
+  // Check, decompress and write a chunk of an incoming transfer. Caller
+  // must hold the transfer's lock.
+  void ReceiveChunk(TransferInfo& transfer, const PeerId& sender, uint32_t chunk_index,
+                    CompressionType compression, ByteBuffer data) {
+    const std::string& file_id = transfer.file_id;
+    if (transfer.status != FileTransferStatus::IN_PROGRESS ||
+        chunk_index >= transfer.received_chunks.Size()) {
+      LOG_ERROR("Received malformed chunk ", chunk_index, " for ", file_id);
+      return;
+    }
+    
+    // Skip if already received this chunk (expected in a swarm endgame,
+    // where the same chunk is requested from more than one source)
+    if (transfer.received_chunks.Test(chunk_index)) {
+      if (!transfer.swarm) {
+        LOG_WARNING("Received duplicate chunk: ", chunk_index);
+      }
+      return;
+    }
+    
+    // Compressed chunks are checked once expanded
+    uint64_t chunk_length = ChunkLength(transfer.file_size, chunk_index);
+    if (compression != CompressionType::NONE) {
+      auto compressor = _compressors.find(compression);
+      if (compressor == _compressors.end()) {
+        LOG_ERROR("Received chunk ", chunk_index, " of ", file_id, " with an unknown codec");
+        return;
+      }
+      
+      ByteBuffer decompressed;
+      if (!compressor->second->Decompress(data.data(), data.size(), chunk_length,
+                                          decompressed)) {
+        LOG_WARNING("Chunk ", chunk_index, " of ", file_id, " failed to decompress");
+        RequestChunkAgain(transfer, chunk_index, sender);
+        return;
+      }
+      data = std::move(decompressed);
+    }
+    
+    if (data.size() != chunk_length) {
+      LOG_ERROR("Received malformed chunk ", chunk_index, " for ", file_id);
+      return;
+    }
+    
+    if (transfer.verify_chunks && transfer.chunk_hashes_verified &&
+        crypto::MerkleTree::HashLeaf(data.data(), data.size()) !=
+            transfer.chunk_hashes[chunk_index]) {
+      LOG_WARNING("Chunk ", chunk_index, " of ", file_id, " failed verification");
+      RequestChunkAgain(transfer, chunk_index, sender);
+      return;
+    }
+    
+    // Mark this chunk as received and write it to the file at the right
+    // position in the background
+    transfer.received_chunks.Set(chunk_index);
+    transfer.bytes_transferred += chunk_length;
+    transfer.chunks_since_checkpoint++;
+    
+    if (transfer.verify_chunks && !transfer.chunk_hashes_verified) {
+      transfer.unverified_chunks.push_back(chunk_index);
+    }
+    
+    if (!WriteChunk(transfer, chunk_index, std::move(data))) {
+      FailIncoming(transfer, "Failed to write to output file");
+      return;
+    }
+    
+    ReportProgress(transfer, chunk_length);
+    
+    // Check if transfer is complete
+    if (IsFullyReceived(transfer)) {
+      CompleteIncoming(transfer);
+      return;
+    }
+    
+    if (transfer.swarm) {
+      AssignSwarmWork(transfer, sender);
+    }
+    MaybeCheckpoint(transfer);
+  }
+  
+  // Chunks of zeros are not sent; they become holes in the file
+  void HandleFileHoles(const FileHolesMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    
+    auto found = _incoming_transfers.Find(transfer_id);
+    if (!found) {
+      LOG_ERROR("Received holes for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    TransferInfo& transfer = *found;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    
+    if (!IsActive(transfer.status)) {
+      return;  // Finished while the message was in flight
+    }
+    
+    if (!IsSender(transfer, sender) || transfer.status != FileTransferStatus::IN_PROGRESS) {
+      LOG_ERROR("Received holes for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    // Chunks not received yet, in runs that are zeroed in one go. Chunks
+    // checked against their hashes must hash as zeros.
+    std::vector<ChunkRange> holes;
+    uint64_t bytes = 0;
+    for (const auto& range : ClampRanges(transfer.file_size, message.GetRanges())) {
+      for (uint32_t chunk_index = range.first; chunk_index < range.first + range.count;
+           ++chunk_index) {
+        if (transfer.received_chunks.Test(chunk_index)) {
+          continue;
+        }
+        
+        uint64_t chunk_length = ChunkLength(transfer.file_size, chunk_index);
+        if (transfer.verify_chunks && transfer.chunk_hashes_verified &&
+            ZeroChunkHash(chunk_length) != transfer.chunk_hashes[chunk_index]) {
+          LOG_WARNING("Chunk ", chunk_index, " of ", transfer.file_id, " failed verification");
+          if (!RequestChunkAgain(transfer, chunk_index, sender)) {
+            return;
+          }
+          continue;
+        }
+        
+        transfer.received_chunks.Set(chunk_index);
+        transfer.chunks_since_checkpoint++;
+        if (transfer.verify_chunks && !transfer.chunk_hashes_verified) {
+          transfer.unverified_chunks.push_back(chunk_index);
+        }
+        
+        bytes += chunk_length;
+        if (!holes.empty() && holes.back().first + holes.back().count == chunk_index) {
+          holes.back().count++;
+        } else {
+          holes.push_back({chunk_index, 1});
+        }
+      }
+    }
+    
+    if (holes.empty()) {
+      return;
+    }
+    
+    for (const auto& hole : holes) {
+      uint64_t offset = static_cast<uint64_t>(hole.first) * _chunk_size;
+      if (!transfer.file->Zero(offset, RangeBytes(transfer.file_size, {hole}))) {
+        FailIncoming(transfer, "Failed to write to output file");
+        return;
+      }
+    }
+    
+    transfer.bytes_transferred += bytes;
+    ReportProgress(transfer, bytes);
+    
+    if (IsFullyReceived(transfer)) {
+      CompleteIncoming(transfer);
+      return;
+    }
+    MaybeCheckpoint(transfer);
+  }
+  
+  // Leaf hash of a chunk of zeros
+  crypto::Digest ZeroChunkHash(uint64_t chunk_length) const {
+    if (chunk_length == _chunk_size) {
+      return _zero_chunk_hash;
+    }
+    ByteBuffer zeros(chunk_length);
+    return crypto::MerkleTree::HashLeaf(zeros.data(), zeros.size());
+  }
+  
+  void HandleFileChunkHashes(const FileChunkHashesMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    const ByteBuffer& hashes = message.GetHashes();
+    
+    auto found = _incoming_transfers.Find(transfer_id);
+    if (!found) {
+      LOG_ERROR("Received chunk hashes for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    TransferInfo& transfer = *found;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    
+    if (!IsActive(transfer.status) || !IsSender(transfer, sender)) {
+      LOG_ERROR("Received chunk hashes for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    const std::string& file_id = transfer.file_id;
+    if (!transfer.verify_chunks || transfer.chunk_hashes_verified ||
+        (transfer.swarm && sender != transfer.hash_source)) {
+      return;
+    }
+    
+    // Batches arrive in order on the session
+    size_t count = hashes.size() / crypto::DIGEST_SIZE;
+    if (hashes.size() % crypto::DIGEST_SIZE != 0 ||
+        message.GetFirstIndex() != transfer.chunk_hashes_received ||
+        count > transfer.chunk_hashes.size() - transfer.chunk_hashes_received) {
+      LOG_ERROR("Received malformed chunk hashes for ", file_id);
+      return;
+    }
+    
+    for (size_t i = 0; i < count; ++i) {
+      std::copy(hashes.begin() + i * crypto::DIGEST_SIZE,
+                hashes.begin() + (i + 1) * crypto::DIGEST_SIZE,
+                transfer.chunk_hashes[transfer.chunk_hashes_received + i].begin());
+    }
+    transfer.chunk_hashes_received += static_cast<uint32_t>(count);
+    
+    if (transfer.chunk_hashes_received < transfer.chunk_hashes.size()) {
+      return;
+    }
+    
+    // The full list must reproduce the root announced in the request
+    if (crypto::MerkleTree::ComputeRoot(transfer.chunk_hashes) != transfer.expected_root) {
+      FailIncoming(transfer, "Chunk hashes do not match content hash");
+      return;
+    }
+    
+    transfer.chunk_hashes_verified = true;
+    LOG_DEBUG("Chunk hashes verified for ", file_id);
+    
+    // Check chunks that were written before the hashes were available
+    std::vector<uint32_t> unverified;
+    unverified.swap(transfer.unverified_chunks);
+    for (uint32_t chunk_index : unverified) {
+      if (VerifyStoredChunk(transfer, chunk_index)) {
+        continue;
+      }
+      
+      LOG_WARNING("Stored chunk ", chunk_index, " of ", file_id, " failed verification");
+      transfer.received_chunks.Clear(chunk_index);
+      transfer.bytes_transferred -= ChunkLength(transfer.file_size, chunk_index);
+      if (!RequestChunkAgain(transfer, chunk_index, sender)) {
+        return;
+      }
+    }
+    
+    if (IsFullyReceived(transfer)) {
+      CompleteIncoming(transfer);
+    }
+  }
+  
+  void HandleFileDeltaManifest(const FileDeltaManifestMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    const std::vector<uint32_t>& lengths = message.GetChunkLengths();
+    const ByteBuffer& hashes = message.GetChunkHashes();
+    
+    auto found = _incoming_transfers.Find(transfer_id);
+    if (!found) {
+      LOG_ERROR("Received delta manifest for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    TransferInfo& transfer = *found;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    
+    if (!IsActive(transfer.status) || transfer.peer_id != sender) {
+      LOG_ERROR("Received delta manifest for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    const std::string& file_id = transfer.file_id;
+    if (transfer.base_path.empty()) {
+      LOG_WARNING("Ignoring unrequested delta manifest for ", file_id);
+      return;
+    }
+    
+    // Batches arrive in order and must describe exactly the announced size
+    if (message.GetFirstIndex() != transfer.manifest_lengths.size() ||
+        hashes.size() != lengths.size() * crypto::DIGEST_SIZE) {
+      FailIncoming(transfer, "Received malformed delta manifest");
+      return;
+    }
+    
+    for (size_t i = 0; i < lengths.size(); ++i) {
+      if (lengths[i] == 0 || lengths[i] > transfer.file_size - transfer.manifest_bytes) {
+        FailIncoming(transfer, "Delta manifest does not match file size");
+        return;
+      }
+      
+      crypto::Digest hash;
+      std::copy(hashes.begin() + i * crypto::DIGEST_SIZE,
+                hashes.begin() + (i + 1) * crypto::DIGEST_SIZE, hash.begin());
+      transfer.manifest_lengths.push_back(lengths[i]);
+      transfer.manifest_hashes.push_back(hash);
+      transfer.manifest_bytes += lengths[i];
+    }
+    transfer.last_progress = std::chrono::steady_clock::now();
+    
+    if (transfer.manifest_bytes < transfer.file_size) {
+      return;
+    }
+    
+    // Reading the earlier version takes a while for a large file, so it
+    // happens on the workers, which ask for the missing chunks once done
+    auto lengths_taken = std::make_shared<std::vector<uint32_t>>(
+        std::move(transfer.manifest_lengths));
+    auto hashes_taken = std::make_shared<std::vector<crypto::Digest>>(
+        std::move(transfer.manifest_hashes));
+    transfer.manifest_lengths = {};
+    transfer.manifest_hashes = {};
+    {
+      std::lock_guard<std::mutex> send_lock(_send_mutex);
+      ++_worker_jobs;
+    }
+    _workers.Submit([this, found, lengths_taken, hashes_taken] {
+      ApplyDelta(found, *lengths_taken, *hashes_taken);
+      
+      // The manager may be destroyed as soon as the lock is released
+      std::lock_guard<std::mutex> lock(_send_mutex);
+      --_worker_jobs;
+      _send_cv.notify_all();
+    });
+  }
+  
+  void HandleFileChunkRequest(const FileChunkRequestMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    
+    auto found = _outgoing_transfers.Find(transfer_id);
+    if (!found || found->peer_id != sender) {
+      LOG_ERROR("Received chunk request for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    TransferInfo& transfer = *found;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    
+    if (transfer.status != FileTransferStatus::IN_PROGRESS) {
+      return;
+    }
+    
+    std::vector<ChunkRange> ranges = ClampRanges(transfer.file_size, message.GetRanges());
+    transfer.pending_ranges.insert(transfer.pending_ranges.end(), ranges.begin(), ranges.end());
+    
+    if (!transfer.serving) {
+      uint64_t resend_bytes = RangeBytes(transfer.file_size, ranges);
+      LOG_WARNING("Receiver requested ", resend_bytes, " bytes of ", transfer.file_id, " again");
+      for (const auto& range : ranges) {
+        transfer.retransmits += range.count;
+      }
+      transfer.bytes_transferred -= std::min(transfer.bytes_transferred, resend_bytes);
+    }
+    
+    WakeSendThread();
+  }
+  
+  void HandleFileTransferComplete(const FileTransferCompleteMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    bool success = message.IsSuccess();
+    const std::string& error_message = message.GetErrorMessage();
+    
+    // The sender gave up on a transfer we are receiving
+    auto incoming = _incoming_transfers.Find(transfer_id);
+    if (incoming) {
+      TransferInfo& transfer = *incoming;
+      std::lock_guard<std::mutex> lock(transfer.mutex);
+    
+      if (IsActive(transfer.status) && IsSender(transfer, sender)) {
+        if (transfer.swarm) {
+          DropSwarmSource(transfer, sender, error_message);
+          return;
+        }
+        
+        LOG_ERROR("File transfer aborted by sender: ", transfer.file_path, ": ", error_message);
+        transfer.status = FileTransferStatus::FAILED;
+        Checkpoint(transfer);
+        CloseFiles(transfer);
+        RestoreDeltaBase(transfer);
+        
+        if (_completed_callback) {
+          _completed_callback(sender, transfer.file_path, false, error_message);
+        }
+        
+        if (IsDirectoryMember(transfer.file_id)) {
+          FailDirectoryMember(sender, transfer.file_id, error_message);
+        }
+        
+        _incoming_transfers.Erase(transfer_id, &transfer);
+        return;
+      }
+    }
+    
+    auto outgoing = _outgoing_transfers.Find(transfer_id);
+    if (!outgoing || outgoing->peer_id != sender) {
+      LOG_ERROR("Received completion for unknown file transfer: ", transfer_id);
+      return;
+    }
+    
+    TransferInfo& transfer = *outgoing;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+      
+    if (!IsActive(transfer.status)) {
+      return;
+    }
+    
+    if (success) {
+      LOG_INFO("File transfer confirmed complete by receiver: ", transfer.file_path);
+      transfer.status = FileTransferStatus::COMPLETED;
+      
+      if (_completed_callback) {
+        _completed_callback(sender, transfer.file_path, true, "");
+      }
+    } else {
+      LOG_ERROR("File transfer failed: ", transfer.file_path, ": ", error_message);
+      transfer.status = FileTransferStatus::FAILED;
+      
+      if (_completed_callback) {
+        _completed_callback(sender, transfer.file_path, false, error_message);
+      }
+    }
+    
+    // Close any open streams
+    CloseFiles(transfer);
+    
+    EraseOutgoing(transfer);
+  }
+  
+  void HandleFileDirectoryManifest(const FileDirectoryManifestMessage& message) {
+    const PeerId& sender = message.GetSender();
+    const std::string& directory_name = message.GetDirectoryName();
+    auto key = std::make_pair(sender, directory_name);
+    
+    IncomingDirectory directory;
+    {
+      std::lock_guard<std::mutex> lock(_state_mutex);
+      
+      // A new manifest replaces whatever was left of an earlier one
+      if (message.GetFirstIndex() == 0) {
+        _incoming_directories.erase(key);
+      }
+      
+      auto it = _incoming_directories.find(key);
+      if (message.GetFirstIndex() != 0 &&
+          (it == _incoming_directories.end() || it->second.manifest_complete ||
+           it->second.entries.size() != message.GetFirstIndex())) {
+        LOG_ERROR("Received out of order manifest for directory: ", directory_name);
+        return;
+      }
+      
+      if (it == _incoming_directories.end()) {
+        it = _incoming_directories.emplace(key, IncomingDirectory{}).first;
+      }
+      
+      const auto& entries = message.GetEntries();
+      it->second.entries.insert(it->second.entries.end(), entries.begin(), entries.end());
+      if (!message.IsLast()) {
+        return;
+      }
+      
+      directory = std::move(it->second);
+      _incoming_directories.erase(it);
+    }
+    
+    // Never let the peer choose where the files land
+    std::string safe_name = std::filesystem::path(directory_name).filename().string();
+    bool valid = !safe_name.empty() && safe_name == directory_name &&
+                 safe_name != "." && safe_name != "..";
+    uint64_t total_size = 0;
+    for (const auto& entry : directory.entries) {
+      valid = valid && IsSafeRelativePath(entry.path);
+      total_size += entry.size;
+    }
+    
+    if (!valid) {
+      LOG_ERROR("Rejecting invalid directory transfer: ", directory_name);
+      return;
+    }
+    
+    // Member transfers of a rejected directory are refused when they arrive
+    if (_request_callback && !_request_callback(sender, directory_name + "/", total_size)) {
+      LOG_INFO("Directory transfer rejected by user");
+      return;
+    }
+    
+    std::filesystem::path root = std::filesystem::current_path() / "downloads" / directory_name;
+    directory.root = root.string();
+    
+    // Create the whole tree up front; files are written as their data arrives
+    std::error_code ec;
+    std::filesystem::create_directories(root, ec);
+    for (const auto& entry : directory.entries) {
+      std::filesystem::path path = root / entry.path;
+      std::filesystem::create_directories(entry.is_directory ? path : path.parent_path(), ec);
+      if (ec) {
+        LOG_ERROR("Failed to create directory ", path.string(), ": ", ec.message());
+        return;
+      }
+      
+      if (entry.packed) {
+        directory.pack.Add(path.string(), entry.size);
+      } else if (!entry.is_directory) {
+        directory.pending_members.insert(entry.path);
+      }
+    }
+    
+    if (!directory.pack.GetEntries().empty()) {
+      directory.pending_members.insert("");
+    }
+    directory.manifest_complete = true;
+    
+    LOG_INFO("Receiving directory ", directory.root, ": ", directory.entries.size(),
+             " entries, ", total_size, " bytes");
+    
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    auto it = _incoming_directories.insert_or_assign(key, std::move(directory)).first;
+    
+    // Nothing but directories and nothing more to wait for
+    if (it->second.pending_members.empty()) {
+      CompleteDirectory(it);
+    }
+  }
+  
+  // A relative path that stays inside the directory it is relative to
+  static bool IsSafeRelativePath(const std::string& path) {
+    std::filesystem::path relative(path);
+    if (path.empty() || relative.is_absolute() || relative.has_root_name()) {
+      return false;
+    }
+    
+    for (const auto& part : relative) {
+      if (part.empty() || part == "." || part == "..") {
+        return false;
+      }
+    }
+    return true;
+  }
+  
+  // Where a member of a directory transfer is stored. The packed small files
+  // are kept next to the directory until they are split up. Returns false if
+  // file_id names no expected member of a directory from sender.
+  bool ResolveDirectoryMember(const PeerId& sender, const std::string& file_id,
+                              std::string& output_path) {
+    size_t slash = file_id.find('/');
+    std::string member = file_id.substr(slash + 1);
+    
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    auto it = _incoming_directories.find(std::make_pair(sender, file_id.substr(0, slash)));
+    if (it == _incoming_directories.end() || !it->second.manifest_complete ||
+        it->second.pending_members.count(member) == 0) {
+      return false;
+    }
+    
+    const IncomingDirectory& directory = it->second;
+    if (member.empty()) {
+      output_path = directory.root + PACK_SUFFIX;
+    } else {
+      output_path = (std::filesystem::path(directory.root) / member).string();
+    }
+    return true;
+  }
+  
+  static bool IsDirectoryMember(const std::string& file_id) {
+    return file_id.find('/') != std::string::npos;
+  }
+  
+  // Account for a received member of a directory transfer, unpacking the
+  // small files once their pack is complete
+  void FinishDirectoryMember(const PeerId& peer_id, const std::string& file_id,
+                             const std::string& output_path) {
+    size_t slash = file_id.find('/');
+    std::string member = file_id.substr(slash + 1);
+    
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    auto it = _incoming_directories.find(std::make_pair(peer_id, file_id.substr(0, slash)));
+    if (it == _incoming_directories.end()) {
+      return;
+    }
+    
+    if (member.empty()) {
+      bool unpacked = it->second.pack.Unpack(output_path);
+      std::error_code ec;
+      std::filesystem::remove(output_path, ec);
+      
+      if (!unpacked) {
+        FailDirectory(it, "Failed to unpack small files");
+        return;
+      }
+    }
+    
+    it->second.pending_members.erase(member);
+    if (it->second.pending_members.empty()) {
+      CompleteDirectory(it);
+    }
+  }
+  
+  // Give up on the directory a failed member belongs to
+  void FailDirectoryMember(const PeerId& peer_id, const std::string& file_id,
+                           const std::string& error) {
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    auto it = _incoming_directories.find(
+        std::make_pair(peer_id, file_id.substr(0, file_id.find('/'))));
+    if (it != _incoming_directories.end()) {
+      FailDirectory(it, error);
+    }
+  }
+  
+  void FailDirectory(DirectoryMap::iterator it, const std::string& error) {
+    const PeerId peer_id = it->first.first;
+    std::string root = it->second.root;
+    
+    LOG_ERROR("Directory transfer failed: ", root, ": ", error);
+    _incoming_directories.erase(it);
+    
+    if (_completed_callback) {
+      _completed_callback(peer_id, root, false, error);
+    }
+  }
+  
+  // Apply modes and modification times once every file is in place.
+  // Deeper paths sort later, so walking backwards finishes a directory's
+  // contents before the directory itself.
+  void CompleteDirectory(DirectoryMap::iterator it) {
+    const PeerId peer_id = it->first.first;
+    const IncomingDirectory& directory = it->second;
+    std::filesystem::path root(directory.root);
+    
+    for (auto entry = directory.entries.rbegin(); entry != directory.entries.rend(); ++entry) {
+      std::string path = (root / entry->path).string();
+      
+      struct timespec times[2];
+      times[0].tv_sec = 0;
+      times[0].tv_nsec = UTIME_OMIT;
+      times[1].tv_sec = static_cast<time_t>(entry->mtime_ns / 1000000000);
+      times[1].tv_nsec = static_cast<long>(entry->mtime_ns % 1000000000);
+      
+      // Permission bits only: a peer never gets to set setuid, setgid or
+      // sticky bits here
+      if (::chmod(path.c_str(), static_cast<mode_t>(entry->mode & 0777)) != 0 ||
+          ::utimensat(AT_FDCWD, path.c_str(), times, 0) != 0) {
+        LOG_WARNING("Failed to restore mode and time of ", path);
+      }
+    }
+    
+    std::string root_path = directory.root;
+    LOG_INFO("Directory transfer complete: ", root_path);
+    _incoming_directories.erase(it);
+    
+    if (_completed_callback) {
+      _completed_callback(peer_id, root_path, true, "");
+    }
+  }
+  
+  void HandleFileSwarmQuery(const FileSwarmQueryMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    std::string file_id = ToHex(message.GetContentHash());
+    
+    uint64_t file_size;
+    {
+      std::lock_guard<std::mutex> lock(_state_mutex);
+      auto shared = _shared_files.find(file_id);
+    
+      if (shared == _shared_files.end()) {
+        return;  // Not shared here
+      }
+      
+      std::error_code ec;
+      if (std::filesystem::file_size(shared->second.file_path, ec) != shared->second.file_size) {
+        LOG_WARNING("Shared file changed, no longer sharing: ", shared->second.file_path);
+        _shared_files.erase(shared);
+        return;
+      }
+      file_size = shared->second.file_size;
+    }
+    
+    // Chunk requests name only the transfer ID, so the transfer that serves
+    // them must exist before the download hears from us
+    auto transfer = StartServing(sender, transfer_id, file_id);
+    if (!transfer) {
+      return;
+    }
+    
+    if (message.IsSendHashes()) {
+      std::lock_guard<std::mutex> lock(transfer->mutex);
+      transfer->hashes_sent = std::min(message.GetFirstHash(),
+                                       static_cast<uint32_t>(transfer->chunk_tree.LeafCount()));
+      WakeSendThread();
+    }
+    
+    FileSwarmHaveMessage have(sender, transfer_id, message.GetContentHash(), file_size);
+    _network_manager->SendMessage(sender, have);
+  }
+  
+  void HandleFileSwarmHave(const FileSwarmHaveMessage& message) {
+    const PeerId& sender = message.GetSender();
+    TransferId transfer_id = message.GetTransferId();
+    const ByteBuffer& content_hash = message.GetContentHash();
+    uint64_t file_size = message.GetFileSize();
+    
+    auto found = _incoming_transfers.Find(transfer_id);
+    if (!found) {
+      // Late answer to a finished or cancelled download
+      ReleaseSwarmSource(sender, transfer_id, "Swarm download already finished");
+      return;
+    }
+    
+    TransferInfo& transfer = *found;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    
+    if (!transfer.swarm ||
+        !std::equal(content_hash.begin(), content_hash.end(),
+                    transfer.expected_root.begin(), transfer.expected_root.end())) {
+      LOG_ERROR("Received swarm answer for unknown download: ", transfer_id);
+      return;
+    }
+    
+    if (!IsActive(transfer.status)) {
+      ReleaseSwarmSource(sender, transfer_id, "Swarm download already finished");
+      return;
+    }
+    
+    const std::string& file_id = transfer.file_id;
+    if (transfer.status == FileTransferStatus::PENDING) {
+      if (ChunkCount(file_size) > std::numeric_limits<uint32_t>::max()) {
+        LOG_ERROR("Swarm source offered an invalid file size for ", file_id);
+        return;
+      }
+      
+      // The first source fixes the file size and provides the chunk hashes
+      uint32_t chunk_count = static_cast<uint32_t>(ChunkCount(file_size));
+      if (!OpenForResume(transfer.file_path, file_size, transfer.file,
+                         transfer.received_chunks)) {
+        transfer.received_chunks = ChunkBitmap(chunk_count);
+        transfer.file = OpenFile(transfer.file_path, DirectFile::Mode::CREATE, file_size);
+      }
+      
+      if (!transfer.file) {
+        FailIncoming(transfer, "Failed to create output file");
+        return;
+      }
+      
+      std::vector<ChunkRange> missing_ranges = transfer.received_chunks.MissingRanges();
+      transfer.file_size = file_size;
+      transfer.bytes_transferred = file_size - RangeBytes(file_size, missing_ranges);
+      transfer.status = FileTransferStatus::IN_PROGRESS;
+      transfer.last_progress = std::chrono::steady_clock::now();
+      StartVerification(transfer);
+      
+      for (const auto& range : missing_ranges) {
+        for (uint32_t first = range.first; first < range.first + range.count;
+             first += SWARM_PIECE_CHUNKS) {
+          uint32_t count = std::min(SWARM_PIECE_CHUNKS, range.first + range.count - first);
+          transfer.unassigned_pieces.push_back({first, count});
+        }
+      }
+      
+      transfer.swarm_sources[sender];
+      transfer.hash_source = sender;
+      FileSwarmQueryMessage query(sender, transfer_id, content_hash, true);
+      _network_manager->SendMessage(sender, query);
+      
+      LOG_INFO("Swarm download of ", transfer.file_path, " started (", file_size, " bytes, ",
+               transfer.unassigned_pieces.size(), " pieces)");
+    } else if (transfer.swarm_sources.count(sender) > 0) {
+      return;
+    } else if (file_size != transfer.file_size) {
+      ReleaseSwarmSource(sender, transfer_id, "File size does not match");
+      return;
+    } else {
+      LOG_INFO("Added swarm source for ", transfer.file_path);
+    }
+    
+    AssignSwarmWork(transfer, sender);
+    
+    if (IsFullyReceived(transfer)) {
+      CompleteIncoming(transfer);
+    }
+  }
+  
+  // Tell a peer that answered a swarm query that it need not keep serving
+  void ReleaseSwarmSource(const PeerId& source, TransferId transfer_id, const std::string& reason) {
+    FileTransferCompleteMessage complete(source, transfer_id, false, reason);
+    _network_manager->SendMessage(source, complete);
+  }
+  
+  // Keep a swarm source busy with up to SWARM_PIECES_PER_SOURCE pieces.
+  // Sources pull a new piece whenever one finishes, so faster peers end up
+  // serving more of the file. Once every piece is handed out, an idle
+  // source takes over what is still missing from the piece furthest behind
+  // (endgame); whichever copy of a chunk arrives first is kept.
+  void AssignSwarmWork(TransferInfo& transfer, const PeerId& source) {
+    auto& pieces = transfer.swarm_sources[source];
+    
+    pieces.erase(std::remove_if(pieces.begin(), pieces.end(),
+                                [&](const ChunkRange& piece) {
+                                  return MissingInRange(transfer, piece).empty();
+                                }),
+                 pieces.end());
+    
+    while (pieces.size() < SWARM_PIECES_PER_SOURCE) {
+      ChunkRange piece;
+      std::vector<ChunkRange> request;
+      
+      if (!transfer.unassigned_pieces.empty()) {
+        piece = transfer.unassigned_pieces.front();
+        transfer.unassigned_pieces.pop_front();
+        request.push_back(piece);
+      } else {
+        uint64_t most_missing = 0;
+        for (const auto& [other, other_pieces] : transfer.swarm_sources) {
+          for (const auto& candidate : other_pieces) {
+            bool mine = std::any_of(pieces.begin(), pieces.end(), [&](const ChunkRange& p) {
+              return p.first == candidate.first;
+            });
+            auto missing = MissingInRange(transfer, candidate);
+            uint64_t missing_bytes = RangeBytes(transfer.file_size, missing);
+            if (other != source && !mine && missing_bytes > most_missing) {
+              most_missing = missing_bytes;
+              piece = candidate;
+              request = std::move(missing);
+            }
+          }
+        }
+        
+        if (request.empty()) {
+          break;
+        }
+      }
+      
+      pieces.push_back(piece);
+      FileChunkRequestMessage chunk_request(source, transfer.transfer_id, request);
+      _network_manager->SendMessage(source, chunk_request);
+    }
+  }
+  
+  // Chunks of a range not yet received, as ranges
+  std::vector<ChunkRange> MissingInRange(const TransferInfo& transfer, const ChunkRange& range) {
+    std::vector<ChunkRange> missing;
+    for (uint32_t i = range.first; i < range.first + range.count; ++i) {
+      if (transfer.received_chunks.Test(i)) {
+        continue;
+      }
+      if (!missing.empty() && missing.back().first + missing.back().count == i) {
+        missing.back().count++;
+      } else {
+        missing.push_back({i, 1});
+      }
+    }
+    return missing;
+  }
+  
+  // A swarm source stopped serving. Its unfinished pieces go back to the
+  // queue for the others, and if it was sending the chunk hashes another
+  // source sends the rest; the download fails once no source is left.
+  void DropSwarmSource(TransferInfo& transfer, const PeerId& source, const std::string& error) {
+    LOG_WARNING("Swarm source dropped out of ", transfer.file_path, ": ", error);
+    auto source_it = transfer.swarm_sources.find(source);
+    for (const auto& piece : source_it->second) {
+      transfer.unassigned_pieces.push_front(piece);
+    }
+    transfer.swarm_sources.erase(source_it);
+    
+    if (transfer.swarm_sources.empty()) {
+      FailIncoming(transfer, "No swarm sources left");
+      return;
+    }
+    
+    if (source == transfer.hash_source && transfer.verify_chunks &&
+        !transfer.chunk_hashes_verified) {
+      transfer.hash_source = transfer.swarm_sources.begin()->first;
+      ByteBuffer content_hash(transfer.expected_root.begin(), transfer.expected_root.end());
+      FileSwarmQueryMessage query(transfer.hash_source, transfer.transfer_id, content_hash, true,
+                                  transfer.chunk_hashes_received);
+      _network_manager->SendMessage(transfer.hash_source, query);
+      LOG_INFO("Asked another swarm source for the chunk hashes of ", transfer.file_path);
+    }
+    
+    std::vector<PeerId> sources;
+    for (const auto& [peer_id, pieces] : transfer.swarm_sources) {
+      sources.push_back(peer_id);
+    }
+    for (const auto& peer_id : sources) {
+      AssignSwarmWork(transfer, peer_id);
+    }
+  }
+  
+  // Send a file under the name the receiver stores it as
+  bool SendFileAs(const PeerId& peer_id, const std::string& file_path, const std::string& file_id) {
+    // Check if file exists
+    if (!std::filesystem::is_regular_file(file_path)) {
+      LOG_ERROR("File not found: ", file_path);
+      return false;
+    }
+    
+    // Get file size
+    uint64_t file_size = std::filesystem::file_size(file_path);
+    if (ChunkCount(file_size) > std::numeric_limits<uint32_t>::max()) {
+      LOG_ERROR("File too large to transfer: ", file_path);
+      return false;
+    }
+    
+    // Hash every chunk up front so the receiver can verify each one as it lands
+    crypto::MerkleTree chunk_tree;
+    if (!crypto::MerkleTree::BuildFromFile(file_path, _chunk_size, chunk_tree)) {
+      LOG_ERROR("Failed to hash file: ", file_path);
+      return false;
+    }
+    
+    auto transfer = std::make_shared<TransferInfo>();
+    transfer->file_path = file_path;
+    transfer->file_id = file_id;
+    transfer->file_size = file_size;
+    transfer->peer_id = peer_id;
+    transfer->chunk_tree = std::move(chunk_tree);
+    return StartOutgoing(std::move(transfer));
+  }
+  
+  // Send the packed small files of a directory as one transfer
+  bool SendPack(const PeerId& peer_id, const std::string& directory_path,
+                const std::string& file_id, FilePack pack) {
+    uint64_t pack_size = pack.Size();
+    uint64_t chunk_count = ChunkCount(pack_size);
+    if (chunk_count > std::numeric_limits<uint32_t>::max()) {
+      LOG_ERROR("Too much data in small files to transfer: ", directory_path);
+      return false;
+    }
+    
+    std::vector<crypto::Digest> leaves;
+    leaves.reserve(chunk_count);
+    ByteBuffer chunk(_chunk_size);
+    for (uint64_t i = 0; i < chunk_count; ++i) {
+      uint64_t chunk_length = ChunkLength(pack_size, static_cast<uint32_t>(i));
+      if (!pack.Read(i * _chunk_size, chunk.data(), chunk_length)) {
+        LOG_ERROR("Failed to read small files of ", directory_path);
+        return false;
+      }
+      leaves.push_back(crypto::MerkleTree::HashLeaf(chunk.data(), chunk_length));
+    }
+    
+    auto transfer = std::make_shared<TransferInfo>();
+    transfer->file_path = directory_path;
+    transfer->file_id = file_id;
+    transfer->file_size = pack_size;
+    transfer->peer_id = peer_id;
+    transfer->chunk_tree = crypto::MerkleTree(std::move(leaves));
+    transfer->pack = std::make_unique<FilePack>(std::move(pack));
+    return StartOutgoing(std::move(transfer));
+  }
+  
+  // Register an outgoing transfer under a fresh ID and ask the receiver to
+  // accept it
+  bool StartOutgoing(TransferPtr transfer) {
+    const PeerId peer_id = transfer->peer_id;
+    const std::string file_id = transfer->file_id;
+    const uint64_t file_size = transfer->file_size;
+    const crypto::Digest& root = transfer->chunk_tree.GetRoot();
+    ByteBuffer content_hash(root.begin(), root.end());
+    
+    for (const auto& other : _outgoing_transfers.Snapshot()) {
+      if (other->peer_id == peer_id && other->file_id == file_id && !other->serving) {
+        LOG_ERROR("A transfer of ", file_id, " to this peer is already in progress");
+        return false;
+      }
+    }
+    
+    transfer->status = FileTransferStatus::PENDING;
+    transfer->bytes_transferred = 0;
+    transfer->start_time = std::chrono::steady_clock::now();
+    const uint8_t compression_types = _compression_enabled ? CompressorFactory::SupportedTypes() : 0;
+    transfer->compression_offered = compression_types;
+    
+    // Offer a sealed stream of chunks under a key pair of the transfer's own
+    transfer->stream_crypto = GetStreamCrypto();
+    if (transfer->stream_crypto) {
+      transfer->stream_keys = transfer->stream_crypto->GenerateKeyPair();
+    }
+    const ByteBuffer stream_key = StreamKey(*transfer);
+    
+    // Store the transfer info before sending the request so that a fast
+    // response always finds it
+    TransferId transfer_id;
+    do {
+      transfer_id = NewTransferId();
+      transfer->transfer_id = transfer_id;
+    } while (!_outgoing_transfers.Insert(transfer_id, transfer));
+    
+    // Send file transfer request
+    FileTransferRequestMessage request(peer_id, transfer_id, file_id, file_size, content_hash,
+                                       compression_types, stream_key);
+    bool sent = _network_manager->SendMessage(peer_id, request);
+    
+    if (!sent) {
+      LOG_ERROR("Failed to send file transfer request");
+      std::lock_guard<std::mutex> lock(transfer->mutex);
+      transfer->status = FileTransferStatus::FAILED;
+      EraseOutgoing(*transfer);
+      return false;
+    }
+    
+    LOG_INFO("File transfer request sent for ", file_id);
+    return true;
+  }
+  
+  // Collect every regular file and subdirectory under root, sorted by path
+  static bool ListDirectory(const std::filesystem::path& root, std::vector<DirectoryEntry>& entries) {
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator it(root, ec);
+    for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+      struct stat info;
+      if (::stat(it->path().c_str(), &info) != 0) {
+        continue;
+      }
+      
+      // Symlinked directories are not followed
+      bool is_directory = S_ISDIR(info.st_mode);
+      if ((is_directory && it->is_symlink()) || (!is_directory && !S_ISREG(info.st_mode))) {
+        continue;
+      }
+      
+      DirectoryEntry entry;
+      entry.path = it->path().lexically_relative(root).generic_string();
+      entry.size = is_directory ? 0 : static_cast<uint64_t>(info.st_size);
+      entry.mode = info.st_mode & 0777;
+      entry.mtime_ns = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+      entry.is_directory = is_directory;
+      entries.push_back(std::move(entry));
+    }
+    
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+      return a.path < b.path;
+    });
+    return !ec;
+  }
+  
+  // Find or create the outgoing transfer that serves a shared file to a
+  // swarm download, under the ID the download picked. Returns null if the
+  // file is not shared or the ID is taken by another transfer.
+  TransferPtr StartServing(const PeerId& peer_id, TransferId transfer_id,
+                           const std::string& file_id) {
+    auto existing = _outgoing_transfers.Find(transfer_id);
+    if (existing) {
+      return existing->peer_id == peer_id && existing->file_id == file_id && existing->serving
+                 ? existing : nullptr;
+    }
+    
+    auto transfer = std::make_shared<TransferInfo>();
+    TransferInfo& transfer_info = *transfer;
+    {
+      std::lock_guard<std::mutex> lock(_state_mutex);
+      auto shared = _shared_files.find(file_id);
+      if (shared == _shared_files.end()) {
+        return nullptr;
+      }
+      
+      transfer_info.file_path = shared->second.file_path;
+      transfer_info.file_size = shared->second.file_size;
+      transfer_info.chunk_tree = shared->second.chunk_tree;
+    }
+    
+    transfer_info.transfer_id = transfer_id;
+    transfer_info.file_id = file_id;
+    transfer_info.peer_id = peer_id;
+    transfer_info.status = FileTransferStatus::IN_PROGRESS;
+    transfer_info.bytes_transferred = 0;
+    transfer_info.start_time = std::chrono::steady_clock::now();
+    transfer_info.hashes_sent = static_cast<uint32_t>(transfer_info.chunk_tree.LeafCount());
+    transfer_info.serving = true;
+    
+    if (!OpenInput(transfer_info)) {
+      LOG_ERROR("Failed to open shared file: ", transfer_info.file_path);
+      return nullptr;
+    }
+    
+    if (!_outgoing_transfers.Insert(transfer_id, transfer)) {
+      return nullptr;
+    }
+    
+    LOG_INFO("Serving ", transfer_info.file_path, " to swarm download");
+    return transfer;
+  }
+  
+  // Tell every peer sending an incoming transfer how it ended
+  void NotifySenders(const TransferInfo& transfer, bool success, const std::string& error = "") {
+    std::vector<PeerId> peers;
+    if (transfer.swarm) {
+      for (const auto& [peer_id, pieces] : transfer.swarm_sources) {
+        peers.push_back(peer_id);
+      }
+    } else {
+      peers.push_back(transfer.peer_id);
+    }
+    
+    for (const auto& peer_id : peers) {
+      FileTransferCompleteMessage complete(peer_id, transfer.transfer_id, success, error);
+      _network_manager->SendMessage(peer_id, complete);
+    }
+  }
+  
+  // Move an earlier version of a download aside so it can seed a delta
+  // transfer. A base left behind by an interrupted delta is used as is.
+  bool PrepareDeltaBase(const std::string& output_path, const std::string& base_path,
+                        uint64_t file_size) {
+    std::error_code ec;
+    if (file_size < DELTA_MIN_FILE_SIZE) {
+      return false;
+    }
+    
+    if (std::filesystem::is_regular_file(base_path, ec)) {
+      return true;
+    }
+    
+    if (!std::filesystem::is_regular_file(output_path, ec) ||
+        std::filesystem::file_size(output_path, ec) < DELTA_MIN_FILE_SIZE) {
+      return false;
+    }
+    
+    std::filesystem::rename(output_path, base_path, ec);
+    return !ec;
+  }
+  
+  // Put the earlier version moved aside for a delta back in place of the
+  // partial download, which holds nothing worth resuming yet. Files must be
+  // closed first.
+  void RestoreDeltaBase(TransferInfo& transfer) {
+    if (transfer.base_path.empty()) {
+      return;
+    }
+    
+    std::error_code ec;
+    std::filesystem::rename(transfer.base_path, transfer.file_path, ec);
+    if (ec) {
+      LOG_WARNING("Failed to restore ", transfer.file_path, " from ", transfer.base_path,
+                  ": ", ec.message());
+    }
+    std::filesystem::remove(transfer.resume_path, ec);
+    transfer.base_path.clear();
+  }
+  
+  // Build the new file from the chunks of the earlier version that also
+  // appear in the sender's manifest, then ask the sender for the rest.
+  // Fixed-size chunks fully covered by reused data count as received; they
+  // are verified against the chunk hashes like any other. The earlier
+  // version is read without holding the transfer's lock, which is only
+  // taken to write what was read; the work stops once the transfer ends.
+  void ApplyDelta(const TransferPtr& transfer_ptr, const std::vector<uint32_t>& lengths,
+                  const std::vector<crypto::Digest>& hashes) {
+    TransferInfo& transfer = *transfer_ptr;
+    std::string base_path;
+    {
+      std::lock_guard<std::mutex> lock(transfer.mutex);
+      if (!IsActive(transfer.status)) {
+        return;
+      }
+      base_path = transfer.base_path;
+    }
+    
+    std::vector<ContentChunk> base_chunks;
+    std::unordered_map<crypto::Digest, ContentChunk, DigestHash> base_index;
+    if (ContentChunker::ChunkFile(base_path, base_chunks)) {
+      for (const auto& chunk : base_chunks) {
+        base_index.emplace(chunk.hash, chunk);
+      }
+    }
+    
+    std::ifstream base(base_path, std::ios::binary);
+    ByteBuffer buffer(ContentChunker::MAX_CHUNK_SIZE);
+    uint64_t offset = 0;
+    uint64_t run_begin = 0;
+    bool in_run = false;
+    uint64_t reused = 0;
+    
+    for (size_t i = 0; i < lengths.size(); ++i) {
+      uint32_t length = lengths[i];
+      bool copied = false;
+      
+      auto match = base_index.find(hashes[i]);
+      if (match != base_index.end() && match->second.length == length &&
+          length <= buffer.size()) {
+        base.seekg(static_cast<std::streamoff>(match->second.offset));
+        base.read(reinterpret_cast<char*>(buffer.data()), length);
+        copied = static_cast<bool>(base);
+        if (!copied) {
+          base.clear();
+        }
+      }
+      
+      std::lock_guard<std::mutex> lock(transfer.mutex);
+      if (!_running || !IsActive(transfer.status)) {
+        return;
+      }
+      
+      if (copied && !WriteOutput(transfer, offset, buffer.data(), length)) {
+        FailIncoming(transfer, "Failed to write to output file");
+        return;
+      }
+      transfer.last_progress = std::chrono::steady_clock::now();
+      
+      if (copied && !in_run) {
+        run_begin = offset;
+        in_run = true;
+      } else if (!copied && in_run) {
+        MarkReceived(transfer, run_begin, offset);
+        in_run = false;
+      }
+      
+      reused += copied ? length : 0;
+      offset += length;
+    }
+    base.close();
+    
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    if (!_running || !IsActive(transfer.status)) {
+      return;
+    }
+    
+    if (in_run) {
+      MarkReceived(transfer, run_begin, offset);
+    }
+    
+    LOG_INFO("Delta transfer of ", transfer.file_id, " reuses ", reused, " of ",
+             transfer.file_size, " bytes (", transfer.bytes_transferred, " in whole chunks)");
+    
+    std::error_code ec;
+    std::filesystem::remove(transfer.base_path, ec);
+    transfer.base_path.clear();
+    
+    // Persist the reused chunks so an interruption doesn't redo the delta
+    Checkpoint(transfer);
+    
+    FileTransferResponseMessage response(transfer.peer_id, transfer.transfer_id, true,
+                                         transfer.received_chunks.MissingRanges(), false,
+                                         transfer.compression, false, transfer.sparse,
+                                         StreamKey(transfer));
+    _network_manager->SendMessage(transfer.peer_id, response);
+    
+    if (IsFullyReceived(transfer)) {
+      CompleteIncoming(transfer);
+    }
+  }
+  
+  // Mark the fixed-size chunks entirely inside [begin, end) as received
+  void MarkReceived(TransferInfo& transfer, uint64_t begin, uint64_t end) {
+    uint64_t first = (begin + _chunk_size - 1) / _chunk_size;
+    uint64_t last = end == transfer.file_size ? ChunkCount(transfer.file_size) : end / _chunk_size;
+    
+    for (uint64_t i = first; i < last; ++i) {
+      uint32_t chunk_index = static_cast<uint32_t>(i);
+      if (transfer.received_chunks.Set(chunk_index)) {
+        transfer.bytes_transferred += ChunkLength(transfer.file_size, chunk_index);
+        if (transfer.verify_chunks) {
+          transfer.unverified_chunks.push_back(chunk_index);
+        }
+      }
+    }
+  }
+  
+  bool IsFullyReceived(const TransferInfo& transfer) const {
+    return transfer.received_chunks.IsComplete() &&
+           (!transfer.verify_chunks || transfer.chunk_hashes_verified);
+  }
+  
+  // Read a chunk back from the partial file and check it against its hash
+  bool VerifyStoredChunk(TransferInfo& transfer, uint32_t chunk_index) {
+    uint64_t chunk_length = ChunkLength(transfer.file_size, chunk_index);
+    ByteBuffer chunk(chunk_length);
+    
+    if (!ReadOutput(transfer, static_cast<uint64_t>(chunk_index) * _chunk_size, chunk.data(),
+                    chunk_length)) {
+      return false;
+    }
+    
+    return crypto::MerkleTree::HashLeaf(chunk.data(), chunk.size()) ==
+           transfer.chunk_hashes[chunk_index];
+  }
+  
+  // Ask the sender for a chunk that failed verification, giving up on the
+  // transfer once the same chunk has failed MAX_CHUNK_RETRIES times. Returns
+  // false if the transfer was failed. Caller must hold the transfer's lock.
+  bool RequestChunkAgain(TransferInfo& transfer, uint32_t chunk_index, const PeerId& peer_id) {
+    if (++transfer.chunk_retries[chunk_index] > MAX_CHUNK_RETRIES) {
+      FailIncoming(transfer, "Chunk " + std::to_string(chunk_index) + " repeatedly failed verification");
+      return false;
+    }
+    
+    FileChunkRequestMessage request(peer_id, transfer.transfer_id, {{chunk_index, 1}});
+    _network_manager->SendMessage(peer_id, request);
+    transfer.retransmits++;
+    return true;
+  }
+  
+  // Abort an incoming transfer and tell the sender. Whatever was received
+  // stays resumable, and an earlier version moved aside for a delta is put
+  // back. Caller must hold the transfer's lock.
+  void FailIncoming(TransferInfo& transfer, const std::string& error) {
+    const PeerId peer_id = transfer.peer_id;
+    
+    LOG_ERROR(error, ": ", transfer.file_path);
+    NotifySenders(transfer, false, error);
+    transfer.status = FileTransferStatus::FAILED;
+    Checkpoint(transfer);
+    CloseFiles(transfer);
+    RestoreDeltaBase(transfer);
+    
+    if (_completed_callback) {
+      _completed_callback(peer_id, transfer.file_path, false, error);
+    }
+    
+    if (IsDirectoryMember(transfer.file_id)) {
+      FailDirectoryMember(peer_id, transfer.file_id, error);
+    }
+    
+    _incoming_transfers.Erase(transfer.transfer_id, &transfer);
+  }
+  
+  // Finish a fully received transfer. Caller must hold the transfer's lock.
+  void CompleteIncoming(TransferInfo& transfer) {
+    const PeerId peer_id = transfer.peer_id;
+    
+    if (!FlushWrites(transfer)) {
+      FailIncoming(transfer, "Failed to write to output file");
+      return;
+    }
+    
+    LOG_INFO("File transfer complete: ", transfer.file_path);
+    transfer.status = FileTransferStatus::COMPLETED;
+    CloseFiles(transfer);
+    
+    // Only content checked against its hash is cached
+    if (transfer.verify_chunks && transfer.file_id.back() != '/') {
+      AddToCache(transfer.expected_root, transfer.file_path);
+    }
+    
+    std::error_code ec;
+    std::filesystem::remove(transfer.resume_path, ec);
+    
+    NotifySenders(transfer, true);
+    if (transfer.swarm) {
+      std::lock_guard<std::mutex> lock(_state_mutex);
+      PruneFinishedSwarms();
+      _finished_swarms.emplace_back(transfer.transfer_id, std::chrono::steady_clock::now());
+    }
+    
+    _incoming_transfers.Erase(transfer.transfer_id, &transfer);
+    
+    // Directory members are reported with their directory
+    if (IsDirectoryMember(transfer.file_id)) {
+      FinishDirectoryMember(peer_id, transfer.file_id, transfer.file_path);
+      return;
+    }
+    
+    if (_completed_callback) {
+      _completed_callback(peer_id, transfer.file_path, true, "");
+    }
+  }
+  
+  // Forget swarm downloads finished longer ago than the grace period.
+  // Caller must hold _state_mutex.
+  void PruneFinishedSwarms() {
+    auto cutoff = std::chrono::steady_clock::now() - FINISHED_SWARM_GRACE;
+    while (!_finished_swarms.empty() && _finished_swarms.front().second < cutoff) {
+      _finished_swarms.pop_front();
+    }
+  }
+  
+  // Drop a finished outgoing transfer, which may let a queued one start
+  void EraseOutgoing(TransferInfo& transfer) {
+    transfer.WipeStreamKey();
+    _outgoing_transfers.Erase(transfer.transfer_id, &transfer);
+    WakeSendThread();
+  }
+  
+  // Abort an outgoing transfer and tell the receiver. Caller must hold the
+  // transfer's lock.
+  void FailOutgoing(TransferInfo& transfer, const std::string& error) {
+    const PeerId peer_id = transfer.peer_id;
+    
+    LOG_ERROR(error, ": ", transfer.file_path);
+    FileTransferCompleteMessage complete(peer_id, transfer.transfer_id, false, error);
+    _network_manager->SendMessage(peer_id, complete);
+    transfer.status = FileTransferStatus::FAILED;
+    CloseFiles(transfer);
+    
+    if (_completed_callback) {
+      _completed_callback(peer_id, transfer.file_path, false, error);
+    }
+    
+    EraseOutgoing(transfer);
+  }
+  
+  // Sends data for every accepted outgoing transfer in the order the
+  // scheduler picks, one message at a time. The network send happens without
+  // holding the transfer's lock so incoming messages keep flowing while a
+  // slow peer applies backpressure.
+  void SendThreadFunc() {
+    auto last_stall_check = std::chrono::steady_clock::now();
+    
+    while (_running) {
+      std::chrono::milliseconds stall_timeout;
+      bool fail_stalled;
+      {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        _send_pending = false;
+        stall_timeout = _stall_timeout;
+        fail_stalled = _fail_stalled;
+      }
+      
+      auto stall_interval = StallCheckInterval(stall_timeout);
+      if (stall_timeout.count() > 0 &&
+          std::chrono::steady_clock::now() - last_stall_check >= stall_interval) {
+        CheckStalls(stall_timeout, fail_stalled);
+        last_stall_check = std::chrono::steady_clock::now();
+      }
+      
+      // Transfers are offered to the scheduler oldest first, which is the
+      // order they are admitted in
+      std::vector<std::pair<std::chrono::steady_clock::time_point, TransferScheduler::Transfer>> current;
+      std::unordered_map<TransferId, TransferPtr> transfers;
+      for (const auto& transfer : _outgoing_transfers.Snapshot()) {
+        std::lock_guard<std::mutex> lock(transfer->mutex);
+        current.push_back({transfer->start_time,
+                           {transfer->transfer_id, transfer->peer_id, transfer->priority}});
+        transfers.emplace(transfer->transfer_id, transfer);
+      }
+      std::stable_sort(current.begin(), current.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+      });
+      
+      std::vector<TransferScheduler::Transfer> scheduled;
+      for (const auto& [start_time, transfer] : current) {
+        scheduled.push_back(transfer);
+      }
+      _scheduler.SetMaxActive(_max_concurrent_transfers);
+      _scheduler.SetUploadLimit(_upload_limit);
+      _scheduler.Update(scheduled);
+      
+      auto is_ready = [&transfers](TransferId transfer_id) {
+        TransferInfo& transfer = *transfers.at(transfer_id);
+        std::lock_guard<std::mutex> lock(transfer.mutex);
+        return HasDataToSend(transfer);
+      };
+      
+      // About one message per transfer, then look for new transfers again
+      bool sent_any = false;
+      for (size_t i = 0; i < transfers.size() && _running; ++i) {
+        TransferId transfer_id;
+        if (!_scheduler.Next(is_ready, transfer_id)) {
+          break;
+        }
+        
+        // Hold off while the upload cap is used up. A changed limit, new work
+        // or a due stall check starts a new pass instead.
+        auto delay = _scheduler.UploadDelay();
+        if (delay > std::chrono::steady_clock::duration::zero()) {
+          bool check_due = stall_timeout.count() > 0 && delay > stall_interval;
+          std::unique_lock<std::mutex> lock(_send_mutex);
+          if (_send_cv.wait_for(lock, check_due ? stall_interval : delay,
+                                [this] { return _send_pending || !_running; }) ||
+              check_due) {
+            break;
+          }
+        }
+        
+        uint64_t sent = SendNext(*transfers.at(transfer_id));
+        _scheduler.Charge(transfer_id, sent);
+        sent_any = sent_any || sent > 0;
+      }
+      
+      // Sleep until a handler reports more work, unless it already has, or
+      // until the next stall check is due
+      if (!sent_any) {
+        std::unique_lock<std::mutex> lock(_send_mutex);
+        auto woken = [this] { return _send_pending || !_running; };
+        if (stall_timeout.count() > 0) {
+          _send_cv.wait_until(lock, last_stall_check + stall_interval, woken);
+        } else {
+          _send_cv.wait(lock, woken);
+        }
+      }
+    }
+  }
+  
+  static std::chrono::milliseconds StallCheckInterval(std::chrono::milliseconds stall_timeout) {
+    return std::max(std::chrono::milliseconds(1),
+                    std::min<std::chrono::milliseconds>(stall_timeout / 4,
+                                                        MAX_STALL_CHECK_INTERVAL));
+  }
+  
+  // Flag or fail transfers that made no progress for stall_timeout. Outgoing
+  // transfers the scheduler holds back are waiting, not stalled, and their
+  // clock starts once they are admitted. A receiver's clock starts when it
+  // accepts, so a sender that never sends a chunk is caught too. A swarm
+  // download no peer has answered yet stalls like one that stopped. Only
+  // called from the send thread.
+  void CheckStalls(std::chrono::milliseconds stall_timeout, bool fail_stalled) {
+    auto now = std::chrono::steady_clock::now();
+    
+    for (bool outgoing : {true, false}) {
+      TransferTable& table = outgoing ? _outgoing_transfers : _incoming_transfers;
+      for (const auto& transfer : table.Snapshot()) {
+        std::lock_guard<std::mutex> lock(transfer->mutex);
+        bool unanswered = !outgoing && transfer->swarm &&
+                          transfer->status == FileTransferStatus::PENDING;
+        if (!unanswered && (transfer->status != FileTransferStatus::IN_PROGRESS ||
+                            transfer->serving ||
+                            transfer->bytes_transferred >= transfer->file_size)) {
+          continue;
+        }
+        
+        if (outgoing && !_scheduler.IsAdmitted(transfer->transfer_id)) {
+          transfer->last_progress = now;
+          continue;
+        }
+        
+        auto idle = now - LastProgress(*transfer);
+        if (idle < stall_timeout || transfer->stalled) {
+          continue;
+        }
+        
+        if (fail_stalled) {
+          if (outgoing) {
+            FailOutgoing(*transfer, "Transfer stalled");
+          } else {
+            FailIncoming(*transfer, unanswered ? "No peer has the file" : "Transfer stalled");
+          }
+        } else {
+          transfer->stalled = true;
+          LOG_WARNING("No progress for ",
+                      std::chrono::duration_cast<std::chrono::milliseconds>(idle).count(),
+                      " ms: ", transfer->file_path);
+        }
+      }
+    }
+  }
+  
+  static std::chrono::steady_clock::time_point LastProgress(const TransferInfo& transfer) {
+    return std::max(transfer.start_time, transfer.last_progress);
+  }
+  
+  // Seconds to go at the given rate: 0 once done, negative if unknown
+  static double EstimateRemaining(const TransferInfo& transfer, double bytes_per_second) {
+    if (transfer.bytes_transferred >= transfer.file_size) {
+      return 0;
+    }
+    if (bytes_per_second <= 0) {
+      return -1;
+    }
+    return (transfer.file_size - transfer.bytes_transferred) / bytes_per_second;
+  }
+  
+  // Chunks the transfer is waiting on: read or compressed ahead of the wire
+  // on the sender, requested and not yet arrived on the receiver
+  static uint32_t ChunksInFlight(const TransferInfo& transfer) {
+    uint32_t in_flight =
+        static_cast<uint32_t>(transfer.reading.size() + transfer.compressing.size());
+    
+    for (const auto& [source, pieces] : transfer.swarm_sources) {
+      for (const auto& piece : pieces) {
+        for (uint32_t i = piece.first; i < piece.first + piece.count; ++i) {
+          in_flight += !transfer.received_chunks.Test(i);
+        }
+      }
+    }
+    
+    if (!transfer.swarm) {
+      for (const auto& [chunk_index, retries] : transfer.chunk_retries) {
+        in_flight += chunk_index < transfer.received_chunks.Size() &&
+                     !transfer.received_chunks.Test(chunk_index);
+      }
+    }
+    return in_flight;
+  }
+  
+  void WakeSendThread() {
+    {
+      std::lock_guard<std::mutex> lock(_send_mutex);
+      _send_pending = true;
+    }
+    _send_cv.notify_one();
+  }
+  
+  static bool HasDataToSend(const TransferInfo& transfer) {
+    if (transfer.status == FileTransferStatus::PENDING) {
+      return transfer.manifest_requested &&
+             (!transfer.manifest_built || transfer.manifest_sent < transfer.manifest.size());
+    }
+    
+    return transfer.status == FileTransferStatus::IN_PROGRESS &&
+           (transfer.hashes_sent < transfer.chunk_tree.LeafCount() ||
+            !transfer.pending_ranges.empty() || !transfer.reading.empty() ||
+            !transfer.compressing.empty() || !transfer.zero_ranges.empty());
+  }
+  
+  // Every chunk the receiver needs has gone out, unless it asks for more
+  static bool AllChunksSent(const TransferInfo& transfer) {
+    return transfer.pending_ranges.empty() && transfer.reading.empty() &&
+           transfer.compressing.empty() && transfer.zero_ranges.empty() && !transfer.serving;
+  }
+  
+  // Send the next message of a transfer. Returns the bytes sent, 0 if the
+  // transfer had nothing to send or failed.
+  uint64_t SendNext(TransferInfo& transfer) {
+    std::unique_lock<std::mutex> lock(transfer.mutex);
+    if (!HasDataToSend(transfer)) {
+      return 0;
+    }
+    
+    if (transfer.status == FileTransferStatus::PENDING) {
+      return SendNextManifestBatch(lock, transfer);
+    }
+    
+    // Chunk hashes go out before any chunk data
+    if (transfer.hashes_sent < transfer.chunk_tree.LeafCount()) {
+      return SendNextHashBatch(lock, transfer);
+    }
+    
+    if (!transfer.zero_ranges.empty()) {
+      return SendNextHoles(lock, transfer);
+    }
+    
+    // Taking chunks may turn up nothing but zeros, which go out next
+    EncodedChunk chunk;
+    if (transfer.compressor || transfer.stream) {
+      if (!QueueCompression(transfer)) {
+        FailOutgoing(transfer, "Failed to read from file");
+        return 0;
+      }
+      if (transfer.compressing.empty()) {
+        return SendNextHoles(lock, transfer);
+      }
+      
+      std::future<EncodedChunk> compressed = std::move(transfer.compressing.front());
+      transfer.compressing.pop_front();
+      
+      lock.unlock();
+      chunk = compressed.get();
+      lock.lock();
+      
+      if (!IsActive(transfer.status)) {
+        return 0;
+      }
+    } else if (!TakeChunk(transfer, chunk)) {
+      FailOutgoing(transfer, "Failed to read from file");
+      return 0;
+    } else if (chunk.data.empty()) {
+      return SendNextHoles(lock, transfer);
+    }
+    
+    uint64_t chunk_length = ChunkLength(transfer.file_size, chunk.chunk_index);
+    uint64_t wire_length = chunk.data.size();
+    if (transfer.stream && !chunk.sealed) {
+      FailOutgoing(transfer, "Failed to seal file chunk");
+      return 0;
+    }
+    
+    FileChunkMessage chunk_msg(transfer.peer_id, transfer.transfer_id, chunk.chunk_index,
+                               chunk.data, chunk.compression, chunk.sealed, chunk.stream_index);
+    
+    lock.unlock();
+    bool sent = _network_manager->SendMessage(transfer.peer_id, chunk_msg);
+    lock.lock();
+      
+    if (!IsActive(transfer.status)) {
+      return wire_length;  // Cancelled while sending
+    }
+      
+    if (!sent) {
+      FailOutgoing(transfer, "Failed to send file chunk");
+      return 0;
+    }
+    
+    transfer.bytes_transferred += chunk_length;
+    ReportProgress(transfer, chunk_length);
+    
+    if (AllChunksSent(transfer)) {
+      // The transfer completes when the receiver confirms it
+      LOG_INFO("All chunks sent, awaiting confirmation: ", transfer.file_path);
+    }
+    return wire_length;
+  }
+  
+  // Send the next batch of zero chunk ranges. They count as sent in full.
+  uint64_t SendNextHoles(std::unique_lock<std::mutex>& lock, TransferInfo& transfer) {
+    if (transfer.zero_ranges.empty()) {
+      return 0;
+    }
+    
+    size_t count = std::min<size_t>(HOLE_BATCH_SIZE, transfer.zero_ranges.size());
+    std::vector<ChunkRange> ranges(transfer.zero_ranges.begin(),
+                                   transfer.zero_ranges.begin() + count);
+    transfer.zero_ranges.erase(transfer.zero_ranges.begin(), transfer.zero_ranges.begin() + count);
+    
+    uint64_t bytes = RangeBytes(transfer.file_size, ranges);
+    FileHolesMessage holes_msg(transfer.peer_id, transfer.transfer_id, ranges);
+    
+    lock.unlock();
+    bool sent = _network_manager->SendMessage(transfer.peer_id, holes_msg);
+    lock.lock();
+    
+    uint64_t wire_length = ranges.size() * sizeof(ChunkRange);
+    if (!IsActive(transfer.status)) {
+      return wire_length;
+    }
+    
+    if (!sent) {
+      FailOutgoing(transfer, "Failed to send file holes");
+      return 0;
+    }
+    
+    transfer.bytes_transferred += bytes;
+    ReportProgress(transfer, bytes);
+    
+    if (AllChunksSent(transfer)) {
+      LOG_INFO("All chunks sent, awaiting confirmation: ", transfer.file_path);
+    }
+    return wire_length;
+  }
+  
+  // Account for bytes that just moved and tell the progress callback, at
+  // most _progress_rate times a second unless the file is done. Caller must
+  // hold the transfer's lock.
+  void ReportProgress(TransferInfo& transfer, uint64_t bytes) {
+    auto now = std::chrono::steady_clock::now();
+    transfer.meter.Add(bytes, now);
+    transfer.last_progress = now;
+    if (transfer.stalled) {
+      LOG_INFO("Transfer moving again: ", transfer.file_path);
+      transfer.stalled = false;
+    }
+    
+    if (!_progress_callback) {
+      return;
+    }
+    
+    if (transfer.last_report == std::chrono::steady_clock::time_point{}) {
+      transfer.last_report = transfer.start_time;
+    }
+    
+    // In clock ticks: whole seconds divided by the rate would truncate to 0
+    bool done = transfer.bytes_transferred >= transfer.file_size;
+    uint32_t rate = _progress_rate;
+    std::chrono::steady_clock::duration second = std::chrono::seconds(1);
+    if (!done && rate > 0 && now - transfer.last_report < second / rate) {
+      return;
+    }
+    transfer.last_report = now;
+    
+    TransferProgress progress;
+    progress.bytes_transferred = std::min(transfer.bytes_transferred, transfer.file_size);
+    progress.total_bytes = transfer.file_size;
+    progress.fraction = static_cast<double>(progress.bytes_transferred) / transfer.file_size;
+    progress.bytes_per_second = transfer.meter.AverageRate(now);
+    progress.eta_seconds = EstimateRemaining(transfer, progress.bytes_per_second);
+    
+    _progress_callback(transfer.peer_id, transfer.file_path, progress);
+  }
+  
+  // Take the next chunk to send off the front of pending_ranges
+  static uint32_t PopPendingChunk(TransferInfo& transfer) {
+    ChunkRange& range = transfer.pending_ranges.front();
+    uint32_t chunk_index = range.first;
+    if (--range.count == 0) {
+      transfer.pending_ranges.pop_front();
+    } else {
+      range.first++;
+    }
+    return chunk_index;
+  }
+  
+  // Set chunks aside to go out as a hole, merging them with the last range
+  static void AddZeroChunks(TransferInfo& transfer, uint32_t first, uint32_t count) {
+    if (!transfer.zero_ranges.empty() &&
+        transfer.zero_ranges.back().first + transfer.zero_ranges.back().count == first) {
+      transfer.zero_ranges.back().count += count;
+    } else {
+      transfer.zero_ranges.push_back({first, count});
+    }
+  }
+  
+  // How many chunks at the front of pending_ranges lie wholly in a hole of
+  // the file. The file is asked only once the data extent found last no
+  // longer covers the chunk.
+  uint32_t LeadingHoleChunks(TransferInfo& transfer) {
+    if (!transfer.sparse || !transfer.file) {
+      return 0;
+    }
+    
+    const ChunkRange& range = transfer.pending_ranges.front();
+    uint64_t offset = static_cast<uint64_t>(range.first) * _chunk_size;
+    if (offset < transfer.data_from || offset >= transfer.data_end) {
+      transfer.data_from = offset;
+      transfer.file->FindData(offset, transfer.data_begin, transfer.data_end);
+    }
+    
+    if (transfer.data_begin >= transfer.file_size) {
+      return range.count;
+    }
+    if (offset >= transfer.data_begin) {
+      return 0;
+    }
+    return static_cast<uint32_t>(
+        std::min<uint64_t>(range.count, (transfer.data_begin - offset) / _chunk_size));
+  }
+  
+  // Queue reads of the next pending chunks, up to READ_AHEAD, and start
+  // them together. Chunks in holes of the file are set aside without being
+  // read. Packs are read as their chunks are taken.
+  void ReadAhead(TransferInfo& transfer) {
+    if (!transfer.file || transfer.reading.size() >= READ_AHEAD ||
+        transfer.pending_ranges.empty()) {
+      return;
+    }
+    
+    while (transfer.reading.size() < READ_AHEAD && !transfer.pending_ranges.empty()) {
+      uint32_t holes = LeadingHoleChunks(transfer);
+      if (holes > 0) {
+        ChunkRange& range = transfer.pending_ranges.front();
+        AddZeroChunks(transfer, range.first, holes);
+        range.first += holes;
+        range.count -= holes;
+        if (range.count == 0) {
+          transfer.pending_ranges.pop_front();
+        }
+        continue;
+      }
+      
+      ChunkRead read;
+      read.chunk_index = PopPendingChunk(transfer);
+      read.request = transfer.file->ReadAsync(*_file_io,
+                                              static_cast<uint64_t>(read.chunk_index) * _chunk_size,
+                                              ChunkLength(transfer.file_size, read.chunk_index));
+      transfer.reading.push_back(std::move(read));
+    }
+    _file_io->Submit();
+  }
+  
+  // Take the next chunk to send along with its data, topping up the reads
+  // ahead of it. On a sparse transfer, chunks that read as all zeros are set
+  // aside; after READ_AHEAD of them, or once none are left, chunk.data is
+  // left empty. Returns false if a chunk can't be read.
+  bool TakeChunk(TransferInfo& transfer, EncodedChunk& chunk) {
+    for (size_t taken = 0; taken < READ_AHEAD; ++taken) {
+      ReadAhead(transfer);
+      if (transfer.reading.empty()) {
+        if (transfer.pending_ranges.empty()) {
+          break;
+        }
+        chunk.chunk_index = PopPendingChunk(transfer);
+        if (!ReadChunk(transfer, chunk.chunk_index, chunk.data)) {
+          return false;
+        }
+      } else {
+        ChunkRead read = std::move(transfer.reading.front());
+        transfer.reading.pop_front();
+        chunk.chunk_index = read.chunk_index;
+        if (!transfer.file->Finish(read.request)) {
+          return false;
+        }
+        chunk.data = std::move(read.request.buffers->data);
+      }
+      
+      if (!transfer.sparse || !IsAllZero(chunk.data)) {
+        ReadAhead(transfer);
+        return true;
+      }
+      AddZeroChunks(transfer, chunk.chunk_index, 1);
+    }
+    
+    chunk.data.clear();
+    return true;
+  }
+  
+  bool ReadChunk(TransferInfo& transfer, uint32_t chunk_index, ByteBuffer& chunk) {
+    uint64_t chunk_length = ChunkLength(transfer.file_size, chunk_index);
+    chunk.resize(chunk_length);
+    uint64_t offset = static_cast<uint64_t>(chunk_index) * _chunk_size;
+    
+    if (transfer.pack) {
+      return transfer.pack->Read(offset, chunk.data(), chunk_length);
+    }
+    return transfer.file && transfer.file->ReadAt(offset, chunk.data(), chunk_length);
+  }
+  
+  // Read the next few pending chunks and hand them to the workers, so they
+  // are compressed and sealed while earlier chunks are on the wire. Chunks
+  // that don't compress are sent raw. Returns false if a chunk can't be
+  // read.
+  bool QueueCompression(TransferInfo& transfer) {
+    while (transfer.compressing.size() < COMPRESSION_AHEAD &&
+           (!transfer.pending_ranges.empty() || !transfer.reading.empty())) {
+      EncodedChunk chunk;
+      if (!TakeChunk(transfer, chunk)) {
+        return false;
+      }
+      if (chunk.data.empty()) {
+        break;
+      }
+      
+      std::shared_ptr<const Compressor> compressor = transfer.compressor;
+      std::shared_ptr<ChunkStream> stream = transfer.stream;
+      if (stream) {
+        chunk.stream_index = transfer.stream_queued++;
+      }
+      transfer.compressing.push_back(
+          _workers.Submit([compressor, stream, chunk = std::move(chunk)]() mutable {
+            if (compressor) {
+              chunk.compression = CompressChunk(*compressor, chunk.data);
+            }
+            if (stream) {
+              SealChunk(*stream, chunk);
+            }
+            return std::move(chunk);
+          }));
+    }
+    return true;
+  }
+  
+  // Seal a chunk once every chunk queued before it on the stream has been
+  // sealed. Its turn passes on even if sealing fails, so later chunks never
+  // wait forever.
+  static void SealChunk(ChunkStream& stream, EncodedChunk& chunk) {
+    size_t header_size = chunk.stream_index == 0 ? crypto::StreamSealer::HEADER_SIZE : 0;
+    ByteBuffer sealed(header_size + chunk.data.size() + crypto::StreamSealer::OVERHEAD);
+    bool rekey = stream.rekey_interval > 0 &&
+                 (chunk.stream_index + 1) % stream.rekey_interval == 0;
+    
+    std::unique_lock<std::mutex> lock(stream.mutex);
+    stream.turn_cv.wait(lock, [&] { return stream.next_turn == chunk.stream_index; });
+    if (header_size > 0) {
+      const auto& header = stream.sealer->GetHeader();
+      std::copy(header.begin(), header.end(), sealed.begin());
+    }
+    chunk.sealed = stream.sealer->Push(chunk.data.data(), chunk.data.size(), rekey,
+                                       sealed.data() + header_size);
+    stream.next_turn++;
+    lock.unlock();
+    stream.turn_cv.notify_all();
+    
+    chunk.data = std::move(sealed);
+  }
+  
+  uint64_t SendNextManifestBatch(std::unique_lock<std::mutex>& lock, TransferInfo& transfer) {
+    if (!transfer.manifest_built) {
+      // Chunking reads the whole file, so don't hold up the transfer's
+      // message handlers
+      std::vector<ContentChunk> manifest;
+      
+      lock.unlock();
+      bool chunked = ContentChunker::ChunkFile(transfer.file_path, manifest);
+      lock.lock();
+      
+      if (!IsActive(transfer.status)) {
+        return 0;  // Cancelled while chunking
+      }
+      
+      if (!chunked) {
+        FailOutgoing(transfer, "Failed to chunk file for delta transfer");
+        return 0;
+      }
+      
+      transfer.manifest = std::move(manifest);
+      transfer.manifest_built = true;
+    }
+    
+    uint32_t first_index = transfer.manifest_sent;
+    uint32_t count = std::min<uint32_t>(
+        MANIFEST_BATCH_SIZE, static_cast<uint32_t>(transfer.manifest.size()) - first_index);
+    
+    std::vector<uint32_t> lengths;
+    ByteBuffer hashes;
+    lengths.reserve(count);
+    hashes.reserve(static_cast<size_t>(count) * crypto::DIGEST_SIZE);
+    for (uint32_t i = first_index; i < first_index + count; ++i) {
+      lengths.push_back(transfer.manifest[i].length);
+      hashes.insert(hashes.end(), transfer.manifest[i].hash.begin(), transfer.manifest[i].hash.end());
+    }
+    transfer.manifest_sent += count;
+    
+    FileDeltaManifestMessage manifest_msg(transfer.peer_id, transfer.transfer_id, first_index,
+                                          lengths, hashes);
+    
+    lock.unlock();
+    bool sent = _network_manager->SendMessage(transfer.peer_id, manifest_msg);
+    lock.lock();
+    
+    if (IsActive(transfer.status) && !sent) {
+      FailOutgoing(transfer, "Failed to send delta manifest");
+      return 0;
+    }
+    return lengths.size() * sizeof(uint32_t) + hashes.size();
+  }
+  
+  uint64_t SendNextHashBatch(std::unique_lock<std::mutex>& lock, TransferInfo& transfer) {
+    const auto& leaves = transfer.chunk_tree.GetLeaves();
+    
+    uint32_t first_index = transfer.hashes_sent;
+    uint32_t count = std::min<uint32_t>(HASH_BATCH_SIZE,
+                                        static_cast<uint32_t>(leaves.size()) - first_index);
+    
+    ByteBuffer hashes;
+    hashes.reserve(static_cast<size_t>(count) * crypto::DIGEST_SIZE);
+    for (uint32_t i = first_index; i < first_index + count; ++i) {
+      hashes.insert(hashes.end(), leaves[i].begin(), leaves[i].end());
+    }
+    transfer.hashes_sent += count;
+    
+    FileChunkHashesMessage hashes_msg(transfer.peer_id, transfer.transfer_id, first_index, hashes);
+    
+    lock.unlock();
+    bool sent = _network_manager->SendMessage(transfer.peer_id, hashes_msg);
+    lock.lock();
+    
+    if (IsActive(transfer.status) && !sent) {
+      FailOutgoing(transfer, "Failed to send chunk hashes");
+      return 0;
+    }
+    return hashes.size();
+  }
+  
+  std::shared_ptr<NetworkManager> _network_manager;
+
+  // Transfers are keyed by ID: outgoing ones by the ID we picked, incoming
+  // ones by the ID the sender picked. Each transfer has its own lock.
+  TransferTable _outgoing_transfers;
+  TransferTable _incoming_transfers;
+  
+  // Guards the state shared between transfers. Taken after a transfer's
+  // lock, never before it.
+  mutable std::mutex _state_mutex;
+  std::map<std::string, SharedFile> _shared_files;
+  std::deque<std::pair<TransferId, std::chrono::steady_clock::time_point>> _finished_swarms;
+  DirectoryMap _incoming_directories;
+
+  size_t _chunk_size;
+  
+  // Leaf hash of a full chunk of zeros, which holes are checked against
+  crypto::Digest _zero_chunk_hash{};
+  
+  // Upload scheduling, only touched by the send thread. The limits are set
+  // from other threads and picked up on its next pass.
+  TransferScheduler _scheduler;
+  std::atomic<size_t> _max_concurrent_transfers{0};
+  std::atomic<uint64_t> _upload_limit{0};
+  
+  // Chunk compression. Codecs are built once and shared; the workers
+  // compress chunks ahead of the send thread.
+  std::map<CompressionType, std::shared_ptr<const Compressor>> _compressors;
+  std::atomic<bool> _compression_enabled{false};
+  WorkerPool _workers;
+  
+  // Chunk sealing for new transfers, off while null. The provider is
+  // guarded by _state_mutex.
+  std::shared_ptr<crypto::CryptoProvider> _stream_crypto;
+  std::atomic<uint32_t> _rekey_interval{0};
+  
+  // Files of at least this size use direct I/O; 0 turns it off. The pool
+  // holds the aligned buffers it goes through.
+  std::atomic<uint64_t> _direct_io_threshold{0};
+  std::shared_ptr<AlignedBufferPool> _io_buffers;
+  
+  // Background reads and writes of transfer files
+  std::unique_ptr<AsyncFileIo> _file_io;
+  
+  // Received files by content hash, if enabled. Guarded by _state_mutex;
+  // additions hold a reference while they run on the workers.
+  std::shared_ptr<ContentStore> _content_store;
+  
+  std::atomic<uint32_t> _progress_rate{DEFAULT_PROGRESS_RATE};
+  
+  std::atomic<bool> _running;
+  std::mutex _send_mutex;
+  std::condition_variable _send_cv;
+  bool _send_pending = false;
+  
+  // Cache fetches and delta applications running on the workers. Guarded
+  // by _send_mutex.
+  size_t _worker_jobs = 0;
+  
+  // Stall detection, off while the timeout is zero. Guarded by _send_mutex.
+  std::chrono::milliseconds _stall_timeout{0};
+  bool _fail_stalled = false;
+  std::thread _send_thread;
 
   FileTransferProgressCallback _progress_callback;
   FileTransferCompletedCallback _completed_callback;
@@ -0,0 +1,71 @@
+#include "linknet/throughput_meter.h"
+#include <cmath>
+
+namespace linknet {
+
+ThroughputMeter::ThroughputMeter(Clock::duration window, double smoothing)
+    : _window(window), _smoothing(smoothing) {
+}
+
+void ThroughputMeter::Start(Clock::time_point now) {
+  _started = true;
+  _window_start = now;
+  _last_activity = now;
+}
+
+void ThroughputMeter::Add(uint64_t bytes, Clock::time_point now) {
+  if (!_started) {
+    Start(now);
+  }
+  
+  Roll(now);
+  _window_bytes += bytes;
+  _total_bytes += bytes;
+  _last_activity = now;
+}
+
+double ThroughputMeter::CurrentRate(Clock::time_point now) const {
+  ThroughputMeter rolled = *this;
+  rolled.Roll(now);
+  if (!rolled._have_average) {
+    return AverageRate(now);
+  }
+  return rolled._current_rate;
+}
+
+double ThroughputMeter::AverageRate(Clock::time_point now) const {
+  ThroughputMeter rolled = *this;
+  rolled.Roll(now);
+  if (rolled._have_average) {
+    return rolled._average_rate;
+  }
+  
+  // Less than a window so far: the plain average
+  double seconds = std::chrono::duration<double>(now - _window_start).count();
+  return _started && seconds > 0 ? _total_bytes / seconds : 0;
+}
+
+void ThroughputMeter::Roll(Clock::time_point now) {
+  if (!_started || now - _window_start < _window) {
+    return;
+  }
+  
+  // The window that was open
+  _current_rate = _window_bytes / std::chrono::duration<double>(_window).count();
+  _average_rate = _have_average
+                      ? _smoothing * _current_rate + (1 - _smoothing) * _average_rate
+                      : _current_rate;
+  _have_average = true;
+  _window_bytes = 0;
+  _window_start += _window;
+  
+  // Any later windows that passed without traffic
+  auto idle_windows = (now - _window_start) / _window;
+  if (idle_windows > 0) {
+    _current_rate = 0;
+    _average_rate *= std::pow(1 - _smoothing, static_cast<double>(idle_windows));
+    _window_start += idle_windows * _window;
+  }
+}
+
+}  // namespace linknet
@@ -0,0 +1,224 @@
+#include "linknet/transfer_scheduler.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace linknet {
+
+TransferScheduler::TransferScheduler(uint64_t quantum)
+    : _quantum(quantum), _last_refill(Clock::now()) {
+}
+
+void TransferScheduler::SetMaxActive(size_t max_active) {
+  _max_active = max_active;
+  Admit();
+}
+
+void TransferScheduler::SetUploadLimit(uint64_t bytes_per_second) {
+  if (bytes_per_second == _rate) {
+    return;
+  }
+  
+  _rate = bytes_per_second;
+  _tokens = 0;
+  _last_refill = Clock::now();
+}
+
+void TransferScheduler::Update(const std::vector<Transfer>& transfers) {
+  std::unordered_set<TransferId> present;
+  for (const auto& transfer : transfers) {
+    present.insert(transfer.transfer_id);
+    
+    auto it = _flows.find(transfer.transfer_id);
+    if (it != _flows.end()) {
+      it->second.priority = transfer.priority;
+      continue;
+    }
+    
+    Flow flow;
+    flow.peer_id = transfer.peer_id;
+    flow.priority = transfer.priority;
+    flow.sequence = _next_sequence++;
+    _flows.emplace(transfer.transfer_id, flow);
+  }
+  
+  std::vector<TransferId> gone;
+  for (const auto& [transfer_id, flow] : _flows) {
+    if (present.count(transfer_id) == 0) {
+      gone.push_back(transfer_id);
+    }
+  }
+  for (TransferId transfer_id : gone) {
+    Remove(transfer_id);
+  }
+  
+  Admit();
+}
+
+bool TransferScheduler::Next(const std::function<bool(TransferId)>& is_ready,
+                             TransferId& transfer_id) {
+  // A peer is served while it has credit left; an exhausted one is topped up
+  // by one quantum and moved to the back. Every visit to a ready peer adds
+  // credit, so the loop ends once one is found or all are known idle.
+  std::vector<PeerId> idle;
+  while (idle.size() < _peer_order.size()) {
+    PeerId peer_id = _peer_order.front();
+    PeerQueue& peer = _peers[peer_id];
+    
+    if (std::find(idle.begin(), idle.end(), peer_id) == idle.end()) {
+      if (peer.credit <= 0) {
+        peer.credit += static_cast<int64_t>(_quantum);
+      } else if (PickFlow(peer, is_ready, transfer_id)) {
+        return true;
+      } else {
+        // Idle peers don't bank credit
+        peer.credit = 0;
+        idle.push_back(peer_id);
+      }
+    }
+    
+    _peer_order.pop_front();
+    _peer_order.push_back(peer_id);
+  }
+  
+  return false;
+}
+
+bool TransferScheduler::PickFlow(PeerQueue& peer, const std::function<bool(TransferId)>& is_ready,
+                                 TransferId& transfer_id) {
+  std::vector<TransferId> idle;
+  while (idle.size() < peer.flows.size()) {
+    TransferId candidate = peer.flows.front();
+    Flow& flow = _flows[candidate];
+    
+    if (std::find(idle.begin(), idle.end(), candidate) == idle.end()) {
+      if (!is_ready(candidate)) {
+        flow.credit = std::min<int64_t>(flow.credit, 0);
+        idle.push_back(candidate);
+      } else if (flow.credit <= 0) {
+        flow.credit += static_cast<int64_t>(_quantum * Weight(flow.priority) /
+                                            Weight(TransferPriority::NORMAL));
+      } else {
+        transfer_id = candidate;
+        return true;
+      }
+    }
+    
+    peer.flows.pop_front();
+    peer.flows.push_back(candidate);
+  }
+  
+  return false;
+}
+
+void TransferScheduler::Charge(TransferId transfer_id, uint64_t bytes, Clock::time_point now) {
+  auto it = _flows.find(transfer_id);
+  if (it != _flows.end()) {
+    it->second.credit -= static_cast<int64_t>(bytes);
+    
+    auto peer = _peers.find(it->second.peer_id);
+    if (peer != _peers.end()) {
+      peer->second.credit -= static_cast<int64_t>(bytes);
+    }
+  }
+  
+  if (_rate > 0) {
+    RefillTokens(now);
+    _tokens -= static_cast<double>(bytes);
+  }
+}
+
+TransferScheduler::Clock::duration TransferScheduler::UploadDelay(Clock::time_point now) {
+  if (_rate == 0) {
+    return Clock::duration::zero();
+  }
+  
+  RefillTokens(now);
+  if (_tokens >= 0) {
+    return Clock::duration::zero();
+  }
+  
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(-_tokens / static_cast<double>(_rate)));
+}
+
+bool TransferScheduler::IsAdmitted(TransferId transfer_id) const {
+  auto it = _flows.find(transfer_id);
+  return it != _flows.end() && it->second.admitted;
+}
+
+uint32_t TransferScheduler::Weight(TransferPriority priority) {
+  switch (priority) {
+    case TransferPriority::LOW:
+      return 1;
+    case TransferPriority::HIGH:
+      return 16;
+    case TransferPriority::NORMAL:
+    default:
+      return 4;
+  }
+}
+
+void TransferScheduler::Remove(TransferId transfer_id) {
+  auto it = _flows.find(transfer_id);
+  if (it == _flows.end()) {
+    return;
+  }
+  
+  if (it->second.admitted) {
+    _active--;
+    
+    auto peer = _peers.find(it->second.peer_id);
+    auto& flows = peer->second.flows;
+    flows.erase(std::find(flows.begin(), flows.end(), transfer_id));
+    
+    if (flows.empty()) {
+      _peer_order.erase(std::find(_peer_order.begin(), _peer_order.end(), peer->first));
+      _peers.erase(peer);
+    }
+  }
+  
+  _flows.erase(it);
+}
+
+// Fill free slots with waiting transfers, highest priority first and then
+// oldest first
+void TransferScheduler::Admit() {
+  while (_max_active == 0 || _active < _max_active) {
+    auto best = _flows.end();
+    for (auto it = _flows.begin(); it != _flows.end(); ++it) {
+      if (it->second.admitted) {
+        continue;
+      }
+      if (best == _flows.end() || it->second.priority > best->second.priority ||
+          (it->second.priority == best->second.priority &&
+           it->second.sequence < best->second.sequence)) {
+        best = it;
+      }
+    }
+    
+    if (best == _flows.end()) {
+      return;
+    }
+    
+    Flow& flow = best->second;
+    flow.admitted = true;
+    flow.credit = 0;
+    _active++;
+    
+    auto [peer, inserted] = _peers.try_emplace(flow.peer_id);
+    if (inserted) {
+      _peer_order.push_back(flow.peer_id);
+    }
+    peer->second.flows.push_back(best->first);
+  }
+}
+
+void TransferScheduler::RefillTokens(Clock::time_point now) {
+  // Allow bursts of up to 100 ms worth, and at least one quantum
+  double burst = std::max(static_cast<double>(_rate) / 10, static_cast<double>(_quantum));
+  double elapsed = std::chrono::duration<double>(now - _last_refill).count();
+  _tokens = std::min(burst, _tokens + elapsed * static_cast<double>(_rate));
+  _last_refill = now;
+}
+
+}  // namespace linknet
@@ -70,12 +70,14 @@ int main(int argc, char* argv[]) {
   
   try {
     // Initialize crypto
-    auto crypto_provider = linknet::crypto::CryptoFactory::Create();
+    std::shared_ptr<linknet::crypto::CryptoProvider> crypto_provider =
+        linknet::crypto::CryptoFactory::Create();
     
     // Set up network manager
     // Convert unique_ptr to shared_ptr since our other components require shared_ptr
     std::shared_ptr<linknet::NetworkManager> network_manager = 
         std::shared_ptr<linknet::NetworkManager>(linknet::NetworkFactory::Create().release());
+    network_manager->SetCryptoProvider(crypto_provider);
     
     if (!network_manager->Start(port)) {
       LOG_FATAL("Failed to start network manager on port ", port);
@@ -102,10 +104,30 @@ int main(int argc, char* argv[]) {
       }
     });
     
+    // Set up file transfer manager
+    // Convert unique_ptr to shared_ptr since our ConsoleUI requires shared_ptr
+    std::shared_ptr<linknet::FileTransferManager> file_transfer_manager = 
+        std::shared_ptr<linknet::FileTransferManager>(linknet::FileTransferFactory::Create(network_manager).release());
+    file_transfer_manager->SetEncryption(crypto_provider);
+    
     // Set up message handling chain
     // First, create a handler for non-chat messages
-    auto non_chat_handler = [network_manager](std::unique_ptr<linknet::Message> message) {
+    auto non_chat_handler = [network_manager, file_transfer_manager](std::unique_ptr<linknet::Message> message) {
       switch (message->GetType()) {        
+        case linknet::MessageType::FILE_TRANSFER_REQUEST:
+        case linknet::MessageType::FILE_TRANSFER_RESPONSE:
+        case linknet::MessageType::FILE_CHUNK:
+        case linknet::MessageType::FILE_HOLES:
+        case linknet::MessageType::FILE_CHUNK_HASHES:
+        case linknet::MessageType::FILE_CHUNK_REQUEST:
+        case linknet::MessageType::FILE_DELTA_MANIFEST:
+        case linknet::MessageType::FILE_SWARM_QUERY:
+        case linknet::MessageType::FILE_SWARM_HAVE:
+        case linknet::MessageType::FILE_DIRECTORY_MANIFEST:
+        case linknet::MessageType::FILE_TRANSFER_COMPLETE:
+          file_transfer_manager->HandleMessage(std::move(message));
+          break;
+          
         case linknet::MessageType::CONNECTION_NOTIFICATION: {
           auto conn_msg = static_cast<linknet::ConnectionMessage&>(*message);
           const linknet::PeerId& sender_id = conn_msg.GetSender();
@@ -177,27 +199,27 @@ int main(int argc, char* argv[]) {
       }
     });
     
-    // Set up file transfer manager
-    // Convert unique_ptr to shared_ptr since our ConsoleUI requires shared_ptr
-    std::shared_ptr<linknet::FileTransferManager> file_transfer_manager = 
-        std::shared_ptr<linknet::FileTransferManager>(linknet::FileTransferFactory::Create(network_manager).release());
-    
     // Handle file transfer progress
     file_transfer_manager->SetProgressCallback([](const linknet::PeerId& peer_id, 
                                                 const std::string& file_path, 
-                                                double progress) {
+                                                const linknet::TransferProgress& progress) {
       std::stringstream peer_id_ss;
       for (const auto& byte : peer_id) {
         peer_id_ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
       }
       
       LOG_INFO("File transfer progress for ", file_path, ": ", 
-               std::fixed, std::setprecision(1), progress * 100.0, "%");
+               std::fixed, std::setprecision(1), progress.fraction * 100.0, "%");
       
       if (g_ui) {
         std::stringstream msg;
         msg << "File transfer progress for " << file_path << ": "
-            << std::fixed << std::setprecision(1) << (progress * 100.0) << "%";
+            << std::fixed << std::setprecision(1) << (progress.fraction * 100.0) << "%"
+            << " (" << progress.bytes_per_second / (1024 * 1024) << " MB/s";
+        if (progress.eta_seconds > 0) {
+          msg << ", " << static_cast<uint64_t>(progress.eta_seconds + 0.5) << "s left";
+        }
+        msg << ")";
         g_ui->DisplayMessage(msg.str());
       }
     });
@@ -1,13 +1,21 @@
 #include "linknet/network.h"
 #include "linknet/message.h"
+#include "linknet/crypto.h"
+#include "linknet/key_arena.h"
+#include "linknet/session_tickets.h"
 #include "linknet/logger.h"
 #include <boost/asio.hpp>
+#include <sodium.h>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <unordered_map>
 #include <queue>
+#include <deque>
 #include <algorithm>
 #include <random>
+#include <set>
+#include <stdexcept>
 
 namespace std {
 template <>
@@ -26,20 +34,32 @@ namespace asio = boost::asio;
 
 namespace linknet {
 
-// A session represents a connected peer
+// A session represents a connected peer. Besides its primary connection, a
+// session may own extra data connections to the same peer, themselves
+// sessions with the same peer ID, which carry file chunks only.
 class PeerSession : public std::enable_shared_from_this<PeerSession> {
  public:
   using tcp = boost::asio::ip::tcp;
   
-  PeerSession(tcp::socket socket, PeerId peer_id, MessageCallback message_callback)
+  // Data connections a session takes at most
+  static constexpr size_t MAX_DATA_CONNECTIONS = 16;
+  
+  // Bytes queued on a data connection before senders wait for it to drain
+  static constexpr size_t MAX_QUEUED_BYTES = 1024 * 1024;
+  
+  // dialed is set for connections this side opened
+  PeerSession(tcp::socket socket, PeerId peer_id, MessageCallback message_callback,
+              bool dialed = false)
       : _socket(std::move(socket)), 
+        _endpoint(_socket.remote_endpoint()),
         _peer_id(peer_id),
         _message_callback(message_callback),
-        _is_connected(true) {
+        _is_connected(true),
+        _dialed(dialed) {
     
     _peer_info.id = peer_id;
-    _peer_info.ip_address = _socket.remote_endpoint().address().to_string();
-    _peer_info.port = _socket.remote_endpoint().port();
+    _peer_info.ip_address = _endpoint.address().to_string();
+    _peer_info.port = _endpoint.port();
     _peer_info.status = ConnectionStatus::CONNECTED;
   }
   
@@ -47,19 +67,61 @@ class PeerSession : public std::enable_shared_from_this<PeerSession> {
     ReadMessage();
   }
   
+  // Seal and open every frame from here on. Must be set before the session
+  // is shared.
+  void SetCipher(std::unique_ptr<crypto::SessionCipher> cipher) {
+    _cipher = std::move(cipher);
+  }
+  
+  bool IsEncrypted() const {
+    return _cipher != nullptr;
+  }
+  
+  // The cipher for a data connection of this session, null if the session
+  // isn't encrypted
+  std::unique_ptr<crypto::SessionCipher> DeriveCipher(const ByteBuffer& salt) const {
+    return _cipher ? _cipher->Derive(salt) : nullptr;
+  }
+  
+  // What a ticket for this session holds. The session must be encrypted.
+  crypto::SessionTicket GetResumptionState() const {
+    return {_peer_id, _cipher->GetSuite(), _cipher->GetResumptionSecret()};
+  }
+  
   bool IsConnected() const {
     return _is_connected;
   }
   
   void Close() {
-    if (_is_connected) {
-      boost::system::error_code ec;
-      _socket.close(ec);
-      _is_connected = false;
+    if (!_is_connected.exchange(false)) {
+      return;
+    }
       
-      if (ec) {
-        LOG_ERROR("Error closing socket: ", ec.message());
-      }
+    boost::system::error_code ec;
+    _socket.close(ec);
+    
+    if (ec) {
+      LOG_ERROR("Error closing socket: ", ec.message());
+    }
+    
+    {
+      std::lock_guard<std::mutex> lock(_queue_mutex);
+      _queue_cv.notify_all();
+    }
+    
+    // Chunks queued on a data connection are lost with it, so the session
+    // and its data connections go down together
+    std::vector<std::shared_ptr<PeerSession>> streams;
+    {
+      std::lock_guard<std::mutex> lock(_streams_mutex);
+      streams.swap(_streams);
+    }
+    for (auto& stream : streams) {
+      stream->Close();
+    }
+    
+    if (auto owner = _owner.lock()) {
+      owner->Close();
     }
   }
   
@@ -71,6 +133,98 @@ class PeerSession : public std::enable_shared_from_this<PeerSession> {
     return _peer_info;
   }
   
+  const tcp::endpoint& GetEndpoint() const {
+    return _endpoint;
+  }
+  
+  bool IsDialed() const {
+    return _dialed;
+  }
+  
+  // True once, for a session this side dialed, which may then open data
+  // connections to the address it dialed
+  bool TakeDataOffer() {
+    return _dialed && !_offer_taken.exchange(true);
+  }
+  
+  // Make stream one of this session's data connections
+  bool AttachStream(const std::shared_ptr<PeerSession>& stream) {
+    std::lock_guard<std::mutex> lock(_streams_mutex);
+    if (!_is_connected || _streams.size() >= MAX_DATA_CONNECTIONS) {
+      return false;
+    }
+    
+    stream->_owner = weak_from_this();
+    _streams.push_back(stream);
+    return true;
+  }
+  
+  // True once per salt a data connection joins this session with; a salt
+  // seen before is a replayed join. A session is joined at most
+  // MAX_DATA_CONNECTIONS times.
+  bool TakeJoinSalt(const ByteBuffer& salt) {
+    std::lock_guard<std::mutex> lock(_streams_mutex);
+    return _join_salts.size() < MAX_DATA_CONNECTIONS && _join_salts.insert(salt).second;
+  }
+  
+  size_t GetStreamCount() const {
+    std::lock_guard<std::mutex> lock(_streams_mutex);
+    return _streams.size();
+  }
+  
+  // The connected data connection with the least queued, if any
+  std::shared_ptr<PeerSession> PickStream() const {
+    std::lock_guard<std::mutex> lock(_streams_mutex);
+    std::shared_ptr<PeerSession> best;
+    for (const auto& stream : _streams) {
+      if (stream->IsConnected() &&
+          (!best || stream->_queued_bytes < best->_queued_bytes)) {
+        best = stream;
+      }
+    }
+    return best;
+  }
+  
+  // Queue a message to be written in the background, waiting while the
+  // queue is full. Unlike SendMessage, the message is only on its way when
+  // this returns.
+  bool QueueMessage(const Message& message) {
+    QueuedFrame frame;
+    frame.data = message.Serialize();
+    frame.mac_size = _cipher ? frame.mac.size() : 0;
+    frame.size_network = htobe32(static_cast<uint32_t>(frame.data.size() + frame.mac_size));
+    
+    std::unique_lock<std::mutex> lock(_queue_mutex);
+    
+    // The io thread drains the queue, so it never waits for it
+    auto& io_context = static_cast<asio::io_context&>(
+        asio::query(_socket.get_executor(), asio::execution::context));
+    if (!io_context.get_executor().running_in_this_thread()) {
+      _queue_cv.wait(lock, [this] {
+        return !_is_connected || _queued_bytes < MAX_QUEUED_BYTES;
+      });
+    }
+    if (!_is_connected) {
+      return false;
+    }
+    
+    // Queued frames go out in order, so they are sealed in order too
+    if (!Seal(frame.data, frame.size_network, frame.mac)) {
+      LOG_ERROR("Failed to encrypt message");
+      return false;
+    }
+    
+    _queued_bytes += frame.data.size();
+    _write_queue.push_back(std::move(frame));
+    if (!_writing) {
+      _writing = true;
+      asio::post(_socket.get_executor(), [self = shared_from_this()]() {
+        self->WriteNext();
+      });
+    }
+    return true;
+  }
+  
   bool SendMessage(const Message& message) {
     if (!_is_connected) {
       return false;
@@ -79,12 +233,35 @@ class PeerSession : public std::enable_shared_from_this<PeerSession> {
     try {
       ByteBuffer data = message.Serialize();
       
-      // Write the size of the message first (4 bytes)
-      uint32_t size_network = htobe32(static_cast<uint32_t>(data.size()));
-      asio::write(_socket, asio::buffer(&size_network, 4));
+      // Size prefix (4 bytes) followed by the message and, on an encrypted
+      // session, its MAC, written as one frame
+      std::array<uint8_t, crypto::SessionCipher::MAC_SIZE> mac;
+      size_t mac_size = _cipher ? mac.size() : 0;
+      uint32_t size_network = htobe32(static_cast<uint32_t>(data.size() + mac_size));
+      std::array<asio::const_buffer, 3> frame = {
+          asio::buffer(&size_network, 4), asio::buffer(data), asio::buffer(mac, mac_size)};
       
-      // Then write the message
-      asio::write(_socket, asio::buffer(data));
+      // Several threads (chat, file transfer, io) may send on this session.
+      // Chunk data waits while any other message is queued for it, so chat
+      // and transfer control never sit behind a bulk transfer.
+      bool bulk = message.GetType() == MessageType::FILE_CHUNK;
+      if (!bulk) {
+        _priority_writers++;
+      }
+      
+      std::unique_lock<std::mutex> lock(_write_mutex);
+      if (bulk) {
+        _write_cv.wait(lock, [this] { return _priority_writers == 0; });
+      } else if (--_priority_writers == 0) {
+        _write_cv.notify_all();
+      }
+      
+      // Frames are sealed in the order they are written, which is the
+      // order their nonces must be in
+      if (!Seal(data, size_network, mac)) {
+        throw std::runtime_error("Failed to encrypt message");
+      }
+      asio::write(_socket, frame);
       
       return true;
     } catch (const std::exception& e) {
@@ -116,9 +293,18 @@ class PeerSession : public std::enable_shared_from_this<PeerSession> {
                 asio::buffer(_read_buffer),
                 [this, self](const boost::system::error_code& ec, std::size_t /*length*/) {
                   if (!ec) {
+                    if (!Open()) {
+                      LOG_ERROR("Dropping connection: message failed authentication");
+                      Close();
+                      return;
+                    }
+                    
                     try {
                       auto message = MessageFactory::CreateFromBuffer(_read_buffer);
                       if (message) {
+                        // Peer IDs are assigned locally per connection, so
+                        // replies must be addressed to this session's ID
+                        message->SetSender(_peer_id);
                         _message_callback(std::move(message));
                       }
                       
@@ -140,11 +326,103 @@ class PeerSession : public std::enable_shared_from_this<PeerSession> {
         });
   }
   
+  // Write the front of the queue, then the rest in turn. Runs on the io
+  // thread.
+  void WriteNext() {
+    std::unique_lock<std::mutex> lock(_queue_mutex);
+    if (_write_queue.empty() || !_is_connected) {
+      _writing = false;
+      return;
+    }
+    
+    // Queued frames stay in place until written
+    QueuedFrame& frame = _write_queue.front();
+    std::array<asio::const_buffer, 3> buffers = {
+        asio::buffer(&frame.size_network, 4), asio::buffer(frame.data),
+        asio::buffer(frame.mac, frame.mac_size)};
+    lock.unlock();
+    
+    auto self = shared_from_this();
+    asio::async_write(
+        _socket, buffers,
+        [this, self](const boost::system::error_code& ec, std::size_t /*length*/) {
+          {
+            std::lock_guard<std::mutex> lock(_queue_mutex);
+            _queued_bytes -= _write_queue.front().data.size();
+            _write_queue.pop_front();
+            _queue_cv.notify_all();
+          }
+          
+          if (ec) {
+            LOG_ERROR("Error writing to data connection: ", ec.message());
+            Close();
+          }
+          WriteNext();
+        });
+  }
+  
+  // Decrypt the message just read in place and drop its MAC. Nothing to do
+  // on an unencrypted session.
+  bool Open() {
+    if (!_cipher) {
+      return true;
+    }
+    if (_read_buffer.size() < crypto::SessionCipher::MAC_SIZE) {
+      return false;
+    }
+    
+    size_t size = _read_buffer.size() - crypto::SessionCipher::MAC_SIZE;
+    if (!_cipher->Open(_read_buffer.data(), size, _read_size_buffer, 4,
+                       _read_buffer.data() + size)) {
+      return false;
+    }
+    _read_buffer.resize(size);
+    return true;
+  }
+  
+  // Encrypt a message in place, with the frame's size prefix as associated
+  // data. Nothing to do on an unencrypted session.
+  bool Seal(ByteBuffer& data, const uint32_t& size_network,
+            std::array<uint8_t, crypto::SessionCipher::MAC_SIZE>& mac) {
+    return !_cipher ||
+           _cipher->Seal(data.data(), data.size(), reinterpret_cast<const uint8_t*>(&size_network),
+                         4, mac.data());
+  }
+  
+  struct QueuedFrame {
+    uint32_t size_network;
+    ByteBuffer data;
+    std::array<uint8_t, crypto::SessionCipher::MAC_SIZE> mac;
+    size_t mac_size;
+  };
+  
   tcp::socket _socket;
+  tcp::endpoint _endpoint;
   PeerId _peer_id;
   PeerInfo _peer_info;
   MessageCallback _message_callback;
   std::atomic<bool> _is_connected;
+  std::mutex _write_mutex;
+  std::condition_variable _write_cv;
+  std::atomic<int> _priority_writers{0};
+  std::unique_ptr<crypto::SessionCipher> _cipher;
+  
+  // Background writes, for data connections
+  std::mutex _queue_mutex;
+  std::condition_variable _queue_cv;
+  std::deque<QueuedFrame> _write_queue;
+  std::atomic<size_t> _queued_bytes{0};
+  bool _writing = false;
+  
+  bool _dialed;
+  std::atomic<bool> _offer_taken{false};
+  
+  // Data connections of a primary session, the dialer's salts they joined
+  // with, and the session a data connection belongs to
+  mutable std::mutex _streams_mutex;
+  std::vector<std::shared_ptr<PeerSession>> _streams;
+  std::set<ByteBuffer> _join_salts;
+  std::weak_ptr<PeerSession> _owner;
   
   uint8_t _read_size_buffer[4];
   ByteBuffer _read_buffer;
@@ -153,6 +431,36 @@ class PeerSession : public std::enable_shared_from_this<PeerSession> {
 // Implementation of NetworkManager using ASIO
 class AsioNetworkManager : public NetworkManager {
  public:
+  // Random bytes each side adds to the salt a data connection's keys are
+  // derived with
+  static constexpr size_t DATA_CONNECTION_SALT_SIZE = 32;
+  
+  // Largest first message of a connection. It is read before the peer is
+  // known, and is always a small CONNECTION or DATA_CONNECTION message.
+  static constexpr uint32_t MAX_FIRST_MESSAGE_SIZE = 4096;
+  
+  // A ticket to resume a session dialed from here, with what it holds,
+  // the secret in the key store it came from; salt is the dialer's half of
+  // the resumed connection's salt
+  struct Resumption {
+    ByteBuffer ticket;
+    PeerId peer_id;
+    crypto::CipherSuite suite;
+    std::shared_ptr<crypto::KeyStore> keys;
+    crypto::Key* secret = nullptr;
+    ByteBuffer salt;
+    
+    Resumption() = default;
+    Resumption(const Resumption&) = delete;
+    Resumption& operator=(const Resumption&) = delete;
+    
+    ~Resumption() {
+      if (keys) {
+        keys->Free(secret);
+      }
+    }
+  };
+  
   AsioNetworkManager()
       : _io_context(), 
         _work_guard(_io_context.get_executor()),
@@ -210,6 +518,7 @@ class AsioNetworkManager : public NetworkManager {
         session->Close();
       }
       _peer_sessions.clear();
+      _data_offers.clear();
     }
     
     _acceptor.close();
@@ -236,32 +545,55 @@ class AsioNetworkManager : public NetworkManager {
       asio::async_connect(
           *socket, endpoints,
           [this, address, port, socket](
-              const boost::system::error_code& ec, const asio::ip::tcp::endpoint& /*endpoint*/) {
+              const boost::system::error_code& ec, const asio::ip::tcp::endpoint& endpoint) {
             if (!ec) {
               LOG_INFO("Connected to peer at ", address, ":", port);
               
-              // Generate a stable peer ID for this connection
+              // Generate a stable peer ID for this connection, or keep the
+              // one of the session a ticket resumes
               PeerId peer_id;
               std::random_device rd;
               std::generate(peer_id.begin(), peer_id.end(), std::ref(rd));
               
-              auto session = std::make_shared<PeerSession>(std::move(*socket), peer_id, _message_callback);
-              
+              // Send a connection notification message to the peer, with a
+              // key exchange if connections are encrypted, and wait for its
+              // answer before anything else. The key exchange goes along
+              // with a ticket too, for a peer that no longer takes it.
+              std::shared_ptr<crypto::CryptoProvider> crypto;
               {
-                std::lock_guard<std::mutex> lock(_peers_mutex);
-                _peer_sessions[peer_id] = session;
+                std::lock_guard<std::mutex> lock(_crypto_mutex);
+                crypto = _crypto;
               }
-              
-              session->Start();
-              
-              // Send a connection notification message to the peer
+              auto keys = std::make_shared<crypto::KeyPair>();
+              std::shared_ptr<Resumption> resumption;
               ConnectionMessage conn_msg(peer_id, ConnectionStatus::CONNECTED);
-              session->SendMessage(conn_msg);
+              if (crypto) {
+                *keys = crypto->GenerateKeyPair();
+                conn_msg.SetKeyExchange(ByteBuffer(keys->public_key.begin(), keys->public_key.end()),
+                                        crypto->GetCipherSuites());
+                
+                resumption = TakeTicket(endpoint);
+                if (resumption) {
+                  peer_id = resumption->peer_id;
+                  conn_msg.SetSender(peer_id);
+                  resumption->salt.resize(ConnectionMessage::RESUMPTION_SALT_SIZE);
+                  randombytes_buf(resumption->salt.data(), resumption->salt.size());
+                  conn_msg.SetResumption(resumption->salt, resumption->ticket);
+                }
+              }
               
-              // Notify connection callback
-              if (_connection_callback) {
-                _connection_callback(peer_id, ConnectionStatus::CONNECTED);
+              boost::system::error_code write_ec;
+              WriteFrame(*socket, conn_msg, write_ec);
+              if (write_ec) {
+                LOG_ERROR("Error sending message: ", write_ec.message());
+                return;
               }
+              
+              ReadFirstMessage(socket, [this, socket, peer_id, crypto, keys, resumption](
+                                           std::unique_ptr<Message> answer) {
+                CompleteConnect(std::move(*socket), peer_id, crypto, *keys, resumption.get(),
+                                std::move(answer));
+              });
             } else {
               LOG_ERROR("Failed to connect to peer at ", address, ":", port, ": ", ec.message());
               
@@ -310,6 +642,14 @@ class AsioNetworkManager : public NetworkManager {
       session = it->second;
     }
     
+    // File chunks go over the least loaded data connection, if there are any
+    if (message.GetType() == MessageType::FILE_CHUNK) {
+      auto stream = session->PickStream();
+      if (stream && stream->QueueMessage(message)) {
+        return true;
+      }
+    }
+    
     return session->SendMessage(message);
   }
   
@@ -347,6 +687,18 @@ class AsioNetworkManager : public NetworkManager {
     return peers;
   }
   
+  void SetCryptoProvider(std::shared_ptr<crypto::CryptoProvider> provider) override {
+    auto ticket_keys =
+        provider ? std::make_shared<crypto::SessionTicketKeys>(*provider) : nullptr;
+    std::lock_guard<std::mutex> lock(_crypto_mutex);
+    _ticket_keys = std::move(ticket_keys);
+    _crypto = std::move(provider);
+  }
+  
+  void SetDataConnections(size_t count) override {
+    _data_connections = std::min(count, PeerSession::MAX_DATA_CONNECTIONS);
+  }
+  
   void SetMessageCallback(MessageCallback callback) override {
     _message_callback = std::move(callback);
   }
@@ -377,28 +729,7 @@ class AsioNetworkManager : public NetworkManager {
                     socket.remote_endpoint().address().to_string(), ":",
                     socket.remote_endpoint().port());
             
-            // Generate a stable peer ID for this connection
-            PeerId peer_id;
-            std::random_device rd;
-            std::generate(peer_id.begin(), peer_id.end(), std::ref(rd));
-            
-            auto session = std::make_shared<PeerSession>(std::move(socket), peer_id, _message_callback);
-            
-            {
-              std::lock_guard<std::mutex> lock(_peers_mutex);
-              _peer_sessions[peer_id] = session;
-            }
-            
-            session->Start();
-            
-            // Send a connection notification message to the peer
-            ConnectionMessage conn_msg(peer_id, ConnectionStatus::CONNECTED);
-            session->SendMessage(conn_msg);
-            
-            // Notify connection callback
-            if (_connection_callback) {
-              _connection_callback(peer_id, ConnectionStatus::CONNECTED);
-            }
+            ReadFirstMessage(std::make_shared<asio::ip::tcp::socket>(std::move(socket)));
           } else {
             LOG_ERROR("Error accepting connection: ", ec.message());
           }
@@ -410,6 +741,520 @@ class AsioNetworkManager : public NetworkManager {
         });
   }
   
+  // The first message of an accepted connection tells a new peer from a
+  // data connection of one already connected
+  void ReadFirstMessage(std::shared_ptr<asio::ip::tcp::socket> socket) {
+    ReadFirstMessage(socket, [this, socket](std::unique_ptr<Message> message) {
+      if (message && message->GetType() == MessageType::DATA_CONNECTION) {
+        AcceptDataConnection(std::move(*socket),
+                             static_cast<const DataConnectionMessage&>(*message));
+      } else {
+        AcceptPeer(std::move(*socket), std::move(message));
+      }
+    });
+  }
+  
+  // Read one message from a connection that has no session yet, in the
+  // clear. handler gets null for a message it can't parse, and isn't called
+  // if the connection fails or the message is over MAX_FIRST_MESSAGE_SIZE,
+  // which closes the connection.
+  void ReadFirstMessage(std::shared_ptr<asio::ip::tcp::socket> socket,
+                        std::function<void(std::unique_ptr<Message>)> handler) {
+    auto size_buffer = std::make_shared<std::array<uint8_t, 4>>();
+    asio::async_read(
+        *socket, asio::buffer(*size_buffer),
+        [socket, size_buffer, handler](const boost::system::error_code& ec,
+                                       std::size_t /*length*/) {
+          if (ec) {
+            LOG_ERROR("Error reading message size: ", ec.message());
+            return;
+          }
+          
+          uint32_t size_network;
+          std::memcpy(&size_network, size_buffer->data(), 4);
+          uint32_t size = be32toh(size_network);
+          if (size > MAX_FIRST_MESSAGE_SIZE) {
+            LOG_ERROR("Dropping connection: first message too large (", size, " bytes)");
+            boost::system::error_code close_ec;
+            socket->close(close_ec);
+            return;
+          }
+          auto buffer = std::make_shared<ByteBuffer>(size);
+          
+          asio::async_read(
+              *socket, asio::buffer(*buffer),
+              [socket, buffer, handler](const boost::system::error_code& ec,
+                                        std::size_t /*length*/) {
+                if (ec) {
+                  LOG_ERROR("Error reading message: ", ec.message());
+                  return;
+                }
+                
+                try {
+                  handler(MessageFactory::CreateFromBuffer(*buffer));
+                } catch (const std::exception& e) {
+                  LOG_ERROR("Error accepting connection: ", e.what());
+                }
+              });
+        });
+  }
+  
+  // Write one message in the clear, before the connection has a session
+  static void WriteFrame(asio::ip::tcp::socket& socket, const Message& message,
+                         boost::system::error_code& ec) {
+    ByteBuffer data = message.Serialize();
+    uint32_t size_network = htobe32(static_cast<uint32_t>(data.size()));
+    std::array<asio::const_buffer, 2> frame = {
+        asio::buffer(&size_network, 4), asio::buffer(data)};
+    asio::write(socket, frame, ec);
+  }
+  
+  // The session cipher for a key exchange in a peer's connection
+  // notification. The initiator takes the one suite the answer names.
+  static std::unique_ptr<crypto::SessionCipher> CreateCipher(
+      const crypto::CryptoProvider& crypto, const crypto::KeyPair& keys,
+      const ConnectionMessage& remote, bool initiator) {
+    crypto::CipherSuite suite = crypto.ChooseCipherSuite(remote.GetCipherSuites());
+    if (suite == crypto::CipherSuite::NONE) {
+      LOG_ERROR("No cipher suite in common with peer");
+      return nullptr;
+    }
+    
+    crypto::Key remote_public_key;
+    std::copy(remote.GetPublicKey().begin(), remote.GetPublicKey().end(),
+              remote_public_key.begin());
+    return crypto.CreateSessionCipher(suite, keys, remote_public_key, initiator);
+  }
+  
+  static const ConnectionMessage* AsKeyExchange(const std::unique_ptr<Message>& message) {
+    if (!message || message->GetType() != MessageType::CONNECTION_NOTIFICATION) {
+      return nullptr;
+    }
+    auto conn_msg = static_cast<const ConnectionMessage*>(message.get());
+    return conn_msg->HasKeyExchange() ? conn_msg : nullptr;
+  }
+  
+  static const ConnectionMessage* AsResumption(const std::unique_ptr<Message>& message) {
+    if (!message || message->GetType() != MessageType::CONNECTION_NOTIFICATION) {
+      return nullptr;
+    }
+    auto conn_msg = static_cast<const ConnectionMessage*>(message.get());
+    return conn_msg->HasResumption() ? conn_msg : nullptr;
+  }
+  
+  // Set up the session of a connection dialed from here, once the peer has
+  // answered its connection notification. resumption is the ticket offered
+  // with it, if any.
+  void CompleteConnect(asio::ip::tcp::socket socket, const PeerId& peer_id,
+                       const std::shared_ptr<crypto::CryptoProvider>& crypto,
+                       const crypto::KeyPair& keys, const Resumption* resumption,
+                       std::unique_ptr<Message> answer) {
+    // Peers without encryption answer without a key exchange, and peers
+    // that took the ticket with their half of the salt instead
+    std::unique_ptr<crypto::SessionCipher> cipher;
+    const ConnectionMessage* key_exchange = AsKeyExchange(answer);
+    const ConnectionMessage* resumed = AsResumption(answer);
+    if (crypto && resumption && resumed) {
+      if (resumed->GetCipherSuites() != crypto::CipherSuiteBit(resumption->suite)) {
+        LOG_ERROR("Peer resumed the session with another cipher suite");
+        return;
+      }
+      ByteBuffer salt = resumption->salt;
+      salt.insert(salt.end(), resumed->GetResumptionSalt().begin(),
+                  resumed->GetResumptionSalt().end());
+      cipher = crypto->ResumeSessionCipher(resumption->suite, *resumption->secret, salt, true);
+      if (!cipher) {
+        LOG_ERROR("Session resumption with peer failed");
+        return;
+      }
+      LOG_INFO("Resumed session with peer");
+    } else if (crypto && key_exchange) {
+      cipher = CreateCipher(*crypto, keys, *key_exchange, true);
+      if (!cipher) {
+        LOG_ERROR("Key exchange with peer failed");
+        return;
+      }
+    } else if (crypto) {
+      // Anyone on the path could strip the key from the answer, so an
+      // encrypting side never falls back to the clear
+      LOG_ERROR("Refused unencrypted connection: peer sent no public key");
+      return;
+    }
+    
+    auto session = std::make_shared<PeerSession>(std::move(socket), peer_id, MakeDispatch(),
+                                                 true);
+    LogEncryption(*session, cipher.get());
+    session->SetCipher(std::move(cipher));
+    
+    Register(session);
+    
+    // Notify connection callback
+    if (_connection_callback) {
+      _connection_callback(peer_id, ConnectionStatus::CONNECTED);
+    }
+    
+    if (answer) {
+      answer->SetSender(peer_id);
+      Dispatch(std::move(answer));
+    }
+    
+    session->Start();
+  }
+  
+  void AcceptPeer(asio::ip::tcp::socket socket, std::unique_ptr<Message> first_message) {
+    // Generate a stable peer ID for this connection
+    PeerId peer_id;
+    std::random_device rd;
+    std::generate(peer_id.begin(), peer_id.end(), std::ref(rd));
+    
+    // Resume the session a valid ticket names, under the peer ID it had,
+    // answering with our half of the salt. Otherwise answer a key exchange
+    // with one of our own, naming the suite chosen.
+    std::shared_ptr<crypto::CryptoProvider> crypto;
+    std::shared_ptr<crypto::SessionTicketKeys> ticket_keys;
+    {
+      std::lock_guard<std::mutex> lock(_crypto_mutex);
+      crypto = _crypto;
+      ticket_keys = _ticket_keys;
+    }
+    std::unique_ptr<crypto::SessionCipher> cipher;
+    ConnectionMessage conn_msg(peer_id, ConnectionStatus::CONNECTED);
+    const ConnectionMessage* key_exchange = AsKeyExchange(first_message);
+    crypto::SessionTicket ticket;
+    if (crypto && ticket_keys && key_exchange && key_exchange->HasResumption() &&
+        ticket_keys->Redeem(key_exchange->GetTicket(), ticket)) {
+      ByteBuffer salt(ConnectionMessage::RESUMPTION_SALT_SIZE);
+      randombytes_buf(salt.data(), salt.size());
+      ByteBuffer both_salts = key_exchange->GetResumptionSalt();
+      both_salts.insert(both_salts.end(), salt.begin(), salt.end());
+      cipher = crypto->ResumeSessionCipher(ticket.suite, ticket.secret, both_salts, false);
+      sodium_memzero(ticket.secret.data(), ticket.secret.size());
+      if (!cipher) {
+        LOG_ERROR("Session resumption with peer failed");
+        return;
+      }
+      
+      peer_id = ticket.peer_id;
+      conn_msg.SetSender(peer_id);
+      conn_msg.SetKeyExchange({}, crypto::CipherSuiteBit(cipher->GetSuite()));
+      conn_msg.SetResumption(salt);
+      LOG_INFO("Peer resumed its session");
+    } else if (crypto && key_exchange) {
+      crypto::KeyPair keys = crypto->GenerateKeyPair();
+      cipher = CreateCipher(*crypto, keys, *key_exchange, false);
+      if (!cipher) {
+        LOG_ERROR("Key exchange with peer failed");
+        return;
+      }
+      conn_msg.SetKeyExchange(ByteBuffer(keys.public_key.begin(), keys.public_key.end()),
+                              crypto::CipherSuiteBit(cipher->GetSuite()));
+    } else if (crypto) {
+      LOG_ERROR("Refused unencrypted connection: peer sent no public key");
+      return;
+    }
+    
+    auto session = std::make_shared<PeerSession>(std::move(socket), peer_id, MakeDispatch());
+    
+    // Send a connection notification message to the peer, the last in the
+    // clear
+    session->SendMessage(conn_msg);
+    LogEncryption(*session, cipher.get());
+    session->SetCipher(std::move(cipher));
+    
+    ByteBuffer token(DataConnectionMessage::TOKEN_SIZE);
+    randombytes_buf(token.data(), token.size());
+    
+    Register(session);
+    {
+      std::lock_guard<std::mutex> lock(_peers_mutex);
+      for (auto it = _data_offers.begin(); it != _data_offers.end();) {
+        auto offered = it->second.lock();
+        it = offered && offered->IsConnected() ? std::next(it) : _data_offers.erase(it);
+      }
+      _data_offers[std::string(token.begin(), token.end())] = session;
+    }
+    
+    // Offer data connections; the peer opens as many as it is set up for
+    DataConnectionMessage offer(peer_id, token);
+    session->SendMessage(offer);
+    
+    // Give the peer a ticket to resume this session with next time
+    if (ticket_keys && session->IsEncrypted()) {
+      crypto::SessionTicket state = session->GetResumptionState();
+      ByteBuffer issued = ticket_keys->Issue(state);
+      sodium_memzero(state.secret.data(), state.secret.size());
+      if (!issued.empty()) {
+        session->SendMessage(SessionTicketMessage(peer_id, issued));
+      }
+    }
+    
+    // Notify connection callback
+    if (_connection_callback) {
+      _connection_callback(peer_id, ConnectionStatus::CONNECTED);
+    }
+    
+    if (first_message) {
+      first_message->SetSender(peer_id);
+      Dispatch(std::move(first_message));
+    }
+    
+    session->Start();
+  }
+  
+  // Make session the one for its peer ID, closing any it replaces: the
+  // peer resumed a session whose connection hasn't noticed it is gone
+  void Register(const std::shared_ptr<PeerSession>& session) {
+    std::shared_ptr<PeerSession> replaced;
+    {
+      std::lock_guard<std::mutex> lock(_peers_mutex);
+      auto& slot = _peer_sessions[session->GetPeerId()];
+      replaced = std::move(slot);
+      slot = session;
+    }
+    if (replaced) {
+      replaced->Close();
+    }
+  }
+  
+  // The ticket held for the peer at endpoint, taken since a ticket redeems
+  // only once
+  std::shared_ptr<Resumption> TakeTicket(const asio::ip::tcp::endpoint& endpoint) {
+    std::lock_guard<std::mutex> lock(_peers_mutex);
+    auto it = _tickets.find(TicketKey(endpoint));
+    if (it == _tickets.end()) {
+      return nullptr;
+    }
+    auto resumption = std::move(it->second);
+    _tickets.erase(it);
+    return resumption;
+  }
+  
+  // Keep a ticket the peer of a session dialed from here sent, replacing
+  // any older one
+  void HandleSessionTicket(const SessionTicketMessage& message) {
+    std::shared_ptr<PeerSession> session;
+    {
+      std::lock_guard<std::mutex> lock(_peers_mutex);
+      auto it = _peer_sessions.find(message.GetSender());
+      if (it != _peer_sessions.end()) {
+        session = it->second;
+      }
+    }
+    
+    if (!session || !session->IsDialed() || !session->IsEncrypted()) {
+      return;
+    }
+    
+    crypto::SessionTicket state = session->GetResumptionState();
+    auto resumption = std::make_shared<Resumption>();
+    resumption->ticket = message.GetTicket();
+    resumption->peer_id = state.peer_id;
+    resumption->suite = state.suite;
+    try {
+      resumption->keys = _ticket_secrets;
+      resumption->secret = _ticket_secrets->Allocate();
+      *resumption->secret = state.secret;
+    } catch (const std::runtime_error& e) {
+      LOG_ERROR("Failed to keep a session ticket: ", e.what());
+    }
+    sodium_memzero(state.secret.data(), state.secret.size());
+    if (!resumption->secret) {
+      return;
+    }
+    
+    std::lock_guard<std::mutex> lock(_peers_mutex);
+    _tickets[TicketKey(session->GetEndpoint())] = std::move(resumption);
+  }
+  
+  static std::string TicketKey(const asio::ip::tcp::endpoint& endpoint) {
+    return endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+  }
+  
+  static void LogEncryption(const PeerSession& session, const crypto::SessionCipher* cipher) {
+    if (!cipher) {
+      LOG_INFO("Connection to ", session.GetPeerInfo().ip_address, " is not encrypted");
+    } else if (cipher->GetSuite() == crypto::CipherSuite::AES256_GCM) {
+      LOG_INFO("Connection to ", session.GetPeerInfo().ip_address, " encrypted with AES-256-GCM");
+    } else {
+      LOG_INFO("Connection to ", session.GetPeerInfo().ip_address,
+               " encrypted with XChaCha20-Poly1305");
+    }
+  }
+  
+  void AcceptDataConnection(asio::ip::tcp::socket socket, const DataConnectionMessage& join) {
+    const ByteBuffer& token = join.GetToken();
+    std::shared_ptr<PeerSession> owner;
+    {
+      std::lock_guard<std::mutex> lock(_peers_mutex);
+      auto it = _data_offers.find(std::string(token.begin(), token.end()));
+      if (it != _data_offers.end()) {
+        owner = it->second.lock();
+      }
+    }
+    
+    if (!owner || !owner->IsConnected()) {
+      LOG_WARNING("Refused data connection for an unknown session");
+      return;
+    }
+    
+    // Data connections of an encrypted session are keyed from its keys and
+    // a salt both sides add to, so a replayed join never gets keys already
+    // used. Our half is the last message in the clear.
+    ByteBuffer salt;
+    if (owner->IsEncrypted()) {
+      if (join.GetSalt().size() != DATA_CONNECTION_SALT_SIZE) {
+        LOG_WARNING("Refused data connection without key derivation salt");
+        return;
+      }
+      if (!owner->TakeJoinSalt(join.GetSalt())) {
+        LOG_WARNING("Refused replayed data connection");
+        return;
+      }
+      salt.resize(DATA_CONNECTION_SALT_SIZE);
+      randombytes_buf(salt.data(), salt.size());
+    }
+    
+    auto stream = std::make_shared<PeerSession>(std::move(socket), owner->GetPeerId(),
+                                                MakeDispatch());
+    if (owner->IsEncrypted()) {
+      ByteBuffer both_salts = join.GetSalt();
+      both_salts.insert(both_salts.end(), salt.begin(), salt.end());
+      stream->SendMessage(DataConnectionMessage(owner->GetPeerId(), token, salt));
+      stream->SetCipher(owner->DeriveCipher(both_salts));
+    }
+    if (!owner->AttachStream(stream)) {
+      LOG_WARNING("Refused data connection beyond ", PeerSession::MAX_DATA_CONNECTIONS);
+      stream->Close();
+      return;
+    }
+    
+    LOG_INFO("Peer opened data connection ", owner->GetStreamCount());
+    stream->Start();
+  }
+  
+  // Open the data connections a peer offered on a session dialed from here
+  void HandleDataOffer(const DataConnectionMessage& offer) {
+    size_t count = _data_connections;
+    std::shared_ptr<PeerSession> session;
+    {
+      std::lock_guard<std::mutex> lock(_peers_mutex);
+      auto it = _peer_sessions.find(offer.GetSender());
+      if (it != _peer_sessions.end()) {
+        session = it->second;
+      }
+    }
+    
+    if (count == 0 || !session || !session->TakeDataOffer()) {
+      return;
+    }
+    
+    LOG_INFO("Opening ", count, " data connections to ", session->GetPeerInfo().ip_address);
+    for (size_t i = 0; i < count; ++i) {
+      OpenDataConnection(session, offer.GetToken());
+    }
+  }
+  
+  void OpenDataConnection(const std::shared_ptr<PeerSession>& session, const ByteBuffer& token) {
+    auto socket = std::make_shared<asio::ip::tcp::socket>(_io_context);
+    std::weak_ptr<PeerSession> weak_session = session;
+    socket->async_connect(
+        session->GetEndpoint(),
+        [this, socket, weak_session, token](const boost::system::error_code& ec) {
+          auto owner = weak_session.lock();
+          if (ec) {
+            LOG_WARNING("Failed to open data connection: ", ec.message());
+            return;
+          }
+          if (!owner || !owner->IsConnected()) {
+            return;
+          }
+          
+          // The token goes first, in the clear, so the peer knows which
+          // session this joins
+          ByteBuffer salt;
+          if (owner->IsEncrypted()) {
+            salt.resize(DATA_CONNECTION_SALT_SIZE);
+            randombytes_buf(salt.data(), salt.size());
+          }
+          DataConnectionMessage join(owner->GetPeerId(), token, salt);
+          boost::system::error_code write_ec;
+          WriteFrame(*socket, join, write_ec);
+          if (write_ec) {
+            LOG_WARNING("Failed to open data connection: ", write_ec.message());
+            return;
+          }
+            
+          if (!owner->IsEncrypted()) {
+            AttachDataConnection(std::move(*socket), *owner, nullptr);
+            return;
+          }
+          
+          // An encrypted session's peer answers with its half of the salt
+          ReadFirstMessage(socket, [this, socket, weak_session, token, salt](
+                                       std::unique_ptr<Message> message) {
+            auto owner = weak_session.lock();
+            if (!owner || !owner->IsConnected()) {
+              return;
+            }
+            if (!message || message->GetType() != MessageType::DATA_CONNECTION) {
+              LOG_WARNING("Failed to open data connection: no key derivation salt");
+              return;
+            }
+            
+            const auto& answer = static_cast<const DataConnectionMessage&>(*message);
+            if (answer.GetToken() != token ||
+                answer.GetSalt().size() != DATA_CONNECTION_SALT_SIZE) {
+              LOG_WARNING("Failed to open data connection: no key derivation salt");
+              return;
+            }
+            
+            ByteBuffer both_salts = salt;
+            both_salts.insert(both_salts.end(), answer.GetSalt().begin(), answer.GetSalt().end());
+            AttachDataConnection(std::move(*socket), *owner, owner->DeriveCipher(both_salts));
+          });
+        });
+  }
+  
+  // Make a data connection dialed from here one of owner's
+  void AttachDataConnection(asio::ip::tcp::socket socket, PeerSession& owner,
+                            std::unique_ptr<crypto::SessionCipher> cipher) {
+    try {
+      auto stream = std::make_shared<PeerSession>(std::move(socket), owner.GetPeerId(),
+                                                  MakeDispatch());
+      stream->SetCipher(std::move(cipher));
+      if (!owner.AttachStream(stream)) {
+        stream->Close();
+        return;
+      }
+      stream->Start();
+    } catch (const std::exception& e) {
+      LOG_WARNING("Failed to open data connection: ", e.what());
+    }
+  }
+  
+  // Session messages, with data connection offers and session tickets
+  // handled here
+  MessageCallback MakeDispatch() {
+    return [this](std::unique_ptr<Message> message) {
+      Dispatch(std::move(message));
+    };
+  }
+  
+  void Dispatch(std::unique_ptr<Message> message) {
+    if (message->GetType() == MessageType::DATA_CONNECTION) {
+      HandleDataOffer(static_cast<const DataConnectionMessage&>(*message));
+      return;
+    }
+    if (message->GetType() == MessageType::SESSION_TICKET) {
+      HandleSessionTicket(static_cast<const SessionTicketMessage&>(*message));
+      return;
+    }
+    
+    if (_message_callback) {
+      _message_callback(std::move(message));
+    }
+  }
+  
   asio::io_context _io_context;
   asio::executor_work_guard<asio::io_context::executor_type> _work_guard;
   asio::ip::tcp::acceptor _acceptor;
@@ -420,6 +1265,20 @@ class AsioNetworkManager : public NetworkManager {
   std::unordered_map<PeerId, std::shared_ptr<PeerSession>, 
                       std::hash<PeerId>> _peer_sessions;
   
+  // Data connection tokens offered to accepted peers
+  std::unordered_map<std::string, std::weak_ptr<PeerSession>> _data_offers;
+  std::atomic<size_t> _data_connections{0};
+  
+  // The provider and the keys for the tickets given to accepted peers,
+  // replaced together while connections are being made
+  std::mutex _crypto_mutex;
+  std::shared_ptr<crypto::CryptoProvider> _crypto;
+  std::shared_ptr<crypto::SessionTicketKeys> _ticket_keys;
+  
+  // The tickets peers gave us, by the address they were dialed at
+  std::unordered_map<std::string, std::shared_ptr<Resumption>> _tickets;
+  std::shared_ptr<crypto::KeyStore> _ticket_secrets = std::make_shared<crypto::KeyStore>();
+  
   MessageCallback _message_callback;
   ConnectionCallback _connection_callback;
   ErrorCallback _error_callback;
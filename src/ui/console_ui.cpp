@@ -104,7 +104,7 @@ ConsoleUI::ConsoleUI(std::shared_ptr<NetworkManager> network_manager,
   RegisterCommand("send", 
       [this](const std::vector<std::string>& args) {
         if (args.size() < 3) {
-          DisplayMessage("Usage: /send <peer_id> <file_path>");
+          DisplayMessage("Usage: /send <peer_id> <file_or_directory_path>");
           return false;
         }
         
@@ -128,6 +128,17 @@ ConsoleUI::ConsoleUI(std::shared_ptr<NetworkManager> network_manager,
           return false;
         }
         
+        if (std::filesystem::is_directory(file_path)) {
+          DisplayMessage("Sending directory " + file_path + " to peer...");
+          
+          if (!_file_transfer_manager->SendDirectory(peer_id, file_path)) {
+            DisplayMessage("Failed to initiate directory transfer");
+            return false;
+          }
+          
+          return true;
+        }
+        
         DisplayMessage("Sending file " + file_path + " to peer...");
         
         if (!_file_transfer_manager->SendFile(peer_id, file_path)) {
@@ -137,7 +148,181 @@ ConsoleUI::ConsoleUI(std::shared_ptr<NetworkManager> network_manager,
         
         return true;
       }, 
-      "Send a file to a peer");
+      "Send a file or directory to a peer");
+  
+  RegisterCommand("share", 
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 2) {
+          DisplayMessage("Usage: /share <file_path>");
+          return false;
+        }
+        
+        ByteBuffer content_hash;
+        if (!_file_transfer_manager->ShareFile(args[1], content_hash)) {
+          DisplayMessage("Failed to share file");
+          return false;
+        }
+        
+        std::stringstream ss;
+        for (const auto& byte : content_hash) {
+          ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
+        }
+        DisplayMessage("Sharing " + args[1] + " as " + ss.str());
+        return true;
+      }, 
+      "Offer a file to swarm downloads");
+  
+  RegisterCommand("fetch", 
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 3) {
+          DisplayMessage("Usage: /fetch <content_hash> <file_name>");
+          return false;
+        }
+        
+        const std::string& hash_str = args[1];
+        
+        // Convert string to content hash
+        ByteBuffer content_hash(32);
+        try {
+          if (hash_str.size() != 64) {
+            DisplayMessage("Invalid content hash length");
+            return false;
+          }
+          
+          for (size_t i = 0; i < 32; ++i) {
+            content_hash[i] = std::stoi(hash_str.substr(i * 2, 2), nullptr, 16);
+          }
+        } catch (const std::exception& e) {
+          DisplayMessage("Invalid content hash format");
+          return false;
+        }
+        
+        DisplayMessage("Downloading " + args[2] + " from all peers sharing it...");
+        
+        if (!_file_transfer_manager->DownloadFile(content_hash, args[2])) {
+          DisplayMessage("Failed to start download");
+          return false;
+        }
+        
+        return true;
+      }, 
+      "Download a shared file from every peer that has it");
+  
+  RegisterCommand("limit", 
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 2) {
+          DisplayMessage("Usage: /limit <upload_kb_per_second> [max_transfers]");
+          return false;
+        }
+        
+        uint64_t kb_per_second;
+        size_t max_transfers = 0;
+        try {
+          kb_per_second = std::stoull(args[1]);
+          if (args.size() > 2) {
+            max_transfers = std::stoul(args[2]);
+          }
+        } catch (const std::exception& e) {
+          DisplayMessage("Invalid limit");
+          return false;
+        }
+        
+        _file_transfer_manager->SetUploadLimit(kb_per_second * 1024);
+        _file_transfer_manager->SetMaxConcurrentTransfers(max_transfers);
+        DisplayMessage("Upload limit set (0 means unlimited)");
+        return true;
+      }, 
+      "Cap the upload rate and the number of concurrent transfers");
+  
+  RegisterCommand("compress", 
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 2 || (args[1] != "on" && args[1] != "off")) {
+          DisplayMessage("Usage: /compress <on|off>");
+          return false;
+        }
+        
+        _file_transfer_manager->SetCompressionEnabled(args[1] == "on");
+        DisplayMessage("Compression " + args[1] + " for new transfers");
+        return true;
+      }, 
+      "Compress file chunks sent to peers");
+  
+  RegisterCommand("streams", 
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 2) {
+          DisplayMessage("Usage: /streams <count>");
+          return false;
+        }
+        
+        size_t count;
+        try {
+          count = std::stoul(args[1]);
+        } catch (const std::exception& e) {
+          DisplayMessage("Invalid count");
+          return false;
+        }
+        
+        _network_manager->SetDataConnections(count);
+        DisplayMessage("Data connections set for new connections (0 means none)");
+        return true;
+      }, 
+      "Stripe file chunks over extra connections to each peer");
+  
+  RegisterCommand("directio", 
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 2) {
+          DisplayMessage("Usage: /directio <min_file_size_mb|off>");
+          return false;
+        }
+        
+        uint64_t megabytes = 0;
+        if (args[1] != "off") {
+          try {
+            megabytes = std::stoull(args[1]);
+          } catch (const std::exception& e) {
+            DisplayMessage("Invalid file size");
+            return false;
+          }
+        }
+        
+        _file_transfer_manager->SetDirectIoThreshold(megabytes * 1024 * 1024);
+        DisplayMessage(megabytes == 0 ? "Direct I/O off"
+                                      : "Direct I/O for files of " + args[1] + " MB and up");
+        return true;
+      }, 
+      "Bypass the page cache for huge files");
+  
+  RegisterCommand("cache",
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 2 || (args[1] != "off" && args.size() < 3)) {
+          DisplayMessage("Usage: /cache <directory> <max_size_mb> or /cache off");
+          return false;
+        }
+        
+        if (args[1] == "off") {
+          _file_transfer_manager->SetContentCache("", 0);
+          DisplayMessage("Content cache off");
+          return true;
+        }
+        
+        uint64_t megabytes = 0;
+        try {
+          megabytes = std::stoull(args[2]);
+        } catch (const std::exception& e) {
+          DisplayMessage("Invalid cache size");
+          return false;
+        }
+        
+        if (!_file_transfer_manager->SetContentCache(args[1], megabytes * 1024 * 1024)) {
+          DisplayMessage("Cannot use " + args[1] + " for the content cache");
+          return false;
+        }
+        DisplayMessage(megabytes == 0 ? "Content cache off"
+                                      : "Caching received files in " + args[1] + " (up to " +
+                                            args[2] + " MB)");
+        return true;
+      },
+      "Keep received files to skip transferring them again");
   
   RegisterCommand("peers", 
       [this](const std::vector<std::string>&) {
@@ -165,9 +350,33 @@ ConsoleUI::ConsoleUI(std::shared_ptr<NetworkManager> network_manager,
       }, 
       "List connected peers");
   
+  RegisterCommand("stall", 
+      [this](const std::vector<std::string>& args) {
+        if (args.size() < 2 || (args.size() > 2 && args[2] != "fail")) {
+          DisplayMessage("Usage: /stall <seconds> [fail]");
+          return false;
+        }
+        
+        uint64_t seconds;
+        try {
+          seconds = std::stoull(args[1]);
+        } catch (const std::exception& e) {
+          DisplayMessage("Invalid timeout");
+          return false;
+        }
+        
+        bool fail = args.size() > 2;
+        _file_transfer_manager->SetStallTimeout(std::chrono::seconds(seconds), fail);
+        DisplayMessage(seconds == 0 ? "Stall detection off"
+                                    : std::string("Stalled transfers will be ") +
+                                          (fail ? "failed" : "flagged"));
+        return true;
+      }, 
+      "Flag or fail transfers that stop making progress");
+  
   RegisterCommand("transfers", 
       [this](const std::vector<std::string>&) {
-        auto transfers = _file_transfer_manager->GetOngoingTransfers();
+        auto transfers = _file_transfer_manager->GetTransferStats();
         
         if (transfers.empty()) {
           DisplayMessage("No ongoing file transfers");
@@ -175,12 +384,26 @@ ConsoleUI::ConsoleUI(std::shared_ptr<NetworkManager> network_manager,
         }
         
         DisplayMessage("Ongoing file transfers:");
-        for (const auto& [peer_id, file_path, status, progress] : transfers) {
+        for (const auto& stats : transfers) {
+          double progress = stats.total_bytes > 0
+                                ? static_cast<double>(stats.bytes_transferred) / stats.total_bytes
+                                : 0.0;
+          
           std::stringstream ss;
-          ss << "File: " << file_path
-             << " | Status: " << static_cast<int>(status)
+          ss << (stats.outgoing ? "Sending: " : "Receiving: ") << stats.file_path
+             << " | Status: " << static_cast<int>(stats.status)
              << " | Progress: " << std::fixed << std::setprecision(1)
-             << (progress * 100.0) << "%";
+             << (progress * 100.0) << "%"
+             << " | " << stats.average_bytes_per_second / (1024 * 1024) << " MB/s";
+          if (stats.eta_seconds >= 0) {
+            ss << " | " << std::setprecision(0) << stats.eta_seconds << "s left";
+          }
+          if (stats.retransmits > 0) {
+            ss << " | Retransmits: " << stats.retransmits;
+          }
+          if (stats.stalled) {
+            ss << " | STALLED";
+          }
           
           DisplayMessage(ss.str());
         }
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include "linknet/async_file_io.h"
+#include "linknet/direct_file.h"
+#include "linknet/types.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace linknet {
+namespace test {
+
+// Both backends, with more requests than the queue is deep
+TEST(AsyncFileIoTest, WritesAndReadsBack) {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "linknet_async_file_io_test";
+  const size_t block_size = 4096;
+  const size_t blocks = 20;
+  const ByteBuffer data = RandomBytes(block_size * blocks, 1);
+  
+  for (bool allow_io_uring : {true, false}) {
+    std::unique_ptr<AsyncFileIo> io = AsyncFileIoFactory::Create(4, allow_io_uring);
+    ASSERT_TRUE(io);
+    if (!allow_io_uring) {
+      EXPECT_STREQ("threads", io->GetName());
+    }
+    
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    ASSERT_GE(fd, 0);
+    
+    std::vector<std::future<int64_t>> writes;
+    for (size_t i = blocks; i-- > 0;) {
+      writes.push_back(io->Write(fd, i * block_size, data.data() + i * block_size, block_size,
+                                 nullptr));
+    }
+    io->Submit();
+    for (auto& write : writes) {
+      EXPECT_EQ(static_cast<int64_t>(block_size), write.get());
+    }
+    
+    auto read_back = std::make_shared<ByteBuffer>(data.size() + 100);
+    std::future<int64_t> read = io->Read(fd, 0, read_back->data(), read_back->size(), read_back);
+    io->Submit();
+    
+    // Short at the end of the file
+    EXPECT_EQ(static_cast<int64_t>(data.size()), read.get());
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), read_back->begin())) << io->GetName();
+    
+    std::future<int64_t> bad_read = io->Read(-1, 0, read_back->data(), 1, nullptr);
+    io->Submit();
+    EXPECT_EQ(-EBADF, bad_read.get());
+    ::close(fd);
+  }
+  
+  std::filesystem::remove(path);
+}
+
+TEST(AsyncFileIoTest, DirectFileRequests) {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "linknet_async_direct_file_test";
+  const size_t chunk_size = 16 * 1024;
+  const ByteBuffer data = RandomBytes(3 * chunk_size + 1000, 2);
+  auto buffers = std::make_shared<AlignedBufferPool>(chunk_size + AlignedBufferPool::ALIGNMENT);
+  std::unique_ptr<AsyncFileIo> io = AsyncFileIoFactory::Create();
+  
+  for (bool direct : {true, false}) {
+    DirectFile file(buffers);
+    ASSERT_TRUE(file.Open(path.string(), DirectFile::Mode::CREATE, direct));
+    
+    // Out of order, as chunks arrive; the unaligned tail can't go direct
+    std::vector<AsyncFileRequest> writes;
+    for (size_t chunk : {3, 1, 0, 2}) {
+      size_t offset = chunk * chunk_size;
+      size_t length = std::min(chunk_size, data.size() - offset);
+      writes.push_back(file.WriteAsync(
+          *io, offset, ByteBuffer(data.begin() + offset, data.begin() + offset + length)));
+    }
+    io->Submit();
+    for (auto& write : writes) {
+      EXPECT_TRUE(file.Finish(write));
+    }
+    
+    std::vector<AsyncFileRequest> reads;
+    for (size_t chunk = 0; chunk < 4; ++chunk) {
+      size_t offset = chunk * chunk_size;
+      reads.push_back(file.ReadAsync(*io, offset, std::min(chunk_size, data.size() - offset)));
+    }
+    AsyncFileRequest past_end = file.ReadAsync(*io, 3 * chunk_size, 1001);
+    io->Submit();
+    
+    ByteBuffer read_back;
+    for (auto& read : reads) {
+      ASSERT_TRUE(file.Finish(read));
+      read_back.insert(read_back.end(), read.buffers->data.begin(), read.buffers->data.end());
+    }
+    EXPECT_EQ(data, read_back);
+    EXPECT_FALSE(file.Finish(past_end));
+    
+    file.Close();
+    EXPECT_EQ(data, ReadFile(path));
+  }
+  
+  std::filesystem::remove(path);
+}
+
+}  // namespace test
+}  // namespace linknet
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include "linknet/chunk_bitmap.h"
+#include <filesystem>
+#include <fstream>
+
+namespace linknet {
+namespace test {
+
+TEST(ChunkBitmapTest, SetAndTest) {
+  ChunkBitmap bitmap(130);
+  
+  EXPECT_EQ(130u, bitmap.Size());
+  EXPECT_EQ(0u, bitmap.Count());
+  EXPECT_FALSE(bitmap.IsComplete());
+  
+  // Setting a chunk twice only counts it once
+  EXPECT_TRUE(bitmap.Set(64));
+  EXPECT_FALSE(bitmap.Set(64));
+  EXPECT_TRUE(bitmap.Test(64));
+  EXPECT_FALSE(bitmap.Test(63));
+  EXPECT_EQ(1u, bitmap.Count());
+  
+  // Out of range indices are ignored
+  EXPECT_FALSE(bitmap.Set(130));
+  EXPECT_FALSE(bitmap.Test(130));
+  
+  bitmap.Clear(64);
+  EXPECT_FALSE(bitmap.Test(64));
+  EXPECT_EQ(0u, bitmap.Count());
+}
+
+TEST(ChunkBitmapTest, MissingRanges) {
+  ChunkBitmap bitmap(200);
+  
+  // Everything is missing initially
+  auto ranges = bitmap.MissingRanges();
+  ASSERT_EQ(1u, ranges.size());
+  EXPECT_EQ(0u, ranges[0].first);
+  EXPECT_EQ(200u, ranges[0].count);
+  
+  // Receive [0, 128) and [150, 151)
+  for (uint32_t i = 0; i < 128; ++i) {
+    bitmap.Set(i);
+  }
+  bitmap.Set(150);
+  
+  ranges = bitmap.MissingRanges();
+  ASSERT_EQ(2u, ranges.size());
+  EXPECT_EQ(128u, ranges[0].first);
+  EXPECT_EQ(22u, ranges[0].count);
+  EXPECT_EQ(151u, ranges[1].first);
+  EXPECT_EQ(49u, ranges[1].count);
+  
+  for (uint32_t i = 0; i < 200; ++i) {
+    bitmap.Set(i);
+  }
+  EXPECT_TRUE(bitmap.IsComplete());
+  EXPECT_TRUE(bitmap.MissingRanges().empty());
+}
+
+TEST(ChunkBitmapTest, SaveAndLoad) {
+  std::string path = (std::filesystem::temp_directory_path() / "linknet_bitmap_test.lnkpart").string();
+  
+  ChunkBitmap original(1000);
+  for (uint32_t i = 0; i < 1000; i += 3) {
+    original.Set(i);
+  }
+  ASSERT_TRUE(original.Save(path, 16 * 1024 * 1000, 16 * 1024));
+  
+  // Loads back with the same contents
+  ChunkBitmap loaded;
+  ASSERT_TRUE(ChunkBitmap::Load(path, 16 * 1024 * 1000, 16 * 1024, loaded));
+  EXPECT_EQ(original.Size(), loaded.Size());
+  EXPECT_EQ(original.Count(), loaded.Count());
+  for (uint32_t i = 0; i < 1000; ++i) {
+    EXPECT_EQ(original.Test(i), loaded.Test(i));
+  }
+  
+  // A bitmap for a different file geometry is rejected
+  ChunkBitmap other;
+  EXPECT_FALSE(ChunkBitmap::Load(path, 12345, 16 * 1024, other));
+  EXPECT_FALSE(ChunkBitmap::Load(path, 16 * 1024 * 1000, 64 * 1024, other));
+  
+  // A chunk count that doesn't match the geometry is rejected
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(20);
+    const char huge_count[4] = {'\x7f', '\xff', '\xff', '\xff'};
+    file.write(huge_count, sizeof(huge_count));
+  }
+  EXPECT_FALSE(ChunkBitmap::Load(path, 16 * 1024 * 1000, 16 * 1024, other));
+  
+  // A truncated bitmap is rejected
+  std::filesystem::resize_file(path, 30);
+  EXPECT_FALSE(ChunkBitmap::Load(path, 16 * 1024 * 1000, 16 * 1024, other));
+  
+  std::filesystem::remove(path);
+  EXPECT_FALSE(ChunkBitmap::Load(path, 16 * 1024 * 1000, 16 * 1024, other));
+}
+
+}  // namespace test
+}  // namespace linknet
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include "linknet/compression.h"
+#include <random>
+#include <string>
+
+namespace linknet {
+namespace test {
+
+namespace {
+
+ByteBuffer MakeText(size_t size) {
+  std::string line = "2024-05-01 12:00:00,INFO,worker-3,request served in 12 ms\n";
+  ByteBuffer text;
+  while (text.size() < size) {
+    text.insert(text.end(), line.begin(), line.end());
+  }
+  text.resize(size);
+  return text;
+}
+
+ByteBuffer MakeRandom(size_t size) {
+  std::mt19937 generator(42);
+  ByteBuffer data(size);
+  for (auto& byte : data) {
+    byte = static_cast<uint8_t>(generator());
+  }
+  return data;
+}
+
+}  // namespace
+
+TEST(CompressionTest, ZlibRoundTrip) {
+  auto compressor = CompressorFactory::Create(CompressionType::ZLIB);
+  ASSERT_NE(nullptr, compressor);
+  EXPECT_EQ(CompressionType::ZLIB, compressor->GetType());
+  
+  ByteBuffer text = MakeText(16 * 1024);
+  ByteBuffer compressed;
+  ASSERT_TRUE(compressor->Compress(text.data(), text.size(), compressed));
+  EXPECT_LT(compressed.size(), text.size() / 5);
+  
+  ByteBuffer restored;
+  ASSERT_TRUE(compressor->Decompress(compressed.data(), compressed.size(), text.size(), restored));
+  EXPECT_EQ(text, restored);
+  
+  // The original size must match exactly, and corrupt input is refused
+  EXPECT_FALSE(compressor->Decompress(compressed.data(), compressed.size(), text.size() - 1,
+                                      restored));
+  EXPECT_FALSE(compressor->Decompress(compressed.data(), compressed.size(), text.size() + 1,
+                                      restored));
+  compressed[compressed.size() / 2] ^= 0xFF;
+  EXPECT_FALSE(compressor->Decompress(compressed.data(), compressed.size(), text.size(),
+                                      restored));
+}
+
+TEST(CompressionTest, EntropyProbe) {
+  ByteBuffer text = MakeText(16 * 1024);
+  ByteBuffer random = MakeRandom(16 * 1024);
+  ByteBuffer zeros(16 * 1024, 0);
+  
+  EXPECT_LT(SampleEntropy(text.data(), text.size()), 6.0);
+  EXPECT_GT(SampleEntropy(random.data(), random.size()), 7.5);
+  EXPECT_EQ(0.0, SampleEntropy(zeros.data(), zeros.size()));
+}
+
+TEST(CompressionTest, CompressChunkSkipsIncompressibleData) {
+  auto compressor = CompressorFactory::Create(CompressionType::ZLIB);
+  ASSERT_NE(nullptr, compressor);
+  
+  ByteBuffer text = MakeText(16 * 1024);
+  ByteBuffer chunk = text;
+  EXPECT_EQ(CompressionType::ZLIB, CompressChunk(*compressor, chunk));
+  EXPECT_LT(chunk.size(), text.size());
+  
+  // Random data, and data too short to shrink, go out unchanged
+  ByteBuffer random = MakeRandom(16 * 1024);
+  chunk = random;
+  EXPECT_EQ(CompressionType::NONE, CompressChunk(*compressor, chunk));
+  EXPECT_EQ(random, chunk);
+  
+  ByteBuffer tiny = {1, 2, 3};
+  chunk = tiny;
+  EXPECT_EQ(CompressionType::NONE, CompressChunk(*compressor, chunk));
+  EXPECT_EQ(tiny, chunk);
+}
+
+TEST(CompressionTest, Negotiate) {
+  uint8_t zlib = 1 << static_cast<int>(CompressionType::ZLIB);
+  uint8_t zstd = 1 << static_cast<int>(CompressionType::ZSTD);
+  
+  EXPECT_EQ(CompressionType::NONE, CompressorFactory::Negotiate(0));
+  EXPECT_EQ(CompressionType::ZLIB, CompressorFactory::Negotiate(zlib));
+  EXPECT_EQ(CompressionType::ZLIB, CompressorFactory::Negotiate(zlib | zstd));
+  
+  // Codecs that aren't built in are never picked
+  EXPECT_EQ(nullptr, CompressorFactory::Create(CompressionType::ZSTD));
+  EXPECT_EQ(CompressionType::NONE, CompressorFactory::Negotiate(zstd));
+}
+
+}  // namespace test
+}  // namespace linknet
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "linknet/content_chunker.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+namespace linknet {
+namespace test {
+
+namespace {
+
+std::vector<size_t> Boundaries(const ByteBuffer& data) {
+  std::vector<size_t> lengths;
+  size_t offset = 0;
+  while (offset < data.size()) {
+    size_t length = ContentChunker::FindBoundary(data.data() + offset, data.size() - offset);
+    lengths.push_back(length);
+    offset += length;
+  }
+  return lengths;
+}
+
+}  // namespace
+
+TEST(ContentChunkerTest, ChunkSizesWithinLimits) {
+  ByteBuffer data = RandomBytes(1024 * 1024, 1);
+  auto lengths = Boundaries(data);
+  
+  for (size_t i = 0; i + 1 < lengths.size(); ++i) {
+    EXPECT_GE(lengths[i], ContentChunker::MIN_CHUNK_SIZE);
+    EXPECT_LE(lengths[i], ContentChunker::MAX_CHUNK_SIZE);
+  }
+  
+  // Normalized chunking keeps the average close to the target
+  size_t average = data.size() / lengths.size();
+  EXPECT_GT(average, ContentChunker::AVG_CHUNK_SIZE / 2);
+  EXPECT_LT(average, ContentChunker::AVG_CHUNK_SIZE * 2);
+  
+  // Data without content-defined boundaries is cut at the maximum size
+  ByteBuffer zeros(3 * ContentChunker::MAX_CHUNK_SIZE);
+  EXPECT_EQ(ContentChunker::MAX_CHUNK_SIZE, ContentChunker::FindBoundary(zeros.data(), zeros.size()));
+}
+
+TEST(ContentChunkerTest, InsertionOnlyChangesNearbyChunks) {
+  const std::filesystem::path dir = std::filesystem::temp_directory_path();
+  const std::string original_path = (dir / "linknet_cdc_original.bin").string();
+  const std::string modified_path = (dir / "linknet_cdc_modified.bin").string();
+  
+  ByteBuffer original = RandomBytes(4 * 1024 * 1024, 2);
+  ByteBuffer modified = original;
+  ByteBuffer inserted = RandomBytes(100, 3);
+  modified.insert(modified.begin() + 1000000, inserted.begin(), inserted.end());
+  
+  for (const auto& [path, data] : {std::make_pair(original_path, &original),
+                                   std::make_pair(modified_path, &modified)}) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data->data()), data->size());
+  }
+  
+  std::vector<ContentChunk> original_chunks;
+  std::vector<ContentChunk> modified_chunks;
+  ASSERT_TRUE(ContentChunker::ChunkFile(original_path, original_chunks));
+  ASSERT_TRUE(ContentChunker::ChunkFile(modified_path, modified_chunks));
+  
+  // File chunking agrees with chunking the data in memory
+  auto lengths = Boundaries(original);
+  ASSERT_EQ(lengths.size(), original_chunks.size());
+  for (size_t i = 0; i < lengths.size(); ++i) {
+    EXPECT_EQ(lengths[i], original_chunks[i].length);
+  }
+  
+  std::set<crypto::Digest> original_hashes;
+  for (const auto& chunk : original_chunks) {
+    original_hashes.insert(chunk.hash);
+  }
+  
+  size_t changed = std::count_if(modified_chunks.begin(), modified_chunks.end(),
+                                 [&](const ContentChunk& chunk) {
+                                   return original_hashes.count(chunk.hash) == 0;
+                                 });
+  EXPECT_GE(changed, 1u);
+  EXPECT_LE(changed, 3u);
+  
+  std::filesystem::remove(original_path);
+  std::filesystem::remove(modified_path);
+}
+
+}  // namespace test
+}  // namespace linknet
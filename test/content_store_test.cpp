@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+#include "linknet/content_store.h"
+#include "linknet/merkle_tree.h"
+#include "linknet/types.h"
+#include <filesystem>
+#include <fstream>
+
+namespace linknet {
+namespace test {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+void WriteFile(const fs::path& path, const std::string& content) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << content;
+}
+
+std::string ReadFile(const fs::path& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+crypto::Digest MakeHash(uint8_t value) {
+  crypto::Digest hash{};
+  hash.fill(value);
+  return hash;
+}
+
+class ContentStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _root = fs::temp_directory_path() / "linknet_content_store_test";
+    fs::remove_all(_root);
+    fs::create_directories(_root);
+  }
+  
+  void TearDown() override {
+    fs::remove_all(_root);
+  }
+  
+  fs::path _root;
+};
+
+}  // namespace
+
+TEST_F(ContentStoreTest, FetchesAddedFiles) {
+  ContentStore store((_root / "cache").string(), 1000);
+  ASSERT_TRUE(store.Open());
+  
+  WriteFile(_root / "received", "hello world");
+  ASSERT_TRUE(store.Add(MakeHash(1), (_root / "received").string()));
+  EXPECT_EQ(1u, store.GetCount());
+  EXPECT_EQ(11u, store.GetSize());
+  EXPECT_TRUE(store.Contains(MakeHash(1), 11));
+  EXPECT_FALSE(store.Contains(MakeHash(1), 12));
+  EXPECT_FALSE(store.Contains(MakeHash(2), 11));
+  
+  // The original stays independent of the entry
+  WriteFile(_root / "received", "changed");
+  
+  fs::path again = _root / "again";
+  WriteFile(again, "old content");
+  ASSERT_TRUE(store.Fetch(MakeHash(1), 11, again.string()));
+  EXPECT_EQ("hello world", ReadFile(again));
+  EXPECT_FALSE(fs::exists(again.string() + ".tmp"));
+  
+  // The fetched file is writable, and changing it leaves the entry alone
+  auto perms = fs::status(again).permissions();
+  EXPECT_NE(fs::perms::none, perms & fs::perms::owner_write);
+  {
+    std::ofstream out(again, std::ios::binary | std::ios::in | std::ios::out);
+    out << "HELLO";
+  }
+  EXPECT_EQ("HELLO world", ReadFile(again));
+  ASSERT_TRUE(store.Fetch(MakeHash(1), 11, (_root / "fresh").string()));
+  EXPECT_EQ("hello world", ReadFile(_root / "fresh"));
+  
+  EXPECT_FALSE(store.Fetch(MakeHash(2), 11, (_root / "missing").string()));
+  EXPECT_FALSE(fs::exists(_root / "missing"));
+  
+  // An entry of the wrong size is dropped
+  EXPECT_FALSE(store.Fetch(MakeHash(1), 12, (_root / "wrong").string()));
+  EXPECT_EQ(0u, store.GetCount());
+}
+
+TEST_F(ContentStoreTest, EvictsLeastRecentlyUsed) {
+  const std::string cache = (_root / "cache").string();
+  ContentStore store(cache, 25);
+  ASSERT_TRUE(store.Open());
+  
+  for (uint8_t i = 1; i <= 2; ++i) {
+    fs::path file = _root / ("file" + std::to_string(i));
+    WriteFile(file, std::string(10, static_cast<char>('a' + i)));
+    ASSERT_TRUE(store.Add(MakeHash(i), file.string()));
+  }
+  
+  // Using the first makes the second the one to go
+  ASSERT_TRUE(store.Fetch(MakeHash(1), 10, (_root / "out").string()));
+  WriteFile(_root / "file3", std::string(10, 'z'));
+  ASSERT_TRUE(store.Add(MakeHash(3), (_root / "file3").string()));
+  
+  EXPECT_EQ(2u, store.GetCount());
+  EXPECT_EQ(20u, store.GetSize());
+  EXPECT_FALSE(store.Fetch(MakeHash(2), 10, (_root / "out").string()));
+  EXPECT_TRUE(store.Fetch(MakeHash(3), 10, (_root / "out").string()));
+  
+  // Too large to cache at all
+  WriteFile(_root / "big", std::string(30, 'b'));
+  EXPECT_FALSE(store.Add(MakeHash(4), (_root / "big").string()));
+  
+  // Entries survive a restart, and a lower cap applies to them
+  ContentStore reopened(cache, 10);
+  ASSERT_TRUE(reopened.Open());
+  EXPECT_EQ(1u, reopened.GetCount());
+}
+
+TEST_F(ContentStoreTest, RefusesFilesNotMatchingTheirHash) {
+  ContentStore store((_root / "cache").string(), 1000);
+  ASSERT_TRUE(store.Open());
+  
+  WriteFile(_root / "received", "hello world");
+  crypto::MerkleTree tree;
+  ASSERT_TRUE(crypto::MerkleTree::BuildFromFile((_root / "received").string(), 4, tree));
+  
+  // Changed after its hash was taken
+  WriteFile(_root / "received", "hello there");
+  EXPECT_FALSE(store.Add(tree.GetRoot(), (_root / "received").string(), 4));
+  EXPECT_EQ(0u, store.GetCount());
+  EXPECT_TRUE(fs::is_empty(_root / "cache"));
+  
+  WriteFile(_root / "received", "hello world");
+  EXPECT_TRUE(store.Add(tree.GetRoot(), (_root / "received").string(), 4));
+  EXPECT_TRUE(store.Contains(tree.GetRoot(), 11));
+}
+
+}  // namespace test
+}  // namespace linknet
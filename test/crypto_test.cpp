@@ -3,6 +3,8 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <filesystem>
+#include <fstream>
 
 namespace linknet {
 namespace test {
@@ -95,6 +97,39 @@ TEST_F(CryptoTest, DigitalSignature) {
   EXPECT_FALSE(result);
 }
 
+TEST_F(CryptoTest, BatchSignatures) {
+  // Enough messages to be split across threads
+  auto batch_crypto = crypto::CryptoFactory::Create(4);
+  crypto::SignatureKeyPair keys = batch_crypto->GenerateSignatureKeyPair();
+  std::vector<ByteBuffer> messages;
+  for (int i = 0; i < 300; ++i) {
+    messages.push_back(ByteBuffer(i % 50 + 1, static_cast<uint8_t>(i)));
+  }
+  
+  std::vector<ByteBuffer> signatures = batch_crypto->SignBatch(messages, keys.private_key);
+  ASSERT_EQ(messages.size(), signatures.size());
+  EXPECT_EQ(crypto_provider->Sign(messages[123], keys.private_key), signatures[123]);
+  
+  std::vector<crypto::SignedData> items;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    items.push_back({messages[i].data(), messages[i].size(), signatures[i].data(),
+                     &keys.public_key});
+  }
+  EXPECT_TRUE(batch_crypto->VerifyBatch(items).empty());
+  
+  // Every failure is reported, unless asked to stop at the first
+  signatures[7][0] ^= 1;
+  signatures[250][0] ^= 1;
+  EXPECT_EQ((std::vector<size_t>{7, 250}), batch_crypto->VerifyBatch(items));
+  std::vector<size_t> first = batch_crypto->VerifyBatch(items, true);
+  ASSERT_FALSE(first.empty());
+  EXPECT_TRUE(first[0] == 7 || first[0] == 250);
+  
+  // Small batches run on the calling thread
+  items.resize(3);
+  EXPECT_TRUE(crypto_provider->VerifyBatch(items).empty());
+}
+
 TEST_F(CryptoTest, Hashing) {
   // Test input
   std::string input1 = "Hello, world!";
@@ -112,5 +147,288 @@ TEST_F(CryptoTest, Hashing) {
   EXPECT_NE(hash1, hash3);
 }
 
+TEST_F(CryptoTest, InPlaceBuffers) {
+  std::string plain_text = "This is a test message for in-place encryption";
+  ByteBuffer plain_buffer(plain_text.begin(), plain_text.end());
+  crypto::Key key = crypto_provider->GenerateKey();
+  crypto::Nonce nonce = crypto_provider->GenerateNonce();
+  
+  // Combined, in place, matches the allocating overload
+  ByteBuffer buffer(crypto::EncryptedSize(plain_buffer.size()));
+  std::copy(plain_buffer.begin(), plain_buffer.end(), buffer.begin());
+  ASSERT_TRUE(crypto_provider->Encrypt(buffer.data(), plain_buffer.size(), buffer.data(),
+                                       key, nonce));
+  EXPECT_EQ(crypto_provider->Encrypt(plain_buffer, key, nonce), buffer);
+  ASSERT_TRUE(crypto_provider->Decrypt(buffer.data(), buffer.size(), buffer.data(), key,
+                                       nonce));
+  EXPECT_TRUE(std::equal(plain_buffer.begin(), plain_buffer.end(), buffer.begin()));
+  
+  // Detached, in place
+  ByteBuffer data = plain_buffer;
+  uint8_t mac[crypto::MAC_SIZE];
+  ASSERT_TRUE(crypto_provider->EncryptDetached(data.data(), data.size(), data.data(), mac,
+                                               key, nonce));
+  EXPECT_NE(plain_buffer, data);
+  mac[0] ^= 1;
+  EXPECT_FALSE(crypto_provider->DecryptDetached(data.data(), data.size(), mac, data.data(),
+                                                key, nonce));
+  mac[0] ^= 1;
+  ASSERT_TRUE(crypto_provider->DecryptDetached(data.data(), data.size(), mac, data.data(),
+                                               key, nonce));
+  EXPECT_EQ(plain_buffer, data);
+  
+  // Asymmetric, from the start of the output buffer and back
+  crypto::KeyPair sender_keys = crypto_provider->GenerateKeyPair();
+  crypto::KeyPair receiver_keys = crypto_provider->GenerateKeyPair();
+  buffer.assign(crypto::AsymmetricEncryptedSize(plain_buffer.size()), 0);
+  std::copy(plain_buffer.begin(), plain_buffer.end(), buffer.begin());
+  ASSERT_TRUE(crypto_provider->AsymmetricEncrypt(buffer.data(), plain_buffer.size(),
+                                                 buffer.data(), receiver_keys.public_key,
+                                                 sender_keys.private_key));
+  EXPECT_EQ(plain_buffer, crypto_provider->AsymmetricDecrypt(buffer, sender_keys.public_key,
+                                                             receiver_keys.private_key));
+  ASSERT_TRUE(crypto_provider->AsymmetricDecrypt(buffer.data(), buffer.size(), buffer.data(),
+                                                 sender_keys.public_key,
+                                                 receiver_keys.private_key));
+  EXPECT_TRUE(std::equal(plain_buffer.begin(), plain_buffer.end(), buffer.begin()));
+  EXPECT_FALSE(crypto_provider->AsymmetricDecrypt(buffer.data(), crypto::MAC_SIZE,
+                                                  buffer.data(), sender_keys.public_key,
+                                                  receiver_keys.private_key));
+  
+  // Signatures
+  crypto::SignatureKeyPair sign_keys = crypto_provider->GenerateSignatureKeyPair();
+  uint8_t signature[crypto::SIGNATURE_SIZE];
+  ASSERT_TRUE(crypto_provider->Sign(plain_buffer.data(), plain_buffer.size(), signature,
+                                    sign_keys.private_key));
+  EXPECT_TRUE(crypto_provider->Verify(plain_buffer, ByteBuffer(signature, signature + 64),
+                                      sign_keys.public_key));
+  plain_buffer[0] ^= 1;
+  EXPECT_FALSE(crypto_provider->Verify(plain_buffer.data(), plain_buffer.size(), signature,
+                                       sign_keys.public_key));
+}
+
+TEST_F(CryptoTest, StreamingHash) {
+  auto Hex = [](const crypto::Digest& digest) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex;
+    for (uint8_t byte : digest) {
+      hex.push_back(digits[byte >> 4]);
+      hex.push_back(digits[byte & 0x0f]);
+    }
+    return hex;
+  };
+  
+  // Fed in pieces, the same as the published values for "abc"
+  const uint8_t abc[] = {'a', 'b', 'c'};
+  auto sha256 = crypto_provider->CreateHasher(crypto::HashAlgorithm::SHA256);
+  sha256->Update(abc, 1);
+  sha256->Update(abc + 1, 2);
+  crypto::Digest digest = sha256->Final();
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", Hex(digest));
+  EXPECT_EQ(ByteBuffer(digest.begin(), digest.end()), crypto_provider->Hash("abc"));
+  
+  auto blake2b = crypto_provider->CreateHasher(crypto::HashAlgorithm::BLAKE2B);
+  blake2b->Update(abc, 2);
+  blake2b->Update(abc + 2, 1);
+  EXPECT_EQ("bddd813c634239723171ef3fee98579b94964e3bb1cb3e427262c8c068d52319",
+            Hex(blake2b->Final()));
+  
+  // Finishing starts over
+  blake2b->Update(abc, 3);
+  EXPECT_EQ("bddd813c634239723171ef3fee98579b94964e3bb1cb3e427262c8c068d52319",
+            Hex(blake2b->Final()));
+}
+
+TEST_F(CryptoTest, TreeHashFile) {
+  std::string path = (std::filesystem::temp_directory_path() / "linknet_tree_hash").string();
+  const uint64_t segment = crypto::CryptoProvider::TREE_SEGMENT_SIZE;
+  ByteBuffer content(4 * segment + 1000);
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<uint8_t>(i * 7 + (i >> 20));
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(content.data()),
+              static_cast<std::streamsize>(content.size()));
+  }
+  
+  // Prefixed segment hashes, then the prefixed list of them
+  auto hasher = crypto_provider->CreateHasher(crypto::HashAlgorithm::BLAKE2B);
+  std::vector<crypto::Digest> segments;
+  for (uint64_t offset = 0; offset < content.size(); offset += segment) {
+    uint8_t leaf = 0x00;
+    hasher->Update(&leaf, 1);
+    hasher->Update(content.data() + offset, std::min<uint64_t>(segment, content.size() - offset));
+    segments.push_back(hasher->Final());
+  }
+  uint8_t node = 0x01;
+  hasher->Update(&node, 1);
+  for (const auto& digest : segments) {
+    hasher->Update(digest.data(), digest.size());
+  }
+  crypto::Digest expected = hasher->Final();
+  
+  auto threaded = crypto::CryptoFactory::Create(4);
+  crypto::Digest digest;
+  ASSERT_TRUE(threaded->HashFile(path, crypto::HashAlgorithm::BLAKE2B, digest));
+  EXPECT_EQ(expected, digest);
+  ASSERT_TRUE(crypto_provider->HashFile(path, crypto::HashAlgorithm::BLAKE2B, digest));
+  EXPECT_EQ(expected, digest);
+  
+  crypto::Digest sha256;
+  ASSERT_TRUE(threaded->HashFile(path, crypto::HashAlgorithm::SHA256, sha256));
+  EXPECT_NE(digest, sha256);
+  
+  std::filesystem::remove(path);
+  EXPECT_FALSE(threaded->HashFile(path, crypto::HashAlgorithm::BLAKE2B, digest));
+}
+
+TEST_F(CryptoTest, SessionCipher) {
+  crypto::KeyPair initiator_keys = crypto_provider->GenerateKeyPair();
+  crypto::KeyPair responder_keys = crypto_provider->GenerateKeyPair();
+  
+  for (crypto::CipherSuite suite :
+       {crypto::CipherSuite::XCHACHA20_POLY1305, crypto::CipherSuite::AES256_GCM}) {
+    if (!(crypto_provider->GetCipherSuites() & crypto::CipherSuiteBit(suite))) {
+      continue;
+    }
+    
+    auto initiator = crypto_provider->CreateSessionCipher(
+        suite, initiator_keys, responder_keys.public_key, true);
+    auto responder = crypto_provider->CreateSessionCipher(
+        suite, responder_keys, initiator_keys.public_key, false);
+    ASSERT_TRUE(initiator && responder);
+    
+    // Both directions, several frames each
+    const std::string text = "Frame sealed in place";
+    const uint8_t ad[4] = {0, 0, 0, 21};
+    for (int frame = 0; frame < 3; ++frame) {
+      for (auto [sender, receiver] : {std::make_pair(initiator.get(), responder.get()),
+                                      std::make_pair(responder.get(), initiator.get())}) {
+        ByteBuffer data(text.begin(), text.end());
+        uint8_t mac[crypto::SessionCipher::MAC_SIZE];
+        ASSERT_TRUE(sender->Seal(data.data(), data.size(), ad, sizeof(ad), mac));
+        EXPECT_NE(ByteBuffer(text.begin(), text.end()), data);
+        ASSERT_TRUE(receiver->Open(data.data(), data.size(), ad, sizeof(ad), mac));
+        EXPECT_EQ(ByteBuffer(text.begin(), text.end()), data);
+      }
+    }
+    
+    // A replayed or reordered frame doesn't open, and neither does one with
+    // other associated data
+    ByteBuffer first(text.begin(), text.end());
+    ByteBuffer second(text.begin(), text.end());
+    uint8_t first_mac[crypto::SessionCipher::MAC_SIZE];
+    uint8_t second_mac[crypto::SessionCipher::MAC_SIZE];
+    ASSERT_TRUE(initiator->Seal(first.data(), first.size(), ad, sizeof(ad), first_mac));
+    ASSERT_TRUE(initiator->Seal(second.data(), second.size(), ad, sizeof(ad), second_mac));
+    EXPECT_FALSE(responder->Open(second.data(), second.size(), ad, sizeof(ad), second_mac));
+    
+    // Data connections derive matching ciphers from the same salt
+    ByteBuffer salt(32, 7);
+    auto initiator_stream = initiator->Derive(salt);
+    auto responder_stream = responder->Derive(salt);
+    ByteBuffer data(text.begin(), text.end());
+    uint8_t mac[crypto::SessionCipher::MAC_SIZE];
+    ASSERT_TRUE(initiator_stream->Seal(data.data(), data.size(), nullptr, 0, mac));
+    ASSERT_TRUE(responder_stream->Open(data.data(), data.size(), nullptr, 0, mac));
+    EXPECT_EQ(ByteBuffer(text.begin(), text.end()), data);
+    
+    auto other_stream = responder->Derive(ByteBuffer(32, 8));
+    ByteBuffer other(text.begin(), text.end());
+    ASSERT_TRUE(initiator_stream->Seal(other.data(), other.size(), nullptr, 0, mac));
+    EXPECT_FALSE(other_stream->Open(other.data(), other.size(), nullptr, 0, mac));
+    
+    // Both ends resume the session from the same secret, with new keys
+    crypto::Key secret = initiator->GetResumptionSecret();
+    EXPECT_EQ(secret, responder->GetResumptionSecret());
+    auto resumed_initiator = crypto_provider->ResumeSessionCipher(suite, secret, salt, true);
+    auto resumed_responder = crypto_provider->ResumeSessionCipher(suite, secret, salt, false);
+    ASSERT_TRUE(resumed_initiator && resumed_responder);
+    EXPECT_NE(secret, resumed_initiator->GetResumptionSecret());
+    for (auto [sender, receiver] :
+         {std::make_pair(resumed_initiator.get(), resumed_responder.get()),
+          std::make_pair(resumed_responder.get(), resumed_initiator.get())}) {
+      ByteBuffer resumed(text.begin(), text.end());
+      ASSERT_TRUE(sender->Seal(resumed.data(), resumed.size(), ad, sizeof(ad), mac));
+      ASSERT_TRUE(receiver->Open(resumed.data(), resumed.size(), ad, sizeof(ad), mac));
+      EXPECT_EQ(ByteBuffer(text.begin(), text.end()), resumed);
+    }
+  }
+  
+  EXPECT_EQ(crypto::CipherSuite::XCHACHA20_POLY1305,
+            crypto_provider->ChooseCipherSuite(
+                crypto::CipherSuiteBit(crypto::CipherSuite::XCHACHA20_POLY1305)));
+  EXPECT_EQ(crypto::CipherSuite::NONE, crypto_provider->ChooseCipherSuite(0));
+}
+
+// More sessions than one arena of keys holds, outliving their provider
+TEST_F(CryptoTest, ManySessionCiphers) {
+  crypto::KeyPair initiator_keys = crypto_provider->GenerateKeyPair();
+  crypto::KeyPair responder_keys = crypto_provider->GenerateKeyPair();
+  crypto::CipherSuite suite = crypto_provider->ChooseCipherSuite(
+      crypto_provider->GetCipherSuites());
+  
+  std::vector<std::pair<std::unique_ptr<crypto::SessionCipher>,
+                        std::unique_ptr<crypto::SessionCipher>>> sessions;
+  for (int i = 0; i < 100; ++i) {
+    auto initiator = crypto_provider->CreateSessionCipher(
+        suite, initiator_keys, responder_keys.public_key, true);
+    auto responder = crypto_provider->CreateSessionCipher(
+        suite, responder_keys, initiator_keys.public_key, false);
+    ASSERT_TRUE(initiator && responder);
+    sessions.emplace_back(std::move(initiator), std::move(responder));
+  }
+  sessions.erase(sessions.begin(), sessions.begin() + 50);
+  crypto_provider.reset();
+  
+  const std::string text = "Frame sealed after the provider went";
+  for (auto& [initiator, responder] : sessions) {
+    ByteBuffer data(text.begin(), text.end());
+    uint8_t mac[crypto::SessionCipher::MAC_SIZE];
+    ASSERT_TRUE(initiator->Seal(data.data(), data.size(), nullptr, 0, mac));
+    ASSERT_TRUE(responder->Open(data.data(), data.size(), nullptr, 0, mac));
+    EXPECT_EQ(ByteBuffer(text.begin(), text.end()), data);
+  }
+}
+
+TEST_F(CryptoTest, SealedStream) {
+  crypto::KeyPair sender_keys = crypto_provider->GenerateKeyPair();
+  crypto::KeyPair receiver_keys = crypto_provider->GenerateKeyPair();
+  auto sealer = crypto_provider->CreateStreamSealer(sender_keys, receiver_keys.public_key);
+  ASSERT_NE(nullptr, sealer);
+  auto opener = crypto_provider->CreateStreamOpener(receiver_keys, sender_keys.public_key,
+                                                    sealer->GetHeader().data());
+  ASSERT_NE(nullptr, opener);
+  
+  // Messages open in order, across a change of key
+  std::vector<ByteBuffer> sealed;
+  for (uint8_t i = 0; i < 6; ++i) {
+    ByteBuffer message(100 + i, i);
+    ByteBuffer output(message.size() + crypto::StreamSealer::OVERHEAD);
+    ASSERT_TRUE(sealer->Push(message.data(), message.size(), i == 2, output.data()));
+    sealed.push_back(output);
+  }
+  for (uint8_t i = 0; i < 3; ++i) {
+    ByteBuffer opened(sealed[i].size() - crypto::StreamSealer::OVERHEAD);
+    ASSERT_TRUE(opener->Pull(sealed[i].data(), sealed[i].size(), opened.data()));
+    EXPECT_EQ(ByteBuffer(100 + i, i), opened);
+  }
+  
+  // A skipped message breaks the stream for good
+  ByteBuffer opened(sealed[4].size() - crypto::StreamSealer::OVERHEAD);
+  EXPECT_FALSE(opener->Pull(sealed[4].data(), sealed[4].size(), opened.data()));
+  opened.resize(sealed[3].size() - crypto::StreamSealer::OVERHEAD);
+  EXPECT_FALSE(opener->Pull(sealed[3].data(), sealed[3].size(), opened.data()));
+  
+  // Only the intended receiver can open the stream
+  crypto::KeyPair other_keys = crypto_provider->GenerateKeyPair();
+  auto other = crypto_provider->CreateStreamOpener(other_keys, sender_keys.public_key,
+                                                   sealer->GetHeader().data());
+  ASSERT_NE(nullptr, other);
+  opened.resize(sealed[0].size() - crypto::StreamSealer::OVERHEAD);
+  EXPECT_FALSE(other->Pull(sealed[0].data(), sealed[0].size(), opened.data()));
+}
+
 }  // namespace test
 }  // namespace linknet
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include "linknet/direct_file.h"
+#include "linknet/types.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+namespace linknet {
+namespace test {
+
+TEST(DirectFileTest, BufferPoolReusesAlignedBuffers) {
+  AlignedBufferPool pool(5000, 1);
+  EXPECT_EQ(8192u, pool.BufferSize());
+  
+  uint8_t* first;
+  {
+    AlignedBufferPool::Buffer buffer = pool.Acquire();
+    ASSERT_TRUE(buffer);
+    first = buffer.get();
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(first) % AlignedBufferPool::ALIGNMENT);
+  }
+  
+  AlignedBufferPool::Buffer again = pool.Acquire();
+  EXPECT_EQ(first, again.get());
+  AlignedBufferPool::Buffer other = pool.Acquire();
+  EXPECT_NE(first, other.get());
+}
+
+// Aligned chunks, an unaligned tail and unaligned reads, whether or not the
+// file system takes O_DIRECT
+TEST(DirectFileTest, WritesAndReadsChunks) {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "linknet_direct_file_test";
+  const size_t chunk_size = 16 * 1024;
+  const ByteBuffer data = RandomBytes(3 * chunk_size + 1000, 1);
+  
+  std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+  auto buffers = std::make_shared<AlignedBufferPool>(chunk_size + AlignedBufferPool::ALIGNMENT);
+  
+  {
+    DirectFile file(buffers);
+    ASSERT_TRUE(file.Open(path.string(), DirectFile::Mode::READ_WRITE));
+    
+    // Out of order, as chunks arrive
+    for (size_t chunk : {3, 1, 0, 2}) {
+      size_t offset = chunk * chunk_size;
+      size_t length = std::min(chunk_size, data.size() - offset);
+      ASSERT_TRUE(file.WriteAt(offset, data.data() + offset, length));
+    }
+    
+    ByteBuffer chunk(chunk_size);
+    ASSERT_TRUE(file.ReadAt(chunk_size, chunk.data(), chunk.size()));
+    EXPECT_TRUE(std::equal(chunk.begin(), chunk.end(), data.begin() + chunk_size));
+  }
+  EXPECT_EQ(data, ReadFile(path));
+  
+  DirectFile file(buffers);
+  ASSERT_TRUE(file.Open(path.string(), DirectFile::Mode::READ));
+  
+  ByteBuffer tail(1000);
+  ASSERT_TRUE(file.ReadAt(3 * chunk_size, tail.data(), tail.size()));
+  EXPECT_TRUE(std::equal(tail.begin(), tail.end(), data.begin() + 3 * chunk_size));
+  
+  ByteBuffer middle(5000);
+  ASSERT_TRUE(file.ReadAt(777, middle.data(), middle.size()));
+  EXPECT_TRUE(std::equal(middle.begin(), middle.end(), data.begin() + 777));
+  
+  // Past the end of the file
+  EXPECT_FALSE(file.ReadAt(3 * chunk_size, tail.data(), 1001));
+  
+  file.Close();
+  std::filesystem::remove(path);
+}
+
+// Holes left by growing the file and by zeroing, and the data between them
+TEST(DirectFileTest, FindsAndPunchesHoles) {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "linknet_direct_file_holes_test";
+  const size_t block_size = 1024 * 1024;
+  const ByteBuffer data = RandomBytes(block_size, 2);
+  auto buffers = std::make_shared<AlignedBufferPool>(64 * 1024);
+  
+  DirectFile file(buffers);
+  ASSERT_TRUE(file.Open(path.string(), DirectFile::Mode::CREATE, false));
+  ASSERT_TRUE(file.Zero(0, 2 * block_size));
+  ASSERT_TRUE(file.WriteAt(2 * block_size, data.data(), data.size()));
+  ASSERT_TRUE(file.WriteAt(3 * block_size, data.data(), data.size()));
+  ASSERT_TRUE(file.Zero(3 * block_size, block_size));
+  
+  // Zeroing past the end grows the file
+  ASSERT_TRUE(file.Zero(4 * block_size, 1000));
+  EXPECT_EQ(4 * block_size + 1000, std::filesystem::file_size(path));
+  
+  ByteBuffer read_back(block_size);
+  ASSERT_TRUE(file.ReadAt(3 * block_size, read_back.data(), read_back.size()));
+  EXPECT_EQ(ByteBuffer(block_size, 0), read_back);
+  ASSERT_TRUE(file.ReadAt(2 * block_size, read_back.data(), read_back.size()));
+  EXPECT_EQ(data, read_back);
+  
+  // File systems without hole reporting show all of it as data
+  uint64_t begin, end;
+  file.FindData(0, begin, end);
+  EXPECT_LE(begin, 2 * block_size);
+  EXPECT_GE(end, 3 * block_size);
+  if (begin == 2 * block_size) {
+    EXPECT_EQ(3 * block_size, end);
+    file.FindData(end, begin, end);
+    EXPECT_EQ(4 * block_size + 1000, begin);
+    EXPECT_EQ(begin, end);
+  }
+  
+  file.Close();
+  std::filesystem::remove(path);
+}
+
+}  // namespace test
+}  // namespace linknet
@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include "linknet/file_pack.h"
+#include "linknet/types.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+namespace linknet {
+namespace test {
+
+TEST(FilePackTest, ReadAcrossFilesAndUnpack) {
+  const std::filesystem::path dir = std::filesystem::temp_directory_path() / "linknet_pack_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir / "in");
+  std::filesystem::create_directories(dir / "out");
+  
+  // Includes empty files, which take no space in the pack
+  const std::vector<size_t> sizes = {1000, 0, 1, 70000, 0, 333};
+  FilePack source;
+  FilePack target;
+  ByteBuffer expected;
+  
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    std::string name = "file" + std::to_string(i);
+    ByteBuffer data = RandomBytes(sizes[i], static_cast<uint32_t>(i));
+    std::ofstream out(dir / "in" / name, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    out.close();
+    
+    source.Add((dir / "in" / name).string(), sizes[i]);
+    target.Add((dir / "out" / name).string(), sizes[i]);
+    expected.insert(expected.end(), data.begin(), data.end());
+  }
+  ASSERT_EQ(expected.size(), source.Size());
+  
+  // Reads in odd-sized pieces, each spanning file boundaries, rebuild the pack
+  ByteBuffer pack(source.Size());
+  for (uint64_t offset = 0; offset < pack.size(); offset += 4096) {
+    size_t length = static_cast<size_t>(std::min<uint64_t>(4096, pack.size() - offset));
+    ASSERT_TRUE(source.Read(offset, pack.data() + offset, length));
+  }
+  EXPECT_EQ(expected, pack);
+  
+  // Random access works after sequential reads
+  uint8_t byte = 0;
+  ASSERT_TRUE(source.Read(1000, &byte, 1));
+  EXPECT_EQ(expected[1000], byte);
+  EXPECT_FALSE(source.Read(pack.size(), &byte, 1));
+  
+  const std::filesystem::path pack_path = dir / "files.lnkpack";
+  {
+    std::ofstream out(pack_path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(pack.data()), pack.size());
+  }
+  
+  ASSERT_TRUE(target.Unpack(pack_path.string()));
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    std::string name = "file" + std::to_string(i);
+    EXPECT_EQ(ReadFile(dir / "in" / name), ReadFile(dir / "out" / name)) << name;
+  }
+  
+  // A short pack fails instead of leaving files silently truncated
+  std::filesystem::resize_file(pack_path, pack.size() - 1);
+  EXPECT_FALSE(target.Unpack(pack_path.string()));
+  
+  std::filesystem::remove_all(dir);
+}
+
+}  // namespace test
+}  // namespace linknet
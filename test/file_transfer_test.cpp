@@ -0,0 +1,844 @@
+#include <gtest/gtest.h>
+#include "linknet/file_transfer.h"
+#include "linknet/crypto.h"
+#include "linknet/message.h"
+#include "linknet/network.h"
+#include "linknet/types.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace linknet {
+namespace test {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+std::string ReadFile(const fs::path& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// Carries messages between in-process network managers on a thread of its
+// own, in the order they were sent, as the sessions of a real network do.
+// Each endpoint is known to the others by a peer ID filled with its index
+// plus one.
+class LoopbackHub {
+ public:
+  // Return false to drop a message
+  using Filter = std::function<bool(size_t from, size_t to, const Message& message)>;
+  
+  LoopbackHub() : _thread(&LoopbackHub::Deliver, this) {}
+  
+  ~LoopbackHub() {
+    Stop();
+  }
+  
+  static PeerId IdOf(size_t index) {
+    PeerId id;
+    id.fill(static_cast<uint8_t>(index + 1));
+    return id;
+  }
+  
+  size_t Attach() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _callbacks.emplace_back();
+    return _callbacks.size() - 1;
+  }
+  
+  size_t Size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _callbacks.size();
+  }
+  
+  void SetCallback(size_t index, MessageCallback callback) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _callbacks[index] = std::move(callback);
+  }
+  
+  void SetFilter(Filter filter) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _filter = std::move(filter);
+  }
+  
+  void Post(size_t from, size_t to, ByteBuffer data) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_stopped && to < _callbacks.size()) {
+      _queue.emplace_back(from, to, std::move(data));
+      _cv.notify_one();
+    }
+  }
+  
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopped = true;
+      _cv.notify_one();
+    }
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+  }
+ 
+ private:
+  void Deliver() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [this] { return _stopped || !_queue.empty(); });
+      if (_stopped) {
+        return;
+      }
+      
+      auto [from, to, data] = std::move(_queue.front());
+      _queue.pop_front();
+      MessageCallback callback = _callbacks[to];
+      Filter filter = _filter;
+      lock.unlock();
+      
+      auto message = MessageFactory::CreateFromBuffer(data);
+      if (message) {
+        message->SetSender(IdOf(from));
+        if (callback && (!filter || filter(from, to, *message))) {
+          callback(std::move(message));
+        }
+      }
+      
+      lock.lock();
+    }
+  }
+  
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  std::vector<MessageCallback> _callbacks;
+  std::deque<std::tuple<size_t, size_t, ByteBuffer>> _queue;
+  Filter _filter;
+  bool _stopped = false;
+  std::thread _thread;
+};
+
+// A network manager connected to every other endpoint of a hub
+class LoopbackNetwork : public NetworkManager {
+ public:
+  explicit LoopbackNetwork(LoopbackHub& hub) : _hub(hub), _index(hub.Attach()) {}
+  
+  bool Start(uint16_t /*port*/) override { return true; }
+  void Stop() override {}
+  bool ConnectToPeer(const std::string& /*address*/, uint16_t /*port*/) override { return true; }
+  void DisconnectFromPeer(const PeerId& /*peer_id*/) override {}
+  
+  bool SendMessage(const PeerId& peer_id, const Message& message) override {
+    _hub.Post(_index, peer_id[0] - 1, message.Serialize());
+    return true;
+  }
+  
+  void BroadcastMessage(const Message& message) override {
+    for (size_t i = 0; i < _hub.Size(); ++i) {
+      if (i != _index) {
+        _hub.Post(_index, i, message.Serialize());
+      }
+    }
+  }
+  
+  std::vector<PeerInfo> GetConnectedPeers() const override {
+    std::vector<PeerInfo> peers;
+    for (size_t i = 0; i < _hub.Size(); ++i) {
+      if (i != _index) {
+        peers.push_back({LoopbackHub::IdOf(i), "", "127.0.0.1", 0, ConnectionStatus::CONNECTED});
+      }
+    }
+    return peers;
+  }
+  
+  uint16_t GetLocalPort() const override { return 0; }
+  void SetDataConnections(size_t /*count*/) override {}
+  void SetCryptoProvider(std::shared_ptr<crypto::CryptoProvider> /*provider*/) override {}
+  
+  void SetMessageCallback(MessageCallback callback) override {
+    _hub.SetCallback(_index, std::move(callback));
+  }
+  
+  void SetConnectionCallback(ConnectionCallback /*callback*/) override {}
+  void SetErrorCallback(ErrorCallback /*callback*/) override {}
+ 
+ private:
+  LoopbackHub& _hub;
+  size_t _index;
+};
+
+// Collects the transfers a manager reports finished
+class Completions {
+ public:
+  explicit Completions(FileTransferManager& manager) {
+    manager.SetCompletedCallback(
+        [this](const PeerId&, const std::string& path, bool success, const std::string&) {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _results.emplace_back(path, success);
+          _cv.notify_all();
+        });
+  }
+  
+  // Wait for count transfers to finish; false on timeout
+  bool Wait(size_t count, std::chrono::seconds timeout = std::chrono::seconds(10)) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _cv.wait_for(lock, timeout, [&] { return _results.size() >= count; });
+  }
+  
+  std::vector<std::pair<std::string, bool>> Results() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _results;
+  }
+ 
+ private:
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  std::vector<std::pair<std::string, bool>> _results;
+};
+
+// Collects the progress reports of a manager
+class ProgressReports {
+ public:
+  explicit ProgressReports(FileTransferManager& manager) {
+    manager.SetProgressCallback(
+        [this](const PeerId&, const std::string&, const TransferProgress& progress) {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _reports.push_back(progress);
+        });
+  }
+  
+  std::vector<TransferProgress> Reports() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _reports;
+  }
+ 
+ private:
+  mutable std::mutex _mutex;
+  std::vector<TransferProgress> _reports;
+};
+
+class FileTransferTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _original_dir = fs::current_path();
+    _root = fs::temp_directory_path() / "linknet_file_transfer_test";
+    fs::remove_all(_root);
+    fs::create_directories(_root);
+    fs::current_path(_root);
+  }
+  
+  void TearDown() override {
+    _hub.Stop();
+    _managers.clear();
+    fs::current_path(_original_dir);
+    fs::remove_all(_root);
+  }
+  
+  // Add a peer to the hub; its index is its position in _managers
+  FileTransferManager& AddPeer() {
+    _managers.push_back(FileTransferFactory::Create(std::make_shared<LoopbackNetwork>(_hub)));
+    return *_managers.back();
+  }
+  
+  fs::path WriteRandomFile(const std::string& name, size_t size) {
+    std::string data(size, '\0');
+    std::mt19937_64 random(size);
+    for (auto& c : data) {
+      c = static_cast<char>(random());
+    }
+    
+    fs::path path = _root / name;
+    std::ofstream(path, std::ios::binary) << data;
+    return path;
+  }
+  
+  fs::path _original_dir;
+  fs::path _root;
+  LoopbackHub _hub;
+  std::vector<std::unique_ptr<FileTransferManager>> _managers;
+};
+
+}  // namespace
+
+TEST_F(FileTransferTest, InterruptedTransferResumes) {
+  constexpr size_t CHUNK_SIZE = 16 * 1024;
+  constexpr size_t DELIVERED = 20;
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  
+  // The first session gets DELIVERED chunks through before it stalls
+  std::mutex mutex;
+  std::condition_variable cv;
+  TransferId first_transfer = 0;
+  std::set<uint32_t> delivered;
+  std::vector<uint32_t> resent;
+  bool resuming = false;
+  _hub.SetFilter([&](size_t, size_t, const Message& message) {
+    if (message.GetType() != MessageType::FILE_CHUNK) {
+      return true;
+    }
+    
+    const auto& chunk = static_cast<const FileChunkMessage&>(message);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!resuming) {
+      first_transfer = chunk.GetTransferId();
+      if (delivered.size() >= DELIVERED) {
+        return false;
+      }
+      delivered.insert(chunk.GetChunkIndex());
+      cv.notify_all();
+    } else if (chunk.GetTransferId() != first_transfer) {
+      resent.push_back(chunk.GetChunkIndex());
+    }
+    return true;
+  });
+  
+  fs::path source = WriteRandomFile("source.bin", 1024 * 1024 + 5);
+  const size_t chunk_count = (fs::file_size(source) + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(10),
+                            [&] { return delivered.size() == DELIVERED; }));
+  }
+  
+  // The sender drops out; the receiver keeps what it has
+  sender.CancelTransfer(LoopbackHub::IdOf(1), source.string());
+  ASSERT_TRUE(completions.Wait(1));
+  EXPECT_FALSE(completions.Results()[0].second);
+  EXPECT_TRUE(fs::exists(_root / "downloads" / "source.bin.lnkpart"));
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    resuming = true;
+  }
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(2));
+  EXPECT_TRUE(completions.Results()[1].second);
+  EXPECT_EQ(ReadFile(source), ReadFile(_root / "downloads" / "source.bin"));
+  EXPECT_FALSE(fs::exists(_root / "downloads" / "source.bin.lnkpart"));
+  
+  // Only the chunks missing after the first session were sent again
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(chunk_count - DELIVERED, resent.size());
+  for (uint32_t chunk_index : resent) {
+    EXPECT_EQ(0u, delivered.count(chunk_index)) << chunk_index;
+  }
+}
+
+TEST_F(FileTransferTest, CorruptChunkIsRequestedAgain) {
+  constexpr uint32_t CORRUPTED = 5;
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  
+  // One copy of a chunk has a byte flipped on the way; the receiver's
+  // requests for single chunks are recorded
+  std::mutex mutex;
+  bool corrupted = false;
+  std::vector<ChunkRange> requested;
+  _hub.SetFilter([&](size_t from, size_t to, const Message& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (message.GetType() == MessageType::FILE_CHUNK_REQUEST) {
+      const auto& request = static_cast<const FileChunkRequestMessage&>(message);
+      requested.insert(requested.end(), request.GetRanges().begin(), request.GetRanges().end());
+      return true;
+    }
+    if (message.GetType() != MessageType::FILE_CHUNK || corrupted) {
+      return true;
+    }
+    
+    const auto& chunk = static_cast<const FileChunkMessage&>(message);
+    if (chunk.GetChunkIndex() != CORRUPTED) {
+      return true;
+    }
+    
+    ByteBuffer data = chunk.GetData();
+    data[data.size() / 2] ^= 0x01;
+    FileChunkMessage tampered(message.GetSender(), chunk.GetTransferId(), CORRUPTED, data,
+                              chunk.GetCompression(), chunk.IsSealed(), chunk.GetStreamIndex());
+    _hub.Post(from, to, tampered.Serialize());
+    corrupted = true;
+    return false;
+  });
+  
+  fs::path source = WriteRandomFile("source.bin", 512 * 1024 + 9);
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  EXPECT_TRUE(completions.Results()[0].second);
+  EXPECT_EQ(ReadFile(source), ReadFile(_root / "downloads" / "source.bin"));
+  
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_TRUE(corrupted);
+  EXPECT_TRUE(std::any_of(requested.begin(), requested.end(), [](const ChunkRange& range) {
+    return range.first == CORRUPTED && range.count == 1;
+  }));
+}
+
+TEST_F(FileTransferTest, SealedChunksArriveOutOfOrder) {
+  constexpr uint32_t HELD = 2;
+  constexpr uint32_t RELEASED_AFTER = 9;
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  
+  // Rekeyed every few chunks, so reordering crosses key changes
+  std::shared_ptr<crypto::CryptoProvider> provider = crypto::CryptoFactory::Create(1);
+  sender.SetEncryption(provider, 4);
+  receiver.SetEncryption(provider, 4);
+  
+  // One sealed chunk is held back until a later one has gone through
+  std::mutex mutex;
+  std::unique_ptr<FileChunkMessage> held;
+  bool released = false;
+  size_t unsealed = 0;
+  _hub.SetFilter([&](size_t from, size_t to, const Message& message) {
+    if (message.GetType() != MessageType::FILE_CHUNK) {
+      return true;
+    }
+    
+    const auto& chunk = static_cast<const FileChunkMessage&>(message);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!chunk.IsSealed()) {
+      unsealed++;
+    }
+    if (chunk.GetStreamIndex() == HELD && !held && !released) {
+      held = std::make_unique<FileChunkMessage>(chunk);
+      return false;
+    }
+    if (chunk.GetStreamIndex() == RELEASED_AFTER && held) {
+      _hub.Post(from, to, held->Serialize());
+      held.reset();
+      released = true;
+    }
+    return true;
+  });
+  
+  fs::path source = WriteRandomFile("source.bin", 512 * 1024 + 17);
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  EXPECT_TRUE(completions.Results()[0].second);
+  EXPECT_EQ(ReadFile(source), ReadFile(_root / "downloads" / "source.bin"));
+  
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_TRUE(released);
+  EXPECT_EQ(0u, unsealed);
+}
+
+TEST_F(FileTransferTest, DeltaTransferReusesEarlierVersion) {
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  
+  // Chunk data sent once the earlier version is in place
+  std::mutex mutex;
+  bool counting = false;
+  size_t chunk_bytes = 0;
+  _hub.SetFilter([&](size_t, size_t, const Message& message) {
+    if (message.GetType() == MessageType::FILE_CHUNK) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (counting) {
+        chunk_bytes += static_cast<const FileChunkMessage&>(message).GetData().size();
+      }
+    }
+    return true;
+  });
+  
+  fs::path source = WriteRandomFile("source.bin", 2 * 1024 * 1024 + 77);
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  ASSERT_TRUE(completions.Results()[0].second);
+  
+  // Bytes inserted in the middle shift everything after them
+  std::string content = ReadFile(source);
+  content.insert(content.size() / 2, "a few more bytes");
+  content.replace(content.size() - 1000, 10, std::string(10, 'x'));
+  std::ofstream(source, std::ios::binary | std::ios::trunc) << content;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    counting = true;
+  }
+  
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(2));
+  EXPECT_TRUE(completions.Results()[1].second);
+  EXPECT_EQ(content, ReadFile(_root / "downloads" / "source.bin"));
+  EXPECT_FALSE(fs::exists(_root / "downloads" / "source.bin.lnkbase"));
+  
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_GT(chunk_bytes, 0u);
+  EXPECT_LT(chunk_bytes, content.size() / 4);
+}
+
+TEST_F(FileTransferTest, SparseFileHolesAreNotSent) {
+  constexpr size_t CHUNK_SIZE = 16 * 1024;
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  
+  // Chunks 8-23 and 40 to the end are punched out of the file, or zeroed
+  // where the file system can't punch holes
+  fs::path source = WriteRandomFile("source.bin", 64 * CHUNK_SIZE);
+  const std::vector<ChunkRange> holes = {{8, 16}, {40, 24}};
+  {
+    int fd = ::open(source.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    for (const auto& hole : holes) {
+      off_t offset = static_cast<off_t>(hole.first * CHUNK_SIZE);
+      off_t length = static_cast<off_t>(hole.count * CHUNK_SIZE);
+      if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) != 0) {
+        std::string zeros(length, '\0');
+        ASSERT_EQ(length, ::pwrite(fd, zeros.data(), zeros.size(), offset));
+      }
+    }
+    ::close(fd);
+  }
+  
+  std::mutex mutex;
+  std::set<uint32_t> sent_as_data;
+  std::set<uint32_t> sent_as_holes;
+  _hub.SetFilter([&](size_t, size_t, const Message& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (message.GetType() == MessageType::FILE_CHUNK) {
+      sent_as_data.insert(static_cast<const FileChunkMessage&>(message).GetChunkIndex());
+    } else if (message.GetType() == MessageType::FILE_HOLES) {
+      for (const auto& range : static_cast<const FileHolesMessage&>(message).GetRanges()) {
+        for (uint32_t i = range.first; i < range.first + range.count; ++i) {
+          sent_as_holes.insert(i);
+        }
+      }
+    }
+    return true;
+  });
+  
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  EXPECT_TRUE(completions.Results()[0].second);
+  EXPECT_EQ(ReadFile(source), ReadFile(_root / "downloads" / "source.bin"));
+  
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto& hole : holes) {
+    for (uint32_t i = hole.first; i < hole.first + hole.count; ++i) {
+      EXPECT_EQ(1u, sent_as_holes.count(i)) << i;
+      EXPECT_EQ(0u, sent_as_data.count(i)) << i;
+    }
+  }
+  EXPECT_EQ(64u - 16u - 24u, sent_as_data.size());
+}
+
+TEST_F(FileTransferTest, SwarmDownloadFromTwoSources) {
+  auto& seeder1 = AddPeer();
+  auto& seeder2 = AddPeer();
+  auto& downloader = AddPeer();
+  
+  fs::path source = WriteRandomFile("source.bin", 3 * 1024 * 1024 + 123);
+  ByteBuffer hash1, hash2;
+  ASSERT_TRUE(seeder1.ShareFile(source.string(), hash1));
+  ASSERT_TRUE(seeder2.ShareFile(source.string(), hash2));
+  EXPECT_EQ(hash1, hash2);
+  
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  bool success = false;
+  downloader.SetCompletedCallback(
+      [&](const PeerId&, const std::string&, bool ok, const std::string&) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        success = ok;
+        cv.notify_all();
+      });
+  
+  ASSERT_TRUE(downloader.DownloadFile(hash1, "fetched.bin"));
+  
+  std::unique_lock<std::mutex> lock(mutex);
+  ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(10), [&] { return done; }));
+  EXPECT_TRUE(success);
+  EXPECT_EQ(ReadFile(source), ReadFile(_root / "downloads" / "fetched.bin"));
+}
+
+TEST_F(FileTransferTest, SwarmDownloadSurvivesLossOfHashSource) {
+  auto& seeder1 = AddPeer();
+  auto& seeder2 = AddPeer();
+  auto& downloader = AddPeer();
+  const size_t downloader_index = 2;
+  
+  fs::path source = WriteRandomFile("source.bin", 3 * 1024 * 1024 + 123);
+  ByteBuffer content_hash;
+  ASSERT_TRUE(seeder1.ShareFile(source.string(), content_hash));
+  ASSERT_TRUE(seeder2.ShareFile(source.string(), content_hash));
+  
+  // Whichever seeder is asked for the chunk hashes never gets them through.
+  // A seeder asked for chunks is a source of the download.
+  std::mutex mutex;
+  std::condition_variable cv;
+  int hash_source = -1;
+  std::set<size_t> sources;
+  _hub.SetFilter([&](size_t from, size_t to, const Message& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (from == downloader_index && message.GetType() == MessageType::FILE_CHUNK_REQUEST) {
+      sources.insert(to);
+      cv.notify_all();
+    }
+    if (to != downloader_index || message.GetType() != MessageType::FILE_CHUNK_HASHES) {
+      return true;
+    }
+    
+    if (hash_source < 0) {
+      hash_source = static_cast<int>(from);
+      cv.notify_all();
+    }
+    return hash_source != static_cast<int>(from);
+  });
+  
+  bool done = false;
+  bool success = false;
+  downloader.SetCompletedCallback(
+      [&](const PeerId&, const std::string&, bool ok, const std::string&) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        success = ok;
+        cv.notify_all();
+      });
+  
+  ASSERT_TRUE(downloader.DownloadFile(content_hash, "fetched.bin"));
+  
+  // The hash source stops serving; the other one must send the hashes
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(10),
+                            [&] { return hash_source >= 0 && sources.size() == 2; }));
+  }
+  _managers[hash_source]->CancelTransfer(LoopbackHub::IdOf(downloader_index), source.string());
+  
+  std::unique_lock<std::mutex> lock(mutex);
+  ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(10), [&] { return done; }));
+  EXPECT_TRUE(success);
+  EXPECT_EQ(ReadFile(source), ReadFile(_root / "downloads" / "fetched.bin"));
+}
+
+TEST_F(FileTransferTest, SwarmDownloadNobodyHasFails) {
+  auto& downloader = AddPeer();
+  AddPeer();
+  Completions completions(downloader);
+  downloader.SetStallTimeout(std::chrono::milliseconds(100), true);
+  
+  ByteBuffer content_hash(crypto::DIGEST_SIZE, 0x5a);
+  ASSERT_TRUE(downloader.DownloadFile(content_hash, "fetched.bin"));
+  ASSERT_TRUE(completions.Wait(1));
+  EXPECT_FALSE(completions.Results()[0].second);
+  
+  // The same download can be tried again
+  EXPECT_TRUE(downloader.DownloadFile(content_hash, "fetched.bin"));
+}
+
+TEST_F(FileTransferTest, ReceiverStallsWithoutFirstChunk) {
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  receiver.SetStallTimeout(std::chrono::milliseconds(100), true);
+  
+  // Accepted, but not a single chunk gets through
+  _hub.SetFilter([](size_t, size_t, const Message& message) {
+    return message.GetType() != MessageType::FILE_CHUNK;
+  });
+  
+  fs::path source = WriteRandomFile("source.bin", 256 * 1024);
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  EXPECT_FALSE(completions.Results()[0].second);
+}
+
+TEST_F(FileTransferTest, DirectoryTransferDropsSpecialModeBits) {
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  
+  fs::create_directories(_root / "tree" / "sub");
+  fs::path script = _root / "tree" / "run.sh";
+  std::ofstream(script) << "#!/bin/sh\n";
+  std::ofstream(_root / "tree" / "sub" / "notes.txt") << "notes";
+  fs::permissions(script, static_cast<fs::perms>(04755));
+  fs::permissions(_root / "tree" / "sub", static_cast<fs::perms>(01775));
+  
+  ASSERT_TRUE(sender.SendDirectory(LoopbackHub::IdOf(1), (_root / "tree").string() + "/"));
+  ASSERT_TRUE(completions.Wait(1));
+  ASSERT_TRUE(completions.Results()[0].second);
+  
+  fs::path received = _root / "downloads" / "tree";
+  EXPECT_EQ("#!/bin/sh\n", ReadFile(received / "run.sh"));
+  EXPECT_EQ(static_cast<fs::perms>(0755), fs::status(received / "run.sh").permissions());
+  EXPECT_EQ(static_cast<fs::perms>(0775), fs::status(received / "sub").permissions());
+}
+
+TEST_F(FileTransferTest, SameNameFromAnotherPeerDoesNotSupersede) {
+  auto& first = AddPeer();
+  auto& second = AddPeer();
+  auto& receiver = AddPeer();
+  const size_t receiver_index = 2;
+  Completions first_done(first);
+  Completions second_done(second);
+  
+  // The first sender's chunks are held back, so its transfer stays open
+  _hub.SetFilter([&](size_t from, size_t, const Message& message) {
+    return from != 0 || message.GetType() != MessageType::FILE_CHUNK;
+  });
+  
+  fs::create_directories(_root / "a");
+  fs::create_directories(_root / "b");
+  fs::path mine = WriteRandomFile("a/same.bin", 256 * 1024);
+  std::ofstream(_root / "b" / "same.bin") << "someone else's file";
+  
+  ASSERT_TRUE(first.SendFile(LoopbackHub::IdOf(receiver_index), mine.string()));
+  for (int i = 0; i < 1000 && receiver.GetOngoingTransfers().empty(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(1u, receiver.GetOngoingTransfers().size());
+  
+  ASSERT_TRUE(second.SendFile(LoopbackHub::IdOf(receiver_index),
+                              (_root / "b" / "same.bin").string()));
+  ASSERT_TRUE(second_done.Wait(1));
+  EXPECT_FALSE(second_done.Results()[0].second);
+  
+  auto ongoing = receiver.GetOngoingTransfers();
+  ASSERT_EQ(1u, ongoing.size());
+  EXPECT_EQ(LoopbackHub::IdOf(0), std::get<0>(ongoing[0]));
+  EXPECT_EQ(FileTransferStatus::IN_PROGRESS, std::get<2>(ongoing[0]));
+  EXPECT_TRUE(first_done.Results().empty());
+}
+
+TEST_F(FileTransferTest, CachedContentIsNotSentAgain) {
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  ASSERT_TRUE(receiver.SetContentCache((_root / "cache").string(), 64 * 1024 * 1024));
+  
+  std::atomic<int> chunks{0};
+  _hub.SetFilter([&](size_t, size_t, const Message& message) {
+    if (message.GetType() == MessageType::FILE_CHUNK) {
+      chunks++;
+    }
+    return true;
+  });
+  
+  fs::path first = WriteRandomFile("first.bin", 1024 * 1024 + 7);
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), first.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  EXPECT_TRUE(completions.Results()[0].second);
+  EXPECT_GT(chunks.load(), 0);
+  
+  // The cache takes the file in on the workers, under a temporary name first
+  auto cached = [&] {
+    for (const auto& entry : fs::directory_iterator(_root / "cache")) {
+      if (entry.path().extension() != ".tmp") {
+        return true;
+      }
+    }
+    return false;
+  };
+  for (int i = 0; i < 1000 && !cached(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  
+  fs::path again = _root / "again.bin";
+  fs::copy_file(first, again);
+  
+  chunks = 0;
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), again.string()));
+  ASSERT_TRUE(completions.Wait(2));
+  EXPECT_TRUE(completions.Results()[1].second);
+  EXPECT_EQ(0, chunks.load());
+  EXPECT_EQ(ReadFile(first), ReadFile(_root / "downloads" / "again.bin"));
+}
+
+TEST_F(FileTransferTest, ProgressRateLimitsReports) {
+  constexpr uint32_t RATE = 2;
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  ProgressReports progress(receiver);
+  receiver.SetProgressRate(RATE);
+  
+  std::atomic<int> chunks{0};
+  _hub.SetFilter([&](size_t, size_t, const Message& message) {
+    if (message.GetType() == MessageType::FILE_CHUNK) {
+      chunks++;
+    }
+    return true;
+  });
+  
+  fs::path source = WriteRandomFile("source.bin", 8 * 1024 * 1024 + 5);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  
+  // At most RATE reports a second, plus the one for the finished file
+  auto reports = progress.Reports();
+  ASSERT_FALSE(reports.empty());
+  EXPECT_LE(reports.size(), static_cast<size_t>(elapsed * RATE) + 1);
+  EXPECT_LT(reports.size(), static_cast<size_t>(chunks.load()));
+  for (size_t i = 1; i < reports.size(); ++i) {
+    EXPECT_GE(reports[i].bytes_transferred, reports[i - 1].bytes_transferred);
+  }
+}
+
+TEST_F(FileTransferTest, ProgressReportsFinishedFile) {
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  ProgressReports progress(receiver);
+  receiver.SetProgressRate(1);
+  
+  // Done well within the first second, so only the final report is due
+  fs::path source = WriteRandomFile("source.bin", 256 * 1024 + 3);
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  
+  auto reports = progress.Reports();
+  ASSERT_FALSE(reports.empty());
+  const TransferProgress& last = reports.back();
+  EXPECT_EQ(fs::file_size(source), last.total_bytes);
+  EXPECT_EQ(last.total_bytes, last.bytes_transferred);
+  EXPECT_DOUBLE_EQ(1.0, last.fraction);
+}
+
+TEST_F(FileTransferTest, ProgressRateZeroReportsEveryChunk) {
+  auto& sender = AddPeer();
+  auto& receiver = AddPeer();
+  Completions completions(receiver);
+  ProgressReports progress(receiver);
+  receiver.SetProgressRate(0);
+  
+  std::atomic<int> chunks{0};
+  _hub.SetFilter([&](size_t, size_t, const Message& message) {
+    if (message.GetType() == MessageType::FILE_CHUNK) {
+      chunks++;
+    }
+    return true;
+  });
+  
+  fs::path source = WriteRandomFile("source.bin", 2 * 1024 * 1024 + 11);
+  ASSERT_TRUE(sender.SendFile(LoopbackHub::IdOf(1), source.string()));
+  ASSERT_TRUE(completions.Wait(1));
+  
+  auto reports = progress.Reports();
+  ASSERT_GT(chunks.load(), 1);
+  EXPECT_EQ(static_cast<size_t>(chunks.load()), reports.size());
+  EXPECT_EQ(reports.back().total_bytes, reports.back().bytes_transferred);
+}
+
+}  // namespace test
+}  // namespace linknet
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include "linknet/key_arena.h"
+#include <set>
+
+namespace linknet {
+namespace test {
+
+TEST(KeyArenaTest, AllocatesEverySlotOnce) {
+  crypto::KeyArena arena(3);
+  EXPECT_EQ(3u, arena.GetCapacity());
+  
+  std::set<crypto::Key*> slots;
+  for (int i = 0; i < 3; ++i) {
+    crypto::Key* key = arena.Allocate();
+    ASSERT_NE(nullptr, key);
+    EXPECT_EQ(crypto::Key{}, *key);
+    key->fill(static_cast<uint8_t>(i + 1));
+    slots.insert(key);
+  }
+  EXPECT_EQ(3u, slots.size());
+  EXPECT_EQ(3u, arena.GetUsed());
+  EXPECT_EQ(nullptr, arena.Allocate());
+  
+  // A freed slot is wiped and handed out again
+  crypto::Key* freed = *slots.begin();
+  arena.Free(freed);
+  EXPECT_EQ(2u, arena.GetUsed());
+  crypto::Key* again = arena.Allocate();
+  EXPECT_EQ(freed, again);
+  EXPECT_EQ(crypto::Key{}, *again);
+  
+  arena.Free(nullptr);
+  EXPECT_EQ(3u, arena.GetUsed());
+  
+  crypto::Key outside;
+  EXPECT_TRUE(arena.Contains(again));
+  EXPECT_FALSE(arena.Contains(&outside));
+}
+
+TEST(KeyArenaTest, KeyStoreGrowsPastOneArena) {
+  crypto::KeyStore store;
+  std::set<crypto::Key*> keys;
+  for (int i = 0; i < 100; ++i) {
+    crypto::Key* key = store.Allocate();
+    ASSERT_NE(nullptr, key);
+    EXPECT_EQ(crypto::Key{}, *key);
+    key->fill(0xff);
+    keys.insert(key);
+  }
+  EXPECT_EQ(100u, keys.size());
+  
+  // Freed keys are wiped wherever they live
+  for (crypto::Key* key : keys) {
+    store.Free(key);
+  }
+  crypto::Key* again = store.Allocate();
+  EXPECT_EQ(1u, keys.count(again));
+  EXPECT_EQ(crypto::Key{}, *again);
+  store.Free(again);
+}
+
+}  // namespace test
+}  // namespace linknet
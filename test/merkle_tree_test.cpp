@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "linknet/merkle_tree.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+namespace linknet {
+namespace test {
+
+TEST(MerkleTreeTest, RootDependsOnEveryLeaf) {
+  std::vector<crypto::Digest> leaves;
+  for (uint8_t i = 0; i < 5; ++i) {
+    uint8_t data[4] = {i, i, i, i};
+    leaves.push_back(crypto::MerkleTree::HashLeaf(data, sizeof(data)));
+  }
+  
+  crypto::MerkleTree tree(leaves);
+  EXPECT_EQ(5u, tree.LeafCount());
+  EXPECT_EQ(tree.GetRoot(), crypto::MerkleTree::ComputeRoot(leaves));
+  
+  // Changing any single leaf, including the promoted odd one, changes the root
+  for (size_t i = 0; i < leaves.size(); ++i) {
+    auto modified = leaves;
+    modified[i][0] ^= 1;
+    EXPECT_NE(tree.GetRoot(), crypto::MerkleTree::ComputeRoot(modified));
+  }
+  
+  // A single leaf is its own root
+  std::vector<crypto::Digest> single(1, leaves[0]);
+  EXPECT_EQ(leaves[0], crypto::MerkleTree::ComputeRoot(single));
+}
+
+TEST(MerkleTreeTest, BuildFromFile) {
+  const size_t chunk_size = 1000;
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "linknet_merkle_test.bin";
+  
+  ByteBuffer contents(100 * chunk_size + 123);
+  std::generate(contents.begin(), contents.end(), []() { return rand() % 256; });
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+  }
+  
+  std::vector<crypto::Digest> expected;
+  for (size_t offset = 0; offset < contents.size(); offset += chunk_size) {
+    size_t length = std::min(chunk_size, contents.size() - offset);
+    expected.push_back(crypto::MerkleTree::HashLeaf(contents.data() + offset, length));
+  }
+  
+  // The result doesn't depend on how the work is split
+  for (unsigned int threads : {1u, 3u, 8u}) {
+    crypto::MerkleTree tree;
+    ASSERT_TRUE(crypto::MerkleTree::BuildFromFile(path.string(), chunk_size, tree, threads));
+    EXPECT_EQ(expected, tree.GetLeaves());
+    EXPECT_EQ(crypto::MerkleTree::ComputeRoot(expected), tree.GetRoot());
+  }
+  
+  std::filesystem::remove(path);
+  
+  crypto::MerkleTree missing;
+  EXPECT_FALSE(crypto::MerkleTree::BuildFromFile(path.string(), chunk_size, missing));
+}
+
+}  // namespace test
+}  // namespace linknet
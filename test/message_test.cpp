@@ -43,9 +43,10 @@ TEST(MessageTest, FileTransferRequestMessageSerialization) {
   std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
   
   // Create a file transfer request message
+  TransferId transfer_id = 0x0123456789ABCDEFULL;
   std::string filename = "test.txt";
   uint64_t file_size = 12345;
-  FileTransferRequestMessage original(sender_id, filename, file_size);
+  FileTransferRequestMessage original(sender_id, transfer_id, filename, file_size);
   
   // Serialize the message
   ByteBuffer serialized = original.Serialize();
@@ -57,7 +58,8 @@ TEST(MessageTest, FileTransferRequestMessageSerialization) {
   // Verify deserialization was successful
   EXPECT_TRUE(result);
   
-  // Verify the filename matches
+  // Verify the transfer ID and filename match
+  EXPECT_EQ(transfer_id, deserialized.GetTransferId());
   EXPECT_EQ(filename, deserialized.GetFilename());
   
   // Verify the file size matches
@@ -71,6 +73,34 @@ TEST(MessageTest, FileTransferRequestMessageSerialization) {
   
   // Verify the timestamp matches
   EXPECT_EQ(original.GetTimestamp(), deserialized.GetTimestamp());
+  
+  // No content hash was given
+  EXPECT_TRUE(deserialized.GetContentHash().empty());
+  
+  // The content hash round-trips when present
+  ByteBuffer content_hash(32, 0xAB);
+  FileTransferRequestMessage hashed(sender_id, transfer_id, filename, file_size, content_hash);
+  FileTransferRequestMessage hashed_copy(sender_id);
+  ASSERT_TRUE(hashed_copy.Deserialize(hashed.Serialize()));
+  EXPECT_EQ(content_hash, hashed_copy.GetContentHash());
+  EXPECT_EQ(0, hashed_copy.GetCompressionTypes());
+  
+  // So do the offered compression codecs
+  FileTransferRequestMessage compressed(sender_id, transfer_id, filename, file_size, content_hash,
+                                        0x06);
+  FileTransferRequestMessage compressed_copy(sender_id);
+  ASSERT_TRUE(compressed_copy.Deserialize(compressed.Serialize()));
+  EXPECT_EQ(0x06, compressed_copy.GetCompressionTypes());
+  EXPECT_TRUE(compressed_copy.GetStreamKey().empty());
+  
+  // And the public key offering a sealed stream
+  ByteBuffer stream_key(32, 0x5A);
+  FileTransferRequestMessage sealed(sender_id, transfer_id, filename, file_size, content_hash,
+                                    0x06, stream_key);
+  FileTransferRequestMessage sealed_copy(sender_id);
+  ASSERT_TRUE(sealed_copy.Deserialize(sealed.Serialize()));
+  EXPECT_EQ(0x06, sealed_copy.GetCompressionTypes());
+  EXPECT_EQ(stream_key, sealed_copy.GetStreamKey());
 }
 
 TEST(MessageTest, MessageFactory) {
@@ -103,5 +133,361 @@ TEST(MessageTest, MessageFactory) {
   EXPECT_EQ(content, chat_msg->GetContent());
 }
 
+TEST(MessageTest, FileTransferResponseMessageSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  // Create a response asking only for the chunks still missing
+  std::vector<ChunkRange> missing = {{0, 4}, {100, 1}, {4000000, 250}};
+  FileTransferResponseMessage original(sender_id, 7, true, missing);
+  
+  // Round trip through the message factory
+  ByteBuffer serialized = original.Serialize();
+  auto deserialized = MessageFactory::CreateFromBuffer(serialized);
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto response = dynamic_cast<FileTransferResponseMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, response);
+  EXPECT_EQ(7u, response->GetTransferId());
+  EXPECT_TRUE(response->IsAccepted());
+  ASSERT_EQ(missing.size(), response->GetMissingRanges().size());
+  for (size_t i = 0; i < missing.size(); ++i) {
+    EXPECT_EQ(missing[i].first, response->GetMissingRanges()[i].first);
+    EXPECT_EQ(missing[i].count, response->GetMissingRanges()[i].count);
+  }
+  EXPECT_FALSE(response->IsManifestRequested());
+  EXPECT_EQ(CompressionType::NONE, response->GetCompression());
+  EXPECT_FALSE(response->IsCached());
+  EXPECT_FALSE(response->IsSparse());
+  
+  // The agreed codec sits after the manifest flag
+  FileTransferResponseMessage compressed(sender_id, 7, true, missing, true, CompressionType::ZLIB);
+  FileTransferResponseMessage compressed_copy(sender_id);
+  ASSERT_TRUE(compressed_copy.Deserialize(compressed.Serialize()));
+  EXPECT_TRUE(compressed_copy.IsManifestRequested());
+  EXPECT_EQ(CompressionType::ZLIB, compressed_copy.GetCompression());
+  
+  // And the cached flag after the codec
+  FileTransferResponseMessage cached(sender_id, 7, true, {}, false, CompressionType::NONE, true);
+  FileTransferResponseMessage cached_copy(sender_id);
+  ASSERT_TRUE(cached_copy.Deserialize(cached.Serialize()));
+  EXPECT_TRUE(cached_copy.IsCached());
+  EXPECT_TRUE(cached_copy.GetMissingRanges().empty());
+  
+  // Then the sparse flag
+  FileTransferResponseMessage sparse(sender_id, 7, true, missing, false, CompressionType::NONE,
+                                     false, true);
+  FileTransferResponseMessage sparse_copy(sender_id);
+  ASSERT_TRUE(sparse_copy.Deserialize(sparse.Serialize()));
+  EXPECT_TRUE(sparse_copy.IsSparse());
+  EXPECT_FALSE(sparse_copy.IsCached());
+  EXPECT_TRUE(sparse_copy.GetStreamKey().empty());
+  
+  // And last the stream key
+  ByteBuffer stream_key(32, 0xC3);
+  FileTransferResponseMessage sealed(sender_id, 7, true, missing, false, CompressionType::NONE,
+                                     false, true, stream_key);
+  FileTransferResponseMessage sealed_copy(sender_id);
+  ASSERT_TRUE(sealed_copy.Deserialize(sealed.Serialize()));
+  EXPECT_TRUE(sealed_copy.IsSparse());
+  EXPECT_EQ(stream_key, sealed_copy.GetStreamKey());
+  
+  // A truncated range list is rejected
+  serialized.resize(serialized.size() - 5);
+  FileTransferResponseMessage truncated(sender_id);
+  EXPECT_FALSE(truncated.Deserialize(serialized));
+}
+
+TEST(MessageTest, FileChunkMessageSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  ByteBuffer data(1000);
+  std::generate(data.begin(), data.end(), []() { return rand() % 256; });
+  FileChunkMessage original(sender_id, ~TransferId{0}, 42, data);
+  
+  auto deserialized = MessageFactory::CreateFromBuffer(original.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto chunk = dynamic_cast<FileChunkMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, chunk);
+  EXPECT_EQ(~TransferId{0}, chunk->GetTransferId());
+  EXPECT_EQ(42u, chunk->GetChunkIndex());
+  EXPECT_EQ(data, chunk->GetData());
+  EXPECT_EQ(CompressionType::NONE, chunk->GetCompression());
+  
+  // Each chunk carries its own codec
+  FileChunkMessage compressed(sender_id, 9, 3, data, CompressionType::ZLIB);
+  FileChunkMessage compressed_copy(sender_id);
+  ASSERT_TRUE(compressed_copy.Deserialize(compressed.Serialize()));
+  EXPECT_EQ(data, compressed_copy.GetData());
+  EXPECT_EQ(CompressionType::ZLIB, compressed_copy.GetCompression());
+  EXPECT_FALSE(compressed_copy.IsSealed());
+  
+  // Sealed chunks are numbered within their stream
+  FileChunkMessage sealed(sender_id, 9, 3, data, CompressionType::LZ4, true, 70000);
+  FileChunkMessage sealed_copy(sender_id);
+  ASSERT_TRUE(sealed_copy.Deserialize(sealed.Serialize()));
+  EXPECT_EQ(data, sealed_copy.GetData());
+  EXPECT_EQ(CompressionType::LZ4, sealed_copy.GetCompression());
+  EXPECT_TRUE(sealed_copy.IsSealed());
+  EXPECT_EQ(70000u, sealed_copy.GetStreamIndex());
+}
+
+TEST(MessageTest, FileChunkHashesMessageSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  ByteBuffer hashes(3 * 32);
+  std::generate(hashes.begin(), hashes.end(), []() { return rand() % 256; });
+  FileChunkHashesMessage original(sender_id, 99, 4096, hashes);
+  
+  auto deserialized = MessageFactory::CreateFromBuffer(original.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto hashes_msg = dynamic_cast<FileChunkHashesMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, hashes_msg);
+  EXPECT_EQ(99u, hashes_msg->GetTransferId());
+  EXPECT_EQ(4096u, hashes_msg->GetFirstIndex());
+  EXPECT_EQ(hashes, hashes_msg->GetHashes());
+}
+
+TEST(MessageTest, FileChunkRequestMessageSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  FileChunkRequestMessage original(sender_id, 1ULL << 63, {{7, 1}, {100, 3}});
+  
+  auto deserialized = MessageFactory::CreateFromBuffer(original.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto request = dynamic_cast<FileChunkRequestMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, request);
+  EXPECT_EQ(1ULL << 63, request->GetTransferId());
+  ASSERT_EQ(2u, request->GetRanges().size());
+  EXPECT_EQ(7u, request->GetRanges()[0].first);
+  EXPECT_EQ(1u, request->GetRanges()[0].count);
+  EXPECT_EQ(100u, request->GetRanges()[1].first);
+  EXPECT_EQ(3u, request->GetRanges()[1].count);
+}
+
+TEST(MessageTest, FileHolesMessageSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  FileHolesMessage original(sender_id, 42, {{0, 64}, {1000, 250000}});
+  
+  auto deserialized = MessageFactory::CreateFromBuffer(original.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto holes = dynamic_cast<FileHolesMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, holes);
+  EXPECT_EQ(42u, holes->GetTransferId());
+  ASSERT_EQ(2u, holes->GetRanges().size());
+  EXPECT_EQ(0u, holes->GetRanges()[0].first);
+  EXPECT_EQ(64u, holes->GetRanges()[0].count);
+  EXPECT_EQ(1000u, holes->GetRanges()[1].first);
+  EXPECT_EQ(250000u, holes->GetRanges()[1].count);
+}
+
+TEST(MessageTest, ConnectionMessageKeyExchange) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  ConnectionMessage plain(sender_id, ConnectionStatus::CONNECTED);
+  auto deserialized = MessageFactory::CreateFromBuffer(plain.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  EXPECT_FALSE(static_cast<ConnectionMessage&>(*deserialized).HasKeyExchange());
+  
+  ByteBuffer public_key(ConnectionMessage::PUBLIC_KEY_SIZE);
+  std::generate(public_key.begin(), public_key.end(), []() { return rand() % 256; });
+  ConnectionMessage original(sender_id, ConnectionStatus::CONNECTED);
+  original.SetKeyExchange(public_key, 0x06);
+  
+  deserialized = MessageFactory::CreateFromBuffer(original.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  auto& conn_msg = static_cast<ConnectionMessage&>(*deserialized);
+  EXPECT_EQ(ConnectionStatus::CONNECTED, conn_msg.GetStatus());
+  ASSERT_TRUE(conn_msg.HasKeyExchange());
+  EXPECT_EQ(public_key, conn_msg.GetPublicKey());
+  EXPECT_EQ(0x06, conn_msg.GetCipherSuites());
+}
+
+TEST(MessageTest, ConnectionMessageResumption) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  // The dialer offers a ticket along with a key exchange
+  ByteBuffer public_key(ConnectionMessage::PUBLIC_KEY_SIZE, 5);
+  ByteBuffer salt(ConnectionMessage::RESUMPTION_SALT_SIZE, 6);
+  ByteBuffer ticket(117, 7);
+  ConnectionMessage offer(sender_id, ConnectionStatus::CONNECTED);
+  offer.SetKeyExchange(public_key, 0x06);
+  offer.SetResumption(salt, ticket);
+  
+  auto deserialized = MessageFactory::CreateFromBuffer(offer.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  auto& offered = static_cast<ConnectionMessage&>(*deserialized);
+  EXPECT_EQ(public_key, offered.GetPublicKey());
+  ASSERT_TRUE(offered.HasResumption());
+  EXPECT_EQ(salt, offered.GetResumptionSalt());
+  EXPECT_EQ(ticket, offered.GetTicket());
+  
+  // A peer that takes it answers with its salt, and no public key
+  ConnectionMessage answer(sender_id, ConnectionStatus::CONNECTED);
+  answer.SetKeyExchange({}, 0x02);
+  answer.SetResumption(salt);
+  deserialized = MessageFactory::CreateFromBuffer(answer.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  auto& answered = static_cast<ConnectionMessage&>(*deserialized);
+  EXPECT_FALSE(answered.HasKeyExchange());
+  EXPECT_EQ(0x02, answered.GetCipherSuites());
+  ASSERT_TRUE(answered.HasResumption());
+  EXPECT_TRUE(answered.GetTicket().empty());
+  
+  auto ticket_msg = MessageFactory::CreateFromBuffer(
+      SessionTicketMessage(sender_id, ticket).Serialize());
+  ASSERT_NE(nullptr, ticket_msg);
+  ASSERT_EQ(MessageType::SESSION_TICKET, ticket_msg->GetType());
+  EXPECT_EQ(ticket, static_cast<SessionTicketMessage&>(*ticket_msg).GetTicket());
+}
+
+TEST(MessageTest, DataConnectionMessageSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  ByteBuffer token(DataConnectionMessage::TOKEN_SIZE);
+  std::generate(token.begin(), token.end(), []() { return rand() % 256; });
+  DataConnectionMessage original(sender_id, token);
+  
+  ByteBuffer serialized = original.Serialize();
+  auto deserialized = MessageFactory::CreateFromBuffer(serialized);
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto data_connection = dynamic_cast<DataConnectionMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, data_connection);
+  EXPECT_EQ(token, data_connection->GetToken());
+  EXPECT_TRUE(data_connection->GetSalt().empty());
+  
+  ByteBuffer salt(32, 9);
+  auto salted = MessageFactory::CreateFromBuffer(
+      DataConnectionMessage(sender_id, token, salt).Serialize());
+  ASSERT_NE(nullptr, salted);
+  EXPECT_EQ(salt, static_cast<DataConnectionMessage&>(*salted).GetSalt());
+  
+  serialized.pop_back();
+  EXPECT_EQ(nullptr, MessageFactory::CreateFromBuffer(serialized));
+}
+
+TEST(MessageTest, FileDeltaManifestMessageSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  std::vector<uint32_t> lengths = {8192, 2048, 65536};
+  ByteBuffer hashes(lengths.size() * 32);
+  std::generate(hashes.begin(), hashes.end(), []() { return rand() % 256; });
+  FileDeltaManifestMessage original(sender_id, 12, 2048, lengths, hashes);
+  
+  auto deserialized = MessageFactory::CreateFromBuffer(original.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto manifest = dynamic_cast<FileDeltaManifestMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, manifest);
+  EXPECT_EQ(12u, manifest->GetTransferId());
+  EXPECT_EQ(2048u, manifest->GetFirstIndex());
+  EXPECT_EQ(lengths, manifest->GetChunkLengths());
+  EXPECT_EQ(hashes, manifest->GetChunkHashes());
+  
+  // A response can ask for the manifest instead of listing missing ranges
+  FileTransferResponseMessage response(sender_id, 12, true, {}, true);
+  FileTransferResponseMessage response_copy(sender_id);
+  ASSERT_TRUE(response_copy.Deserialize(response.Serialize()));
+  EXPECT_TRUE(response_copy.IsManifestRequested());
+  EXPECT_TRUE(response_copy.GetMissingRanges().empty());
+}
+
+TEST(MessageTest, FileSwarmMessagesSerialization) {
+  // Create a random PeerId
+  PeerId sender_id;
+  std::generate(sender_id.begin(), sender_id.end(), []() { return rand() % 256; });
+  
+  ByteBuffer content_hash(32);
+  std::generate(content_hash.begin(), content_hash.end(), []() { return rand() % 256; });
+  
+  FileSwarmQueryMessage query(sender_id, 0xFEEDULL, content_hash, true, 70000);
+  auto deserialized = MessageFactory::CreateFromBuffer(query.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto query_copy = dynamic_cast<FileSwarmQueryMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, query_copy);
+  EXPECT_EQ(0xFEEDULL, query_copy->GetTransferId());
+  EXPECT_EQ(content_hash, query_copy->GetContentHash());
+  EXPECT_TRUE(query_copy->IsSendHashes());
+  EXPECT_EQ(70000u, query_copy->GetFirstHash());
+  
+  FileSwarmHaveMessage have(sender_id, 0xFEEDULL, content_hash, 1ULL << 40);
+  deserialized = MessageFactory::CreateFromBuffer(have.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto have_copy = dynamic_cast<FileSwarmHaveMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, have_copy);
+  EXPECT_EQ(0xFEEDULL, have_copy->GetTransferId());
+  EXPECT_EQ(content_hash, have_copy->GetContentHash());
+  EXPECT_EQ(1ULL << 40, have_copy->GetFileSize());
+}
+
+TEST(MessageTest, FileDirectoryManifestMessageSerialization) {
+  PeerId sender_id;
+  std::fill(sender_id.begin(), sender_id.end(), 0x0C);
+  
+  std::vector<DirectoryEntry> entries(3);
+  entries[0].path = "docs";
+  entries[0].mode = 0755;
+  entries[0].is_directory = true;
+  entries[1].path = "docs/notes.txt";
+  entries[1].size = 1234;
+  entries[1].mode = 0640;
+  entries[1].mtime_ns = -1;
+  entries[1].packed = true;
+  entries[2].path = "video.mkv";
+  entries[2].size = 1ULL << 33;
+  entries[2].mode = 0600;
+  entries[2].mtime_ns = 1700000000123456789LL;
+  
+  FileDirectoryManifestMessage original(sender_id, "photos", 2048, entries, true);
+  auto deserialized = MessageFactory::CreateFromBuffer(original.Serialize());
+  ASSERT_NE(nullptr, deserialized);
+  
+  auto copy = dynamic_cast<FileDirectoryManifestMessage*>(deserialized.get());
+  ASSERT_NE(nullptr, copy);
+  EXPECT_EQ("photos", copy->GetDirectoryName());
+  EXPECT_EQ(2048u, copy->GetFirstIndex());
+  EXPECT_TRUE(copy->IsLast());
+  ASSERT_EQ(entries.size(), copy->GetEntries().size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const DirectoryEntry& entry = copy->GetEntries()[i];
+    EXPECT_EQ(entries[i].path, entry.path);
+    EXPECT_EQ(entries[i].size, entry.size);
+    EXPECT_EQ(entries[i].mode, entry.mode);
+    EXPECT_EQ(entries[i].mtime_ns, entry.mtime_ns);
+    EXPECT_EQ(entries[i].is_directory, entry.is_directory);
+    EXPECT_EQ(entries[i].packed, entry.packed);
+  }
+  
+  // A truncated entry list is rejected
+  ByteBuffer data = original.Serialize();
+  data.resize(data.size() - 5);
+  EXPECT_EQ(nullptr, MessageFactory::CreateFromBuffer(data));
+}
+
 }  // namespace test
 }  // namespace linknet
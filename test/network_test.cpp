@@ -0,0 +1,371 @@
+#include <gtest/gtest.h>
+#include "linknet/crypto.h"
+#include "linknet/message.h"
+#include "linknet/network.h"
+#include "linknet/types.h"
+#include <boost/asio.hpp>
+#include <endian.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace linknet {
+namespace test {
+
+namespace {
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+// Forwards every connection made to its own port on to a target port,
+// keeping a copy of what went through in either direction
+class RecordingProxy {
+ public:
+  struct Connection {
+    std::string sent;      // Dialer to target
+    std::string answered;  // Target to dialer
+  };
+  
+  explicit RecordingProxy(uint16_t target)
+      : _acceptor(_io_context, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0)),
+        _target(asio::ip::make_address("127.0.0.1"), target) {
+    Accept();
+    _thread = std::thread([this] { _io_context.run(); });
+  }
+  
+  ~RecordingProxy() {
+    _io_context.stop();
+    _thread.join();
+  }
+  
+  uint16_t GetPort() const {
+    return _acceptor.local_endpoint().port();
+  }
+  
+  // Connections in the order they were accepted
+  std::vector<Connection> GetConnections() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Connection> connections;
+    for (const auto& connection : _connections) {
+      connections.push_back(*connection);
+    }
+    return connections;
+  }
+ 
+ private:
+  void Accept() {
+    _acceptor.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+      if (ec) {
+        return;
+      }
+      
+      auto in = std::make_shared<tcp::socket>(std::move(socket));
+      auto out = std::make_shared<tcp::socket>(_io_context);
+      auto connection = std::make_shared<Connection>();
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _connections.push_back(connection);
+      }
+      out->async_connect(_target, [this, in, out, connection](
+                                      const boost::system::error_code& connect_ec) {
+        if (connect_ec) {
+          return;
+        }
+        Pump(in, out, connection, &Connection::sent);
+        Pump(out, in, connection, &Connection::answered);
+      });
+      Accept();
+    });
+  }
+  
+  void Pump(std::shared_ptr<tcp::socket> from, std::shared_ptr<tcp::socket> to,
+            std::shared_ptr<Connection> connection, std::string Connection::*record) {
+    auto buffer = std::make_shared<std::array<char, 65536>>();
+    from->async_read_some(asio::buffer(*buffer), [=](const boost::system::error_code& ec,
+                                                    size_t size) {
+      boost::system::error_code close_ec;
+      if (ec) {
+        to->shutdown(tcp::socket::shutdown_send, close_ec);
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ((*connection).*record).append(buffer->data(), size);
+      }
+      asio::async_write(*to, asio::buffer(buffer->data(), size),
+                        [=](const boost::system::error_code& write_ec, size_t) {
+                          if (!write_ec) {
+                            Pump(from, to, connection, record);
+                          }
+                        });
+    });
+  }
+  
+  asio::io_context _io_context;
+  tcp::acceptor _acceptor;
+  tcp::endpoint _target;
+  std::thread _thread;
+  mutable std::mutex _mutex;
+  std::vector<std::shared_ptr<Connection>> _connections;
+};
+
+template <typename Predicate>
+bool WaitFor(Predicate predicate) {
+  for (int i = 0; i < 500; ++i) {
+    if (predicate()) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return predicate();
+}
+
+// The first message framed in a recorded stream, if it is a connection
+// notification
+std::unique_ptr<ConnectionMessage> FirstConnectionMessage(const std::string& stream) {
+  if (stream.size() < 4) {
+    return nullptr;
+  }
+  uint32_t size_network;
+  std::memcpy(&size_network, stream.data(), 4);
+  size_t size = be32toh(size_network);
+  if (stream.size() < 4 + size) {
+    return nullptr;
+  }
+  
+  auto message = MessageFactory::CreateFromBuffer(
+      ByteBuffer(stream.begin() + 4, stream.begin() + 4 + size));
+  if (!message || message->GetType() != MessageType::CONNECTION_NOTIFICATION) {
+    return nullptr;
+  }
+  return std::unique_ptr<ConnectionMessage>(static_cast<ConnectionMessage*>(message.release()));
+}
+
+}  // namespace
+
+TEST(NetworkTest, StripesChunksAcrossEncryptedDataConnections) {
+  constexpr size_t DATA_CONNECTIONS = 3;
+  constexpr uint32_t CHUNKS = 64;
+  constexpr uint32_t CHATS = 8;
+  
+  auto receiver = NetworkFactory::Create();
+  auto sender = NetworkFactory::Create();
+  receiver->SetCryptoProvider(crypto::CryptoFactory::Create());
+  sender->SetCryptoProvider(crypto::CryptoFactory::Create());
+  sender->SetDataConnections(DATA_CONNECTIONS);
+  
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::map<uint32_t, std::vector<ByteBuffer>> chunks;
+  std::vector<std::string> chats;
+  receiver->SetMessageCallback([&](std::unique_ptr<Message> message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (message->GetType() == MessageType::FILE_CHUNK) {
+      const auto& chunk = static_cast<const FileChunkMessage&>(*message);
+      chunks[chunk.GetChunkIndex()].push_back(chunk.GetData());
+    } else if (message->GetType() == MessageType::CHAT_MESSAGE) {
+      chats.push_back(static_cast<const ChatMessage&>(*message).GetContent());
+    }
+    cv.notify_all();
+  });
+  
+  ASSERT_TRUE(receiver->Start(0));
+  ASSERT_TRUE(sender->Start(0));
+  RecordingProxy proxy(receiver->GetLocalPort());
+  ASSERT_TRUE(sender->ConnectToPeer("127.0.0.1", proxy.GetPort()));
+  
+  // Each encrypted data connection is attached once the receiver has
+  // answered its join with a salt
+  ASSERT_TRUE(WaitFor([&] {
+    auto connections = proxy.GetConnections();
+    return connections.size() == 1 + DATA_CONNECTIONS &&
+           std::all_of(connections.begin(), connections.end(),
+                       [](const auto& connection) { return !connection.answered.empty(); });
+  }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  
+  auto peers = sender->GetConnectedPeers();
+  ASSERT_EQ(1u, peers.size());
+  PeerId sender_id{};
+  
+  std::mt19937 random(7);
+  std::vector<ByteBuffer> sent(CHUNKS);
+  for (uint32_t i = 0; i < CHUNKS; ++i) {
+    sent[i].resize(64 * 1024);
+    for (auto& byte : sent[i]) {
+      byte = static_cast<uint8_t>(random());
+    }
+    ASSERT_TRUE(sender->SendMessage(peers[0].id, FileChunkMessage(sender_id, 1, i, sent[i])));
+    if (i % (CHUNKS / CHATS) == 0) {
+      ChatMessage chat(sender_id, std::to_string(i / (CHUNKS / CHATS)));
+      ASSERT_TRUE(sender->SendMessage(peers[0].id, chat));
+    }
+  }
+  
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(10), [&] {
+      return chunks.size() == CHUNKS && chats.size() == CHATS;
+    }));
+    
+    // Every chunk arrives once and intact, whichever connection carried it,
+    // and the session's own messages stay in order
+    for (uint32_t i = 0; i < CHUNKS; ++i) {
+      ASSERT_EQ(1u, chunks[i].size());
+      EXPECT_EQ(sent[i], chunks[i][0]);
+    }
+    for (uint32_t i = 0; i < CHATS; ++i) {
+      EXPECT_EQ(std::to_string(i), chats[i]);
+    }
+  }
+  
+  // Chunks were spread over the data connections, none of them in the clear
+  auto connections = proxy.GetConnections();
+  ASSERT_EQ(1 + DATA_CONNECTIONS, connections.size());
+  std::string plain(sent[0].begin(), sent[0].begin() + 64);
+  size_t striped = 0;
+  for (size_t i = 0; i < connections.size(); ++i) {
+    EXPECT_EQ(std::string::npos, connections[i].sent.find(plain));
+    if (i > 0 && connections[i].sent.size() > sent[0].size()) {
+      striped++;
+    }
+  }
+  EXPECT_GE(striped, 2u);
+  
+  // Replaying a recorded join straight to the receiver gets no answer
+  const std::string& join = connections[1].sent;
+  ASSERT_GE(join.size(), 4u);
+  uint32_t size_network;
+  std::memcpy(&size_network, join.data(), 4);
+  size_t frame_size = 4 + be32toh(size_network);
+  ASSERT_GE(join.size(), frame_size);
+  
+  asio::io_context io_context;
+  tcp::socket replay(io_context);
+  replay.connect(tcp::endpoint(asio::ip::make_address("127.0.0.1"), receiver->GetLocalPort()));
+  asio::write(replay, asio::buffer(join.data(), frame_size));
+  char byte;
+  boost::system::error_code ec;
+  replay.read_some(asio::buffer(&byte, 1), ec);
+  EXPECT_EQ(asio::error::eof, ec);
+  EXPECT_EQ(1u, receiver->GetConnectedPeers().size());
+  
+  sender->Stop();
+  receiver->Stop();
+}
+
+TEST(NetworkTest, DialerResumesSessionWithTicket) {
+  auto receiver = NetworkFactory::Create();
+  auto dialer = NetworkFactory::Create();
+  receiver->SetCryptoProvider(crypto::CryptoFactory::Create());
+  dialer->SetCryptoProvider(crypto::CryptoFactory::Create());
+  
+  std::atomic<int> chats{0};
+  receiver->SetMessageCallback([&](std::unique_ptr<Message> message) {
+    if (message->GetType() == MessageType::CHAT_MESSAGE) {
+      chats++;
+    }
+  });
+  
+  ASSERT_TRUE(receiver->Start(0));
+  ASSERT_TRUE(dialer->Start(0));
+  RecordingProxy proxy(receiver->GetLocalPort());
+  
+  // Connect through the proxy, leaving time for the ticket to arrive, and
+  // return the answer to the connection notification
+  auto connect = [&]() -> std::unique_ptr<ConnectionMessage> {
+    size_t before = proxy.GetConnections().size();
+    if (!dialer->ConnectToPeer("127.0.0.1", proxy.GetPort()) ||
+        !WaitFor([&] {
+          return receiver->GetConnectedPeers().size() == 1 &&
+                 dialer->GetConnectedPeers().size() == 1;
+        })) {
+      return nullptr;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return FirstConnectionMessage(proxy.GetConnections().at(before).answered);
+  };
+  auto disconnect = [&] {
+    dialer->DisconnectFromPeer(dialer->GetConnectedPeers().at(0).id);
+    return WaitFor([&] { return receiver->GetConnectedPeers().empty(); });
+  };
+  
+  auto first = connect();
+  ASSERT_TRUE(first);
+  EXPECT_TRUE(first->HasKeyExchange());
+  EXPECT_FALSE(first->HasResumption());
+  PeerId dialer_id = receiver->GetConnectedPeers()[0].id;
+  ASSERT_TRUE(disconnect());
+  
+  // The ticket brings the session back under the same ID, and the answer
+  // carries only the receiver's half of the salt
+  auto resumed = connect();
+  ASSERT_TRUE(resumed);
+  EXPECT_TRUE(resumed->HasResumption());
+  EXPECT_FALSE(resumed->HasKeyExchange());
+  EXPECT_EQ(dialer_id, receiver->GetConnectedPeers()[0].id);
+  ASSERT_TRUE(disconnect());
+  
+  // With its ticket keys replaced the receiver refuses the ticket and
+  // answers the key exchange sent along with it
+  receiver->SetCryptoProvider(crypto::CryptoFactory::Create());
+  auto refused = connect();
+  ASSERT_TRUE(refused);
+  EXPECT_FALSE(refused->HasResumption());
+  EXPECT_TRUE(refused->HasKeyExchange());
+  EXPECT_NE(dialer_id, receiver->GetConnectedPeers()[0].id);
+  
+  // Messages get through over the new session
+  ASSERT_TRUE(dialer->SendMessage(dialer->GetConnectedPeers()[0].id,
+                                  ChatMessage(PeerId{}, "after fallback")));
+  EXPECT_TRUE(WaitFor([&] { return chats.load() == 1; }));
+  
+  dialer->Stop();
+  receiver->Stop();
+}
+
+TEST(NetworkTest, EncryptingSideRefusesPeerWithoutKey) {
+  // A peer without a crypto provider offers no key, as would a handshake
+  // an attacker stripped the key from
+  auto encrypting = NetworkFactory::Create();
+  auto plain = NetworkFactory::Create();
+  encrypting->SetCryptoProvider(crypto::CryptoFactory::Create());
+  ASSERT_TRUE(encrypting->Start(0));
+  ASSERT_TRUE(plain->Start(0));
+  
+  std::atomic<int> connected{0};
+  auto count = [&](const PeerId&, ConnectionStatus status) {
+    if (status == ConnectionStatus::CONNECTED) {
+      connected++;
+    }
+  };
+  encrypting->SetConnectionCallback(count);
+  
+  // Dialed by the peer without a key
+  ASSERT_TRUE(plain->ConnectToPeer("127.0.0.1", encrypting->GetLocalPort()));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  EXPECT_TRUE(encrypting->GetConnectedPeers().empty());
+  EXPECT_TRUE(plain->GetConnectedPeers().empty());
+  
+  // Dialing a peer that answers without a key
+  ASSERT_TRUE(encrypting->ConnectToPeer("127.0.0.1", plain->GetLocalPort()));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  EXPECT_TRUE(encrypting->GetConnectedPeers().empty());
+  EXPECT_TRUE(WaitFor([&] { return plain->GetConnectedPeers().empty(); }));
+  EXPECT_EQ(0, connected.load());
+  
+  plain->Stop();
+  encrypting->Stop();
+}
+
+}  // namespace test
+}  // namespace linknet
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include "linknet/nonce_sequence.h"
+#include <limits>
+#include <set>
+#include <vector>
+
+namespace linknet {
+namespace test {
+
+TEST(NonceSequenceTest, CountsFromRandomPrefix) {
+  crypto::NonceSequence first;
+  crypto::NonceSequence second;
+  std::set<crypto::Nonce> nonces;
+  crypto::Nonce nonce;
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(first.Next(nonce));
+    nonces.insert(nonce);
+    ASSERT_TRUE(second.Next(nonce));
+    nonces.insert(nonce);
+  }
+  EXPECT_EQ(200u, nonces.size());
+  EXPECT_EQ(100u, first.GetCount());
+  
+  // The last counter value is used once, then the key must change
+  crypto::NonceSequence ending(std::numeric_limits<uint64_t>::max() - 1);
+  EXPECT_TRUE(ending.Next(nonce));
+  EXPECT_TRUE(ending.Next(nonce));
+  EXPECT_FALSE(ending.Next(nonce));
+  ending.Reset();
+  EXPECT_TRUE(ending.Next(nonce));
+  EXPECT_EQ(1u, ending.GetCount());
+}
+
+TEST(NonceSequenceTest, ReplayWindowRefusesRepeats) {
+  crypto::NonceSequence sequence;
+  std::vector<crypto::Nonce> sent(crypto::ReplayWindow::WINDOW_SIZE + 10);
+  for (auto& nonce : sent) {
+    ASSERT_TRUE(sequence.Next(nonce));
+  }
+  
+  crypto::ReplayWindow window;
+  EXPECT_TRUE(window.Accept(sent[5]));
+  EXPECT_FALSE(window.Accept(sent[5]));
+  
+  // Out of order within the window
+  EXPECT_TRUE(window.Accept(sent[2]));
+  EXPECT_TRUE(window.Accept(sent[9]));
+  EXPECT_TRUE(window.Check(sent[7]));
+  EXPECT_FALSE(window.Check(sent[2]));
+  
+  // Checking doesn't record
+  EXPECT_TRUE(window.Accept(sent[7]));
+  
+  // Too far behind the newest
+  EXPECT_TRUE(window.Accept(sent.back()));
+  EXPECT_FALSE(window.Check(sent[8]));
+  EXPECT_TRUE(window.Check(sent[sent.size() - 2]));
+  
+  // Another sequence's nonces are refused until a reset
+  crypto::NonceSequence other;
+  crypto::Nonce nonce;
+  other.Next(nonce);
+  EXPECT_FALSE(window.Accept(nonce));
+  window.Reset();
+  EXPECT_TRUE(window.Accept(nonce));
+}
+
+}  // namespace test
+}  // namespace linknet
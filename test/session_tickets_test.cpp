@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include "linknet/session_tickets.h"
+
+namespace linknet {
+namespace test {
+
+namespace {
+
+crypto::SessionTicket MakeTicket(const crypto::CryptoProvider& crypto) {
+  crypto::SessionTicket ticket;
+  ticket.peer_id.fill(3);
+  ticket.suite = crypto::CipherSuite::XCHACHA20_POLY1305;
+  ticket.secret = crypto.GenerateKey();
+  return ticket;
+}
+
+}  // namespace
+
+TEST(SessionTicketsTest, RedeemsOnce) {
+  auto crypto = crypto::CryptoFactory::Create();
+  crypto::SessionTicketKeys keys(*crypto);
+  crypto::SessionTicket original = MakeTicket(*crypto);
+  
+  ByteBuffer issued = keys.Issue(original);
+  ASSERT_EQ(crypto::SessionTicketKeys::TICKET_SIZE, issued.size());
+  
+  crypto::SessionTicket redeemed;
+  ASSERT_TRUE(keys.Redeem(issued, redeemed));
+  EXPECT_EQ(original.peer_id, redeemed.peer_id);
+  EXPECT_EQ(original.suite, redeemed.suite);
+  EXPECT_EQ(original.secret, redeemed.secret);
+  EXPECT_FALSE(keys.Redeem(issued, redeemed));
+  
+  // An altered ticket, or one from another host, doesn't redeem
+  ByteBuffer altered = keys.Issue(original);
+  altered.back() ^= 1;
+  EXPECT_FALSE(keys.Redeem(altered, redeemed));
+  crypto::SessionTicketKeys other_keys(*crypto);
+  EXPECT_FALSE(other_keys.Redeem(keys.Issue(original), redeemed));
+  EXPECT_FALSE(keys.Redeem(ByteBuffer(10), redeemed));
+}
+
+TEST(SessionTicketsTest, OutlivesOneRotation) {
+  auto crypto = crypto::CryptoFactory::Create();
+  crypto::SessionTicketKeys keys(*crypto);
+  crypto::SessionTicket original = MakeTicket(*crypto);
+  
+  ByteBuffer first = keys.Issue(original);
+  ByteBuffer second = keys.Issue(original);
+  keys.Rotate();
+  
+  crypto::SessionTicket redeemed;
+  EXPECT_TRUE(keys.Redeem(first, redeemed));
+  keys.Rotate();
+  EXPECT_FALSE(keys.Redeem(second, redeemed));
+  EXPECT_TRUE(keys.Redeem(keys.Issue(original), redeemed));
+}
+
+}  // namespace test
+}  // namespace linknet
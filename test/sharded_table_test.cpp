@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "linknet/sharded_table.h"
+#include <algorithm>
+#include <thread>
+
+namespace linknet {
+namespace test {
+
+TEST(ShardedTableTest, InsertFindErase) {
+  ShardedTable<int> table;
+  auto value = std::make_shared<int>(1);
+  
+  EXPECT_EQ(nullptr, table.Find(42));
+  EXPECT_TRUE(table.Insert(42, value));
+  EXPECT_EQ(value, table.Find(42));
+  
+  // An ID can only be taken once
+  EXPECT_FALSE(table.Insert(42, std::make_shared<int>(2)));
+  EXPECT_EQ(1, *table.Find(42));
+  
+  // Erasing through a stale pointer leaves the current value alone
+  int other = 3;
+  table.Erase(42, &other);
+  EXPECT_EQ(value, table.Find(42));
+  
+  table.Erase(42, value.get());
+  EXPECT_EQ(nullptr, table.Find(42));
+  
+  // The value outlives its entry while a pointer is held
+  EXPECT_EQ(1, *value);
+}
+
+TEST(ShardedTableTest, ConcurrentInsertsAndSnapshot) {
+  ShardedTable<uint64_t> table;
+  const uint64_t per_thread = 1000;
+  
+  std::vector<std::thread> threads;
+  for (uint64_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&table, t, per_thread] {
+      for (uint64_t i = 0; i < per_thread; ++i) {
+        uint64_t id = t * per_thread + i;
+        table.Insert(id, std::make_shared<uint64_t>(id));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  
+  auto values = table.Snapshot();
+  ASSERT_EQ(4 * per_thread, values.size());
+  
+  std::vector<uint64_t> ids;
+  for (const auto& value : values) {
+    ids.push_back(*value);
+  }
+  std::sort(ids.begin(), ids.end());
+  for (uint64_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(i, ids[i]);
+  }
+}
+
+}  // namespace test
+}  // namespace linknet
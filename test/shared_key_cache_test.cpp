@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "linknet/shared_key_cache.h"
+#include <stdexcept>
+#include <vector>
+
+namespace linknet {
+namespace test {
+
+TEST(SharedKeyCacheTest, MatchesUncachedEncryption) {
+  auto crypto = crypto::CryptoFactory::Create();
+  crypto::KeyPair local_keys = crypto->GenerateKeyPair();
+  crypto::KeyPair peer_keys = crypto->GenerateKeyPair();
+  crypto::SharedKeyCache cache(*crypto, local_keys.private_key);
+  ByteBuffer message = {'h', 'e', 'l', 'l', 'o'};
+  
+  // Both directions open with the plain asymmetric operations
+  ByteBuffer sent = cache.Encrypt(message, peer_keys.public_key);
+  EXPECT_EQ(message, crypto->AsymmetricDecrypt(sent, local_keys.public_key,
+                                               peer_keys.private_key));
+  ByteBuffer received = crypto->AsymmetricEncrypt(message, local_keys.public_key,
+                                                  peer_keys.private_key);
+  EXPECT_EQ(message, cache.Decrypt(received, peer_keys.public_key));
+  EXPECT_EQ(1u, cache.GetSize());
+  
+  // Both ends compute the same key
+  crypto::Key shared_key = crypto->ComputeSharedKey(peer_keys.public_key,
+                                                    local_keys.private_key);
+  EXPECT_EQ(shared_key, crypto->ComputeSharedKey(local_keys.public_key,
+                                                 peer_keys.private_key));
+  EXPECT_EQ(message, crypto->AsymmetricDecryptPrecomputed(sent, shared_key));
+  
+  // After a change of local key, messages to the old one no longer open
+  crypto::KeyPair new_keys = crypto->GenerateKeyPair();
+  cache.SetPrivateKey(new_keys.private_key);
+  EXPECT_EQ(0u, cache.GetSize());
+  EXPECT_THROW(cache.Decrypt(received, peer_keys.public_key), std::runtime_error);
+  received = crypto->AsymmetricEncrypt(message, new_keys.public_key, peer_keys.private_key);
+  EXPECT_EQ(message, cache.Decrypt(received, peer_keys.public_key));
+}
+
+TEST(SharedKeyCacheTest, EvictsLeastRecentlyUsed) {
+  auto crypto = crypto::CryptoFactory::Create();
+  crypto::KeyPair local_keys = crypto->GenerateKeyPair();
+  crypto::SharedKeyCache cache(*crypto, local_keys.private_key, 2);
+  ByteBuffer message = {1, 2, 3};
+  
+  std::vector<crypto::KeyPair> peers;
+  for (int i = 0; i < 3; ++i) {
+    peers.push_back(crypto->GenerateKeyPair());
+    cache.Encrypt(message, peers.back().public_key);
+  }
+  EXPECT_EQ(2u, cache.GetSize());
+  
+  cache.Forget(peers[2].public_key);
+  cache.Forget(peers[0].public_key);
+  EXPECT_EQ(1u, cache.GetSize());
+  
+  // An evicted peer's key is computed again when needed
+  ByteBuffer sent = cache.Encrypt(message, peers[0].public_key);
+  EXPECT_EQ(message, crypto->AsymmetricDecrypt(sent, local_keys.public_key,
+                                               peers[0].private_key));
+}
+
+}  // namespace test
+}  // namespace linknet
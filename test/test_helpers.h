@@ -0,0 +1,31 @@
+#ifndef LINKNET_TEST_HELPERS_H_
+#define LINKNET_TEST_HELPERS_H_
+
+#include "linknet/types.h"
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+namespace linknet {
+namespace test {
+
+// The same size bytes for the same seed
+inline ByteBuffer RandomBytes(size_t size, uint32_t seed) {
+  std::mt19937 rng(seed);
+  ByteBuffer data(size);
+  std::generate(data.begin(), data.end(), [&rng]() { return static_cast<uint8_t>(rng()); });
+  return data;
+}
+
+inline ByteBuffer ReadFile(const std::filesystem::path& path) {
+  std::ifstream in(path, std::ios::binary);
+  return ByteBuffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+}  // namespace test
+}  // namespace linknet
+
+#endif  // LINKNET_TEST_HELPERS_H_
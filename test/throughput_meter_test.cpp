@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include "linknet/throughput_meter.h"
+
+namespace linknet {
+namespace test {
+
+using std::chrono::milliseconds;
+
+TEST(ThroughputMeterTest, AveragesWithinTheFirstWindow) {
+  ThroughputMeter meter(milliseconds(500));
+  auto start = ThroughputMeter::Clock::now();
+  
+  EXPECT_EQ(0.0, meter.AverageRate(start));
+  
+  meter.Start(start);
+  meter.Add(1000, start + milliseconds(100));
+  EXPECT_DOUBLE_EQ(5000.0, meter.AverageRate(start + milliseconds(200)));
+  EXPECT_DOUBLE_EQ(5000.0, meter.CurrentRate(start + milliseconds(200)));
+  EXPECT_EQ(1000u, meter.TotalBytes());
+  EXPECT_EQ(start + milliseconds(100), meter.LastActivity());
+}
+
+TEST(ThroughputMeterTest, FollowsRateChanges) {
+  ThroughputMeter meter(milliseconds(100), 0.5);
+  auto start = ThroughputMeter::Clock::now();
+  meter.Start(start);
+  
+  // 1000 bytes per window, then 3000
+  meter.Add(1000, start + milliseconds(50));
+  meter.Add(3000, start + milliseconds(150));
+  
+  auto now = start + milliseconds(200);
+  EXPECT_DOUBLE_EQ(30000.0, meter.CurrentRate(now));
+  EXPECT_DOUBLE_EQ(20000.0, meter.AverageRate(now));
+}
+
+TEST(ThroughputMeterTest, DecaysWhileIdle) {
+  ThroughputMeter meter(milliseconds(100), 0.5);
+  auto start = ThroughputMeter::Clock::now();
+  meter.Start(start);
+  meter.Add(1000, start + milliseconds(50));
+  
+  // Two empty windows after the busy one
+  auto now = start + milliseconds(300);
+  EXPECT_EQ(0.0, meter.CurrentRate(now));
+  EXPECT_DOUBLE_EQ(2500.0, meter.AverageRate(now));
+  
+  // Queries leave the meter as it was
+  EXPECT_DOUBLE_EQ(10000.0, meter.AverageRate(start + milliseconds(100)));
+}
+
+}  // namespace test
+}  // namespace linknet
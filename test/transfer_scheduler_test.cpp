@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include "linknet/transfer_scheduler.h"
+#include <map>
+
+namespace linknet {
+namespace test {
+
+namespace {
+
+const uint64_t QUANTUM = 16 * 1024;
+
+PeerId MakePeer(uint8_t value) {
+  PeerId peer_id;
+  peer_id.fill(value);
+  return peer_id;
+}
+
+bool AlwaysReady(TransferId) {
+  return true;
+}
+
+// Make rounds picks, each sending one quantum, and total the bytes per transfer
+std::map<TransferId, uint64_t> SendRounds(TransferScheduler& scheduler, int rounds) {
+  std::map<TransferId, uint64_t> sent;
+  for (int i = 0; i < rounds; ++i) {
+    TransferId transfer_id;
+    if (!scheduler.Next(AlwaysReady, transfer_id)) {
+      break;
+    }
+    scheduler.Charge(transfer_id, QUANTUM);
+    sent[transfer_id] += QUANTUM;
+  }
+  return sent;
+}
+
+}  // namespace
+
+TEST(TransferSchedulerTest, PeersShareEvenly) {
+  TransferScheduler scheduler(QUANTUM);
+  
+  // Peer 1 has three transfers, peer 2 only one
+  scheduler.Update({{1, MakePeer(1), TransferPriority::NORMAL},
+                    {2, MakePeer(1), TransferPriority::NORMAL},
+                    {3, MakePeer(1), TransferPriority::NORMAL},
+                    {4, MakePeer(2), TransferPriority::NORMAL}});
+  
+  auto sent = SendRounds(scheduler, 600);
+  EXPECT_EQ(sent[1] + sent[2] + sent[3], sent[4]);
+  EXPECT_EQ(sent[1], sent[2]);
+  EXPECT_EQ(sent[2], sent[3]);
+}
+
+TEST(TransferSchedulerTest, PriorityWeightsShare) {
+  TransferScheduler scheduler(QUANTUM);
+  scheduler.Update({{1, MakePeer(1), TransferPriority::HIGH},
+                    {2, MakePeer(1), TransferPriority::LOW}});
+  
+  auto sent = SendRounds(scheduler, 680);
+  EXPECT_EQ(sent[1], 16 * sent[2]);
+  
+  // Priorities can change while transfers run
+  scheduler.Update({{1, MakePeer(1), TransferPriority::NORMAL},
+                    {2, MakePeer(1), TransferPriority::NORMAL}});
+  SendRounds(scheduler, 40);
+  sent = SendRounds(scheduler, 400);
+  EXPECT_EQ(sent[1], sent[2]);
+}
+
+TEST(TransferSchedulerTest, IdleTransfersAreSkipped) {
+  TransferScheduler scheduler(QUANTUM);
+  scheduler.Update({{1, MakePeer(1), TransferPriority::NORMAL},
+                    {2, MakePeer(2), TransferPriority::NORMAL}});
+  
+  TransferId transfer_id;
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(scheduler.Next([](TransferId id) { return id == 2; }, transfer_id));
+    EXPECT_EQ(2u, transfer_id);
+    scheduler.Charge(transfer_id, QUANTUM);
+  }
+  
+  EXPECT_FALSE(scheduler.Next([](TransferId) { return false; }, transfer_id));
+}
+
+TEST(TransferSchedulerTest, LimitsConcurrentTransfers) {
+  TransferScheduler scheduler(QUANTUM);
+  scheduler.SetMaxActive(2);
+  scheduler.Update({{1, MakePeer(1), TransferPriority::NORMAL},
+                    {2, MakePeer(1), TransferPriority::NORMAL},
+                    {3, MakePeer(2), TransferPriority::NORMAL},
+                    {4, MakePeer(2), TransferPriority::NORMAL}});
+  
+  // The first two are admitted; the rest only get a turn once they finish
+  EXPECT_TRUE(scheduler.IsAdmitted(1));
+  EXPECT_TRUE(scheduler.IsAdmitted(2));
+  EXPECT_FALSE(scheduler.IsAdmitted(3));
+  EXPECT_FALSE(scheduler.IsAdmitted(4));
+  
+  auto sent = SendRounds(scheduler, 20);
+  EXPECT_EQ(0u, sent[3] + sent[4]);
+  
+  // A waiting transfer raised to a higher priority goes first when a slot
+  // frees up
+  scheduler.Update({{2, MakePeer(1), TransferPriority::NORMAL},
+                    {3, MakePeer(2), TransferPriority::NORMAL},
+                    {4, MakePeer(2), TransferPriority::HIGH}});
+  EXPECT_TRUE(scheduler.IsAdmitted(4));
+  EXPECT_FALSE(scheduler.IsAdmitted(3));
+  
+  // Lifting the limit admits everyone
+  scheduler.SetMaxActive(0);
+  EXPECT_TRUE(scheduler.IsAdmitted(3));
+}
+
+TEST(TransferSchedulerTest, UploadLimit) {
+  TransferScheduler scheduler(QUANTUM);
+  auto start = TransferScheduler::Clock::now();
+  EXPECT_EQ(TransferScheduler::Clock::duration::zero(), scheduler.UploadDelay(start));
+  
+  scheduler.SetUploadLimit(1024 * 1024);
+  start = TransferScheduler::Clock::now();
+  scheduler.Charge(1, 1024 * 1024, start);
+  
+  // A megabyte at a megabyte per second takes about a second to pay off
+  auto delay = scheduler.UploadDelay(start);
+  EXPECT_GT(delay, std::chrono::milliseconds(990));
+  EXPECT_LE(delay, std::chrono::milliseconds(1000));
+  
+  EXPECT_EQ(TransferScheduler::Clock::duration::zero(),
+            scheduler.UploadDelay(start + std::chrono::seconds(1)));
+}
+
+}  // namespace test
+}  // namespace linknet
@@ -0,0 +1,28 @@
+#include <gtest/gtest.h>
+#include "linknet/worker_pool.h"
+#include <atomic>
+
+namespace linknet {
+namespace test {
+
+TEST(WorkerPoolTest, RunsSubmittedJobs) {
+  WorkerPool pool(3);
+  EXPECT_EQ(3u, pool.Size());
+  
+  std::atomic<int> ran(0);
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 100; ++i) {
+    results.push_back(pool.Submit([i, &ran] {
+      ran++;
+      return i * i;
+    }));
+  }
+  
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i * i, results[i].get());
+  }
+  EXPECT_EQ(100, ran);
+}
+
+}  // namespace test
+}  // namespace linknet